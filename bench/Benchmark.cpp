@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <TString.h>
+#include <TChain.h>
+#include <TROOT.h>
+#include <TSystem.h>
+#include <TTreeReader.h>
+
+#include "Experiment.hpp"
+#include "DAQModule.hpp"
+#include "Detector.hpp"
+#include "Run.hpp"
+#include "Event.hpp"
+#include "ChannelIndex.hpp"
+#include "HistogramManager.hpp"
+#include "TaskManager.hpp"
+#include "RunScheduler.hpp"
+#include "SortSetup.hpp"
+#include "HitFilter.hpp"
+#include "DataGenerator.hpp"
+
+// Throughput of the sort stages on one run, written as JSON or CSV (by file extension) to be tracked over releases:
+//   generate         DataGenerator writing as many entries as the run has, one temporary file per thread
+//   read             TTree reading and Event::readEntry(), no tasks
+//   getdata          Event::getData() of every channel handle, on events held in memory
+//   fill             amplitude histogram filling of every detector channel, on events held in memory
+//   fill_hits        the same spectra filled from the hit pre-filter as in the standard sort, on events held in memory
+//   pipeline         the full standard sort of SortSetup.hpp, one Task per step
+//   static_pipeline  the same sort fused into one StaticPipeline task
+// Every stage runs at 1, 2, 4, ... and max_threads threads. generate and the in memory stages split their events
+// evenly between the threads, each thread with its own Event and histogram slot.
+
+namespace
+{
+    const Long64_t MEMORY_EVENTS = 16384; // Events held in memory for the getdata and fill stages
+
+    struct Result
+    {
+        TString stage;     // Name of the stage
+        UInt_t n_threads;  // Number of threads the stage ran with
+        Long64_t n_events; // Number of events processed
+        Double_t seconds;  // Wall clock time
+        Double_t n_bytes;  // Uncompressed bytes processed
+    };
+
+    Double_t secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::vector<UInt_t> threadCounts(UInt_t max_threads)
+    {
+        std::vector<UInt_t> counts;
+        for (UInt_t n_threads = 1; n_threads < max_threads; n_threads *= 2)
+        {
+            counts.push_back(n_threads);
+        }
+        counts.push_back(max_threads);
+        return counts;
+    }
+
+    // Runs func(slot, first, last) on n_threads threads, each on its share [first, last) of n_items items. The first
+    // exception of a thread is rethrown after all threads are joined.
+    template <typename Func>
+    void runThreads(UInt_t n_threads, Long64_t n_items, Func func)
+    {
+        std::vector<std::exception_ptr> errors(n_threads);
+        std::vector<std::thread> threads;
+        for (UInt_t slot = 0; slot < n_threads; ++slot)
+        {
+            threads.emplace_back([&, slot]()
+                                 {
+                                     try
+                                     {
+                                         func(slot, n_items * slot / n_threads, n_items * (slot + 1) / n_threads);
+                                     }
+                                     catch (...)
+                                     {
+                                         errors[slot] = std::current_exception();
+                                     } });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        for (const std::exception_ptr &error : errors)
+        {
+            if (error)
+                std::rethrow_exception(error);
+        }
+    }
+
+    // Each thread count gets a fresh pool, TaskManager only creates one if implicit MT is off
+    void resetThreadPool()
+    {
+        if (ROOT::IsImplicitMTEnabled())
+        {
+            ROOT::DisableImplicitMT();
+        }
+    }
+
+    void writeResults(const TString &file_name, const TString &config_file, const Run *prun, const std::vector<Result> &results)
+    {
+        std::ofstream output(file_name.Data());
+        if (!output)
+        {
+            throw std::runtime_error("Error opening benchmark output file: " + file_name);
+        }
+
+        if (file_name.EndsWith(".csv"))
+        {
+            output << "stage,threads,events,seconds,events_per_s,mb_per_s" << std::endl;
+            for (const Result &result : results)
+            {
+                output << result.stage << "," << result.n_threads << "," << result.n_events << "," << result.seconds << ","
+                       << result.n_events / result.seconds << "," << result.n_bytes / 1e6 / result.seconds << std::endl;
+            }
+            return;
+        }
+
+        output << "{" << std::endl;
+        output << "  \"config\": \"" << config_file << "\"," << std::endl;
+        output << "  \"run\": " << prun->getRunNumber() << "," << std::endl;
+        output << "  \"entries\": " << prun->getEntries() << "," << std::endl;
+        output << "  \"tot_bytes\": " << prun->getMetadata().tot_bytes << "," << std::endl;
+        output << "  \"zip_bytes\": " << prun->getMetadata().zip_bytes << "," << std::endl;
+        output << "  \"root_version\": \"" << gROOT->GetVersion() << "\"," << std::endl;
+        output << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << "," << std::endl;
+        output << "  \"results\": [" << std::endl;
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result &result = results[i];
+            output << "    {\"stage\": \"" << result.stage << "\", \"threads\": " << result.n_threads << ", \"events\": " << result.n_events
+                   << ", \"seconds\": " << result.seconds << ", \"events_per_s\": " << result.n_events / result.seconds
+                   << ", \"mb_per_s\": " << result.n_bytes / 1e6 / result.seconds << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+        }
+        output << "  ]" << std::endl;
+        output << "}" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <config_file> [run_number] [max_threads] [output_file]" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        Experiment Expt = Experiment(argv[1]);
+        if (Expt.getRuns()->empty())
+        {
+            throw std::runtime_error(Form("No runs defined in %s", argv[1]));
+        }
+        const Int_t run_number = argc > 2 ? std::stoi(argv[2]) : Expt.getRuns()->front()->getRunNumber();
+        const UInt_t max_threads = argc > 3 ? std::max(1ul, std::stoul(argv[3])) : std::max(1u, std::thread::hardware_concurrency());
+        const TString output_file_name = argc > 4 ? argv[4] : "bench_results.json";
+
+        const Run *prun = Expt.getRun(run_number);
+        if (!prun)
+        {
+            throw std::runtime_error(Form("Run %i is not defined in %s", run_number, argv[1]));
+        }
+        ChannelIndex channel_index(*Expt.getDAQModules());
+        const Long64_t n_entries = prun->getEntries();
+        const Double_t tot_bytes = prun->getMetadata().tot_bytes;
+        const Double_t event_bytes = channel_index.getSize() * sizeof(Double_t);
+
+        std::vector<Result> results;
+        auto report = [&results](const Result &result)
+        {
+            std::cout << "CloverSort [INFO]: Benchmark " << result.stage << " with " << result.n_threads << " thread(s): "
+                      << result.n_events / result.seconds << " events/s, " << result.n_bytes / 1e6 / result.seconds << " MB/s" << std::endl;
+            results.push_back(result);
+        };
+
+        // Synthetic data generation, every thread writes its share of the entries to its own file
+        ROOT::EnableThreadSafety();
+        for (UInt_t n_threads : threadCounts(max_threads))
+        {
+            std::vector<TString> file_names;
+            for (UInt_t slot = 0; slot < n_threads; ++slot)
+            {
+                file_names.push_back(Form("%s/clover_bench_%d_%u.root", gSystem->TempDirectory(), gSystem->GetPid(), slot));
+            }
+            const auto start = std::chrono::steady_clock::now();
+            runThreads(n_threads, n_entries, [&](UInt_t slot, Long64_t first, Long64_t last)
+                       {
+                           DataGenerator generator(*Expt.getDAQModules(), 4357 + slot);
+                           generator.generate(file_names[slot], prun->getTreeName(), last - first); });
+            report({"generate", n_threads, n_entries, secondsSince(start), n_entries * event_bytes});
+            for (const TString &file_name : file_names)
+            {
+                gSystem->Unlink(file_name);
+            }
+        }
+
+        // Tree reading
+        for (UInt_t n_threads : threadCounts(max_threads))
+        {
+            resetThreadPool();
+            TaskManager task_manager;
+            const auto start = std::chrono::steady_clock::now();
+            const Long64_t n_events = task_manager.processRun(prun, channel_index, n_threads);
+            report({"read", n_threads, n_events, secondsSince(start), tot_bytes});
+        }
+
+        // Events held in memory, every in memory stage processes as many events as the run has
+        const Long64_t n_memory_events = std::min(n_entries, MEMORY_EVENTS);
+        std::vector<Double_t> memory_values;
+        {
+            std::unique_ptr<TChain> pchain = prun->openChain();
+            TTreeReader tree_reader(pchain.get());
+            Event event(&channel_index, &tree_reader);
+            while (Long64_t(memory_values.size() / channel_index.getSize()) < n_memory_events && tree_reader.Next())
+            {
+                event.readEntry();
+                memory_values.insert(memory_values.end(), event.getValues().begin(), event.getValues().end());
+            }
+        }
+        const Long64_t n_passes = n_memory_events > 0 ? std::max<Long64_t>(1, n_entries / n_memory_events) : 0;
+        const Long64_t n_processed = n_passes * n_memory_events;
+
+        // Event::getData of every handle
+        for (UInt_t n_threads : threadCounts(max_threads))
+        {
+            const auto start = std::chrono::steady_clock::now();
+            runThreads(n_threads, n_memory_events, [&](UInt_t, Long64_t first, Long64_t last)
+                       {
+                           Event memory_event(&channel_index);
+                           volatile Double_t sink = 0;
+                           for (Long64_t pass = 0; pass < n_passes; ++pass)
+                           {
+                               for (Long64_t i = first; i < last; ++i)
+                               {
+                                   memory_event.setValues(memory_values.data() + i * channel_index.getSize());
+                                   Double_t sum = 0;
+                                   for (ChannelHandle handle = 0; handle < channel_index.getSize(); ++handle)
+                                   {
+                                       const Double_t value = memory_event.getData(handle);
+                                       if (!std::isnan(value))
+                                           sum += value;
+                                   }
+                                   sink = sink + sum;
+                               }
+                           } });
+            report({"getdata", n_threads, n_processed, secondsSince(start), n_processed * event_bytes});
+        }
+
+        // Amplitude histogram filling
+        {
+            HistogramManager hist_manager;
+            std::vector<std::pair<ChannelHandle, HistHandle>> handles;
+            for (DAQModule *pmodule : *Expt.getDAQModules())
+            {
+                if (channel_index.findColumn(pmodule, "amplitude") < 0)
+                    continue;
+                for (const Detector *pdetector : *pmodule->getDetectors())
+                {
+                    HistHandle hist_handle = hist_manager.addHistograms(pdetector, "amplitude", 65536, 0, 65536);
+                    for (Int_t channel : *pdetector->getChannels())
+                    {
+                        handles.emplace_back(channel_index.getHandle(pmodule, "amplitude", channel), hist_handle++);
+                    }
+                }
+            }
+
+            for (UInt_t n_threads : threadCounts(max_threads))
+            {
+                hist_manager.initializeSlots(n_threads);
+                const auto start = std::chrono::steady_clock::now();
+                runThreads(n_threads, n_memory_events, [&](UInt_t slot, Long64_t first, Long64_t last)
+                           {
+                               Event memory_event(&channel_index);
+                               for (Long64_t pass = 0; pass < n_passes; ++pass)
+                               {
+                                   for (Long64_t i = first; i < last; ++i)
+                                   {
+                                       memory_event.setValues(memory_values.data() + i * channel_index.getSize());
+                                       fillAmplitudes(&memory_event, slot, &hist_manager, &handles);
+                                   }
+                               } });
+                report({"fill", n_threads, n_processed, secondsSince(start), n_processed * event_bytes});
+            }
+
+            // Same spectra filled from the sparse hit list of the pre-filter, pileup hits are left out
+            HitFilter hit_filter(channel_index);
+            const ProductHandle hits_handle = 0; // Only product of the memory events, there is no TaskManager to assign handles
+            std::vector<Int_t> hist_lookup(channel_index.getSize(), -1);
+            for (const auto &[channel_handle, hist_handle] : handles)
+            {
+                hist_lookup[channel_handle] = hist_handle;
+            }
+            for (UInt_t n_threads : threadCounts(max_threads))
+            {
+                hist_manager.initializeSlots(n_threads);
+                const auto start = std::chrono::steady_clock::now();
+                runThreads(n_threads, n_memory_events, [&](UInt_t slot, Long64_t first, Long64_t last)
+                           {
+                               Event memory_event(&channel_index);
+                               for (Long64_t pass = 0; pass < n_passes; ++pass)
+                               {
+                                   for (Long64_t i = first; i < last; ++i)
+                                   {
+                                       memory_event.setValues(memory_values.data() + i * channel_index.getSize());
+                                       filterHits(&memory_event, slot, &hit_filter, hits_handle);
+                                       fillHitAmplitudes(&memory_event, slot, &hit_filter, hits_handle, &hist_manager, &hist_lookup);
+                                   }
+                               } });
+                report({"fill_hits", n_threads, n_processed, secondsSince(start), n_processed * event_bytes});
+            }
+        }
+
+        // Full task pipeline, including the merge of the slots, once with separate tasks and once fused at compile time
+        for (Bool_t static_pipeline : {kFALSE, kTRUE})
+        {
+            for (UInt_t n_threads : threadCounts(max_threads))
+            {
+                resetThreadPool();
+                RunContext context{prun, {}, {}, {}};
+                context.task_manager.setHistogramManager(&context.hist_manager);
+                setupSort(context, &Expt, &channel_index, static_pipeline);
+                const auto start = std::chrono::steady_clock::now();
+                const Long64_t n_events = context.task_manager.processRun(prun, channel_index, n_threads);
+                report({static_pipeline ? "static_pipeline" : "pipeline", n_threads, n_events, secondsSince(start), tot_bytes});
+            }
+        }
+
+        writeResults(output_file_name, argv[1], prun, results);
+        std::cout << "CloverSort [INFO]: Benchmark results written to " << output_file_name << std::endl;
+
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "CloverSort [ERROR]: " << e.what() << std::endl;
+        return 1;
+    }
+}
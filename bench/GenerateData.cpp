@@ -0,0 +1,54 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <TString.h>
+#include <TSystem.h>
+
+#include "Experiment.hpp"
+#include "Run.hpp"
+#include "DataGenerator.hpp"
+
+// Writes a synthetic run file for a run of an experiment configuration, e.g. the benchmark run of config/example.conf
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <config_file> <run_number> [n_entries] [multiplicity] [occupancy] [pileup_fraction] [seed]" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        Experiment Expt = Experiment(argv[1]);
+        const Run *prun = Expt.getRun(std::stoi(argv[2]));
+        if (!prun)
+        {
+            throw std::runtime_error(Form("Run %s is not defined in %s", argv[2], argv[1]));
+        }
+
+        // Existing files are never overwritten, they may be real data
+        if (!gSystem->AccessPathName(prun->getFileName()))
+        {
+            std::cout << "CloverSort [INFO]: " << prun->getFileName() << " exists, remove it to generate it again" << std::endl;
+            return 0;
+        }
+
+        const Long64_t n_entries = argc > 3 ? std::stoll(argv[3]) : 1000000;
+        DataGenerator generator(*Expt.getDAQModules(), argc > 7 ? std::stoul(argv[7]) : 4357);
+        if (argc > 4)
+            generator.setMultiplicity(std::stod(argv[4]));
+        if (argc > 5)
+            generator.setOccupancy(std::stod(argv[5]));
+        if (argc > 6)
+            generator.setPileupFraction(std::stod(argv[6]));
+        generator.generate(prun->getFileName(), prun->getTreeName(), n_entries);
+
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "CloverSort [ERROR]: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef ADD_BACK_HPP
+#define ADD_BACK_HPP
+
+#include <array>
+#include <vector>
+#include <TString.h>
+#include "ChannelIndex.hpp"
+
+// Forward declarations
+class DAQModule;
+class Detector;
+class Event;
+
+// Which crystals of a clover are summed into the add-back energy
+enum class AddBackMode
+{
+    kAllCrystals, // Every crystal within the coincidence window
+    kNeighbours   // Only crystals sharing a face with the crystal of highest energy, i.e. no diagonal partners
+};
+
+// Clover crystal add-back. Every CloverHPGE detector maps to 4 channels of its module, given in order around the
+// clover so that crystals i and i + 1 (mod 4) are neighbours. Per event the crystals above threshold whose time lies
+// within the coincidence window of the crystal of highest energy are summed. The add-back energy (NaN without a hit),
+// time of the crystal of highest energy (NaN without a hit) and multiplicity of every clover are written into an event
+// product of getProductSize() values, so tasks executed later read the result of their own event, also in batches:
+// the energies of all clovers, then their times, then their multiplicities.
+class AddBack
+{
+public:
+    static const UInt_t CRYSTAL_NUM_ = 4; // Number of crystals of a clover
+
+    struct Clover
+    {
+        const Detector *pdetector;                        // Clover detector
+        std::array<ChannelHandle, CRYSTAL_NUM_> energies; // Handles of the crystal energies
+        std::array<ChannelHandle, CRYSTAL_NUM_> times;    // Handles of the crystal times
+    };
+
+    // Constructor resolving the crystal handles of every CloverHPGE detector of the modules
+    AddBack(const ChannelIndex &channel_index, Double_t window, AddBackMode mode = AddBackMode::kAllCrystals,
+            const TString &energy_filter = "amplitude", const TString &time_filter = "channel_time", Double_t threshold = 0.);
+
+    // Default destructor
+    virtual ~AddBack();
+
+    // Getters
+
+    const std::vector<Clover> &getClovers() const { return clovers_; }
+    const Int_t findClover(const TString &detector_name) const;
+    const Double_t getWindow() const { return window_; }
+    const AddBackMode getMode() const { return mode_; }
+    const Double_t getThreshold() const { return threshold_; }
+    const UInt_t getProductSize() const { return 3 * clovers_.size(); }
+
+    // Views of an add-back product written by process()
+
+    const Double_t *getEnergies(const Double_t *addback_product) const { return addback_product; }
+    const Double_t *getTimes(const Double_t *addback_product) const { return addback_product + clovers_.size(); }
+    const Double_t *getMultiplicities(const Double_t *addback_product) const { return addback_product + 2 * clovers_.size(); }
+
+    // Setters
+
+    void setWindow(Double_t window) { window_ = window; }
+    void setMode(AddBackMode mode) { mode_ = mode; }
+    void setThreshold(Double_t threshold) { threshold_ = threshold; }
+
+    // Methods
+
+    void process(const Event *pevent, Double_t *addback_product) const;
+    void process(const Double_t *energy_values, const Double_t *time_values, Double_t *addback_product) const;
+
+    static Int_t addBack(const Double_t *energies, const Double_t *times, Double_t window, Double_t threshold, AddBackMode mode, Double_t &energy, Double_t &time);
+
+    void printInfo() const;
+
+private:
+    std::vector<Clover> clovers_; // Clovers in module and detector order
+    Double_t window_;             // Coincidence window on the crystal time difference
+    AddBackMode mode_;            // Which crystals are summed
+    Double_t threshold_;          // Crystal energies at or below threshold are ignored
+};
+
+#endif // ADD_BACK_HPP
@@ -0,0 +1,75 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <TString.h>
+
+// Blocking first in, first out queue of at most getCapacity() items, used to hand blocks of work from a producer
+// thread to worker threads with bounded memory. close() wakes everybody up: push() then fails, pop() drains the
+// remaining items and fails once the queue is empty.
+template <typename T>
+class BoundedQueue
+{
+public:
+    // Constructor
+    BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1), closed_(false) {}
+
+    // Default destructor
+    virtual ~BoundedQueue() = default;
+
+    // Getters
+
+    const size_t getCapacity() const { return capacity_; }
+    const Bool_t isClosed() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return closed_;
+    }
+
+    // Methods
+
+    Bool_t push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this]()
+                       { return closed_ || items_.size() < capacity_; });
+        if (closed_)
+            return kFALSE;
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return kTRUE;
+    }
+
+    Bool_t pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]()
+                        { return closed_ || !items_.empty(); });
+        if (items_.empty())
+            return kFALSE;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return kTRUE;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    const size_t capacity_;             // Maximum number of queued items
+    Bool_t closed_;                     // No more items will be pushed
+    std::deque<T> items_;               // Queued items, oldest first
+    mutable std::mutex mutex_;          // Guards items_ and closed_
+    std::condition_variable not_full_;  // Signalled when an item is popped
+    std::condition_variable not_empty_; // Signalled when an item is pushed
+};
+
+#endif // BOUNDED_QUEUE_HPP
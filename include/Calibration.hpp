@@ -0,0 +1,104 @@
+#ifndef CALIBRATION_HPP
+#define CALIBRATION_HPP
+
+#include <vector>
+#include <TString.h>
+#include "ChannelIndex.hpp"
+
+// Forward declarations
+class DAQModule;
+class Event;
+
+// Per channel energy calibration of whole (module, filter) columns. Every calibrated column keeps its polynomial
+// coefficients coefficient major, i.e. coefficient k of all channels is contiguous, so a column is calibrated by one
+// Horner pass over contiguous arrays that the compiler vectorizes across channels. Channels with a non-linear lookup
+// table are corrected afterwards by a scalar pass over those channels only. Calibrated values are kept per worker
+// slot in the layout of Event::getValues(), so the same ChannelHandle indexes raw and calibrated data.
+//
+// Calibration file format, one entry per line, later entries override earlier ones:
+// run_numbers    module_name    filter    channels    poly    c0 c1 c2 ...
+// run_numbers    module_name    filter    channels    lut     x0 y0 x1 y1 ...
+// run_numbers and channels are lists or ranges like 0-3 or 0,1,2,3, run_numbers can also be * for every run
+class Calibration
+{
+public:
+    struct Column
+    {
+        UInt_t offset;                      // Index of channel 0 in the flat value array
+        UInt_t width;                       // Number of channels in the column
+        UInt_t order;                       // Highest polynomial order of any channel in the column
+        std::vector<Double_t> coefficients; // (order + 1) x width coefficients, coefficient major
+    };
+
+    struct LookupTable
+    {
+        ChannelHandle handle;    // Channel the table replaces the polynomial of
+        std::vector<Double_t> x; // Raw values, ascending
+        std::vector<Double_t> y; // Calibrated values at x
+    };
+
+    // Constructor, every channel starts uncalibrated
+    Calibration(const ChannelIndex &channel_index);
+
+    // Constructor loading the entries of a run from a calibration file
+    Calibration(const ChannelIndex &channel_index, const TString &file_name, Int_t run_number);
+
+    // Default destructor
+    virtual ~Calibration();
+
+    // Getters
+
+    const std::vector<Column> &getColumns() const { return columns_; }
+    const std::vector<LookupTable> &getLookupTables() const { return lookup_tables_; }
+    const Double_t *getValues(UInt_t slot) const { return slot_values_[slot].data(); }
+    const Double_t getValue(UInt_t slot, ChannelHandle handle) const { return slot_values_[slot][handle]; }
+
+    // Setters
+
+    void setPolynomial(const DAQModule *pmodule, const TString &filter, Int_t channel, const std::vector<Double_t> &coefficients);
+    void setLookupTable(const DAQModule *pmodule, const TString &filter, Int_t channel, const std::vector<Double_t> &x, const std::vector<Double_t> &y);
+
+    // Methods
+
+    void addColumn(const DAQModule *pmodule, const TString &filter);
+    void load(const TString &file_name, Int_t run_number);
+
+    void initializeSlots(UInt_t n_slots);
+    void process(const Event *pevent, UInt_t slot);
+    void process(const Event *pevent, Double_t *calibrated) const;
+
+    static void applyPolynomial(const Double_t *raw, Double_t *calibrated, const Double_t *coefficients, UInt_t order, UInt_t width);
+
+    // Polynomial of a column of a module type, the channel loops have a constant trip count
+    template <UInt_t CHANNEL_NUM>
+    static void applyPolynomial(ColumnView<CHANNEL_NUM> raw, Double_t *calibrated, const Double_t *coefficients, UInt_t order)
+    {
+        const Double_t *highest = coefficients + order * CHANNEL_NUM;
+        for (UInt_t i = 0; i < CHANNEL_NUM; ++i)
+        {
+            calibrated[i] = highest[i];
+        }
+        for (UInt_t k = order; k-- > 0;)
+        {
+            const Double_t *c = coefficients + k * CHANNEL_NUM;
+            for (UInt_t i = 0; i < CHANNEL_NUM; ++i)
+            {
+                calibrated[i] = calibrated[i] * raw[i] + c[i];
+            }
+        }
+    }
+    static Double_t applyLookupTable(Double_t raw, const LookupTable &table);
+
+    void printInfo() const;
+
+private:
+    Column &getColumn(const DAQModule *pmodule, const TString &filter);
+
+    const ChannelIndex &channel_index_;              // Layout of the raw and calibrated values
+    std::vector<Int_t> column_lookup_;               // Position in columns_ of every channel index column, -1 if uncalibrated
+    std::vector<Column> columns_;                    // Calibrated columns
+    std::vector<LookupTable> lookup_tables_;         // Channels calibrated by lookup table
+    std::vector<std::vector<Double_t>> slot_values_; // Per slot calibrated values, indexed by ChannelHandle
+};
+
+#endif // CALIBRATION_HPP
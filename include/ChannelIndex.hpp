@@ -0,0 +1,84 @@
+#ifndef CHANNEL_INDEX_HPP
+#define CHANNEL_INDEX_HPP
+
+#include <vector>
+#include <TString.h>
+#include "ModuleTypes.hpp"
+
+// Forward declarations
+class DAQModule;
+
+// Dense integer handle of a (module, filter, channel) triple, i.e. the index of its value in Event::getValues()
+using ChannelHandle = UInt_t;
+
+// Handle of a column of a module whose type is known at compile time, see ChannelIndex::getColumnHandle()
+template <typename Descriptor>
+struct ColumnHandle
+{
+    ChannelHandle offset; // Index of channel 0 of the column in the flat value array
+};
+
+// Values of one column with the channel count known at compile time, loops over it have a constant trip count
+template <UInt_t CHANNEL_NUM>
+class ColumnView
+{
+public:
+    explicit ColumnView(const Double_t *pvalues) : pvalues_(pvalues) {}
+
+    static constexpr UInt_t size() { return CHANNEL_NUM; }
+    const Double_t *data() const { return pvalues_; }
+    const Double_t operator[](UInt_t channel) const { return pvalues_[channel]; }
+
+private:
+    const Double_t *pvalues_; // Value of channel 0
+};
+
+// Flat layout of all (module, filter, channel) values of an event. Every (module, filter) pair is a column of
+// getChannelNum() consecutive values, columns are laid out in module and filter order. The layout only depends on
+// the modules and their filters, so handles resolved once at setup time are valid for every Event built from an
+// equivalent index, regardless of which slot or tree it reads from.
+class ChannelIndex
+{
+public:
+    struct Column
+    {
+        DAQModule *pmodule; // Module the column belongs to
+        TString filter;     // Filter (MVME data source) name
+        UInt_t offset;      // Index of channel 0 in the flat value array
+        UInt_t width;       // Number of channels in the column
+    };
+
+    // Constructor
+    ChannelIndex(const std::vector<DAQModule *> &daq_modules);
+
+    // Default destructor
+    virtual ~ChannelIndex();
+
+    // Getters
+
+    const std::vector<DAQModule *> &getDAQModules() const { return daq_modules_; }
+    const std::vector<Column> &getColumns() const { return columns_; }
+    const UInt_t getSize() const { return size_; }
+    const Int_t findColumn(const DAQModule *pmodule, const TString &filter) const;
+    const ChannelHandle getHandle(const DAQModule *pmodule, const TString &filter, Int_t channel = 0) const;
+
+    // Column of a module of type Descriptor, throws if the module's column is not as wide as the descriptor
+    template <typename Descriptor>
+    const ColumnHandle<Descriptor> getColumnHandle(const DAQModule *pmodule, const TString &filter) const
+    {
+        return {getColumnOffset(pmodule, filter, Descriptor::CHANNEL_NUM_)};
+    }
+
+    // Methods
+
+    static TString getBranchName(const DAQModule *pmodule, const TString &filter);
+
+private:
+    const ChannelHandle getColumnOffset(const DAQModule *pmodule, const TString &filter, UInt_t width) const;
+
+    std::vector<DAQModule *> daq_modules_; // Modules in layout order
+    std::vector<Column> columns_;          // Columns in layout order
+    UInt_t size_;                          // Total number of values per event
+};
+
+#endif // CHANNEL_INDEX_HPP
@@ -0,0 +1,80 @@
+#ifndef CHECKPOINTER_HPP
+#define CHECKPOINTER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <TString.h>
+#include <TH1D.h>
+#include "BoundedQueue.hpp"
+
+// Forward declarations
+class HistogramManager;
+
+// Checkpoint of one run while it is sorted: the entry ranges sorted so far and the merged histograms and coincidence
+// matrices they filled, in a ROOT file. submit() only copies the merged state, the copy is compressed and written by
+// a background thread into a temporary file that then replaces the checkpoint, so a crash during a write leaves the
+// previous checkpoint intact. If a write is still running when the next checkpoint is due, that one is skipped
+// rather than queued. Once the run's hist file is written, complete() marks the checkpoint so a resumed sort skips
+// the run. Only histogram state is checkpointed, other state the tasks keep is not restored.
+class Checkpointer
+{
+public:
+    // Entry ranges [first, second)
+    using RangeList = std::vector<std::pair<Long64_t, Long64_t>>;
+
+    // Constructor
+    Checkpointer(const TString &file_name, Double_t interval);
+
+    // Destructor waiting for the running write
+    virtual ~Checkpointer();
+
+    Checkpointer(const Checkpointer &) = delete;
+    Checkpointer &operator=(const Checkpointer &) = delete;
+
+    // Getters
+
+    const TString &getFileName() const { return file_name_; }
+    const Double_t getInterval() const { return interval_; }
+    const RangeList &getRestoredRanges() const { return restored_ranges_; }
+    const Long64_t getRestoredEntries() const;
+    const UInt_t getWriteNum() const { return n_writes_; }
+    const Bool_t isDue() const;
+    const Double_t getSecondsToDue() const;
+
+    // Methods
+
+    Bool_t restore(HistogramManager *phist_manager);
+    void submit(const HistogramManager &hist_manager, const RangeList &ranges);
+    void complete(Long64_t n_entries);
+
+    static Bool_t isComplete(const TString &file_name);
+    static RangeList coalesce(RangeList ranges);
+    static RangeList subtract(const RangeList &ranges, const RangeList &done);
+
+private:
+    struct Snapshot
+    {
+        RangeList ranges;                                // Entry ranges the state was filled from
+        std::vector<std::unique_ptr<TH1D>> hists;        // Copies of the merged histograms, indexed by HistHandle
+        std::vector<std::vector<UInt_t>> matrix_counts;  // Raw counts of the coincidence matrices, indexed by MatrixHandle
+        const HistogramManager *phist_manager = nullptr; // Names of the histograms and matrices
+    };
+
+    void write(const Snapshot *psnapshot, Bool_t complete) const;
+    void writeLoop();
+
+    TString file_name_;                                 // Name of the checkpoint file
+    Double_t interval_;                                 // Seconds between checkpoints
+    RangeList restored_ranges_;                         // Entry ranges sorted before the resume
+    BoundedQueue<std::unique_ptr<Snapshot>> snapshots_; // Snapshot handed to the writer thread
+    std::atomic<Bool_t> writing_;                       // Writer thread busy with a snapshot
+    std::atomic<UInt_t> n_writes_;                      // Number of checkpoints written
+    std::chrono::steady_clock::time_point last_submit_; // Time of the last submitted checkpoint
+    std::thread writer_thread_;                         // Writes the submitted snapshots
+};
+
+#endif // CHECKPOINTER_HPP
@@ -0,0 +1,88 @@
+#ifndef COINCIDENCE_MATRIX_HPP
+#define COINCIDENCE_MATRIX_HPP
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <TString.h>
+#include <TH1D.h>
+#include <TH2.h>
+
+// Symmetric gamma-gamma coincidence matrix. Only the upper triangle (i <= j) of the n_bins x n_bins matrix is
+// stored, as 32 bit counts, in one copy shared by all worker slots. Fills are collected per slot as cell indices
+// in a small buffer, which is sorted and flushed into the shared matrix with relaxed atomic adds once it is full,
+// so threads neither lock nor hold private copies of the matrix. Each pair is stored once; in the symmetric view
+// (getCount(), export, projections) an off-diagonal pair counts at (i, j) and (j, i) and a diagonal pair twice at
+// (i, i), like filling a full matrix with both (x, y) and (y, x). Values outside [x_low, x_up) are dropped.
+// A subtracted matrix counts prompt and random pairs in two such triangles, filled through fill() and fillRandom(),
+// and is exported as a TH2D of prompt + random_weight * random with the errors sqrt(prompt + random_weight^2 * random),
+// e.g. prompt minus random coincidences. Both triangles stay exact integer counts, so it takes the memory of the two
+// count matrices it replaces. The cells are allocated by initializeSlots(), so a matrix that is set up but not yet
+// sorted takes no memory, see getMemoryBytes(). getExportBytes() is the size of the full square TH2 of toTH2().
+class CoincidenceMatrix
+{
+public:
+    // Constructor
+    CoincidenceMatrix(const TString &name, const TString &title, Int_t n_bins, Double_t x_low, Double_t x_up, UInt_t buffer_size = 4096,
+                      Double_t random_weight = 0.);
+
+    // Default destructor
+    virtual ~CoincidenceMatrix();
+
+    // Getters
+
+    const TString &getName() const { return name_; }
+    const TString &getTitle() const { return title_; }
+    const Int_t getBinNum() const { return n_bins_; }
+    const Double_t getLow() const { return x_low_; }
+    const Double_t getUp() const { return x_up_; }
+    const ULong64_t getCellNum() const { return n_cells_; }
+    const Bool_t isSubtracted() const { return random_weight_ != 0.; }
+    const Double_t getRandomWeight() const { return random_weight_; }
+    const ULong64_t getMemoryBytes() const { return n_cells_ * sizeof(UInt_t) * (isSubtracted() ? 2 : 1); }
+    const ULong64_t getExportBytes() const { return ULong64_t(n_bins_ + 2) * (n_bins_ + 2) * (isSubtracted() ? 2 * sizeof(Double_t) : sizeof(Int_t)); }
+    const ULong64_t getCount(Int_t bin_x, Int_t bin_y) const;
+    const Double_t getContent(Int_t bin_x, Int_t bin_y) const;
+    const Int_t findBin(Double_t x) const;
+
+    // Methods
+
+    void initializeSlots(UInt_t n_slots);
+    void fill(UInt_t slot, Double_t x, Double_t y);
+    void fillRandom(UInt_t slot, Double_t x, Double_t y);
+    void flush(UInt_t slot);
+    void flushSlots();
+
+    // Raw upper triangle counts, e.g. for checkpoints. A subtracted matrix has the prompt triangle, then the random one.
+    std::vector<UInt_t> getCounts() const;
+    void addCounts(const std::vector<UInt_t> &counts);
+
+    std::unique_ptr<TH2> toTH2() const;
+    std::unique_ptr<TH1D> project(const TString &name) const;
+    std::unique_ptr<TH1D> gate(const TString &name, Double_t gate_low, Double_t gate_up) const;
+
+    void printInfo() const;
+
+private:
+    ULong64_t getCell(Int_t bin_low, Int_t bin_high) const { return ULong64_t(bin_low) * (2 * ULong64_t(n_bins_) - bin_low + 1) / 2 + (bin_high - bin_low); }
+    Double_t getCellContent(ULong64_t cell) const;
+    Double_t getCellError2(ULong64_t cell) const;
+    void addCells(std::vector<ULong64_t> &cells, std::vector<std::atomic<UInt_t>> &counts);
+    std::unique_ptr<TH1D> makeProjection(const TString &name, Int_t gate_low_bin, Int_t gate_up_bin) const;
+
+    TString name_;                                          // Name of the matrix and of exported histograms
+    TString title_;                                         // Title of exported histograms
+    const Int_t n_bins_;                                    // Number of bins per axis
+    const Double_t x_low_;                                  // Lower edge of both axes
+    const Double_t x_up_;                                   // Upper edge of both axes
+    const UInt_t buffer_size_;                              // Number of fills collected per slot before flushing
+    const Double_t random_weight_;                          // Weight of a random pair at export, 0 if the matrix only counts
+    const ULong64_t n_cells_;                               // Number of cells of the upper triangle
+    std::vector<std::atomic<UInt_t>> counts_;               // Upper triangle counts, of the prompt pairs if subtracted, row major
+    std::vector<std::atomic<UInt_t>> random_counts_;        // Upper triangle counts of the random pairs, empty unless subtracted
+    std::vector<std::vector<ULong64_t>> slot_cells_;        // Per slot buffer of filled cells
+    std::vector<std::vector<ULong64_t>> slot_random_cells_; // Per slot buffer of filled random cells
+};
+
+#endif // COINCIDENCE_MATRIX_HPP
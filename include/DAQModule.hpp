@@ -1,61 +1,72 @@
 #ifndef DAQMODULE_HPP
 #define DAQMODULE_HPP
 
-#define VALID_MODULE_TYPES {"mdpp16scp", "mdpp16qdc"}
-
 #include <vector>
 #include <TString.h>
+#include "ModuleTypes.hpp"
 
 // Forward declarations
 class Detector;
 
+// A module of the DAQ. Its type is one of the descriptors of ModuleTypes.hpp, picked by name when the module is
+// created; the channel count and the default filters come from the descriptor, so nothing dispatches on the type name
+// afterwards. Code that needs fixed size arrays per module visits the type with visitModuleType(getType(), ...).
 class DAQModule
 {
 public:
-    // Constructors
-
+    // Constructor picking the module type by its MVME name, throws for unsupported types
     DAQModule(TString name, TString type);
 
+    // Constructor of a module whose type is known at compile time
+    template <typename Descriptor>
+    DAQModule(TString name, Descriptor)
+        : module_name_(std::move(name)), MODULE_TYPE_(Descriptor::NAME_), CHANNEL_NUM_(Descriptor::CHANNEL_NUM_),
+          DEFAULT_FILTERS_(Descriptor::DEFAULT_FILTERS_.begin(), Descriptor::DEFAULT_FILTERS_.end()), channel_names_()
+    {
+    }
+
     // Default destructor method
     virtual ~DAQModule();
 
     // Getters
 
-    virtual const TString &getName() const { return module_name_; }
-    virtual const TString &getType() const { return MODULE_TYPE_; }
-    virtual const Int_t getChannelNum() const { return CHANNEL_NUM_; }
-    virtual const TString &getChannelName(Int_t channel) const;
-    virtual const Int_t getChannel(const TString &channel_name) const;
-    virtual const std::vector<TString> *getFilters() const { return &filters_; }
-    virtual const std::vector<Detector *> *getDetectors() const { return &detectors_; }
-    virtual const Detector *getDetector(const TString &detectorName) const;
+    const TString &getName() const { return module_name_; }
+    const TString &getType() const { return MODULE_TYPE_; }
+    const Int_t getChannelNum() const { return CHANNEL_NUM_; }
+    const std::vector<TString> &getDefaultFilters() const { return DEFAULT_FILTERS_; }
+    const TString &getChannelName(Int_t channel) const;
+    const Int_t getChannel(const TString &channel_name) const;
+    const std::vector<TString> *getFilters() const { return &filters_; }
+    const std::vector<Detector *> *getDetectors() const { return &detectors_; }
+    const Detector *getDetector(const TString &detectorName) const;
 
     // Setters
 
-    virtual void setName(const TString &name) { module_name_ = name; }
-    virtual void setChannelName(const Int_t channel, const TString &channel_name);
+    void setName(const TString &name) { module_name_ = name; }
+    void setChannelName(const Int_t channel, const TString &channel_name);
 
     // Methods
 
-    virtual void generateDefaultFilters();
+    void generateDefaultFilters();
     void addFilter(const TString &filterName);
     void removeFilter(const TString &filterName);
 
-    virtual void addDetector(Detector *detector);
-    virtual void removeDetector(Detector *detector);
+    void addDetector(Detector *detector);
+    void removeDetector(Detector *detector);
 
     void printInfo() const;
 
     // Class consts
-    static const std::vector<TString> VALID_MODULE_TYPES_; // Valid module types
+    static const std::vector<TString> VALID_MODULE_TYPES_; // Names of the types of ModuleTypeList
 
 protected:
-    TString module_name_;                // Name of the module as defined in MVME
-    const TString MODULE_TYPE_;          // Type of the module as defined in MVME
-    const Int_t CHANNEL_NUM_;            // Number of channels in the module
-    std::vector<TString> channel_names_; // Map of channels, where key is the channel number and value is the channel name
-    std::vector<TString> filters_;       // List of filters associated with the module
-    std::vector<Detector *> detectors_;  // List of detectors associated with this module
+    TString module_name_;                        // Name of the module as defined in MVME
+    const TString MODULE_TYPE_;                  // Type of the module as defined in MVME
+    const Int_t CHANNEL_NUM_;                    // Number of channels in the module
+    const std::vector<TString> DEFAULT_FILTERS_; // Filters MVME defines for the module type
+    std::vector<TString> channel_names_;         // Map of channels, where key is the channel number and value is the channel name
+    std::vector<TString> filters_;               // List of filters associated with the module
+    std::vector<Detector *> detectors_;          // List of detectors associated with this module
 };
 
 #endif // DAQMODULE_HPP
\ No newline at end of file
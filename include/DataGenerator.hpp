@@ -0,0 +1,66 @@
+#ifndef DATA_GENERATOR_HPP
+#define DATA_GENERATOR_HPP
+
+#include <vector>
+#include <TString.h>
+#include <TRandom3.h>
+#include "ChannelIndex.hpp"
+
+// Forward declarations
+class DAQModule;
+
+// Writes synthetic runs shaped like MVME exports of the given modules, for benchmarks and for trying out sorts
+// without beam time. Every (module, filter) pair is a branch named like ChannelIndex::getBranchName() with one
+// Double_t per channel, module_timestamp is a single Double_t. In every entry each module is read out with
+// probability getOccupancy(). A module that is read out has a Poisson distributed number of hit channels with mean
+// getMultiplicity() (at least one), every other channel and every module that is not read out is NaN, as in MVME.
+// Amplitudes are a few gamma lines on an exponential background, piled up hits have their pileup flag set and an
+// amplitude summed with a second hit.
+class DataGenerator
+{
+public:
+    // Constructor
+    DataGenerator(const std::vector<DAQModule *> &daq_modules, ULong_t seed = 4357);
+
+    // Default destructor
+    virtual ~DataGenerator();
+
+    // Getters
+
+    const ChannelIndex &getChannelIndex() const { return channel_index_; }
+    const Double_t getMultiplicity() const { return multiplicity_; }
+    const Double_t getOccupancy() const { return occupancy_; }
+    const Double_t getPileupFraction() const { return pileup_fraction_; }
+    const Double_t getMeanSpacing() const { return mean_spacing_; }
+    const Double_t getTimestampWrap() const { return timestamp_wrap_; }
+
+    // Setters
+
+    void setMultiplicity(Double_t multiplicity) { multiplicity_ = multiplicity; }
+    void setOccupancy(Double_t occupancy) { occupancy_ = occupancy; }
+    void setPileupFraction(Double_t pileup_fraction) { pileup_fraction_ = pileup_fraction; }
+    void setMeanSpacing(Double_t mean_spacing) { mean_spacing_ = mean_spacing; }
+    void setTimestampWrap(Double_t timestamp_wrap) { timestamp_wrap_ = timestamp_wrap; }
+    void setSeed(ULong_t seed) { random_.SetSeed(seed); }
+
+    // Methods
+
+    Long64_t generate(const TString &file_name, const TString &tree_name, Long64_t n_entries);
+
+    static const Bool_t isScalarFilter(const TString &filter) { return filter == "module_timestamp"; }
+
+private:
+    void fillModule(const DAQModule *pmodule, Double_t timestamp);
+    Double_t generateAmplitude();
+
+    ChannelIndex channel_index_;   // Layout of the generated values, one branch per column
+    std::vector<Double_t> values_; // Values of the current entry, the branches point into it
+    TRandom3 random_;              // Random number generator, seeded for reproducible runs
+    Double_t multiplicity_;        // Mean number of hit channels of a module that is read out
+    Double_t occupancy_;           // Probability that a module is read out in an entry
+    Double_t pileup_fraction_;     // Probability that a hit is piled up
+    Double_t mean_spacing_;        // Mean number of module timestamp ticks between entries
+    Double_t timestamp_wrap_;      // Range of the module timestamp in ticks
+};
+
+#endif // DATA_GENERATOR_HPP
@@ -2,45 +2,90 @@
 #define EVENT_HPP
 
 #include <vector>
-#include <map>
-#include <variant>
+#include <memory>
 #include <TString.h>
 #include <TTreeReaderArray.h>
+#include "ChannelIndex.hpp"
 
 class DAQModule;
 class Detector;
+class SortCache;
+
+// Dense integer handle of a per event product, e.g. calibrated energies, see TaskManager::getProductHandle()
+using ProductHandle = UInt_t;
 
 class Event
 {
+
+    friend class EventBuilder; // Allow EventBuilder to compose events from module fragments
+
 public:
-    // Default constructor
+    // Constructor binding readers for every column of the channel index, or only for the active ones. The branches of
+    // inactive columns are disabled on the tree and their values stay NaN.
+    Event(const ChannelIndex *pchannel_index, TTreeReader *ptree_reader, const std::vector<UChar_t> *pactive_columns = nullptr);
+
+    // Constructor building its own channel index from the modules
     Event(std::vector<DAQModule *> daq_modules, TTreeReader *ptree_reader);
 
+    // Constructor reading from a sort cache instead of a tree, inactive columns are not decoded
+    Event(const ChannelIndex *pchannel_index, const SortCache *pcache, const std::vector<UChar_t> *pactive_columns = nullptr);
+
+    // Constructor of an event without a source, filled by an EventBuilder or with setValues()
+    Event(const ChannelIndex *pchannel_index);
+
     // Default destructor
     virtual ~Event();
 
     // Getters
 
-    const std::vector<DAQModule *> &getDAQModules() const { return daq_modules_; }
+    const std::vector<DAQModule *> &getDAQModules() const { return pchannel_index_->getDAQModules(); }
+    const ChannelIndex *getChannelIndex() const { return pchannel_index_; }
+    const std::vector<Double_t> &getValues() const { return values_; }
+    const Double_t getData(ChannelHandle handle) const { return values_[handle]; }
+    const Double_t *getArray(ChannelHandle handle) const { return values_.data() + handle; }
+    template <typename Descriptor>
+    const ColumnView<Descriptor::CHANNEL_NUM_> getColumn(ColumnHandle<Descriptor> handle) const { return ColumnView<Descriptor::CHANNEL_NUM_>(values_.data() + handle.offset); }
     const Double_t getData(DAQModule *pdaq_module, const TString &filter, Int_t channel = 0);
+    const Double_t *getProduct(ProductHandle handle) const { return products_[handle].data(); }
+    Double_t *getProduct(ProductHandle handle, size_t size);
 
     // Setters
 
-    // Methods
+    void setValues(const Double_t *pvalues);
 
-    void addArray(DAQModule *pmodule, const TString &filter, TTreeReader *ptree_reader);
+    // Methods
 
-    void addValue(DAQModule *pmodule, const TString &filter, TTreeReader *ptree_reader);
+    void readEntry();
+    void readEntry(Long64_t entry);
 
 private:
-    TTreeReader *ptree_reader_; // Pointer to the TTreeReader for reading data
-    std::vector<DAQModule *> daq_modules_;
-
-    using ReaderVar = std::variant<
-        TTreeReaderArray<Double_t>, // For double arrays
-        TTreeReaderValue<Double_t>  // For doubles
-        >;
-    std::map<DAQModule *, std::map<TString, ReaderVar>> data_;
+    template <typename ReaderT>
+    struct BoundReader
+    {
+        std::unique_ptr<ReaderT> preader; // Reader of the column's branch
+        UInt_t offset;                    // Index of channel 0 of the column in values_
+        UInt_t width;                     // Number of channels in the column
+    };
+
+    void bindReaders(const std::vector<UChar_t> *pactive_columns = nullptr);
+    void bindCache(const std::vector<UChar_t> *pactive_columns = nullptr);
+    void addArray(const ChannelIndex::Column &column, const TString &branch_name);
+    void addValue(const ChannelIndex::Column &column, const TString &branch_name);
+
+    TTreeReader *ptree_reader_;                                    // Pointer to the TTreeReader for reading data
+    std::unique_ptr<ChannelIndex> powned_channel_index_;           // Channel index owned by this event, if it built its own
+    const ChannelIndex *pchannel_index_;                           // Layout of values_
+    std::vector<BoundReader<TTreeReaderArray<Double_t>>> arrays_;  // Readers of per channel branches
+    std::vector<BoundReader<TTreeReaderValue<Double_t>>> scalars_; // Readers of per module branches
+    std::vector<Double_t> values_;                                 // Flat values of the current entry, indexed by ChannelHandle
+    std::vector<std::vector<Double_t>> products_;                  // Values derived by tasks, indexed by ProductHandle
+
+    const SortCache *pcache_ = nullptr;                // Sort cache read instead of the tree, if any
+    std::vector<Int_t> cache_columns_;                 // Cache column of every channel index column, -1 if inactive
+    Long64_t cache_block_ = -1;                        // Block the chunk pointers refer to
+    std::vector<const Double_t *> cache_chunks_;       // Values of the current block for every channel index column
+    std::vector<std::vector<Double_t>> cache_buffers_; // Decoded chunks, if not read in place
+    std::vector<char> cache_scratch_;                  // Decompression buffer
 };
 
-#endif // EVENT_HPP
\ No newline at end of file
+#endif // EVENT_HPP
@@ -0,0 +1,107 @@
+#ifndef EVENT_BUILDER_HPP
+#define EVENT_BUILDER_HPP
+
+#include <memory>
+#include <queue>
+#include <vector>
+#include <TString.h>
+#include <TChain.h>
+#include <TTreeReader.h>
+#include "ChannelIndex.hpp"
+#include "Event.hpp"
+#include "ReadCounter.hpp"
+
+// Forward declarations
+class DAQModule;
+class Run;
+
+// Builds events across modules that MVME read out in separate events. Every module is read as its own stream of
+// fragments, i.e. the entries in which its timestamp filter is set, through its own file handle and readers of only its
+// own branches, with every other branch disabled on the stream's chain. Columns no task reads are disabled as well once
+// setActiveColumns() is called before the first event, except the timestamps and channel times the streams are merged
+// by. A fragment's time is timestamp_scale * module_timestamp plus channel_time_scale times the earliest channel_time
+// of the fragment. The streams are merged in time order with a k-way heap merge, and fragments within the window of the
+// first fragment of an event are combined, at most one per module. Only one fragment per module and the event being
+// built are held in memory, so runs of any size are built in a single streaming pass. Every module's fragments have to
+// be in time order, wrapping module timestamps are extended with setTimestampWrap().
+class EventBuilder
+{
+public:
+    // Constructor opening one stream per module of the channel index
+    EventBuilder(const Run *prun, const ChannelIndex &channel_index, Double_t window,
+                 const TString &timestamp_filter = "module_timestamp", const TString &time_filter = "channel_time");
+
+    // Default destructor
+    virtual ~EventBuilder();
+
+    // Getters
+
+    const ChannelIndex &getChannelIndex() const { return channel_index_; }
+    const Double_t getWindow() const { return window_; }
+    const Double_t getTimestampScale() const { return timestamp_scale_; }
+    const Double_t getChannelTimeScale() const { return channel_time_scale_; }
+    const Double_t getTimestampWrap() const { return timestamp_wrap_; }
+    const Long64_t getBuiltNum() const { return n_built_; }
+    const Long64_t getFragmentNum() const { return n_fragments_; }
+    const Long64_t getBytesRead() const;
+    const Double_t getEventTime() const { return event_time_; }
+    Event *getEvent() { return &event_; }
+
+    // Setters
+
+    void setWindow(Double_t window) { window_ = window; }
+    void setTimestampScale(Double_t timestamp_scale) { timestamp_scale_ = timestamp_scale; }
+    void setChannelTimeScale(Double_t channel_time_scale) { channel_time_scale_ = channel_time_scale; }
+    void setTimestampWrap(Double_t timestamp_wrap) { timestamp_wrap_ = timestamp_wrap; }
+    void setActiveColumns(const std::vector<UChar_t> &active_columns);
+
+    // Methods
+
+    Bool_t next();
+
+private:
+    struct Stream
+    {
+        const DAQModule *pmodule;                     // Module read by the stream
+        std::unique_ptr<TChain> pchain;               // Private chain over the parts of the run
+        std::unique_ptr<TTreeReader> ptree_reader;    // Reader positioned at the current fragment
+        std::unique_ptr<ReadCounter> pread_counter;   // Bytes read by the reader
+        std::unique_ptr<ChannelIndex> pchannel_index; // Layout of the module's columns only
+        std::unique_ptr<Event> pevent;                // Current fragment, bound when the streams are primed
+        Int_t timestamp_column;                       // Column of the module timestamps in the fragment
+        ChannelHandle timestamp_handle;               // Handle of the module timestamp in the fragment
+        Int_t time_column;                            // Column of the channel times in the fragment, -1 if none
+        UInt_t offset;                                // Index of the module's first value in the built event
+        Double_t last_timestamp;                      // Module timestamp of the previous fragment
+        Double_t epoch;                               // Ticks added to the module timestamp for every wrap so far
+        Double_t time;                                // Time of the current fragment
+    };
+
+    struct Pending
+    {
+        Double_t time; // Time of the stream's current fragment
+        UInt_t stream; // Index of the stream
+
+        bool operator>(const Pending &other) const { return time > other.time || (time == other.time && stream > other.stream); }
+    };
+
+    void bindStream(Stream &stream);
+    Bool_t advance(Stream &stream);
+
+    const ChannelIndex &channel_index_;                                                 // Layout of the built events
+    Double_t window_;                                                                   // Maximum time after the first fragment of an event
+    Double_t timestamp_scale_;                                                          // Time units per module timestamp tick
+    Double_t channel_time_scale_;                                                       // Time units per channel_time unit
+    Double_t timestamp_wrap_;                                                           // Module timestamp range in ticks, 0 if it does not wrap
+    std::vector<Stream> streams_;                                                       // One stream per module
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> pending_; // Streams by time of their current fragment
+    std::vector<UChar_t> merged_;                                                       // Streams merged into the current event
+    std::vector<UChar_t> active_columns_;                                               // Columns of the built events that are read, empty if all of them
+    Bool_t primed_;                                                                     // First fragment of every stream read
+    Event event_;                                                                       // Event being built
+    Double_t event_time_;                                                               // Time of the first fragment of the current event
+    Long64_t n_built_;                                                                  // Number of events built so far
+    Long64_t n_fragments_;                                                              // Number of fragments merged so far
+};
+
+#endif // EVENT_BUILDER_HPP
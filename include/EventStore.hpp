@@ -0,0 +1,138 @@
+#ifndef EVENT_STORE_HPP
+#define EVENT_STORE_HPP
+
+#include <vector>
+#include <TString.h>
+
+// Forward declarations
+class TH1D;
+
+// Indexed store of the calibrated add-back hits of a run, written during the sort by an EventStoreWriter and memory
+// mapped to gate on. Events are grouped into blocks, each block holding the hit list of every event and an index of
+// its hits by (detector, energy bucket) key: the sorted keys that have hits, and per key the posting list of the
+// events within the block. A bucket summary of one bit per key, stored uncompressed, lets a gate skip every block
+// without a hit in its buckets, so a narrow gate decompresses only the few blocks it can match. Buckets only narrow
+// the candidates, the gate itself is applied to the exact hit energies. Energies outside the bucket range fall into
+// the first or last bucket.
+//
+// File layout (native byte order): FileHeader, the detector name table, the blocks (8 byte aligned), and the block
+// table of n_blocks BlockRecords at FileHeader::index_offset. Per block:
+//   summary  n_detectors x n_buckets bits in ULong64_t words, key = detector * n_buckets + bucket
+//   hits     event_offsets[n_events + 1] (UInt_t), energies[n_hits] (Float_t), detectors[n_hits] (UShort_t)
+//   index    keys[n_keys] (UInt_t), key_offsets[n_keys + 1] (UInt_t), postings[n_hits] (UInt_t event in block)
+class EventStore
+{
+public:
+    enum class Codec : UChar_t
+    {
+        kNone, // Section stored as is
+        kLZ4,  // Section compressed with ROOT's LZ4 codec
+    };
+
+    struct FileHeader
+    {
+        char magic[8];          // "CSEVSTR1"
+        UInt_t version;         // Format version
+        UInt_t n_detectors;     // Number of detectors in the name table
+        UInt_t n_buckets;       // Number of energy buckets per detector
+        UInt_t n_blocks;        // Number of blocks
+        Double_t energy_low;    // Lower edge of the first bucket
+        Double_t energy_up;     // Upper edge of the last bucket
+        ULong64_t n_events;     // Number of events
+        ULong64_t n_hits;       // Number of hits
+        ULong64_t index_offset; // Position of the block table in the file
+    };
+
+    struct BlockRecord
+    {
+        ULong64_t summary_offset; // Position of the bucket summary
+        ULong64_t hits_offset;    // Position of the hit section
+        ULong64_t index_offset;   // Position of the index section
+        UInt_t n_events;          // Number of events in the block
+        UInt_t n_hits;            // Number of hits in the block
+        UInt_t n_keys;            // Number of keys with at least one hit
+        UInt_t hits_bytes;        // Size of the hit section in the file
+        UInt_t index_bytes;       // Size of the index section in the file
+        Codec hits_codec;         // Compression of the hit section
+        Codec index_codec;        // Compression of the index section
+        UShort_t reserved;        // Padding, zero
+    };
+
+    // Energy window opening a gate, hits of the gating detector in [low, up) select their event
+    struct Gate
+    {
+        TString name;     // Name of the gated spectrum
+        Double_t low;     // Lower edge of the window
+        Double_t up;      // Upper edge of the window
+        TString detector; // Only hits of this detector open the gate, any detector if empty
+    };
+
+    // Constructor mapping an existing store file
+    EventStore(const TString &file_name);
+
+    // Destructor unmapping the file
+    virtual ~EventStore();
+
+    EventStore(const EventStore &) = delete;
+    EventStore &operator=(const EventStore &) = delete;
+
+    // Getters
+
+    const TString &getFileName() const { return file_name_; }
+    const Long64_t getEvents() const { return pheader_->n_events; }
+    const Long64_t getHits() const { return pheader_->n_hits; }
+    const UInt_t getBlockNum() const { return pheader_->n_blocks; }
+    const UInt_t getBucketNum() const { return pheader_->n_buckets; }
+    const Double_t getEnergyLow() const { return pheader_->energy_low; }
+    const Double_t getEnergyUp() const { return pheader_->energy_up; }
+    const std::vector<TString> &getDetectorNames() const { return detector_names_; }
+    const Int_t findDetector(const TString &detector_name) const;
+    const BlockRecord &getBlock(UInt_t block) const { return pblocks_[block]; }
+
+    // Methods
+
+    Long64_t gate(const std::vector<Gate> &gates, const std::vector<TH1D *> &spectra, Bool_t parallel = kTRUE) const;
+
+    static UInt_t findBucket(Double_t energy, Double_t energy_low, Double_t energy_up, UInt_t n_buckets);
+    static std::vector<Gate> parseGates(const TString &gate_string);
+
+    void printInfo() const;
+
+    // Class consts
+    static const UInt_t VERSION_ = 1; // Current format version
+
+private:
+    // Gate with its detector and the buckets its window overlaps resolved against the store
+    struct ResolvedGate
+    {
+        Double_t low;        // Lower edge of the window
+        Double_t up;         // Upper edge of the window
+        Int_t detector;      // Gating detector, -1 for any
+        UInt_t first_bucket; // First bucket the window overlaps
+        UInt_t last_bucket;  // Last bucket the window overlaps
+    };
+
+    // Per slot buffers and results of a gate query
+    struct QueryBuffers
+    {
+        std::vector<char> hits;                      // Decompressed hit section
+        std::vector<char> index;                     // Decompressed index section
+        std::vector<std::vector<UInt_t>> candidates; // Per gate events of the block with a hit in the gate's buckets
+        std::vector<std::vector<Double_t>> contents; // Per gate bin contents, under- and overflow included
+        std::vector<Double_t> n_fills;               // Per gate number of fills
+        Long64_t n_gated = 0;                        // Events selected by a gate, counted once per gate
+    };
+
+    void validate();
+    const char *readSection(ULong64_t offset, UInt_t stored_bytes, size_t raw_bytes, Codec codec, std::vector<char> &scratch) const;
+    void gateBlock(UInt_t block, const std::vector<ResolvedGate> &gates, const std::vector<TH1D *> &spectra, QueryBuffers &buffers) const;
+
+    TString file_name_;                   // Name of the mapped file
+    const char *pdata_;                   // Start of the mapping
+    size_t size_;                         // Size of the mapping
+    const FileHeader *pheader_;           // Header at the start of the mapping
+    const BlockRecord *pblocks_;          // Block table within the mapping
+    std::vector<TString> detector_names_; // Detectors in file order
+};
+
+#endif // EVENT_STORE_HPP
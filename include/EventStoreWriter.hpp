@@ -0,0 +1,78 @@
+#ifndef EVENT_STORE_WRITER_HPP
+#define EVENT_STORE_WRITER_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <TString.h>
+#include "EventStore.hpp"
+
+// Writes the EventStore of a run while it is sorted. Every worker slot collects the hits of its events into its own
+// block, and once the block holds getBlockEvents() events it builds the block's index and compresses it on the
+// worker, then appends it to the file under a lock. Blocks of different slots interleave, an event store keeps no
+// entry order. The file is written under a temporary name and renamed by close(), so a store that looks complete is.
+class EventStoreWriter
+{
+public:
+    // Constructor creating the output file, hits are bucketed by energy over [energy_low, energy_up)
+    EventStoreWriter(const TString &file_name, const std::vector<TString> &detector_names, Double_t energy_low, Double_t energy_up,
+                     UInt_t n_buckets = 4096, UInt_t min_hits = 2);
+
+    // Destructor removing the temporary file if close() was not called
+    virtual ~EventStoreWriter();
+
+    EventStoreWriter(const EventStoreWriter &) = delete;
+    EventStoreWriter &operator=(const EventStoreWriter &) = delete;
+
+    // Getters
+
+    const TString &getFileName() const { return file_name_; }
+    const UInt_t getBucketNum() const { return header_.n_buckets; }
+    const UInt_t getMinHits() const { return min_hits_; }
+    const UInt_t getBlockEvents() const { return block_events_; }
+    const Long64_t getEvents() const { return header_.n_events; }
+
+    // Setters
+
+    void setBlockEvents(UInt_t block_events) { block_events_ = std::clamp(block_events, 1u, UInt_t(MAX_BLOCK_HITS_)); }
+
+    // Methods
+
+    void initializeSlots(UInt_t n_slots);
+    void fill(const Double_t *energies, UInt_t slot);
+    void close();
+
+    // Class consts
+    static const UInt_t MAX_BLOCK_HITS_ = 1u << 20; // A block is written once it holds this many hits, bounds its sections
+
+private:
+    struct Slot
+    {
+        std::vector<UInt_t> event_offsets;               // First hit of every event of the open block, then the end
+        std::vector<Float_t> energies;                   // Energies of the hits of the open block
+        std::vector<UShort_t> detectors;                 // Detectors of the hits of the open block
+        std::vector<std::pair<UInt_t, UInt_t>> key_hits; // (key, event) of every hit, sorted into the index
+        std::vector<char> hits;                          // Encoded hit section
+        std::vector<char> index;                         // Encoded index section
+        std::vector<char> hits_zipped;                   // Compressed hit section
+        std::vector<char> index_zipped;                  // Compressed index section
+        std::vector<ULong64_t> summary;                  // Bucket summary of the open block
+    };
+
+    void writeBlock(Slot &slot);
+
+    TString file_name_;                           // Name of the store file
+    TString temp_file_name_;                      // Name the file is written under until close()
+    std::vector<TString> detector_names_;         // Detectors hits can come from, in the order of fill()
+    UInt_t min_hits_;                             // Events with fewer hits are not stored
+    UInt_t block_events_;                         // Events per block
+    EventStore::FileHeader header_;               // Header written by close()
+    std::vector<EventStore::BlockRecord> blocks_; // Block table in file order
+    std::ofstream out_;                           // Store file, open until close()
+    std::mutex write_mutex_;                      // Guards out_, header_ and blocks_
+    std::vector<Slot> slots_;                     // Per slot open blocks
+};
+
+#endif // EVENT_STORE_WRITER_HPP
@@ -26,6 +26,36 @@ public:
     const std::vector<DAQModule *> *getDAQModules() const { return &daq_modules_; }
     const Run *getRun(const Int_t runNumber) const;
     const std::vector<Run *> *getRuns() const { return &runs_; }
+    const TString &getCalibrationFileName() const { return calibration_file_name_; }
+    const Double_t getEventBuildWindow() const { return event_build_window_; }
+    const Double_t getTimestampScale() const { return timestamp_scale_; }
+    const Double_t getChannelTimeScale() const { return channel_time_scale_; }
+    const Double_t getTimestampWrap() const { return timestamp_wrap_; }
+    const UInt_t getProfileSampling() const { return profile_sampling_; }
+    const Double_t getProgressInterval() const { return progress_interval_; }
+    const TString &getProfilePattern() const { return profile_pattern_; }
+    const UInt_t getTaskBatchSize() const { return task_batch_size_; }
+    const Bool_t isStaticPipeline() const { return static_pipeline_; }
+    const Double_t getFollowInterval() const { return follow_interval_; }
+    const Double_t getFollowTimeout() const { return follow_timeout_; }
+    const TString &getCheckpointPattern() const { return checkpoint_pattern_; }
+    const Double_t getCheckpointInterval() const { return checkpoint_interval_; }
+    const UInt_t getPrefetchThreads() const { return prefetch_threads_; }
+    const UInt_t getPrefetchDepth() const { return prefetch_depth_; }
+    const UInt_t getSharedHistogramBins() const { return shared_histogram_bins_; }
+    const UInt_t getSharedHistogramBuffer() const { return shared_histogram_buffer_; }
+    const UInt_t getHistogramMemoryLimit() const { return histogram_memory_limit_; }
+    const TString &getSkimPattern() const { return skim_pattern_; }
+    const UInt_t getSkimMinClovers() const { return skim_min_clovers_; }
+    const TString &getSkimCompression() const { return skim_compression_; }
+    const Int_t getSkimCompressionLevel() const { return skim_compression_level_; }
+    const TString &getEventStorePattern() const { return event_store_pattern_; }
+    const UInt_t getEventStoreMinHits() const { return event_store_min_hits_; }
+    const UInt_t getEventStoreBuckets() const { return event_store_buckets_; }
+    const TString &getGateFileName() const { return gate_file_name_; }
+    const Double_t getPromptWindow() const { return prompt_window_; }
+    const Double_t getRandomWindowLow() const { return random_window_low_; }
+    const Double_t getRandomWindowUp() const { return random_window_up_; }
 
     // Setters
 
@@ -34,14 +64,45 @@ public:
     void removeDAQModule(const TString &module_name);
     void addRun(Run *run);
     void removeRun(const Int_t run_number);
+    void prefetchRunMetadata(const TString &run_type = "", UInt_t n_threads = 0) const;
 
     void printInfo() const;
 
 private:
-    TString name_;                         // Name of the experiment, same name as the ROOT Tree MVME generates
-    TString file_name_;                    // Name of the file where the experiment configuration is stored
-    std::vector<DAQModule *> daq_modules_; // List of pointers to modules associated with the experiment
-    std::vector<Run *> runs_;              // List of pointers to runs associated with the experiment
+    TString name_;                          // Name of the experiment, same name as the ROOT Tree MVME generates
+    TString file_name_;                     // Name of the file where the experiment configuration is stored
+    std::vector<DAQModule *> daq_modules_;  // List of pointers to modules associated with the experiment
+    std::vector<Run *> runs_;               // List of pointers to runs associated with the experiment
+    TString calibration_file_name_;         // Name of the energy calibration file, empty if the data is not calibrated
+    Double_t event_build_window_ = 0;       // Coincidence window of the event builder, events are not built across modules if 0
+    Double_t timestamp_scale_ = 1;          // Time units per module timestamp tick
+    Double_t channel_time_scale_ = 1;       // Time units per channel_time unit
+    Double_t timestamp_wrap_ = 0;           // Number of module timestamp ticks after which the timestamp wraps, 0 if it does not
+    UInt_t profile_sampling_ = 1024;        // Every n-th entry of a slot is timed by the profiler, 0 for none
+    Double_t progress_interval_ = 10;       // Seconds between progress lines, 0 for none
+    TString profile_pattern_;               // Profile summary file name, --- is replaced by the run number, none if empty
+    UInt_t task_batch_size_ = 0;            // Entries per batch if independent tasks run concurrently, 0 for none
+    Bool_t static_pipeline_ = kFALSE;       // Sort with the fused compile time pipeline instead of separate tasks
+    Double_t follow_interval_ = 10;         // Seconds between hist file updates while following a run
+    Double_t follow_timeout_ = 300;         // Seconds without new entries after which a followed run is over, 0 to follow forever
+    TString checkpoint_pattern_;            // Checkpoint file name, --- is replaced by the run number, no checkpoints if empty
+    Double_t checkpoint_interval_ = 300;    // Seconds between checkpoints of a run
+    UInt_t prefetch_threads_ = 0;           // Threads reading and decompressing clusters ahead of the sort, 0 for none
+    UInt_t prefetch_depth_ = 16;            // Blocks of entries the prefetch threads may read ahead
+    UInt_t shared_histogram_bins_ = 0;      // Spectra with at least this many bins are shared by the slots, 0 for none
+    UInt_t shared_histogram_buffer_ = 16;   // Write-combining entries per slot of every shared spectrum, 0 for none
+    UInt_t histogram_memory_limit_ = 0;     // MB of histograms runs sorted concurrently may hold, 0 for half the RAM
+    TString skim_pattern_;                  // Skim file name, --- is replaced by the run number, no skims if empty
+    UInt_t skim_min_clovers_ = 2;           // Events with at least this many clovers with an add-back energy are skimmed
+    TString skim_compression_ = "zstd";     // Compression algorithm of the skim files, zlib, lzma, lz4 or zstd
+    Int_t skim_compression_level_ = 5;      // Compression level of the skim files
+    TString event_store_pattern_;           // Event store file name, --- is replaced by the run number, no event stores if empty
+    UInt_t event_store_min_hits_ = 2;       // Events with at least this many clovers with an add-back energy are stored
+    UInt_t event_store_buckets_ = 4096;     // Energy buckets per clover in the index of an event store
+    TString gate_file_name_ = "gates.root"; // File the gated spectra of --gate are written to
+    Double_t prompt_window_ = 0;            // Clover pairs with |dt| within this window are prompt, no random subtraction if 0
+    Double_t random_window_low_ = 0;        // Lower edge of the random window on the clover |dt|
+    Double_t random_window_up_ = 0;         // Upper edge of the random window on the clover |dt|
 };
 
 std::vector<Int_t> parseNumberString(const TString &number_string);
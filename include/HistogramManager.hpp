@@ -3,36 +3,99 @@
 
 #include <vector>
 #include <map>
+#include <memory>
+#include <stdexcept>
 #include <TH1D.h>
-#include <TStopwatch.h>
-#include <TTreeReader.h>
-#include <TTreeReaderArray.h>
-#include <ROOT/TThreadedObject.hxx>
-#include <ROOT/TTreeProcessorMT.hxx>
 #include <TFile.h>
+#include "CoincidenceMatrix.hpp"
+#include "SharedHistogram.hpp"
 
 // Forward declarations
 
 class DAQModule;
 class Detector;
 
+// Dense integer handle of a registered histogram, i.e. its index in every slot's histogram table
+using HistHandle = UInt_t;
+
+// Dense integer handle of a registered coincidence matrix
+using MatrixHandle = UInt_t;
+
+// How the slots fill a histogram
+enum class HistBackend
+{
+    kSlotCopies, // Every slot fills a private copy, the copies are merged after the event loop
+    kShared      // One SharedHistogram for all slots, memory does not grow with the number of slots
+};
+
+// Histograms are registered once per detector/filter/channel before sorting. Every worker slot then owns a private
+// copy of each histogram and fills it through a flat pointer table indexed by HistHandle, so filling needs no lock
+// and no lookup. After the event loop the slots are merged pairwise as a tree reduction into slot 0. Coincidence
+// matrices are too large for per slot copies, they are shared by all slots and fed through per slot buffers.
+// Histograms registered with HistBackend::kShared have no copies either: slot 0 fills the result histogram and the
+// other slots fill a SharedHistogram, whose counts are added to the result when the slots are merged. Their entries
+// in the tables of the slots other than 0 are null, they are filled through fill().
 class HistogramManager
 {
 public:
+    struct HistInfo
+    {
+        TString detector_name; // Group (directory) the histogram is written to
+        TString filter;        // Filter the histogram is filled from, can be empty
+        Int_t channel;         // Channel the histogram is filled from, -1 if not channel specific
+        TString name;          // Name of the histogram, unique within its group
+        HistBackend backend;   // How the slots fill the histogram
+    };
+
     HistogramManager();
     ~HistogramManager();
 
     // Getters
 
-    const std::map<TString, std::vector<ROOT::TThreadedObject<TH1D>>> *getHistograms() const { return &histogram_map_; }
+    const std::vector<HistInfo> &getHistInfos() const { return hist_infos_; }
+    const UInt_t getHistNum() const { return hist_infos_.size(); }
+    const UInt_t getSlotNum() const { return slot_hists_.size(); }
+    const Int_t findHistogram(const TString &detector_name, const TString &name) const;
+    const HistHandle getHandle(const TString &detector_name, const TString &name) const;
+    const HistHandle getHandle(const Detector *pdetector, const TString &filter, Int_t channel) const;
+    TH1D *getHistogram(HistHandle handle) const;
+    TH1D *const *getSlot(UInt_t slot) const { return slot_hists_[slot].data(); }
+    const UInt_t getMatrixNum() const { return matrices_.size(); }
+    const Int_t findMatrix(const TString &name) const;
+    CoincidenceMatrix *getMatrix(MatrixHandle handle) const { return matrices_.at(handle).get(); }
+    const ULong64_t getMemoryBytes(UInt_t n_slots) const;
+    const UInt_t getSharedBufferSize() const { return shared_buffer_size_; }
 
     // Setters
 
+    void setSharedBufferSize(UInt_t shared_buffer_size) { shared_buffer_size_ = shared_buffer_size; }
+
     // Methods
 
-    void addHistogram(ROOT::TThreadedObject<TH1D> *histogram);
+    HistHandle addHistogram(const TString &detector_name, const TH1D &model, const TString &filter = "", Int_t channel = -1, HistBackend backend = HistBackend::kSlotCopies);
+    HistHandle addHistograms(const Detector *pdetector, const TString &filter, Int_t n_bins, Double_t x_low, Double_t x_up, HistBackend backend = HistBackend::kSlotCopies);
     void removeHistogram(const TString &detector_name, const TString &name);
-    std::map<std::vector<TString>, std::vector<std::shared_ptr<TH1D>>> generateHistPtrMap() const;
+    MatrixHandle addMatrix(const TString &name, const TString &title, Int_t n_bins, Double_t x_low, Double_t x_up, Double_t random_weight = 0.);
+    std::map<std::vector<TString>, TH1D *> generateHistPtrMap() const;
+
+    void initializeSlots(UInt_t n_slots);
+    void fill(UInt_t slot, HistHandle handle, Double_t x) const
+    {
+        if (TH1D *phist = slot_hists_[slot][handle])
+            phist->Fill(x);
+        else
+            shared_hists_[handle]->fill(slot, x);
+    }
+    // Weighted fills need a histogram of the kSlotCopies backend, shared histograms only count
+    void fill(UInt_t slot, HistHandle handle, Double_t x, Double_t weight) const
+    {
+        if (hist_infos_[handle].backend == HistBackend::kShared)
+            throw std::logic_error("Weighted fill of shared histogram " + hist_infos_[handle].detector_name + "/" + hist_infos_[handle].name);
+        slot_hists_[slot][handle]->Fill(x, weight);
+    }
+    void fillMatrix(UInt_t slot, MatrixHandle handle, Double_t x, Double_t y) const { matrices_[handle]->fill(slot, x, y); }
+    void fillRandomMatrix(UInt_t slot, MatrixHandle handle, Double_t x, Double_t y) const { matrices_[handle]->fillRandom(slot, x, y); }
+    void mergeSlots(Bool_t keep_slots = kFALSE);
 
     void writeHistsToFile(TFile *file);
     // void readHistsFromFile(TFile *file);
@@ -40,7 +103,15 @@ public:
     void printInfo();
 
 private:
-    std::map<TString, std::vector<ROOT::TThreadedObject<TH1D>>> histogram_map_; // Map of histograms managed by this class
+    void clearSlots();
+
+    std::vector<HistInfo> hist_infos_;                           // Registered histograms, indexed by HistHandle
+    std::vector<std::unique_ptr<TH1D>> models_;                  // Model of every registered histogram, cloned into each slot
+    std::vector<std::vector<TH1D *>> slot_hists_;                // Per slot histogram tables, slot 0 holds the merged result
+    std::vector<std::vector<std::unique_ptr<TH1D>>> owned_;      // Owners of the slot histograms
+    std::vector<std::unique_ptr<CoincidenceMatrix>> matrices_;   // Shared coincidence matrices, indexed by MatrixHandle
+    std::vector<std::unique_ptr<SharedHistogram>> shared_hists_; // Shared counts of the kShared histograms, indexed by HistHandle
+    UInt_t shared_buffer_size_ = 16;                             // Write-combining entries per slot of every SharedHistogram
 };
 
-#endif // HISTOGRAM_MANAGER_HPP
\ No newline at end of file
+#endif // HISTOGRAM_MANAGER_HPP
@@ -0,0 +1,93 @@
+#ifndef HIT_FILTER_HPP
+#define HIT_FILTER_HPP
+
+#include <vector>
+#include <TString.h>
+#include "ChannelIndex.hpp"
+#include "ModuleTypes.hpp"
+
+// Forward declarations
+class DAQModule;
+class Event;
+
+// Once per event pre-filter of the real hits. For every module with an energy column, a hit mask has bit i set if
+// channel i has a value (MVME leaves unhit channels NaN), the value is above threshold and the channel's pileup flag
+// is not set. The masks are built with compares and bit arithmetic only, no branches, so the compiler vectorizes them.
+// The set bits are then expanded into a sparse list of the ChannelHandles of the hits in the energy columns, so tasks
+// executed later in the same entry loop over the 1 to 3 hits of an event instead of testing all channels. Masks and
+// hit list are written into an event product of getProductSize() values, so they travel with the event like every
+// other product and batched tasks read the hits of their own event: the mask of every module, the number of hits,
+// then the handles of the hits. Modules without a pileup filter only have their energies tested. A module whose width
+// is the channel count of a type of ModuleTypes.hpp reads its columns as ColumnViews of that count and has its mask
+// built by a loop unrolled over it, selected with visitChannelNum(), any other width takes the runtime sized loop.
+class HitFilter
+{
+public:
+    static const UInt_t MAX_CHANNEL_NUM_ = 32; // Channels of a module, one bit each in a hit mask
+
+    struct Module
+    {
+        const DAQModule *pmodule; // Module the mask belongs to
+        UInt_t energy_offset;     // Index of channel 0 of the energy column in the flat value array
+        Int_t pileup_offset;      // Index of channel 0 of the pileup column, -1 if the module has none
+        UInt_t width;             // Number of channels of the module
+    };
+
+    // Constructor resolving the columns of every module with an energy filter
+    HitFilter(const ChannelIndex &channel_index, const TString &energy_filter = "amplitude", const TString &pileup_filter = "pileup", Double_t threshold = 0.);
+
+    // Default destructor
+    virtual ~HitFilter();
+
+    // Getters
+
+    const std::vector<Module> &getModules() const { return modules_; }
+    const Double_t getThreshold() const { return threshold_; }
+    const UInt_t getProductSize() const { return modules_.size() + 1 + n_channels_; }
+
+    // Views of a hit product written by process()
+
+    const UInt_t getMask(const Double_t *hit_product, UInt_t module) const { return UInt_t(hit_product[module]); }
+    const UInt_t getHitNum(const Double_t *hit_product) const { return UInt_t(hit_product[modules_.size()]); }
+    const Double_t *getHits(const Double_t *hit_product) const { return hit_product + modules_.size() + 1; }
+
+    // Setters
+
+    void setThreshold(Double_t threshold) { threshold_ = threshold; }
+
+    // Methods
+
+    UInt_t process(const Event *pevent, Double_t *hit_product) const;
+    UInt_t process(const Double_t *values, Double_t *hit_product) const;
+
+    static UInt_t buildMask(const Double_t *energies, const Double_t *pileups, UInt_t width, Double_t threshold);
+
+    // Mask of a column of a module type, the channel loop is unrolled
+    template <UInt_t CHANNEL_NUM>
+    static UInt_t buildMask(ColumnView<CHANNEL_NUM> energies, ColumnView<CHANNEL_NUM> pileups, Double_t threshold)
+    {
+        static_assert(CHANNEL_NUM <= MAX_CHANNEL_NUM_, "Hit masks hold 32 channels");
+        UInt_t mask = 0;
+        forEachChannel<CHANNEL_NUM>([&](auto channel)
+                                    { mask |= UInt_t((energies[channel] > threshold) & !(pileups[channel] > 0.)) << channel; });
+        return mask;
+    }
+
+    // Mask of a module of any width, unrolled if the width is the channel count of a type of ModuleTypeList
+    static UInt_t buildModuleMask(const Double_t *energies, const Double_t *pileups, UInt_t width, Double_t threshold)
+    {
+        UInt_t mask = 0;
+        const Bool_t unrolled = visitChannelNum(width, [&](auto channel_num)
+                                                { mask = buildMask(ColumnView<channel_num>(energies), ColumnView<channel_num>(pileups), threshold); });
+        return unrolled ? mask : buildMask(energies, pileups, width, threshold);
+    }
+
+    void printInfo() const;
+
+private:
+    std::vector<Module> modules_; // Modules with an energy column in layout order
+    UInt_t n_channels_;           // Total number of channels of the modules, the most hits an entry can have
+    Double_t threshold_;          // Energies at or below threshold are no hits
+};
+
+#endif // HIT_FILTER_HPP
@@ -1,6 +1,12 @@
 #ifndef ITASK_HPP
 #define ITASK_HPP
 
+#include <vector>
+#include <TString.h>
+
+// Forward declarations
+class Event;
+
 class ITask
 {
 public:
@@ -10,5 +16,33 @@ public:
     virtual void callExecute() = 0;
     virtual void callFinalize() = 0;
     virtual const TString &getName() const = 0;
+
+    // Names of the per event products the task reads and writes, TaskManager orders the tasks by them
+
+    virtual const std::vector<TString> &getInputs() const = 0;
+    virtual const std::vector<TString> &getOutputs() const = 0;
+
+    // Branches the task reads from the event, as module.filter or as a filter name for that filter of every module.
+    // TaskManager only reads the branches some task declares, "*" (the default) declares all of them.
+
+    virtual const std::vector<TString> &getBranches() const
+    {
+        static const std::vector<TString> all_branches{"*"};
+        return all_branches;
+    }
+
+    // Event loop hooks, see TaskManager::processRun()
+
+    virtual void callInitializeSlots(UInt_t n_slots) {}       // Called once before the event loop with the number of worker slots
+    virtual void callExecute(Event *pevent, UInt_t slot) = 0; // Called once per entry by the worker holding the given slot
+    virtual void callExecuteBatch(Event *const *events, UInt_t n_events, UInt_t slot)
+    {
+        // Called once per batch of entries if the task manager batches, see TaskManager::executeBatch()
+        for (UInt_t i = 0; i < n_events; ++i)
+        {
+            callExecute(events[i], slot);
+        }
+    }
+    virtual void callMergeSlots() {}                          // Called once after the event loop to merge the per slot results
 };
-#endif // ITASK_HPP
\ No newline at end of file
+#endif // ITASK_HPP
@@ -0,0 +1,90 @@
+#ifndef MODULE_TYPES_HPP
+#define MODULE_TYPES_HPP
+
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <TString.h>
+
+// Compile time descriptors of the supported Mesytec module types. Every descriptor carries the MVME type name, the
+// channel count as a constexpr and the filters MVME defines by default, in column order. The config parser picks the
+// descriptor at runtime with visitModuleType() to build the DAQModule. On the per event path the channel counts give
+// the columns their width at compile time: ChannelIndex::getColumnHandle<Descriptor>() resolves a column checked
+// against the descriptor, Event::getColumn() reads it as a ColumnView of fixed size, and the per column loops of
+// HitFilter and Calibration are unrolled over the width picked once per column with visitChannelNum(). A new module
+// type is a new descriptor added to ModuleTypeList, nothing else dispatches on the type name.
+namespace ModuleTypes
+{
+    // MDPP-16 with the SCP firmware, spectroscopy of HPGe and other slow signals
+    struct MDPP16SCP
+    {
+        static constexpr const char *NAME_ = "mdpp16scp";
+        static constexpr UInt_t CHANNEL_NUM_ = 16;
+        static constexpr std::array<const char *, 4> DEFAULT_FILTERS_ = {"amplitude", "channel_time", "module_timestamp", "trigger_time"};
+    };
+
+    // MDPP-16 with the QDC firmware, charge integration of fast scintillators
+    struct MDPP16QDC
+    {
+        static constexpr const char *NAME_ = "mdpp16qdc";
+        static constexpr UInt_t CHANNEL_NUM_ = 16;
+        static constexpr std::array<const char *, 5> DEFAULT_FILTERS_ = {"channel_time", "integration_long", "integration_short", "module_timestamp", "trigger_time"};
+    };
+
+    // MDPP-32 with the SCP firmware
+    struct MDPP32SCP
+    {
+        static constexpr const char *NAME_ = "mdpp32scp";
+        static constexpr UInt_t CHANNEL_NUM_ = 32;
+        static constexpr std::array<const char *, 4> DEFAULT_FILTERS_ = {"amplitude", "channel_time", "module_timestamp", "trigger_time"};
+    };
+
+    // MDPP-32 with the QDC firmware
+    struct MDPP32QDC
+    {
+        static constexpr const char *NAME_ = "mdpp32qdc";
+        static constexpr UInt_t CHANNEL_NUM_ = 32;
+        static constexpr std::array<const char *, 5> DEFAULT_FILTERS_ = {"channel_time", "integration_long", "integration_short", "module_timestamp", "trigger_time"};
+    };
+}
+
+// Every supported module type, the order is the order of DAQModule::VALID_MODULE_TYPES_
+using ModuleTypeList = std::tuple<ModuleTypes::MDPP16SCP, ModuleTypes::MDPP16QDC, ModuleTypes::MDPP32SCP, ModuleTypes::MDPP32QDC>;
+
+// Call func(descriptor) with the descriptor of the named type, returns kFALSE if no type has that name
+template <typename Func>
+Bool_t visitModuleType(const TString &type, Func &&func)
+{
+    return std::apply([&](auto... descriptors)
+                      { return ((type == decltype(descriptors)::NAME_ ? (func(descriptors), kTRUE) : kFALSE) || ...); },
+                      ModuleTypeList{});
+}
+
+// Call func(std::integral_constant<UInt_t, CHANNEL_NUM>) if channel_num is the channel count of a type of
+// ModuleTypeList, returns kFALSE otherwise
+template <typename Func>
+Bool_t visitChannelNum(UInt_t channel_num, Func &&func)
+{
+    return std::apply([&](auto... descriptors)
+                      { return ((channel_num == decltype(descriptors)::CHANNEL_NUM_ ? (func(std::integral_constant<UInt_t, decltype(descriptors)::CHANNEL_NUM_>{}), kTRUE) : kFALSE) || ...); },
+                      ModuleTypeList{});
+}
+
+namespace detail
+{
+    template <typename Func, UInt_t... Channels>
+    void forEachChannel(Func &func, std::integer_sequence<UInt_t, Channels...>)
+    {
+        (func(std::integral_constant<UInt_t, Channels>{}), ...);
+    }
+}
+
+// Call func(std::integral_constant<UInt_t, channel>) for channels 0 to CHANNEL_NUM - 1, unrolled at compile time
+template <UInt_t CHANNEL_NUM, typename Func>
+void forEachChannel(Func &&func)
+{
+    detail::forEachChannel(func, std::make_integer_sequence<UInt_t, CHANNEL_NUM>{});
+}
+
+#endif // MODULE_TYPES_HPP
@@ -0,0 +1,65 @@
+#ifndef RANDOM_SUBTRACTION_HPP
+#define RANDOM_SUBTRACTION_HPP
+
+#include <vector>
+#include <TString.h>
+
+// Prompt minus random subtraction of coincidences by their time difference, in the same pass that fills the spectra.
+// Every pair of hits of an event is classified by |dt|, the difference of the two hit times: a pair with |dt| within
+// the prompt window is prompt and weighs +1, a pair with random_low <= |dt| < random_up is random and weighs
+// -prompt_window / (random_up - random_low), the ratio of the window widths, any other pair is dropped. Spectra
+// filled with these weights are prompt minus random directly, subtracted matrices count the prompt and random pairs
+// and apply the weight at export, so nothing is subtracted by hand afterwards. Per event the hits are gathered into contiguous lanes and the time differences and weights
+// of all pairs computed in flat loops with selects instead of branches, so they vectorize. Hits without an energy
+// (NaN) take no part, hits with a NaN time fail every comparison and weigh 0.
+class RandomSubtraction
+{
+public:
+    struct Pair
+    {
+        UInt_t first;    // Index of the first hit, e.g. its clover
+        UInt_t second;   // Index of the second hit, greater than first
+        Double_t weight; // 1 for a prompt pair, getRandomWeight() for a random one
+    };
+
+    // Constructor, the windows are in the unit of the hit times
+    RandomSubtraction(Double_t prompt_window, Double_t random_low, Double_t random_up);
+
+    // Default destructor
+    virtual ~RandomSubtraction();
+
+    // Getters
+
+    const Double_t getPromptWindow() const { return prompt_window_; }
+    const Double_t getRandomLow() const { return random_low_; }
+    const Double_t getRandomUp() const { return random_up_; }
+    const Double_t getRandomWeight() const { return random_weight_; }
+    const UInt_t getPairNum(UInt_t slot) const { return slot_buffers_[slot].pairs.size(); }
+    const Pair *getPairs(UInt_t slot) const { return slot_buffers_[slot].pairs.data(); }
+
+    // Methods
+
+    void initializeSlots(UInt_t n_slots);
+    UInt_t process(const Double_t *energies, const Double_t *times, UInt_t n_hits, UInt_t slot);
+
+    void printInfo() const;
+
+private:
+    struct alignas(64) SlotBuffers
+    {
+        std::vector<UInt_t> hits;      // Indices of the hits with an energy
+        std::vector<Double_t> times;   // Times of those hits, contiguous
+        std::vector<UInt_t> firsts;    // Lane of the first hit of every pair
+        std::vector<UInt_t> seconds;   // Lane of the second hit of every pair
+        std::vector<Double_t> weights; // Time difference, then weight of every pair
+        std::vector<Pair> pairs;       // Prompt and random pairs of the event
+    };
+
+    Double_t prompt_window_;                // Pairs with |dt| <= prompt_window_ are prompt
+    Double_t random_low_;                   // Lower edge of the random window on |dt|
+    Double_t random_up_;                    // Upper edge of the random window on |dt|
+    Double_t random_weight_;                // Weight of a random pair, minus the ratio of the window widths
+    std::vector<SlotBuffers> slot_buffers_; // Per slot pairs of the current event
+};
+
+#endif // RANDOM_SUBTRACTION_HPP
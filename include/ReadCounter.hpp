@@ -0,0 +1,52 @@
+#ifndef READ_COUNTER_HPP
+#define READ_COUNTER_HPP
+
+#include <TFile.h>
+#include <TString.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+
+// Bytes one TTreeReader reads from the files of its tree, for the profiler. TFile::GetFileBytesRead() counts the
+// files of the whole process, so runs sorted at the same time would count each other's reads. A chain closes the
+// file of a part when it moves on to the next, so update() has to be called after every entry, while the file of
+// the entry is still open. The file the tree is in when the counter is set up counts from then on, since a tree
+// reused across entry ranges has read bytes for earlier ranges, a part the reader moves on to counts from its opening.
+class ReadCounter
+{
+public:
+    // Constructor
+    ReadCounter(TTreeReader &tree_reader);
+
+    // Default destructor
+    virtual ~ReadCounter();
+
+    // Getters
+
+    const Long64_t getBytesRead() const { return closed_bytes_ + bytes_ - start_bytes_; }
+
+    // Methods
+
+    void update()
+    {
+        TTree *ptree = tree_reader_.GetTree();
+        TFile *pfile = ptree ? ptree->GetCurrentFile() : nullptr;
+        const Long64_t bytes = pfile ? pfile->GetBytesRead() : 0;
+        const Int_t tree_number = ptree ? ptree->GetTreeNumber() : -1;
+        if (tree_number != tree_number_)
+        {
+            closed_bytes_ += bytes_ - start_bytes_;
+            start_bytes_ = 0;
+            tree_number_ = tree_number;
+        }
+        bytes_ = bytes;
+    }
+
+private:
+    TTreeReader &tree_reader_; // Reader whose files are counted
+    Int_t tree_number_;        // Part of the chain the tree is in, -1 if none is loaded
+    Long64_t start_bytes_;     // Bytes read from the current file before it was counted
+    Long64_t bytes_;           // Bytes read from the current file at the last update()
+    Long64_t closed_bytes_;    // Bytes read from the files the reader has moved on from
+};
+
+#endif // READ_COUNTER_HPP
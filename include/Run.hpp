@@ -1,7 +1,12 @@
 #ifndef RUN_HPP
 #define RUN_HPP
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <TString.h>
+#include <TChain.h>
 #include <TFile.h>
 #include <TTree.h>
 #include "HistogramManager.hpp"
@@ -12,17 +17,37 @@ class Run
     friend class Experiment; // Allow Experiment to access private members
 
 public:
+    // Entry and cluster layout of the run's tree over all its parts, read once without keeping the files open
+    struct Metadata
+    {
+        Long64_t n_entries = -1;                      // Number of entries in the tree, -1 if not fetched yet
+        std::vector<Long64_t> part_entries;           // Number of entries in every part of the run, in chain order
+        std::vector<Long64_t> cluster_starts;         // First entry of every cluster over all parts, in ascending order
+        Long64_t tot_bytes = 0;                       // Uncompressed size of the tree
+        Long64_t zip_bytes = 0;                       // Compressed size of the tree
+        std::map<TString, Long64_t> branch_zip_bytes; // Compressed size of every branch holding a leaf, by branch name
+    };
+
     // Default Constructor
 
     // Getters
 
     const Int_t getRunNumber() const { return run_number_; }
     const TString &getDescription() const { return run_description_; }
-    const TFile *getFile() const { return pfile_; }
+    const TString &getRunType() const { return run_type_; }
+    const TFile *getFile() const;
     const TString &getFileName() const { return file_name_; }
-    const TTree *getTree() const { return ptree_; }
+    const std::vector<TString> &getFileNames() const { return file_names_; }
+    const TString &getFilePattern() const { return file_pattern_; }
+    const UInt_t getPartNum() const { return file_names_.size(); }
+    const TTree *getTree() const;
+    const TString &getTreeName() const { return tree_name_; }
     const TFile *getHistFile() const { return phist_file_; }
     const HistogramManager *getHistMan() const { return phist_manager_; }
+    const Metadata &getMetadata() const;
+    const Long64_t getEntries() const { return getMetadata().n_entries; }
+    const Bool_t isOpen() const { return pfile_ != nullptr; }
+    const Bool_t isChained() const { return file_names_.size() > 1; }
 
     // Setters
 
@@ -37,24 +62,36 @@ public:
     // Methods
     void createHistogramManager();
 
+    void open() const;
+    void close() const;
+    void fetchMetadata() const;
+    std::unique_ptr<TChain> openChain() const;
+
     void printInfo() const;
 
     // Destructor
     virtual ~Run();
 
 private:
-    Run(Int_t run_number, TString file_name, TString tree_name, TString run_description, TString run_type); // Private constructor to prevent instantiation without an Experiment context
-
-    Int_t run_number_;                // Run number, unique identifier for the run
-    TString run_description_;         // Name of the run, can be empty if not specified
-    TString run_type_;                // Type of the run, can be empty if not specified
-    TString file_name_;               // Name of the file associated with this run
-    TString tree_name_;               // Name of the TTree associated with this run as defined by MVME
-    TString hist_file_name_;          // Name of the histogram file associated with this run
-    TFile *pfile_;                    // Pointer to the ROOT file associated with this run
-    TTree *ptree_;                    // Pointer to the ROOT tree associated with this run
-    TFile *phist_file_;               // Pointer to the ROOT file for histograms, if applicable
-    HistogramManager *phist_manager_; // Pointer to the HistogramManager for this run
+    Run(Int_t run_number, TString run_description, TString run_type, std::vector<TString> file_names, TString tree_name); // Private constructor to prevent instantiation without an Experiment context
+
+    void releaseFile() const;
+
+    Int_t run_number_;                  // Run number, unique identifier for the run
+    TString run_description_;           // Name of the run, can be empty if not specified
+    TString run_type_;                  // Type of the run, can be empty if not specified
+    TString file_name_;                 // Name of the file associated with this run, the first part if the run is chained
+    std::vector<TString> file_names_;   // Names of all parts of the run, in order
+    TString file_pattern_;              // File name of the run before its parts were looked up, e.g. run001_part*.root
+    TString tree_name_;                 // Name of the TTree associated with this run as defined by MVME
+    TString hist_file_name_;            // Name of the histogram file associated with this run
+    mutable TFile *pfile_;              // Pointer to the ROOT file associated with this run, opened on first use
+    mutable TTree *ptree_;              // Pointer to the ROOT tree associated with this run, owned by pfile_
+    mutable std::mutex file_mutex_;     // Guards pfile_ and ptree_
+    mutable Metadata metadata_;         // Entry and cluster layout, fetched on first use
+    mutable std::mutex metadata_mutex_; // Guards metadata_
+    TFile *phist_file_;                 // Pointer to the ROOT file for histograms, if applicable
+    HistogramManager *phist_manager_;   // Pointer to the HistogramManager for this run
 };
 
-#endif // RUN_HPP
\ No newline at end of file
+#endif // RUN_HPP
@@ -0,0 +1,157 @@
+#ifndef RUN_SCHEDULER_HPP
+#define RUN_SCHEDULER_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <TString.h>
+#include "TaskManager.hpp"
+#include "HistogramManager.hpp"
+#include "EventStore.hpp"
+
+// Forward declarations
+class Experiment;
+class ChannelIndex;
+class Run;
+class TaskProfiler;
+
+// Everything one run is sorted with. Runs may be sorted concurrently, so every run gets its own task and histogram
+// manager, and the objects its tasks use are kept alive here until the run is written.
+struct RunContext
+{
+    const Run *prun;                              // Run being sorted
+    TaskManager task_manager;                     // Tasks of the run
+    HistogramManager hist_manager;                // Histograms of the run, written to the run's hist file
+    std::vector<std::shared_ptr<void>> resources; // Objects used by the tasks
+    Bool_t resumed = kFALSE;                      // Run continues from its checkpoint, outputs of every event are not written
+
+    // Create an object owned by the context
+    template <typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+        auto pobject = std::make_shared<T>(std::forward<Args>(args)...);
+        resources.push_back(pobject);
+        return pobject.get();
+    }
+};
+
+// Sorts every run of an experiment, or the runs of one run type, in one invocation. Large runs are sorted one after
+// another, each split by cluster over the whole thread pool through TaskManager::processRun(). Small runs are sorted
+// serially but concurrently, one per worker, largest first. A run is large if it holds more than its fair share of the
+// entries of all scheduled runs per worker, unless a split threshold is set. With a cache pattern, every run is
+// converted to a SortCache on its first sort and read from the cache on every later sort, until its files change. If
+// the experiment sets an event build window, every run is sorted from events built across modules by an EventBuilder
+// instead. followRun() sorts a single run while MVME is still writing it and updates its hist file at a fixed interval.
+// With a checkpoint pattern, the progress of every run read from its tree is checkpointed, and a resumed sort skips the
+// completed runs and continues the others from their checkpoints. The progress of the runs sorted concurrently is
+// printed by a single monitor of the scheduler, one block of lines per interval. gateRuns() sets gates on the event stores written by
+// earlier sorts instead of sorting the runs again.
+class RunScheduler
+{
+public:
+    // Builds the tasks and histograms of a run into its context
+    using SortSetup = std::function<void(RunContext &)>;
+
+    // Constructor
+    RunScheduler(const Experiment *pexperiment, const ChannelIndex &channel_index, SortSetup setup);
+
+    // Default destructor
+    virtual ~RunScheduler();
+
+    // Getters
+
+    const TString &getRunType() const { return run_type_; }
+    const TString &getHistFilePattern() const { return hist_file_pattern_; }
+    const Long64_t getSplitThreshold() const { return split_threshold_; }
+    const TString &getCachePattern() const { return cache_pattern_; }
+    const TString &getProfilePattern() const { return profile_pattern_; }
+    const UInt_t getProfileSampling() const { return profile_sampling_; }
+    const Double_t getProgressInterval() const { return progress_interval_; }
+    const UInt_t getTaskBatchSize() const { return task_batch_size_; }
+    const Double_t getFollowInterval() const { return follow_interval_; }
+    const Double_t getFollowTimeout() const { return follow_timeout_; }
+    const TString &getCheckpointPattern() const { return checkpoint_pattern_; }
+    const Double_t getCheckpointInterval() const { return checkpoint_interval_; }
+    const Bool_t isResume() const { return resume_; }
+    const UInt_t getPrefetchThreads() const { return prefetch_threads_; }
+    const UInt_t getPrefetchDepth() const { return prefetch_depth_; }
+    const UInt_t getHistogramMemoryLimit() const { return histogram_memory_limit_; }
+    const TString &getEventStorePattern() const { return event_store_pattern_; }
+    std::vector<Run *> getScheduledRuns() const;
+    TString getHistFileName(const Run *prun) const;
+    TString getCacheFileName(const Run *prun) const;
+    TString getProfileFileName(const Run *prun) const;
+    TString getCheckpointFileName(const Run *prun) const;
+    TString getEventStoreFileName(const Run *prun) const;
+
+    // Setters
+
+    void setRunType(const TString &run_type) { run_type_ = run_type; }
+    void setHistFilePattern(const TString &hist_file_pattern) { hist_file_pattern_ = hist_file_pattern; }
+    void setSplitThreshold(Long64_t split_threshold) { split_threshold_ = split_threshold; }
+    void setCachePattern(const TString &cache_pattern) { cache_pattern_ = cache_pattern; }
+    void setProfilePattern(const TString &profile_pattern) { profile_pattern_ = profile_pattern; }
+    void setProfileSampling(UInt_t profile_sampling) { profile_sampling_ = profile_sampling; }
+    void setProgressInterval(Double_t progress_interval) { progress_interval_ = progress_interval; }
+    void setTaskBatchSize(UInt_t task_batch_size) { task_batch_size_ = task_batch_size; }
+    void setFollowInterval(Double_t follow_interval) { follow_interval_ = follow_interval; }
+    void setFollowTimeout(Double_t follow_timeout) { follow_timeout_ = follow_timeout; }
+    void setCheckpointPattern(const TString &checkpoint_pattern) { checkpoint_pattern_ = checkpoint_pattern; }
+    void setCheckpointInterval(Double_t checkpoint_interval) { checkpoint_interval_ = checkpoint_interval; }
+    void setResume(Bool_t resume) { resume_ = resume; }
+    void setPrefetchThreads(UInt_t prefetch_threads) { prefetch_threads_ = prefetch_threads; }
+    void setPrefetchDepth(UInt_t prefetch_depth) { prefetch_depth_ = prefetch_depth; }
+    void setHistogramMemoryLimit(UInt_t histogram_memory_limit) { histogram_memory_limit_ = histogram_memory_limit; }
+    void setEventStorePattern(const TString &event_store_pattern) { event_store_pattern_ = event_store_pattern; }
+
+    // Methods
+
+    Long64_t processRuns(UInt_t n_threads = 0);
+    Long64_t followRun(Int_t run_number, UInt_t n_threads = 0);
+    Long64_t gateRuns(const std::vector<EventStore::Gate> &gates, const TString &gate_file_name, UInt_t n_threads = 0);
+
+    // Class consts
+    static const Int_t GATE_BINS_ = 65536; // Bins of the gated spectra, over the energy range of the event stores
+
+private:
+    Long64_t processRun(Run *prun, UInt_t n_threads, Bool_t concurrent);
+    std::shared_ptr<void> reserveHistogramMemory(const Run *prun, ULong64_t n_bytes);
+    std::shared_ptr<void> watchProgress(const TaskProfiler *pprofiler);
+    void startProgressMonitor();
+    void stopProgressMonitor();
+    void monitorProgress();
+
+    const Experiment *pexperiment_;                  // Experiment whose runs are sorted
+    const ChannelIndex &channel_index_;              // Channel layout shared by all runs
+    SortSetup setup_;                                // Builds the tasks of every run
+    TString run_type_;                               // Only runs of this type are sorted, all runs if empty
+    TString hist_file_pattern_;                      // Hist file name, --- is replaced by the run number, derived from the run file if empty
+    Long64_t split_threshold_;                       // Runs with more entries are split by cluster, 0 derives it from the runs
+    TString cache_pattern_;                          // Sort cache file name, --- is replaced by the run number, no caching if empty
+    TString profile_pattern_;                        // Profile summary file name, --- is replaced by the run number, none if empty
+    UInt_t profile_sampling_;                        // Every n-th entry of a slot is timed, 0 for none
+    Double_t progress_interval_;                     // Seconds between progress lines, 0 for none
+    UInt_t task_batch_size_;                         // Entries per batch if independent tasks run concurrently, 0 for none
+    Double_t follow_interval_;                       // Seconds between hist file updates while following a run
+    Double_t follow_timeout_;                        // Seconds without new entries after which a followed run is over, 0 to follow forever
+    TString checkpoint_pattern_;                     // Checkpoint file name, --- is replaced by the run number, no checkpoints if empty
+    Double_t checkpoint_interval_;                   // Seconds between checkpoints of a run
+    Bool_t resume_;                                  // Skip runs and clusters of earlier sorts that are in their checkpoints
+    UInt_t prefetch_threads_;                        // Threads reading and decompressing clusters ahead of the sort, 0 for none
+    UInt_t prefetch_depth_;                          // Blocks of entries the prefetch threads may read ahead
+    UInt_t histogram_memory_limit_;                  // MB of histograms runs sorted concurrently may hold, 0 for half the RAM
+    TString event_store_pattern_;                    // Event store file name, --- is replaced by the run number, none if empty
+    std::mutex histogram_memory_mutex_;              // Guards histogram_memory_
+    std::condition_variable histograms_released_;    // Notified whenever a run releases its histograms
+    ULong64_t histogram_memory_;                     // Bytes of histograms held by the runs being sorted
+    std::vector<const TaskProfiler *> profilers_;    // Profilers of the runs sorted concurrently, printed by the progress monitor
+    Bool_t monitoring_;                              // Progress monitor running
+    std::thread progress_thread_;                    // Prints the progress of the runs sorted concurrently
+    std::mutex progress_mutex_;                      // Guards profilers_ and monitoring_
+    std::condition_variable progress_condition_;     // Wakes the progress monitor up when it is stopped
+};
+
+#endif // RUN_SCHEDULER_HPP
@@ -0,0 +1,54 @@
+#ifndef SHARED_HISTOGRAM_HPP
+#define SHARED_HISTOGRAM_HPP
+
+#include <atomic>
+#include <vector>
+#include <TH1D.h>
+
+// Counts of a 1D spectrum in one copy shared by all worker slots, for spectra too large to copy into every slot.
+// Bins are 32 bit counts incremented with relaxed atomic adds, laid out like TH1D: bin 0 is the underflow and
+// n_bins + 1 the overflow. Every slot can keep a small write-combining buffer of (bin, count) entries, direct mapped
+// by the low bits of the bin: repeated fills of a hot bin, e.g. a strong gamma line, are counted in the buffer and
+// added with one atomic add when the entry is taken by another bin or the slot is flushed. Only unweighted fills.
+class SharedHistogram
+{
+public:
+    // Constructor, the buffer size is rounded up to a power of two and 0 adds every fill directly
+    SharedHistogram(Int_t n_bins, Double_t x_low, Double_t x_up, UInt_t buffer_size = 16);
+
+    // Default destructor
+    virtual ~SharedHistogram();
+
+    // Getters
+
+    const Int_t getBinNum() const { return n_bins_; }
+    const Double_t getLow() const { return x_low_; }
+    const Double_t getUp() const { return x_up_; }
+    const UInt_t getBufferSize() const { return buffer_size_; }
+    const UInt_t getCount(Int_t bin) const { return counts_.at(bin).load(std::memory_order_relaxed); }
+    const Int_t findBin(Double_t x) const;
+
+    // Methods
+
+    void initializeSlots(UInt_t n_slots);
+    void fill(UInt_t slot, Double_t x);
+    void flush(UInt_t slot);
+    void flushSlots();
+    void moveTo(TH1D *phist);
+
+private:
+    struct alignas(64) SlotBuffer
+    {
+        std::vector<Int_t> bins;    // Bin of every entry, -1 if the entry is empty
+        std::vector<UInt_t> counts; // Fills of the bin not yet added to the shared counts
+    };
+
+    const Int_t n_bins_;                      // Number of bins, without underflow and overflow
+    const Double_t x_low_;                    // Lower edge of the axis
+    const Double_t x_up_;                     // Upper edge of the axis
+    const UInt_t buffer_size_;                // Number of write-combining entries per slot, 0 for none
+    std::vector<std::atomic<UInt_t>> counts_; // Counts of bins 0 to n_bins + 1
+    std::vector<SlotBuffer> slot_buffers_;    // Per slot write-combining buffers
+};
+
+#endif // SHARED_HISTOGRAM_HPP
@@ -0,0 +1,80 @@
+#ifndef SKIM_WRITER_HPP
+#define SKIM_WRITER_HPP
+
+#include <memory>
+#include <vector>
+#include <TString.h>
+#include "ChannelIndex.hpp"
+
+// Forward declarations
+class DAQModule;
+class Event;
+class TTree;
+namespace ROOT
+{
+    class TBufferMerger;
+    class TBufferMergerFile;
+}
+
+// List mode output of the selected events of a run. The skim tree has the layout of an MVME tree, one module.filter
+// branch per column of the channel index, so a skim is sorted like any run file. Calibrated columns are written as
+// an extra module.filter_calibrated branch each. Every worker slot fills its own tree in a TBufferMerger file and
+// hands its baskets to the merger every getFlushEntries() entries, the merger appends them to the output file, so
+// slots never wait for each other while filling. The compression algorithm and level are chosen per skim. The file
+// is written under a temporary name and renamed by close(), so a skim that looks complete is.
+class SkimWriter
+{
+public:
+    // Constructor creating the output file, algorithm is one of zlib, lzma, lz4 or zstd
+    SkimWriter(const ChannelIndex &channel_index, const TString &file_name, const TString &tree_name = "skim",
+               const TString &algorithm = "zstd", Int_t level = 5);
+
+    // Destructor removing the temporary file if close() was not called
+    virtual ~SkimWriter();
+
+    SkimWriter(const SkimWriter &) = delete;
+    SkimWriter &operator=(const SkimWriter &) = delete;
+
+    // Getters
+
+    const TString &getFileName() const { return file_name_; }
+    const Int_t getCompressionSettings() const { return compression_settings_; }
+    const Long64_t getFlushEntries() const { return flush_entries_; }
+    const Long64_t getEntries() const;
+
+    // Setters
+
+    void setFlushEntries(Long64_t flush_entries) { flush_entries_ = flush_entries; }
+
+    // Methods
+
+    void addCalibratedColumn(const DAQModule *pmodule, const TString &filter);
+
+    void initializeSlots(UInt_t n_slots);
+    void fill(const Event *pevent, const Double_t *calibrated, UInt_t slot);
+    void close();
+
+    static Int_t getCompressionSettings(const TString &algorithm, Int_t level);
+
+private:
+    struct alignas(64) Slot
+    {
+        std::shared_ptr<ROOT::TBufferMergerFile> pfile; // In memory file of the slot, emptied into the merger on every flush
+        TTree *ptree = nullptr;                         // Skim tree of the slot, owned by pfile
+        std::vector<Double_t> values;                   // Branch buffer in the layout of Event::getValues()
+        std::vector<Double_t> calibrated;               // Branch buffer of the calibrated columns, one after another
+        Long64_t n_entries = 0;                         // Entries filled by the slot
+    };
+
+    const ChannelIndex &channel_index_;            // Layout of the written values
+    TString file_name_;                            // Name of the skim file
+    TString tree_name_;                            // Name of the skim tree
+    Int_t compression_settings_;                   // ROOT compression settings, 100 * algorithm + level
+    TString temp_file_name_;                       // Name the file is written under until close()
+    Long64_t flush_entries_;                       // Entries a slot fills before it hands its baskets to the merger
+    std::vector<Int_t> calibrated_columns_;        // Channel index columns written calibrated as well
+    std::unique_ptr<ROOT::TBufferMerger> pmerger_; // Merges the slot files into the skim file
+    std::vector<Slot> slots_;                      // Per slot trees and branch buffers
+};
+
+#endif // SKIM_WRITER_HPP
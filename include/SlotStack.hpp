@@ -0,0 +1,34 @@
+#ifndef SLOT_STACK_HPP
+#define SLOT_STACK_HPP
+
+#include <mutex>
+#include <vector>
+#include <TString.h>
+
+// Hands out worker slot numbers in [0, n_slots) to concurrently running event loop tasks, so that per slot
+// state (readers, histograms, task results) is never shared between two threads at the same time
+class SlotStack
+{
+public:
+    // Constructor
+    SlotStack(UInt_t n_slots);
+
+    // Default destructor
+    virtual ~SlotStack();
+
+    // Getters
+
+    const UInt_t getSlotNum() const { return n_slots_; }
+
+    // Methods
+
+    UInt_t acquireSlot();
+    void releaseSlot(UInt_t slot);
+
+private:
+    const UInt_t n_slots_;           // Total number of slots
+    std::mutex mutex_;               // Guards free_slots_
+    std::vector<UInt_t> free_slots_; // Slots not currently held by a worker
+};
+
+#endif // SLOT_STACK_HPP
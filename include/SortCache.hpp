@@ -0,0 +1,119 @@
+#ifndef SORT_CACHE_HPP
+#define SORT_CACHE_HPP
+
+#include <vector>
+#include <TString.h>
+
+// Forward declarations
+class ChannelIndex;
+class Run;
+
+// CloverSort native columnar copy of a run, written once by SortCache::convert() and memory mapped by later sorts.
+// Entries are grouped into blocks. Within a block every (module, filter) column is one contiguous chunk of
+// entries x width values, laid out like that column of Event::getValues(). Each chunk is stored in the narrowest
+// type its values allow (integers use a sentinel for NaN) and compressed with LZ4 if that makes it smaller.
+// Uncompressed double chunks are read straight from the mapping without any copy or decoding.
+//
+// File layout (native byte order): FileHeader, the column table, the source table, the chunk data (8 byte aligned),
+// and the chunk index of n_blocks x n_columns ChunkRecords at FileHeader::index_offset. The source table records the
+// name, size and modification time of every part of the run at conversion, matches() compares them to the files on
+// disk so a cache of a rewritten or extended run is converted again instead of read.
+class SortCache
+{
+public:
+    enum class ValueType : UChar_t
+    {
+        kUInt16,  // Integers in [0, 65534], 65535 is NaN
+        kInt32,   // 32 bit integers, INT32_MIN is NaN
+        kInt64,   // 64 bit integers, INT64_MIN is NaN
+        kFloat64, // Anything else
+    };
+
+    enum class Codec : UChar_t
+    {
+        kNone, // Chunk stored as is
+        kLZ4,  // Chunk compressed with ROOT's LZ4 codec
+    };
+
+    struct Column
+    {
+        TString module_name; // Name of the module
+        TString filter;      // Filter (MVME data source) name
+        UInt_t width;        // Number of channels in the column
+    };
+
+    struct Source
+    {
+        TString file_name; // Name of the part
+        Long64_t size;     // Size of the part in bytes
+        Long64_t mtime;    // Modification time of the part
+    };
+
+    struct FileHeader
+    {
+        char magic[8];          // "CSCACHE1"
+        UInt_t version;         // Format version
+        UInt_t n_columns;       // Number of columns
+        ULong64_t n_entries;    // Number of entries
+        UInt_t block_entries;   // Number of entries per block, the last block may be shorter
+        UInt_t n_blocks;        // Number of blocks
+        ULong64_t index_offset; // Position of the chunk index in the file
+        UInt_t n_sources;       // Number of parts in the source table
+        UInt_t reserved;        // Padding, zero
+    };
+
+    struct ChunkRecord
+    {
+        ULong64_t offset;    // Position of the chunk in the file
+        UInt_t stored_bytes; // Size of the chunk in the file
+        ValueType type;      // Type of the stored values
+        Codec codec;         // Compression of the chunk
+        UShort_t reserved;   // Padding, zero
+    };
+
+    // Constructor mapping an existing cache file
+    SortCache(const TString &file_name);
+
+    // Destructor unmapping the file
+    virtual ~SortCache();
+
+    SortCache(const SortCache &) = delete;
+    SortCache &operator=(const SortCache &) = delete;
+
+    // Getters
+
+    const TString &getFileName() const { return file_name_; }
+    const Long64_t getEntries() const { return pheader_->n_entries; }
+    const UInt_t getBlockEntries() const { return pheader_->block_entries; }
+    const UInt_t getBlockNum() const { return pheader_->n_blocks; }
+    const std::vector<Column> &getColumns() const { return columns_; }
+    const std::vector<Source> &getSources() const { return sources_; }
+    const Int_t findColumn(const TString &module_name, const TString &filter) const;
+    const ChunkRecord &getChunk(UInt_t block, UInt_t column) const { return pindex_[ULong64_t(block) * columns_.size() + column]; }
+    const ULong64_t getChunkValueNum(UInt_t block, UInt_t column) const;
+
+    // Methods
+
+    Bool_t matches(const Run *prun) const;
+    const Double_t *readChunk(UInt_t block, UInt_t column, std::vector<Double_t> &buffer, std::vector<char> &scratch) const;
+
+    static void convert(const Run *prun, const ChannelIndex &channel_index, const TString &file_name, UInt_t block_entries = 4096, Codec codec = Codec::kLZ4);
+
+    void printInfo() const;
+
+    // Class consts
+    static const UInt_t VERSION_ = 2; // Current format version
+
+private:
+    void validate();
+
+    TString file_name_;           // Name of the mapped file
+    const char *pdata_;           // Start of the mapping
+    size_t size_;                 // Size of the mapping
+    const FileHeader *pheader_;   // Header at the start of the mapping
+    const ChunkRecord *pindex_;   // Chunk index within the mapping
+    std::vector<Column> columns_; // Columns in file order
+    std::vector<Source> sources_; // Parts of the run at conversion
+};
+
+#endif // SORT_CACHE_HPP
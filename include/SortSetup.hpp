@@ -0,0 +1,51 @@
+#ifndef SORT_SETUP_HPP
+#define SORT_SETUP_HPP
+
+#include <vector>
+#include <TString.h>
+#include "ChannelIndex.hpp"
+#include "HistogramManager.hpp"
+#include "Event.hpp"
+
+// Forward declarations
+class Experiment;
+class Calibration;
+class AddBack;
+class RandomSubtraction;
+class HitFilter;
+class SkimWriter;
+class EventStoreWriter;
+struct RunContext;
+
+// The standard CloverSort sort, shared by the main program and the benchmarks so both measure the same pipeline
+
+// Fill one amplitude spectrum per detector channel, both handle lists are resolved once before sorting
+void fillAmplitudes(Event *pevent, UInt_t slot, const HistogramManager *phist_manager, const std::vector<std::pair<ChannelHandle, HistHandle>> *phandles);
+
+// Build the hit masks and the sparse hit list of the event into its hits product
+void filterHits(Event *pevent, UInt_t slot, const HitFilter *phit_filter, ProductHandle hits_handle);
+
+// Fill the amplitude spectra of the event's hits only, the lookup gives the HistHandle of every ChannelHandle or -1
+void fillHitAmplitudes(Event *pevent, UInt_t slot, const HitFilter *phit_filter, ProductHandle hits_handle, const HistogramManager *phist_manager, const std::vector<Int_t> *phist_lookup);
+
+// Calibrate the event into its calibrated energies product, laid out like Event::getValues()
+void calibrateEvent(Event *pevent, UInt_t slot, const Calibration *pcalibration, ProductHandle energies_handle);
+
+// Add-back every clover from the calibrated energies into the addback product, then fill the add-back spectra, whose handles are consecutive in clover order
+void addBackClovers(Event *pevent, UInt_t slot, ProductHandle energies_handle, ProductHandle addback_handle, const AddBack *paddback, const HistogramManager *phist_manager, HistHandle first_handle, MatrixHandle matrix_handle);
+
+// Fill the prompt minus random spectra from the clover pairs of the event, weighted by their time difference, and
+// count the prompt and random pairs in the subtracted matrix
+void subtractRandoms(Event *pevent, UInt_t slot, ProductHandle addback_handle, const AddBack *paddback, RandomSubtraction *psubtraction, const HistogramManager *phist_manager, HistHandle first_handle, MatrixHandle matrix_handle);
+
+// Write the event and its calibrated energies to the skim if at least min_clovers clovers have an add-back energy
+void skimEvent(Event *pevent, UInt_t slot, ProductHandle energies_handle, ProductHandle addback_handle, const AddBack *paddback, SkimWriter *pskim_writer, UInt_t min_clovers);
+
+// Add the add-back energies of the event's clovers to the event store, which keeps events with enough clovers hit
+void storeEvent(Event *pevent, UInt_t slot, ProductHandle addback_handle, const AddBack *paddback, EventStoreWriter *pstore_writer);
+
+// Build the tasks and histograms of one run, every run gets its own so runs can be sorted concurrently. With
+// static_pipeline the tasks are fused into a single StaticPipeline task, otherwise every task is a separate Task.
+void setupSort(RunContext &context, const Experiment *pexperiment, const ChannelIndex *pchannel_index, Bool_t static_pipeline = kFALSE);
+
+#endif // SORT_SETUP_HPP
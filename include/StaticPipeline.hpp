@@ -0,0 +1,207 @@
+#ifndef STATIC_PIPELINE_HPP
+#define STATIC_PIPELINE_HPP
+
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "ITask.hpp"
+#include "Task.hpp" // detail::FunctionSignatureTraits and detail::IsEventArgsTuple
+
+// Compile time counterpart of a list of Task objects. A StaticPipeline is a tuple of stages, every stage a callable
+// taking (Event *, UInt_t slot, ...) and the values bound to its remaining arguments. The stages are called in order
+// by a fold expression, so the compiler sees the whole per event chain and can inline and fuse it: no std::function,
+// no std::apply over stored tuples per call and no std::optional outputs. Wrapped in a PipelineTask, the whole chain
+// costs TaskManager a single virtual call per event, or per batch. Task and the dynamic TaskManager path stay the way
+// to prototype, a pipeline is for sorts that have settled.
+//
+// Example:
+//   auto pipeline = makePipeline(makeStage(Function<fillAmplitudes>{}, &hist_manager, &handles),
+//                                makeStage([](Event *pevent, UInt_t slot, Calibration *pcalibration) { ... }, &calibration));
+//   task_manager.addTask(new PipelineTask<decltype(pipeline)>("sort", pipeline));
+
+namespace detail
+{
+    // CallableTraits extends FunctionSignatureTraits to function pointers and to lambdas and functors with a single operator()
+    template <typename Callable>
+    struct CallableTraits : CallableTraits<decltype(&Callable::operator())>
+    {
+    };
+
+    template <typename Ret, typename... Args>
+    struct CallableTraits<Ret (*)(Args...)> : FunctionSignatureTraits<Ret(Args...)>
+    {
+    };
+
+    template <typename Class, typename Ret, typename... Args>
+    struct CallableTraits<Ret (Class::*)(Args...)> : FunctionSignatureTraits<Ret(Args...)>
+    {
+    };
+
+    template <typename Class, typename Ret, typename... Args>
+    struct CallableTraits<Ret (Class::*)(Args...) const> : FunctionSignatureTraits<Ret(Args...)>
+    {
+    };
+}
+
+// A free function as a compile time constant, so that calls through it are direct calls the compiler can inline
+template <auto Func>
+struct Function
+{
+    template <typename... Args>
+    decltype(auto) operator()(Args &&...args) const { return Func(std::forward<Args>(args)...); }
+};
+
+namespace detail
+{
+    template <auto Func>
+    struct CallableTraits<Function<Func>> : CallableTraits<decltype(Func)>
+    {
+    };
+}
+
+// One stage of a StaticPipeline, the callable with every argument after (Event *, UInt_t) bound
+template <typename Callable, typename... Bound>
+class PipelineStage
+{
+public:
+    using ArgsTuple = typename detail::CallableTraits<Callable>::ArgsTuple;
+
+    static_assert(detail::IsEventArgsTuple<ArgsTuple>::value, "Pipeline stages take (Event *, UInt_t) as their first arguments");
+    static_assert(std::tuple_size_v<ArgsTuple> == sizeof...(Bound) + 2, "Every argument after (Event *, UInt_t) has to be bound");
+
+    // Constructor
+    PipelineStage(Callable callable, Bound... bound) : callable_(std::move(callable)), bound_(std::move(bound)...) {}
+
+    // Getters
+
+    const std::tuple<Bound...> &getBoundArguments() const { return bound_; }
+
+    // Methods
+
+    void operator()(Event *pevent, UInt_t slot) { call(pevent, slot, std::index_sequence_for<Bound...>{}); }
+
+private:
+    template <std::size_t... Is>
+    void call(Event *pevent, UInt_t slot, std::index_sequence<Is...>)
+    {
+        callable_(pevent, slot, std::get<Is>(bound_)...);
+    }
+
+    Callable callable_;          // Stage function
+    std::tuple<Bound...> bound_; // Arguments after (Event *, UInt_t)
+};
+
+template <typename Callable, typename... Bound>
+PipelineStage<Callable, std::decay_t<Bound>...> makeStage(Callable callable, Bound &&...bound)
+{
+    return PipelineStage<Callable, std::decay_t<Bound>...>(std::move(callable), std::forward<Bound>(bound)...);
+}
+
+// Stages called in order for every event
+template <typename... Stages>
+class StaticPipeline
+{
+public:
+    // Constructor
+    StaticPipeline(Stages... stages) : stages_(std::move(stages)...) {}
+
+    // Getters
+
+    static constexpr size_t getStageNum() { return sizeof...(Stages); }
+
+    // Methods
+
+    void operator()(Event *pevent, UInt_t slot)
+    {
+        std::apply([pevent, slot](auto &...stage)
+                   { (stage(pevent, slot), ...); },
+                   stages_);
+    }
+
+    // The whole chain runs on one event before the next, so the event stays in cache between the stages
+    void processBatch(Event *const *events, UInt_t n_events, UInt_t slot)
+    {
+        for (UInt_t i = 0; i < n_events; ++i)
+        {
+            (*this)(events[i], slot);
+        }
+    }
+
+private:
+    std::tuple<Stages...> stages_; // Stages in execution order
+};
+
+template <typename... Stages>
+StaticPipeline<Stages...> makePipeline(Stages... stages)
+{
+    return StaticPipeline<Stages...>(std::move(stages)...);
+}
+
+// A StaticPipeline as a single task of a TaskManager
+template <typename Pipeline>
+class PipelineTask final : public ITask
+{
+public:
+    // Per slot hooks used by the event loop
+    using SlotInitializeFuncStd = std::function<void(UInt_t)>;
+    using SlotMergeFuncStd = std::function<void()>;
+    using FinalizeFuncStd = std::function<void()>;
+
+    // Constructor
+    PipelineTask(TString name, Pipeline pipeline) : name_(std::move(name)), pipeline_(std::move(pipeline)) {}
+
+    // Getters
+
+    const TString &getName() const override { return name_; }
+    const std::vector<TString> &getInputs() const override { return inputs_; }
+    const std::vector<TString> &getOutputs() const override { return outputs_; }
+    const std::vector<TString> &getBranches() const override { return branches_; }
+    Pipeline &getPipeline() { return pipeline_; }
+
+    // Setters
+
+    void setName(const TString &name) { name_ = name; }
+    void setInputs(std::vector<TString> inputs) { inputs_ = std::move(inputs); }
+    void setOutputs(std::vector<TString> outputs) { outputs_ = std::move(outputs); }
+    void setBranches(std::vector<TString> branches) { branches_ = std::move(branches); }
+    void setSlotInitializeFunction(SlotInitializeFuncStd func) { slot_initialize_func_ = std::move(func); }
+    void setSlotMergeFunction(SlotMergeFuncStd func) { slot_merge_func_ = std::move(func); }
+    void setFinalizeFunction(FinalizeFuncStd func) { finalize_func_ = std::move(func); }
+
+    // Methods
+
+    void callInitialize() override {}
+    void callExecute() override {}
+    void callFinalize() override
+    {
+        if (finalize_func_)
+            finalize_func_();
+    }
+
+    void callInitializeSlots(UInt_t n_slots) override
+    {
+        if (slot_initialize_func_)
+            slot_initialize_func_(n_slots);
+    }
+    void callExecute(Event *pevent, UInt_t slot) override { pipeline_(pevent, slot); }
+    void callExecuteBatch(Event *const *events, UInt_t n_events, UInt_t slot) override { pipeline_.processBatch(events, n_events, slot); }
+    void callMergeSlots() override
+    {
+        if (slot_merge_func_)
+            slot_merge_func_();
+    }
+
+private:
+    TString name_;                               // Name of the task
+    std::vector<TString> inputs_;                // Products the pipeline reads
+    std::vector<TString> outputs_;               // Products the pipeline writes
+    std::vector<TString> branches_ = {"*"};      // Branches the stages read
+    Pipeline pipeline_;                          // Fused stages
+    SlotInitializeFuncStd slot_initialize_func_; // Sets up the per slot state of the stages
+    SlotMergeFuncStd slot_merge_func_;           // Merges the per slot state of the stages
+    FinalizeFuncStd finalize_func_;              // Called once after the event loop
+};
+
+#endif // STATIC_PIPELINE_HPP
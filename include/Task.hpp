@@ -23,6 +23,17 @@ namespace detail
         using ArgsTuple = std::tuple<Args...>;
         using ReturnType = Ret;
     };
+
+    // IsEventArgsTuple is true for argument tuples starting with (Event *, UInt_t), i.e. tasks that are executed per entry
+    template <typename ArgsTuple>
+    struct IsEventArgsTuple : std::false_type
+    {
+    };
+
+    template <typename... Rest>
+    struct IsEventArgsTuple<std::tuple<Event *, UInt_t, Rest...>> : std::true_type
+    {
+    };
 }
 
 // Helper struct for void return types in std::conditional_t
@@ -39,6 +50,10 @@ public:
     using ExecuteFuncStd = std::function<ExecFuncSignature>;
     using FinalizeFuncStd = std::function<FinalFuncSignature>;
 
+    // Per slot hooks used by the event loop
+    using SlotInitializeFuncStd = std::function<void(UInt_t)>;
+    using SlotMergeFuncStd = std::function<void()>;
+
     // Argument tuple types derived from signatures
     using InitializeArgsTuple = typename detail::FunctionSignatureTraits<InitFuncSignature>::ArgsTuple;
     using ExecuteArgsTuple = typename detail::FunctionSignatureTraits<ExecFuncSignature>::ArgsTuple;
@@ -68,10 +83,15 @@ public:
     // Getters
 
     const TString &getName() const { return name_; }
+    const std::vector<TString> &getInputs() const { return inputs_; }
+    const std::vector<TString> &getOutputs() const { return outputs_; }
+    const std::vector<TString> &getBranches() const { return branches_; }
 
     const InitializeFuncStd &getInitializeFunction() const { return initialize_func_; }
     const ExecuteFuncStd &getExecuteFunction() const { return execute_func_; }
     const FinalizeFuncStd &getFinalizeFunction() const { return finalize_func_; }
+    const SlotInitializeFuncStd &getSlotInitializeFunction() const { return slot_initialize_func_; }
+    const SlotMergeFuncStd &getSlotMergeFunction() const { return slot_merge_func_; }
 
     const InitializeArgsTuple &getInitializeArguments() const { return initialize_args_; }
     const ExecuteArgsTuple &getExecuteArguments() const { return execute_args_; }
@@ -101,10 +121,15 @@ public:
     // Setters
 
     void setName(const TString &name) { name_ = name; }
+    void setInputs(std::vector<TString> inputs) { inputs_ = std::move(inputs); }
+    void setOutputs(std::vector<TString> outputs) { outputs_ = std::move(outputs); }
+    void setBranches(std::vector<TString> branches) { branches_ = std::move(branches); }
 
     void setInitializeFunction(InitializeFuncStd func) { initialize_func_ = std::move(func); }
     void setExecuteFunction(ExecuteFuncStd func) { execute_func_ = std::move(func); }
     void setFinalizeFunction(FinalizeFuncStd func) { finalize_func_ = std::move(func); }
+    void setSlotInitializeFunction(SlotInitializeFuncStd func) { slot_initialize_func_ = std::move(func); }
+    void setSlotMergeFunction(SlotMergeFuncStd func) { slot_merge_func_ = std::move(func); }
 
     void setInitializeArguments(InitializeArgsTuple args) { initialize_args_ = std::move(args); }
     void setExecuteArguments(ExecuteArgsTuple args) { execute_args_ = std::move(args); }
@@ -143,6 +168,36 @@ public:
         }
     }
 
+    // Per entry caller used by TaskManager::processRun(). If the execute signature starts with (Event *, UInt_t),
+    // the current event and slot replace the first two stored arguments. The output is not stored, since several
+    // slots may be executing the task at the same time.
+    void callExecute(Event *pevent, UInt_t slot)
+    {
+        if (!execute_func_)
+            throw std::runtime_error("Execute function not set");
+
+        if constexpr (detail::IsEventArgsTuple<ExecuteArgsTuple>::value)
+        {
+            callExecuteWithEvent(pevent, slot, std::make_index_sequence<std::tuple_size_v<ExecuteArgsTuple> - 2>{});
+        }
+        else
+        {
+            std::apply(execute_func_, execute_args_);
+        }
+    }
+
+    void callInitializeSlots(UInt_t n_slots)
+    {
+        if (slot_initialize_func_)
+            slot_initialize_func_(n_slots);
+    }
+
+    void callMergeSlots()
+    {
+        if (slot_merge_func_)
+            slot_merge_func_();
+    }
+
     void callFinalize()
     {
         if (!finalize_func_)
@@ -160,12 +215,17 @@ public:
     }
 
 protected:
-    TString name_; // Optional: name of the task, can be used for identification
+    TString name_;                          // Optional: name of the task, can be used for identification
+    std::vector<TString> inputs_;           // Products the task reads, see TaskManager::buildGraph()
+    std::vector<TString> outputs_;          // Products the task writes
+    std::vector<TString> branches_ = {"*"}; // Branches the task reads, see TaskManager::selectColumns()
 
     // Stored functions
     InitializeFuncStd initialize_func_;
     ExecuteFuncStd execute_func_;
     FinalizeFuncStd finalize_func_;
+    SlotInitializeFuncStd slot_initialize_func_;
+    SlotMergeFuncStd slot_merge_func_;
 
     // Stored arguments
     InitializeArgsTuple initialize_args_;
@@ -176,6 +236,13 @@ protected:
     InitializeOutputStorage initialize_output_;
     ExecuteOutputStorage execute_output_;
     FinalizeOutputStorage finalize_output_;
+
+private:
+    template <std::size_t... Is>
+    void callExecuteWithEvent(Event *pevent, UInt_t slot, std::index_sequence<Is...>)
+    {
+        execute_func_(pevent, slot, std::get<Is + 2>(execute_args_)...);
+    }
 };
 
 #endif // TASK_HPP
\ No newline at end of file
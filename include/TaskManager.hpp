@@ -1,14 +1,47 @@
 #ifndef TASK_MANAGER_HPP
 #define TASK_MANAGER_HPP
 
+#include <functional>
+#include <memory>
+#include <utility>
 #include <vector>
+#include <TString.h>
+#include "Event.hpp"
 
 // Forward declarations
 class ITask;
+class ChannelIndex;
+class Run;
+class TTreeReader;
+class HistogramManager;
+class SortCache;
+class EventBuilder;
+class TaskProfiler;
+class Checkpointer;
+class TFile;
+class TTree;
+class TChain;
 
+// Runs the tasks of a sort for every entry. Tasks declare the per event products they read and write
+// (ITask::getInputs(), getOutputs()), and buildGraph() orders them into a dependency graph: a task runs after every
+// task writing one of its inputs, and tasks writing the same product run in the order they were added. Tasks without
+// declarations keep the order they were added in. With a task batch size, entries are processed in batches and the
+// tasks of one level of the graph, which do not depend on each other, run concurrently over the whole batch on the
+// ROOT thread pool. Products are then passed through Event::getProduct(), since every event of a batch has its own,
+// and buildGraph() rejects outputs whose handle was not resolved with getProductHandle() before the task was added.
+// A profiled batch holding a sampled entry times every task over the whole batch, recorded as the time per entry.
+// With a checkpointer, processRun() sorts the clusters of the run in epochs and checkpoints between them. Only the
+// branches the tasks declare (ITask::getBranches()) are read, see selectColumns(). With prefetch threads, clusters
+// are read and decompressed by dedicated I/O threads ahead of the workers, see processPrefetched().
 class TaskManager
 {
 public:
+    // Called by followRun() with the number of entries sorted so far, once the histograms are merged into slot 0
+    using PublishFunc = std::function<void(Long64_t)>;
+
+    // Entry ranges [first, second) of a tree
+    using EntryRanges = std::vector<std::pair<Long64_t, Long64_t>>;
+
     // Default constructor
     TaskManager();
 
@@ -18,16 +51,83 @@ public:
     // Getters
 
     const std::vector<ITask *> &getTasks() const { return tasks_; }
+    const std::vector<ITask *> &getOrderedTasks() const { return ordered_tasks_; }
+    const std::vector<std::vector<ITask *>> &getTaskLevels() const { return task_levels_; }
+    const std::vector<TString> &getProducts() const { return products_; }
+    const UInt_t getTaskBatchSize() const { return task_batch_size_; }
+    const std::vector<UChar_t> &getActiveColumns() const { return active_columns_; }
+    const UInt_t getPrefetchThreads() const { return prefetch_threads_; }
+    const UInt_t getPrefetchDepth() const { return prefetch_depth_; }
+    const Bool_t isBatched() const { return task_batch_size_ > 1 && has_parallel_levels_; }
+    HistogramManager *getHistogramManager() const { return phist_manager_; }
+    TaskProfiler *getProfiler() const { return pprofiler_; }
+    Checkpointer *getCheckpointer() const { return pcheckpointer_; }
+
+    // Setters
+
+    void setHistogramManager(HistogramManager *phist_manager) { phist_manager_ = phist_manager; }
+    void setProfiler(TaskProfiler *pprofiler) { pprofiler_ = pprofiler; }
+    void setCheckpointer(Checkpointer *pcheckpointer) { pcheckpointer_ = pcheckpointer; }
+    void setTaskBatchSize(UInt_t task_batch_size) { task_batch_size_ = task_batch_size; }
+    void setPrefetchThreads(UInt_t prefetch_threads) { prefetch_threads_ = prefetch_threads; }
+    void setPrefetchDepth(UInt_t prefetch_depth) { prefetch_depth_ = std::max<UInt_t>(1, prefetch_depth); }
+
+    // Methods
 
     virtual void initializeTasks();
     virtual void executeTasks();
     virtual void finalizeTasks();
 
+    virtual void initializeSlots(UInt_t n_slots);
+    virtual void executeTasks(Event *pevent, UInt_t slot);
+    virtual void mergeSlots();
+
+    virtual void executeBatch(Event *const *events, UInt_t n_events, UInt_t slot);
+
     virtual void addTask(ITask *task);
     virtual void removeTask(const TString &name);
 
+    virtual void buildGraph();
+    ProductHandle getProductHandle(const TString &name);
+    void printGraph() const;
+    void selectColumns(const ChannelIndex &channel_index, const Run *prun = nullptr);
+
+    // Event loop
+
+    virtual Long64_t processRun(const Run *prun, const ChannelIndex &channel_index, UInt_t n_threads = 0);
+    virtual Long64_t processCache(const Run *prun, const SortCache &cache, const ChannelIndex &channel_index, UInt_t n_threads = 0);
+    virtual Long64_t processBuiltEvents(const Run *prun, EventBuilder &builder, UInt_t n_threads = 0);
+    virtual Long64_t followRun(const Run *prun, const ChannelIndex &channel_index, const PublishFunc &publish, Double_t publish_interval, Double_t idle_timeout, UInt_t n_threads = 0);
+
+    // Class consts
+    static const UInt_t BUILT_BATCH_EVENTS_ = 256;      // Number of built events handed to a worker at once
+    static const UInt_t FOLLOW_POLL_MS_ = 500;          // Milliseconds between looks for new entries in follow mode
+    static const UInt_t PREFETCH_BLOCK_ENTRIES_ = 1024; // Number of prefetched entries handed to a worker at once
+
 protected:
-    std::vector<ITask *> tasks_; // List of tasks to manage
+    Long64_t processEntries(TTreeReader &tree_reader, const ChannelIndex &channel_index, UInt_t slot);
+    Long64_t processBlock(const SortCache &cache, UInt_t block, const ChannelIndex &channel_index, UInt_t slot);
+    Long64_t processRanges(const std::vector<TTree *> &trees, const EntryRanges &ranges, const ChannelIndex &channel_index, Bool_t parallel);
+    Long64_t processCheckpointed(const Run *prun, const ChannelIndex &channel_index, UInt_t n_threads);
+    Long64_t processPrefetched(const Run *prun, const ChannelIndex &channel_index, UInt_t n_threads);
+    std::vector<TTree *> openSlotTrees(const Run *prun, UInt_t n_slots, std::vector<std::unique_ptr<TFile>> &files) const;
+    std::vector<TTree *> openSlotChains(const Run *prun, UInt_t n_slots, std::vector<std::unique_ptr<TChain>> &chains) const;
+    void startProfile(const Run *prun, UInt_t n_slots, Long64_t n_expected_entries);
+    void warnIgnoredPrefetch(const TString &sort_path) const;
+    void finishSlots();
+
+    std::vector<ITask *> tasks_;                    // List of tasks to manage, in the order they were added
+    std::vector<ITask *> ordered_tasks_;            // Tasks in dependency order, as executed for a single entry
+    std::vector<std::vector<ITask *>> task_levels_; // Tasks by level of the graph, tasks of a level are independent
+    Bool_t has_parallel_levels_ = false;            // Some level holds more than one task
+    std::vector<TString> products_;                 // Names of the products, indexed by ProductHandle
+    UInt_t task_batch_size_ = 0;                    // Entries per batch if independent tasks run concurrently, 0 for none
+    std::vector<UChar_t> active_columns_;           // Channel index columns some task reads, empty if all of them
+    UInt_t prefetch_threads_ = 0;                   // I/O threads reading ahead of the workers in processRun(), 0 for none
+    UInt_t prefetch_depth_ = 16;                    // Blocks of entries the I/O threads may read ahead
+    HistogramManager *phist_manager_ = nullptr;     // Histograms filled by the tasks, slots are set up and merged around the event loop
+    TaskProfiler *pprofiler_ = nullptr;             // Instrumentation of the event loop, none if null
+    Checkpointer *pcheckpointer_ = nullptr;         // Checkpoints of processRun(), none if null
 };
 
-#endif // TASK_MANAGER_HPP
\ No newline at end of file
+#endif // TASK_MANAGER_HPP
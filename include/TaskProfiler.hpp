@@ -0,0 +1,136 @@
+#ifndef TASK_PROFILER_HPP
+#define TASK_PROFILER_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <TString.h>
+
+// Forward declarations
+class ITask;
+
+// Low overhead instrumentation of the event loop of TaskManager. Every slot counts its entries in its own cache line,
+// so counting takes no lock and no atomic read-modify-write. Every getSampleInterval()-th entry of a slot is sampled:
+// the time to read it (TTree reading and basket decompression, which TTreeReader does lazily on first access) and
+// the time of every task are measured and added to per slot, per task latency histograms with power of two bins.
+// Cumulative times are estimated from the sampled calls. A monitor thread prints the progress of the run with an
+// ETA every getProgressInterval() seconds, unless the interval is 0 and the caller prints printProgress() itself, as
+// RunScheduler does for the runs it sorts concurrently. The summary can be written as JSON or CSV at the end of the run.
+// The bytes read are added by the event loop from the ROOT files of the run's own readers (see ReadCounter), so runs
+// profiled at the same time do not count each other's reads. A memory mapped sort cache is not counted.
+class TaskProfiler
+{
+public:
+    // Class consts
+    static const UInt_t LATENCY_BINS_ = 40; // Number of latency histogram bins, the last one counts everything above 2^38 ns
+
+    // Per task results, summed over all slots
+    struct TaskSummary
+    {
+        TString name;                                 // Name of the task, "read" for entry reading
+        ULong64_t n_calls;                            // Number of calls
+        ULong64_t n_sampled;                          // Number of timed calls
+        Double_t sampled_ns;                          // Total time of the timed calls
+        std::array<ULong64_t, LATENCY_BINS_> latency; // Timed calls by latency, bin b counts latencies in [2^(b-1), 2^b) ns
+
+        Double_t getMeanNs() const { return n_sampled ? sampled_ns / n_sampled : 0.; }
+        Double_t getEstimatedSeconds() const { return getMeanNs() * n_calls * 1e-9; }
+        Double_t getQuantileNs(Double_t quantile) const;
+    };
+
+    // Constructor, a sample interval of 0 turns timing off and only counts entries
+    TaskProfiler(UInt_t sample_interval = 1024, Double_t progress_interval = 10.);
+
+    // Destructor stopping the monitor thread
+    virtual ~TaskProfiler();
+
+    TaskProfiler(const TaskProfiler &) = delete;
+    TaskProfiler &operator=(const TaskProfiler &) = delete;
+
+    // Getters
+
+    const UInt_t getSampleInterval() const { return sample_interval_; }
+    const Double_t getProgressInterval() const { return progress_interval_; }
+    const Long64_t getEntries() const;
+    const Double_t getElapsedSeconds() const;
+    const Double_t getMergeSeconds() const { return merge_seconds_; }
+    const Long64_t getBytesRead() const { return bytes_read_.load(std::memory_order_relaxed); }
+    const Bool_t isRunning() const;
+    std::vector<TaskSummary> getSummaries() const;
+
+    // Setters
+
+    void setSampleInterval(UInt_t sample_interval) { sample_interval_ = sample_interval; }
+    void setProgressInterval(Double_t progress_interval) { progress_interval_ = progress_interval; }
+    void setMergeSeconds(Double_t merge_seconds) { merge_seconds_ = merge_seconds; }
+
+    // Methods
+
+    void start(const TString &label, const std::vector<ITask *> &tasks, UInt_t n_slots, Long64_t n_expected_entries);
+    void stop();
+
+    // Event loop hooks, called by the worker holding the slot
+
+    Bool_t isSampleDue(UInt_t slot) const { return sample_interval_ && slots_[slot].countdown == 1; }
+    Bool_t countEntry(UInt_t slot)
+    {
+        // Returns whether the entry is sampled
+        SlotCounters &counters = slots_[slot];
+        counters.n_entries.store(counters.n_entries.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (sample_interval_ && --counters.countdown == 0)
+        {
+            counters.countdown = sample_interval_;
+            return kTRUE;
+        }
+        return kFALSE;
+    }
+    void recordRead(UInt_t slot, ULong64_t ns) { record(slots_[slot].read, ns); }
+    void recordTask(UInt_t slot, UInt_t task, ULong64_t ns) { record(slots_[slot].tasks[task], ns); }
+    void addBytesRead(Long64_t bytes) { bytes_read_.fetch_add(bytes, std::memory_order_relaxed); }
+
+    void printProgress() const;
+    void printSummary() const;
+    void writeSummary(const TString &file_name) const;
+
+private:
+    struct TimingCounters
+    {
+        ULong64_t n_sampled = 0;                        // Number of timed calls
+        ULong64_t sampled_ns = 0;                       // Total time of the timed calls
+        std::array<ULong64_t, LATENCY_BINS_> latency{}; // Timed calls by latency
+    };
+
+    struct alignas(64) SlotCounters
+    {
+        std::atomic<Long64_t> n_entries{0}; // Entries processed by the slot, read by the monitor thread
+        UInt_t countdown = 1;               // Entries until the next sample
+        TimingCounters read;                // Timing of entry reading
+        std::vector<TimingCounters> tasks;  // Timing of every task
+    };
+
+    static void record(TimingCounters &counters, ULong64_t ns);
+    void monitor();
+
+    UInt_t sample_interval_;                           // Every n-th entry of a slot is timed, 0 for none
+    Double_t progress_interval_;                       // Seconds between progress lines, 0 for none
+    TString label_;                                    // Prefix of the progress lines, e.g. "Run 12"
+    std::vector<TString> task_names_;                  // Names of the profiled tasks in execution order
+    std::unique_ptr<SlotCounters[]> slots_;            // Counters of every slot
+    UInt_t n_slots_;                                   // Number of slots
+    Long64_t n_expected_entries_;                      // Entries the run is expected to have, for the ETA
+    std::chrono::steady_clock::time_point start_time_; // Start of the event loop
+    std::chrono::steady_clock::time_point stop_time_;  // End of the event loop
+    Bool_t running_;                                   // Event loop running
+    std::atomic<Long64_t> bytes_read_;                 // Bytes read from ROOT files by the run's own readers
+    Double_t merge_seconds_;                           // Time to merge the slots
+    std::thread monitor_thread_;                       // Prints the progress lines
+    mutable std::mutex monitor_mutex_;                 // Guards running_ for the monitor thread
+    std::condition_variable monitor_condition_;        // Wakes the monitor thread up when the loop stops
+};
+
+#endif // TASK_PROFILER_HPP
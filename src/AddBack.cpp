@@ -0,0 +1,128 @@
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include "AddBack.hpp"
+#include "DAQModule.hpp"
+#include "Detector.hpp"
+#include "Event.hpp"
+
+AddBack::AddBack(const ChannelIndex &channel_index, Double_t window, AddBackMode mode,
+                 const TString &energy_filter, const TString &time_filter, Double_t threshold)
+    : clovers_(), window_(window), mode_(mode), threshold_(threshold)
+{
+    for (DAQModule *pmodule : channel_index.getDAQModules())
+    {
+        for (const Detector *pdetector : *pmodule->getDetectors())
+        {
+            if (pdetector->getType() != "CloverHPGE")
+                continue;
+
+            const std::vector<Int_t> &channels = *pdetector->getChannels();
+            if (channels.size() != CRYSTAL_NUM_)
+            {
+                std::cerr << "CloverSort [WARN]: Clover " << pdetector->getName() << " has " << channels.size() << " channels instead of " << CRYSTAL_NUM_ << ", skipping it for add-back" << std::endl;
+                continue;
+            }
+
+            Clover clover{pdetector, {}, {}};
+            for (UInt_t i = 0; i < CRYSTAL_NUM_; ++i)
+            {
+                clover.energies[i] = channel_index.getHandle(pmodule, energy_filter, channels[i]);
+                clover.times[i] = channel_index.getHandle(pmodule, time_filter, channels[i]);
+            }
+            clovers_.push_back(clover);
+        }
+    }
+}
+
+AddBack::~AddBack()
+{
+}
+
+const Int_t AddBack::findClover(const TString &detector_name) const
+{
+    for (size_t i = 0; i < clovers_.size(); ++i)
+    {
+        if (clovers_[i].pdetector->getName() == detector_name)
+        {
+            return i;
+        }
+    }
+    return -1; // Return -1 if the clover is not found
+}
+
+void AddBack::process(const Event *pevent, Double_t *addback_product) const
+{
+    process(pevent->getValues().data(), pevent->getValues().data(), addback_product);
+}
+
+void AddBack::process(const Double_t *energy_values, const Double_t *time_values, Double_t *addback_product) const
+{
+    // Both arrays are in the layout of Event::getValues(), e.g. calibrated energies and raw times. addback_product
+    // holds getProductSize() values.
+    const size_t n_clovers = clovers_.size();
+    Double_t *energies = addback_product;
+    Double_t *times = addback_product + n_clovers;
+    Double_t *multiplicities = addback_product + 2 * n_clovers;
+
+    for (size_t i = 0; i < n_clovers; ++i)
+    {
+        // Gather the crystals into contiguous lanes, the channels of a clover need not be contiguous in the event
+        Double_t crystal_energies[CRYSTAL_NUM_];
+        Double_t crystal_times[CRYSTAL_NUM_];
+        for (UInt_t j = 0; j < CRYSTAL_NUM_; ++j)
+        {
+            crystal_energies[j] = energy_values[clovers_[i].energies[j]];
+            crystal_times[j] = time_values[clovers_[i].times[j]];
+        }
+        multiplicities[i] = addBack(crystal_energies, crystal_times, window_, threshold_, mode_, energies[i], times[i]);
+    }
+}
+
+Int_t AddBack::addBack(const Double_t *energies, const Double_t *times, Double_t window, Double_t threshold, AddBackMode mode, Double_t &energy, Double_t &time)
+{
+    // All loops run over the fixed 4 crystals and use selects instead of branches, so they unroll and vectorize.
+    // Unhit crystals are NaN, which fails every comparison and therefore drops out without an explicit check.
+    Bool_t valid[CRYSTAL_NUM_];
+    for (UInt_t i = 0; i < CRYSTAL_NUM_; ++i)
+    {
+        valid[i] = energies[i] > threshold;
+    }
+
+    // Reference crystal is the one of highest energy
+    Double_t max_energy = -std::numeric_limits<Double_t>::infinity();
+    UInt_t max_crystal = 0;
+    for (UInt_t i = 0; i < CRYSTAL_NUM_; ++i)
+    {
+        const Bool_t higher = valid[i] & (energies[i] > max_energy);
+        max_energy = higher ? energies[i] : max_energy;
+        max_crystal = higher ? i : max_crystal;
+    }
+    const Double_t reference_time = times[max_crystal];
+    const Bool_t neighbours_only = mode == AddBackMode::kNeighbours;
+
+    Double_t sum = 0.;
+    Int_t multiplicity = 0;
+    for (UInt_t i = 0; i < CRYSTAL_NUM_; ++i)
+    {
+        const Bool_t diagonal = ((i - max_crystal) & (CRYSTAL_NUM_ - 1)) == 2;
+        const Bool_t summed = valid[i] & (std::fabs(times[i] - reference_time) <= window) & !(neighbours_only & diagonal);
+        sum += summed ? energies[i] : 0.;
+        multiplicity += summed;
+    }
+
+    energy = multiplicity > 0 ? sum : std::numeric_limits<Double_t>::quiet_NaN();
+    time = multiplicity > 0 ? reference_time : std::numeric_limits<Double_t>::quiet_NaN();
+    return multiplicity;
+}
+
+void AddBack::printInfo() const
+{
+    std::cout << Form("AddBack (%s) [window %g, threshold %g]", mode_ == AddBackMode::kNeighbours ? "neighbours" : "all crystals", window_, threshold_) << std::endl;
+    for (const Clover &clover : clovers_)
+    {
+        std::cout << "    ";
+        clover.pdetector->printInfo();
+    }
+}
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "Calibration.hpp"
+#include "DAQModule.hpp"
+#include "Event.hpp"
+#include "Experiment.hpp"
+
+Calibration::Calibration(const ChannelIndex &channel_index)
+    : channel_index_(channel_index), column_lookup_(channel_index.getColumns().size(), -1), columns_(), lookup_tables_(), slot_values_()
+{
+}
+
+Calibration::Calibration(const ChannelIndex &channel_index, const TString &file_name, Int_t run_number)
+    : Calibration(channel_index)
+{
+    load(file_name, run_number);
+}
+
+Calibration::~Calibration()
+{
+}
+
+void Calibration::setPolynomial(const DAQModule *pmodule, const TString &filter, Int_t channel, const std::vector<Double_t> &coefficients)
+{
+    if (coefficients.empty())
+    {
+        throw std::invalid_argument(Form("No coefficients given for channel %i of module %s", channel, pmodule->getName().Data()));
+    }
+
+    Column &column = getColumn(pmodule, filter);
+    const ChannelHandle handle = channel_index_.getHandle(pmodule, filter, channel);
+    const UInt_t index = handle - column.offset;
+
+    // Raise the order of the whole column if needed, the new coefficients of the other channels are zero
+    const UInt_t order = coefficients.size() - 1;
+    if (order > column.order)
+    {
+        column.coefficients.resize((order + 1) * column.width, 0.);
+        column.order = order;
+    }
+    for (UInt_t k = 0; k <= column.order; ++k)
+    {
+        column.coefficients[k * column.width + index] = k < coefficients.size() ? coefficients[k] : 0.;
+    }
+
+    // A polynomial replaces an earlier lookup table of the channel
+    lookup_tables_.erase(std::remove_if(lookup_tables_.begin(), lookup_tables_.end(),
+                                        [handle](const LookupTable &table)
+                                        { return table.handle == handle; }),
+                         lookup_tables_.end());
+}
+
+void Calibration::setLookupTable(const DAQModule *pmodule, const TString &filter, Int_t channel, const std::vector<Double_t> &x, const std::vector<Double_t> &y)
+{
+    if (x.size() < 2 || x.size() != y.size() || !std::is_sorted(x.begin(), x.end()))
+    {
+        throw std::invalid_argument(Form("Lookup table of channel %i of module %s needs at least 2 points with ascending x", channel, pmodule->getName().Data()));
+    }
+
+    getColumn(pmodule, filter);
+    const ChannelHandle handle = channel_index_.getHandle(pmodule, filter, channel);
+    auto it = std::find_if(lookup_tables_.begin(), lookup_tables_.end(),
+                           [handle](const LookupTable &table)
+                           { return table.handle == handle; });
+    if (it != lookup_tables_.end())
+    {
+        it->x = x;
+        it->y = y;
+    }
+    else
+    {
+        lookup_tables_.push_back({handle, x, y});
+    }
+}
+
+void Calibration::addColumn(const DAQModule *pmodule, const TString &filter)
+{
+    // Calibrate a column even without entries, its channels then pass their raw value through
+    getColumn(pmodule, filter);
+}
+
+void Calibration::load(const TString &file_name, Int_t run_number)
+{
+    std::ifstream calibration_file(file_name.Data());
+    if (!calibration_file.is_open())
+    {
+        throw std::runtime_error(std::string("Could not open calibration file: ") + file_name.Data());
+    }
+
+    std::string line;
+    while (std::getline(calibration_file, line))
+    {
+        // Skip empty lines and comments
+        Size_t line_start = line.find_first_not_of(" \t");
+        if (line_start == std::string::npos || line[line_start] == '#')
+            continue;
+
+        // Format: run_numbers    module_name    filter    channels    type    values...
+        std::istringstream iss(line);
+        std::string run_numbers, module_name, filter, channels, type;
+        if (!(iss >> run_numbers >> module_name >> filter >> channels >> type))
+            continue;
+
+        if (run_numbers != "*")
+        {
+            std::vector<Int_t> run_numbers_parsed = parseNumberString(run_numbers);
+            if (std::find(run_numbers_parsed.begin(), run_numbers_parsed.end(), run_number) == run_numbers_parsed.end())
+                continue;
+        }
+
+        const std::vector<DAQModule *> &daq_modules = channel_index_.getDAQModules();
+        auto module_it = std::find_if(daq_modules.begin(), daq_modules.end(),
+                                      [&](const DAQModule *pmodule)
+                                      { return pmodule->getName() == module_name; });
+        if (module_it == daq_modules.end())
+        {
+            throw std::runtime_error("Calibration file " + std::string(file_name.Data()) + " refers to unknown module: " + module_name);
+        }
+
+        std::vector<Double_t> values;
+        Double_t value;
+        while (iss >> value)
+        {
+            values.push_back(value);
+        }
+
+        for (Int_t channel : parseNumberString(channels))
+        {
+            if (type == "poly")
+            {
+                setPolynomial(*module_it, filter, channel, values);
+            }
+            else if (type == "lut")
+            {
+                std::vector<Double_t> x, y;
+                for (size_t i = 0; i + 1 < values.size(); i += 2)
+                {
+                    x.push_back(values[i]);
+                    y.push_back(values[i + 1]);
+                }
+                setLookupTable(*module_it, filter, channel, x, y);
+            }
+            else
+            {
+                throw std::runtime_error("Unsupported calibration type: " + type);
+            }
+        }
+    }
+
+    std::cout << "CloverSort [INFO]: Loaded calibration of run " << run_number << " from " << file_name << ", " << columns_.size() << " column(s) and " << lookup_tables_.size() << " lookup table(s)" << std::endl;
+}
+
+void Calibration::initializeSlots(UInt_t n_slots)
+{
+    // Values of uncalibrated columns stay NaN
+    slot_values_.assign(n_slots, std::vector<Double_t>(channel_index_.getSize(), std::numeric_limits<Double_t>::quiet_NaN()));
+}
+
+void Calibration::process(const Event *pevent, UInt_t slot)
+{
+    process(pevent, slot_values_[slot].data());
+}
+
+void Calibration::process(const Event *pevent, Double_t *calibrated) const
+{
+    // Only calibrated columns are written, the rest of calibrated keeps its values, e.g. NaN from Event::getProduct()
+    const Double_t *raw = pevent->getValues().data();
+    for (const Column &column : columns_)
+    {
+        // Columns as wide as a module type are calibrated with the channel loop unrolled
+        const Bool_t unrolled = visitChannelNum(column.width, [&](auto channel_num)
+                                                { applyPolynomial(ColumnView<channel_num>(raw + column.offset), calibrated + column.offset, column.coefficients.data(), column.order); });
+        if (!unrolled)
+        {
+            applyPolynomial(raw + column.offset, calibrated + column.offset, column.coefficients.data(), column.order, column.width);
+        }
+    }
+    for (const LookupTable &table : lookup_tables_)
+    {
+        calibrated[table.handle] = applyLookupTable(raw[table.handle], table);
+    }
+}
+
+void Calibration::applyPolynomial(const Double_t *raw, Double_t *calibrated, const Double_t *coefficients, UInt_t order, UInt_t width)
+{
+    // Horner's scheme with channels as the inner loop, every step is one vector multiply-add over the column.
+    // Unhit channels are NaN and stay NaN.
+    const Double_t *highest = coefficients + order * width;
+    for (UInt_t i = 0; i < width; ++i)
+    {
+        calibrated[i] = highest[i];
+    }
+    for (UInt_t k = order; k-- > 0;)
+    {
+        const Double_t *c = coefficients + k * width;
+        for (UInt_t i = 0; i < width; ++i)
+        {
+            calibrated[i] = calibrated[i] * raw[i] + c[i];
+        }
+    }
+}
+
+Double_t Calibration::applyLookupTable(Double_t raw, const LookupTable &table)
+{
+    // Piecewise linear interpolation, the first and last segments are extrapolated
+    if (std::isnan(raw))
+        return raw;
+
+    const size_t upper = std::clamp<size_t>(std::upper_bound(table.x.begin(), table.x.end(), raw) - table.x.begin(), 1, table.x.size() - 1);
+    const Double_t x0 = table.x[upper - 1], x1 = table.x[upper];
+    const Double_t y0 = table.y[upper - 1], y1 = table.y[upper];
+    return x1 > x0 ? y0 + (raw - x0) * (y1 - y0) / (x1 - x0) : y0;
+}
+
+void Calibration::printInfo() const
+{
+    const std::vector<ChannelIndex::Column> &index_columns = channel_index_.getColumns();
+    for (size_t i = 0; i < index_columns.size(); ++i)
+    {
+        if (column_lookup_[i] < 0)
+            continue;
+        const Column &column = columns_[column_lookup_[i]];
+        std::cout << Form("%s.%s [order %u]", index_columns[i].pmodule->getName().Data(), index_columns[i].filter.Data(), column.order) << std::endl;
+    }
+    for (const LookupTable &table : lookup_tables_)
+    {
+        std::cout << Form("    handle %u [lookup table, %zu points]", table.handle, table.x.size()) << std::endl;
+    }
+}
+
+Calibration::Column &Calibration::getColumn(const DAQModule *pmodule, const TString &filter)
+{
+    Int_t index_column = channel_index_.findColumn(pmodule, filter);
+    if (index_column < 0)
+    {
+        throw std::out_of_range(Form("Filter %s not found for module %s", filter.Data(), pmodule->getName().Data()));
+    }
+
+    // Columns start out as identity, so channels without an entry pass their raw value through
+    if (column_lookup_[index_column] < 0)
+    {
+        const ChannelIndex::Column &index = channel_index_.getColumns()[index_column];
+        Column column{index.offset, index.width, 1, std::vector<Double_t>(2 * index.width, 0.)};
+        std::fill(column.coefficients.begin() + index.width, column.coefficients.end(), 1.);
+        column_lookup_[index_column] = columns_.size();
+        columns_.push_back(std::move(column));
+    }
+    return columns_[column_lookup_[index_column]];
+}
@@ -0,0 +1,65 @@
+#include <stdexcept>
+#include "ChannelIndex.hpp"
+#include "DAQModule.hpp"
+
+ChannelIndex::ChannelIndex(const std::vector<DAQModule *> &daq_modules)
+    : daq_modules_(daq_modules), columns_(), size_(0)
+{
+    for (DAQModule *pmodule : daq_modules_)
+    {
+        for (const TString &filter : *pmodule->getFilters())
+        {
+            const UInt_t width = pmodule->getChannelNum();
+            columns_.push_back({pmodule, filter, size_, width});
+            size_ += width;
+        }
+    }
+}
+
+ChannelIndex::~ChannelIndex()
+{
+}
+
+const Int_t ChannelIndex::findColumn(const DAQModule *pmodule, const TString &filter) const
+{
+    for (size_t i = 0; i < columns_.size(); ++i)
+    {
+        if (columns_[i].pmodule == pmodule && columns_[i].filter == filter)
+        {
+            return i;
+        }
+    }
+    return -1; // Return -1 if the column is not found
+}
+
+const ChannelHandle ChannelIndex::getHandle(const DAQModule *pmodule, const TString &filter, Int_t channel) const
+{
+    // Resolve a (module, filter, channel) triple once at setup time, the handle is then used for every event
+    Int_t column = findColumn(pmodule, filter);
+    if (column < 0)
+    {
+        throw std::out_of_range(Form("Filter %s not found for module %s", filter.Data(), pmodule ? pmodule->getName().Data() : "(null)"));
+    }
+    if (channel < 0 || channel >= Int_t(columns_[column].width))
+    {
+        throw std::out_of_range(Form("Channel %i out of range for module %s", channel, pmodule->getName().Data()));
+    }
+    return columns_[column].offset + channel;
+}
+
+const ChannelHandle ChannelIndex::getColumnOffset(const DAQModule *pmodule, const TString &filter, UInt_t width) const
+{
+    const ChannelHandle offset = getHandle(pmodule, filter);
+    const UInt_t column_width = columns_[findColumn(pmodule, filter)].width;
+    if (column_width != width)
+    {
+        throw std::invalid_argument(Form("Module %s has %u channels, not the %u of its type", pmodule->getName().Data(), column_width, width));
+    }
+    return offset;
+}
+
+TString ChannelIndex::getBranchName(const DAQModule *pmodule, const TString &filter)
+{
+    // MVME exports one branch per module with one leaf per data source (filter)
+    return pmodule->getName() + "." + filter;
+}
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <TFile.h>
+#include <TNamed.h>
+#include <TSystem.h>
+#include "Checkpointer.hpp"
+#include "HistogramManager.hpp"
+
+Checkpointer::Checkpointer(const TString &file_name, Double_t interval)
+    : file_name_(file_name), interval_(interval), restored_ranges_(), snapshots_(1), writing_(false), n_writes_(0),
+      last_submit_(std::chrono::steady_clock::now()), writer_thread_(&Checkpointer::writeLoop, this)
+{
+}
+
+Checkpointer::~Checkpointer()
+{
+    snapshots_.close();
+    if (writer_thread_.joinable())
+    {
+        writer_thread_.join();
+    }
+}
+
+const Long64_t Checkpointer::getRestoredEntries() const
+{
+    Long64_t n_entries = 0;
+    for (const auto &[first, last] : restored_ranges_)
+    {
+        n_entries += last - first;
+    }
+    return n_entries;
+}
+
+const Bool_t Checkpointer::isDue() const
+{
+    return !writing_ && std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - last_submit_).count() >= interval_;
+}
+
+const Double_t Checkpointer::getSecondsToDue() const
+{
+    // 0 once the interval is over, even if the last checkpoint is still being written
+    return std::max(0., interval_ - std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - last_submit_).count());
+}
+
+Bool_t Checkpointer::restore(HistogramManager *phist_manager)
+{
+    // A complete checkpoint belongs to a run whose hist file went missing, the run is sorted again from the start
+    restored_ranges_.clear();
+    if (gSystem->AccessPathName(file_name_) || isComplete(file_name_))
+        return kFALSE;
+
+    std::unique_ptr<TFile> pfile(TFile::Open(file_name_, "READ"));
+    if (!pfile || pfile->IsZombie())
+    {
+        throw std::runtime_error("Error opening checkpoint file: " + file_name_);
+    }
+    TNamed *pranges = static_cast<TNamed *>(pfile->Get("ranges"));
+    if (!pranges)
+    {
+        throw std::runtime_error("No entry ranges in checkpoint file: " + file_name_);
+    }
+
+    RangeList ranges;
+    std::istringstream iss(pranges->GetTitle());
+    std::string range;
+    while (std::getline(iss, range, ','))
+    {
+        const size_t dash = range.find('-');
+        if (dash == std::string::npos)
+        {
+            throw std::runtime_error("Invalid entry range " + range + " in checkpoint file: " + file_name_);
+        }
+        ranges.emplace_back(std::stoll(range.substr(0, dash)), std::stoll(range.substr(dash + 1)));
+    }
+
+    // Histograms are found by name, so the checkpoint only has to come from the same sort setup, not the same handles
+    if (phist_manager)
+    {
+        for (HistHandle handle = 0; handle < phist_manager->getHistNum(); ++handle)
+        {
+            const HistogramManager::HistInfo &info = phist_manager->getHistInfos()[handle];
+            TH1D *phist = static_cast<TH1D *>(pfile->Get(info.detector_name + "/" + info.name));
+            if (!phist)
+            {
+                throw std::runtime_error("Histogram " + info.detector_name + "/" + info.name + " missing from checkpoint file: " + file_name_);
+            }
+            phist_manager->getSlot(0)[handle]->Add(phist);
+        }
+        for (MatrixHandle handle = 0; handle < phist_manager->getMatrixNum(); ++handle)
+        {
+            CoincidenceMatrix *pmatrix = phist_manager->getMatrix(handle);
+            std::vector<UInt_t> *pcounts = nullptr;
+            pfile->GetObject("Matrices/" + pmatrix->getName(), pcounts);
+            if (!pcounts)
+            {
+                throw std::runtime_error("Coincidence matrix " + pmatrix->getName() + " missing from checkpoint file: " + file_name_);
+            }
+            std::unique_ptr<std::vector<UInt_t>> powned_counts(pcounts);
+            pmatrix->addCounts(*pcounts);
+        }
+    }
+
+    restored_ranges_ = coalesce(std::move(ranges));
+    return kTRUE;
+}
+
+void Checkpointer::submit(const HistogramManager &hist_manager, const RangeList &ranges)
+{
+    // Called while no worker fills, after the slots are merged into slot 0. Copying is all the caller waits for.
+    auto psnapshot = std::make_unique<Snapshot>();
+    psnapshot->ranges = coalesce(ranges);
+    psnapshot->phist_manager = &hist_manager;
+    psnapshot->hists.reserve(hist_manager.getHistNum());
+    for (HistHandle handle = 0; handle < hist_manager.getHistNum(); ++handle)
+    {
+        psnapshot->hists.push_back(std::make_unique<TH1D>(*hist_manager.getHistogram(handle)));
+        psnapshot->hists.back()->SetDirectory(nullptr);
+    }
+    for (MatrixHandle handle = 0; handle < hist_manager.getMatrixNum(); ++handle)
+    {
+        psnapshot->matrix_counts.push_back(hist_manager.getMatrix(handle)->getCounts());
+    }
+
+    writing_ = true;
+    last_submit_ = std::chrono::steady_clock::now();
+    snapshots_.push(std::move(psnapshot));
+}
+
+void Checkpointer::complete(Long64_t n_entries)
+{
+    // The last partial checkpoint is replaced only after it is on disk
+    snapshots_.close();
+    if (writer_thread_.joinable())
+    {
+        writer_thread_.join();
+    }
+    Snapshot snapshot;
+    snapshot.ranges.emplace_back(0, n_entries);
+    write(&snapshot, kTRUE);
+}
+
+Bool_t Checkpointer::isComplete(const TString &file_name)
+{
+    if (gSystem->AccessPathName(file_name))
+        return kFALSE;
+    std::unique_ptr<TFile> pfile(TFile::Open(file_name, "READ"));
+    if (!pfile || pfile->IsZombie())
+        return kFALSE;
+    TNamed *pstatus = static_cast<TNamed *>(pfile->Get("status"));
+    return pstatus && TString(pstatus->GetTitle()) == "complete";
+}
+
+Checkpointer::RangeList Checkpointer::coalesce(RangeList ranges)
+{
+    // Sorted, with overlapping and adjacent ranges joined
+    std::sort(ranges.begin(), ranges.end());
+    RangeList coalesced;
+    for (const auto &range : ranges)
+    {
+        if (!coalesced.empty() && range.first <= coalesced.back().second)
+        {
+            coalesced.back().second = std::max(coalesced.back().second, range.second);
+        }
+        else if (range.first < range.second)
+        {
+            coalesced.push_back(range);
+        }
+    }
+    return coalesced;
+}
+
+Checkpointer::RangeList Checkpointer::subtract(const RangeList &ranges, const RangeList &done)
+{
+    // Parts of ranges not covered by done, a range split by done becomes several ranges
+    const RangeList covered = coalesce(done);
+    RangeList remaining;
+    for (auto [first, last] : ranges)
+    {
+        for (const auto &[done_first, done_last] : covered)
+        {
+            if (done_last <= first || done_first >= last)
+                continue;
+            if (done_first > first)
+            {
+                remaining.emplace_back(first, done_first);
+            }
+            first = std::max(first, done_last);
+            if (first >= last)
+                break;
+        }
+        if (first < last)
+        {
+            remaining.emplace_back(first, last);
+        }
+    }
+    return remaining;
+}
+
+void Checkpointer::write(const Snapshot *psnapshot, Bool_t complete) const
+{
+    const TString part_file_name = file_name_ + ".part";
+    {
+        std::unique_ptr<TFile> pfile(TFile::Open(part_file_name, "RECREATE"));
+        if (!pfile || pfile->IsZombie())
+        {
+            throw std::runtime_error("Error opening checkpoint file: " + part_file_name);
+        }
+
+        TString ranges;
+        for (const auto &[first, last] : psnapshot->ranges)
+        {
+            ranges += Form("%s%lld-%lld", ranges.IsNull() ? "" : ",", first, last);
+        }
+        TNamed status("status", complete ? "complete" : "partial");
+        TNamed ranges_named("ranges", ranges);
+        pfile->WriteTObject(&status);
+        pfile->WriteTObject(&ranges_named);
+
+        // Same layout as HistogramManager::writeHistsToFile(), one directory per detector
+        for (size_t handle = 0; handle < psnapshot->hists.size(); ++handle)
+        {
+            const HistogramManager::HistInfo &info = psnapshot->phist_manager->getHistInfos()[handle];
+            TDirectory *pdir = pfile->GetDirectory(info.detector_name);
+            if (!pdir)
+            {
+                pdir = pfile->mkdir(info.detector_name);
+            }
+            pdir->WriteTObject(psnapshot->hists[handle].get(), info.name, "Overwrite");
+        }
+        if (!psnapshot->matrix_counts.empty())
+        {
+            TDirectory *pdir = pfile->mkdir("Matrices");
+            for (size_t handle = 0; handle < psnapshot->matrix_counts.size(); ++handle)
+            {
+                pdir->WriteObject(&psnapshot->matrix_counts[handle], psnapshot->phist_manager->getMatrix(handle)->getName());
+            }
+        }
+        pfile->Close();
+    }
+    if (gSystem->Rename(part_file_name, file_name_) != 0)
+    {
+        throw std::runtime_error("Error replacing checkpoint file: " + file_name_);
+    }
+}
+
+void Checkpointer::writeLoop()
+{
+    // A failed write is reported, the sort goes on and the next checkpoint is tried again
+    std::unique_ptr<Snapshot> psnapshot;
+    while (snapshots_.pop(psnapshot))
+    {
+        try
+        {
+            write(psnapshot.get(), kFALSE);
+            ++n_writes_;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "CloverSort [WARN]: " << e.what() << std::endl;
+        }
+        psnapshot.reset();
+        writing_ = false;
+    }
+}
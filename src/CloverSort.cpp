@@ -1,62 +1,121 @@
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include <TString.h>
 
 #include "Experiment.hpp"
-#include "Run.hpp"
-#include "TaskManager.hpp"
-#include "Task.hpp"
-#include <ROOT/TTreeProcessorMT.hxx>
-
-void init(int i)
-{
-    std::cout << "CloverSort [INFO]: Initialize Task " << i << std::endl;
-}
-
-char execute()
-{
-    std::cout << "CloverSort [INFO]: Execute Task " << '!' << std::endl;
-    return '!';
-}
-
-bool final(int i)
-{
-    std::cout << "CloverSort [INFO]: Finalize Task " << (i == 1) << std::endl;
-    return bool(i == 1);
-}
+#include "ChannelIndex.hpp"
+#include "RunScheduler.hpp"
+#include "SortSetup.hpp"
+#include "EventStore.hpp"
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    // Options start with --, everything else is positional
+    std::vector<TString> args;
+    Int_t follow_run = -1;
+    Bool_t resume = kFALSE;
+    TString gate_string;
+    for (Int_t i = 1; i < argc; ++i)
     {
-        std::cerr << "Usage: " << argv[0] << " <config_file>" << std::endl;
+        const TString arg = argv[i];
+        if (arg == "--follow" && i + 1 < argc)
+        {
+            follow_run = std::stoi(argv[++i]);
+        }
+        else if (arg == "--resume")
+        {
+            resume = kTRUE;
+        }
+        else if (arg == "--gate" && i + 1 < argc)
+        {
+            gate_string = argv[++i];
+        }
+        else if (arg.BeginsWith("--"))
+        {
+            std::cerr << "CloverSort [ERROR]: Unknown option " << arg << std::endl;
+            return 1;
+        }
+        else
+        {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " <config_file> [n_threads] [run_type] [cache_pattern] [--follow <run_number>] [--resume] [--gate <low:up[@detector],...>]" << std::endl;
         return 1;
     }
 
     try
     {
+        // Number of worker threads, 0 uses all available cores and 1 sorts serially
+        const UInt_t n_threads = args.size() > 1 ? std::stoul(args[1].Data()) : 0;
+
         // Define the experiment from the configuration file
-        std::cout << "CloverSort [INFO]: Initializing Experiment from configuration file: " << argv[1] << std::endl;
-        Experiment Expt = Experiment(argv[1]);
+        std::cout << "CloverSort [INFO]: Initializing Experiment from configuration file: " << args[0] << std::endl;
+        Experiment Expt = Experiment(args[0]);
 
         std::cout << "CloverSort [INFO]: Experiment " << Expt.getName() << " loaded successfully." << std::endl;
-        std::cout << "CloverSort [INFO]: Tree named " << Expt.getRun(1)->getTree()->GetName() << " with " << Expt.getRun(1)->getTree()->GetEntries() << " entries found." << std::endl;
 
-        ROOT::TTreeProcessorMT EventProcessor(Expt.getRun(1)->getFileName(), TString(Expt.getRun(1)->getTree()->GetName()));
+        // Flat channel layout shared by all events, handles can be resolved against it before sorting
+        ChannelIndex channel_index(*Expt.getDAQModules());
+
+        // Sort every run, or only the runs of the given type, each into its own hist file
+        RunScheduler scheduler(&Expt, channel_index, [&](RunContext &context)
+                               { setupSort(context, &Expt, &channel_index, Expt.isStaticPipeline()); });
+        if (args.size() > 2 && args[2] != "all")
+        {
+            scheduler.setRunType(args[2]);
+        }
+
+        // Convert every run to a sort cache once, later sorts read the cache, e.g. cache/run---.cache
+        if (args.size() > 3)
+        {
+            scheduler.setCachePattern(args[3]);
+        }
+        // Event loop instrumentation, see the Experiment section of the configuration
+        scheduler.setProfileSampling(Expt.getProfileSampling());
+        scheduler.setProgressInterval(Expt.getProgressInterval());
+        scheduler.setProfilePattern(Expt.getProfilePattern());
+        scheduler.setTaskBatchSize(Expt.getTaskBatchSize());
+
+        // Clusters read and decompressed by dedicated threads ahead of the sorting threads
+        scheduler.setPrefetchThreads(Expt.getPrefetchThreads());
+        scheduler.setPrefetchDepth(Expt.getPrefetchDepth());
+
+        // Runs sorted concurrently wait for each other's histograms rather than exceed this memory
+        scheduler.setHistogramMemoryLimit(Expt.getHistogramMemoryLimit());
 
-        TaskManager task_manager;
+        // Checkpoints of long sorts, --resume continues a sort that did not finish
+        scheduler.setCheckpointPattern(Expt.getCheckpointPattern());
+        scheduler.setCheckpointInterval(Expt.getCheckpointInterval());
+        scheduler.setResume(resume);
+        if (resume && Expt.getCheckpointPattern().IsNull())
+        {
+            std::cerr << "CloverSort [WARN]: --resume without a CheckpointFile in the configuration sorts every run again" << std::endl;
+        }
 
-        Task<void(int), char(), bool(int)> task("test", init, execute, final);
-        task.setInitializeArguments(std::make_tuple(1));
-        task.setExecuteArguments(std::make_tuple());
-        task.setFinalizeArguments(std::make_tuple(1));
+        // Gates set on the event stores of an earlier sort, the runs are not sorted again
+        scheduler.setEventStorePattern(Expt.getEventStorePattern());
+        if (!gate_string.IsNull())
+        {
+            scheduler.gateRuns(EventStore::parseGates(gate_string), Expt.getGateFileName(), n_threads);
+            return 0;
+        }
 
-        task_manager.addTask(&task);
-        task_manager.initializeTasks();
-        task_manager.executeTasks();
-        task_manager.finalizeTasks();
+        // Online sorting of the run MVME is writing, its hist file is updated while the run goes on
+        if (follow_run >= 0)
+        {
+            scheduler.setFollowInterval(Expt.getFollowInterval());
+            scheduler.setFollowTimeout(Expt.getFollowTimeout());
+            scheduler.followRun(follow_run, n_threads);
+            return 0;
+        }
 
-        std::cout << (task.getExecuteOutput() == '!' ? Form("CloverSort [INFO]: Task %s executed successfully.", task.getName().Data()) : Form("CloverSort [ERROR]: Task %s execution failed.", task.getName().Data())) << std::endl;
+        scheduler.processRuns(n_threads);
 
         return 0;
     }
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <TH2D.h>
+#include <TH2I.h>
+#include "CoincidenceMatrix.hpp"
+
+CoincidenceMatrix::CoincidenceMatrix(const TString &name, const TString &title, Int_t n_bins, Double_t x_low, Double_t x_up, UInt_t buffer_size,
+                                     Double_t random_weight)
+    : name_(name), title_(title), n_bins_(n_bins), x_low_(x_low), x_up_(x_up), buffer_size_(std::max(buffer_size, 1u)), random_weight_(random_weight),
+      n_cells_(n_bins > 0 ? ULong64_t(n_bins) * (n_bins + 1) / 2 : 0), counts_(), random_counts_(), slot_cells_(), slot_random_cells_()
+{
+    if (n_bins <= 0 || !(x_up > x_low))
+    {
+        throw std::invalid_argument(Form("Invalid binning for coincidence matrix %s", name.Data()));
+    }
+}
+
+CoincidenceMatrix::~CoincidenceMatrix()
+{
+}
+
+const ULong64_t CoincidenceMatrix::getCount(Int_t bin_x, Int_t bin_y) const
+{
+    // Symmetric view of the stored upper triangle, bins are 0 based
+    if (bin_x < 0 || bin_y < 0 || bin_x >= n_bins_ || bin_y >= n_bins_)
+    {
+        throw std::out_of_range(Form("Bin (%i, %i) out of range for coincidence matrix %s", bin_x, bin_y, name_.Data()));
+    }
+    if (isSubtracted())
+    {
+        throw std::runtime_error(Form("Coincidence matrix %s is subtracted, it has contents instead of counts", name_.Data()));
+    }
+    // The stored count is read as is, a diagonal count doubled in 64 bits cannot wrap
+    if (counts_.empty())
+        return 0;
+    const ULong64_t count = counts_[getCell(std::min(bin_x, bin_y), std::max(bin_x, bin_y))].load(std::memory_order_relaxed);
+    return bin_x == bin_y ? 2 * count : count;
+}
+
+const Double_t CoincidenceMatrix::getContent(Int_t bin_x, Int_t bin_y) const
+{
+    // Symmetric view like getCount(), also for subtracted matrices
+    if (bin_x < 0 || bin_y < 0 || bin_x >= n_bins_ || bin_y >= n_bins_)
+    {
+        throw std::out_of_range(Form("Bin (%i, %i) out of range for coincidence matrix %s", bin_x, bin_y, name_.Data()));
+    }
+    const Double_t content = getCellContent(getCell(std::min(bin_x, bin_y), std::max(bin_x, bin_y)));
+    return bin_x == bin_y ? 2. * content : content;
+}
+
+const Int_t CoincidenceMatrix::findBin(Double_t x) const
+{
+    // 0 based bin of x, -1 if x is outside the axis or NaN
+    const Double_t position = (x - x_low_) / (x_up_ - x_low_) * n_bins_;
+    return position >= 0. && position < n_bins_ ? Int_t(position) : -1;
+}
+
+Double_t CoincidenceMatrix::getCellContent(ULong64_t cell) const
+{
+    // Cells that are not allocated yet are empty
+    if (counts_.empty())
+        return 0.;
+    const Double_t count = counts_[cell].load(std::memory_order_relaxed);
+    if (!isSubtracted())
+        return count;
+    return count + random_weight_ * random_counts_[cell].load(std::memory_order_relaxed);
+}
+
+Double_t CoincidenceMatrix::getCellError2(ULong64_t cell) const
+{
+    // Poisson variance of the prompt and the scaled random counts
+    if (counts_.empty())
+        return 0.;
+    const Double_t count = counts_[cell].load(std::memory_order_relaxed);
+    if (!isSubtracted())
+        return count;
+    return count + random_weight_ * random_weight_ * random_counts_[cell].load(std::memory_order_relaxed);
+}
+
+void CoincidenceMatrix::initializeSlots(UInt_t n_slots)
+{
+    // Starts an empty matrix like the fresh slot copies of HistogramManager::initializeSlots(), so a manager that
+    // sorts a second time does not add to the first sort's counts. The cells are allocated on the first call.
+    if (counts_.empty())
+    {
+        counts_ = std::vector<std::atomic<UInt_t>>(n_cells_);
+        random_counts_ = std::vector<std::atomic<UInt_t>>(isSubtracted() ? n_cells_ : 0);
+    }
+    for (auto &count : counts_)
+    {
+        count.store(0, std::memory_order_relaxed);
+    }
+    for (auto &count : random_counts_)
+    {
+        count.store(0, std::memory_order_relaxed);
+    }
+    slot_cells_.assign(n_slots, std::vector<ULong64_t>());
+    for (auto &cells : slot_cells_)
+    {
+        cells.reserve(buffer_size_);
+    }
+    slot_random_cells_.assign(isSubtracted() ? n_slots : 0, std::vector<ULong64_t>());
+    for (auto &cells : slot_random_cells_)
+    {
+        cells.reserve(buffer_size_);
+    }
+}
+
+void CoincidenceMatrix::fill(UInt_t slot, Double_t x, Double_t y)
+{
+    const Int_t bin_x = findBin(x);
+    const Int_t bin_y = findBin(y);
+    if (bin_x < 0 || bin_y < 0)
+        return;
+
+    std::vector<ULong64_t> &cells = slot_cells_[slot];
+    cells.push_back(getCell(std::min(bin_x, bin_y), std::max(bin_x, bin_y)));
+    if (cells.size() >= buffer_size_)
+    {
+        flush(slot);
+    }
+}
+
+void CoincidenceMatrix::fillRandom(UInt_t slot, Double_t x, Double_t y)
+{
+    if (!isSubtracted())
+    {
+        throw std::runtime_error(Form("Coincidence matrix %s is not subtracted, it cannot be filled with random pairs", name_.Data()));
+    }
+    const Int_t bin_x = findBin(x);
+    const Int_t bin_y = findBin(y);
+    if (bin_x < 0 || bin_y < 0)
+        return;
+
+    std::vector<ULong64_t> &cells = slot_random_cells_[slot];
+    cells.push_back(getCell(std::min(bin_x, bin_y), std::max(bin_x, bin_y)));
+    if (cells.size() >= buffer_size_)
+    {
+        flush(slot);
+    }
+}
+
+void CoincidenceMatrix::addCells(std::vector<ULong64_t> &cells, std::vector<std::atomic<UInt_t>> &counts)
+{
+    // Sorting turns the batch into one ordered sweep over the matrix and collapses repeated cells into one add
+    std::sort(cells.begin(), cells.end());
+    for (size_t i = 0; i < cells.size();)
+    {
+        size_t j = i + 1;
+        while (j < cells.size() && cells[j] == cells[i])
+        {
+            ++j;
+        }
+        counts[cells[i]].fetch_add(j - i, std::memory_order_relaxed);
+        i = j;
+    }
+    cells.clear();
+}
+
+void CoincidenceMatrix::flush(UInt_t slot)
+{
+    addCells(slot_cells_[slot], counts_);
+    if (isSubtracted())
+    {
+        addCells(slot_random_cells_[slot], random_counts_);
+    }
+}
+
+void CoincidenceMatrix::flushSlots()
+{
+    const size_t n_slots = slot_cells_.size();
+    for (UInt_t slot = 0; slot < n_slots; ++slot)
+    {
+        flush(slot);
+    }
+}
+
+std::vector<UInt_t> CoincidenceMatrix::getCounts() const
+{
+    std::vector<UInt_t> counts(isSubtracted() ? 2 * n_cells_ : n_cells_);
+    if (counts_.empty())
+    {
+        return counts;
+    }
+    for (ULong64_t cell = 0; cell < n_cells_; ++cell)
+    {
+        counts[cell] = counts_[cell].load(std::memory_order_relaxed);
+    }
+    for (ULong64_t cell = 0; cell < random_counts_.size(); ++cell)
+    {
+        counts[n_cells_ + cell] = random_counts_[cell].load(std::memory_order_relaxed);
+    }
+    return counts;
+}
+
+void CoincidenceMatrix::addCounts(const std::vector<UInt_t> &counts)
+{
+    const ULong64_t n_words = isSubtracted() ? 2 * n_cells_ : n_cells_;
+    if (counts.size() != n_words)
+    {
+        throw std::runtime_error(Form("Cannot add %zu words to coincidence matrix %s of %llu cells", counts.size(), name_.Data(), n_cells_));
+    }
+    if (counts_.empty())
+    {
+        throw std::logic_error(Form("Coincidence matrix %s is not initialized, its cells are allocated by initializeSlots()", name_.Data()));
+    }
+    for (ULong64_t cell = 0; cell < n_cells_; ++cell)
+    {
+        counts_[cell].fetch_add(counts[cell], std::memory_order_relaxed);
+    }
+    for (ULong64_t cell = 0; cell < random_counts_.size(); ++cell)
+    {
+        random_counts_[cell].fetch_add(counts[n_cells_ + cell], std::memory_order_relaxed);
+    }
+}
+
+std::unique_ptr<TH2> CoincidenceMatrix::toTH2() const
+{
+    // Counts are exported as a TH2I, subtracted matrices as a TH2D with the errors of the prompt and random counts.
+    // Counts whose symmetric view does not fit the Int_t bins of a TH2I are exported as a TH2D as well.
+    Bool_t fits_int = kTRUE;
+    for (ULong64_t cell = 0; cell < counts_.size() && fits_int && !isSubtracted(); ++cell)
+    {
+        fits_int = 2 * ULong64_t(counts_[cell].load(std::memory_order_relaxed)) <= ULong64_t(std::numeric_limits<Int_t>::max());
+    }
+    if (!fits_int)
+    {
+        std::cout << "CloverSort [INFO]: Coincidence matrix " << name_ << " has counts beyond the range of a TH2I, it is exported as a TH2D" << std::endl;
+    }
+    std::unique_ptr<TH2> phist;
+    if (isSubtracted() || !fits_int)
+        phist = std::make_unique<TH2D>(name_, title_, n_bins_, x_low_, x_up_, n_bins_, x_low_, x_up_);
+    else
+        phist = std::make_unique<TH2I>(name_, title_, n_bins_, x_low_, x_up_, n_bins_, x_low_, x_up_);
+    phist->SetDirectory(nullptr);
+    if (isSubtracted())
+        phist->Sumw2();
+    Double_t entries = 0.;
+    for (Int_t i = 0; i < n_bins_; ++i)
+    {
+        for (Int_t j = i; j < n_bins_; ++j)
+        {
+            const ULong64_t cell = getCell(i, j);
+            const Double_t error2 = getCellError2(cell);
+            if (error2 == 0)
+                continue;
+            const Double_t count = getCellContent(cell);
+            if (i == j)
+            {
+                phist->SetBinContent(i + 1, i + 1, 2. * count);
+                if (isSubtracted())
+                    phist->SetBinError(i + 1, i + 1, std::sqrt(4. * error2));
+            }
+            else
+            {
+                phist->SetBinContent(i + 1, j + 1, count);
+                phist->SetBinContent(j + 1, i + 1, count);
+                if (isSubtracted())
+                {
+                    phist->SetBinError(i + 1, j + 1, std::sqrt(error2));
+                    phist->SetBinError(j + 1, i + 1, std::sqrt(error2));
+                }
+            }
+            entries += 2. * count;
+        }
+    }
+    phist->SetEntries(entries);
+    return phist;
+}
+
+std::unique_ptr<TH1D> CoincidenceMatrix::project(const TString &name) const
+{
+    return makeProjection(name, 0, n_bins_ - 1);
+}
+
+std::unique_ptr<TH1D> CoincidenceMatrix::gate(const TString &name, Double_t gate_low, Double_t gate_up) const
+{
+    // Bins whose centre lies within [gate_low, gate_up] form the gate
+    const Double_t bin_width = (x_up_ - x_low_) / n_bins_;
+    const Int_t gate_low_bin = std::max(0, Int_t(std::ceil((gate_low - x_low_) / bin_width - 0.5)));
+    const Int_t gate_up_bin = std::min(n_bins_ - 1, Int_t(std::floor((gate_up - x_low_) / bin_width - 0.5)));
+    return makeProjection(name, gate_low_bin, gate_up_bin);
+}
+
+std::unique_ptr<TH1D> CoincidenceMatrix::makeProjection(const TString &name, Int_t gate_low_bin, Int_t gate_up_bin) const
+{
+    // Sum of the symmetric matrix over the gate bins j, for every bin i. Walking the stored rows once, a cell
+    // (i, j) with i < j adds to bin i if j is in the gate and to bin j if i is in the gate. The variances add the
+    // same way, they are only set on the projections of subtracted matrices.
+    std::vector<Double_t> sums(n_bins_, 0.), errors2(n_bins_, 0.);
+    for (Int_t i = 0; i < n_bins_; ++i)
+    {
+        const Bool_t i_in_gate = i >= gate_low_bin && i <= gate_up_bin;
+        const ULong64_t row = getCell(i, i);
+        for (Int_t j = i; j < n_bins_; ++j)
+        {
+            const Double_t error2 = getCellError2(row + (j - i));
+            if (error2 == 0)
+                continue;
+            const Double_t count = getCellContent(row + (j - i));
+            if (j == i)
+            {
+                sums[i] += i_in_gate ? 2. * count : 0.;
+                errors2[i] += i_in_gate ? 4. * error2 : 0.;
+                continue;
+            }
+            if (j >= gate_low_bin && j <= gate_up_bin)
+            {
+                sums[i] += count;
+                errors2[i] += error2;
+            }
+            if (i_in_gate)
+            {
+                sums[j] += count;
+                errors2[j] += error2;
+            }
+        }
+    }
+
+    auto phist = std::make_unique<TH1D>(name, title_, n_bins_, x_low_, x_up_);
+    phist->SetDirectory(nullptr);
+    if (isSubtracted())
+        phist->Sumw2();
+    Double_t entries = 0.;
+    for (Int_t i = 0; i < n_bins_; ++i)
+    {
+        phist->SetBinContent(i + 1, sums[i]);
+        if (isSubtracted())
+            phist->SetBinError(i + 1, std::sqrt(errors2[i]));
+        entries += sums[i];
+    }
+    phist->SetEntries(entries);
+    return phist;
+}
+
+void CoincidenceMatrix::printInfo() const
+{
+    std::cout << Form("%s [%i x %i bins, %llu %s cells, %.1f MB]", name_.Data(), n_bins_, n_bins_, n_cells_, isSubtracted() ? "prompt and random" : "count", getMemoryBytes() / 1048576.) << std::endl;
+}
@@ -1,12 +1,32 @@
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <tuple>
 #include "DAQModule.hpp"
 #include "Detector.hpp"
 
-const std::vector<TString> DAQModule::VALID_MODULE_TYPES_ = VALID_MODULE_TYPES;
+const std::vector<TString> DAQModule::VALID_MODULE_TYPES_ = std::apply([](auto... descriptors)
+                                                                        { return std::vector<TString>{decltype(descriptors)::NAME_...}; },
+                                                                        ModuleTypeList{});
+
+namespace
+{
+    // The descriptor is only known at runtime here, every type of ModuleTypeList is tried by name
+    DAQModule makeModule(const TString &module_name, const TString &module_type)
+    {
+        std::unique_ptr<DAQModule> pmodule;
+        if (!visitModuleType(module_type, [&](auto descriptor)
+                             { pmodule = std::make_unique<DAQModule>(module_name, descriptor); }))
+        {
+            throw std::runtime_error("Unsupported module type: " + module_type);
+        }
+        return std::move(*pmodule);
+    }
+}
 
 DAQModule::DAQModule(TString module_name, TString module_type)
-    : module_name_(module_name), MODULE_TYPE_(*std::find(VALID_MODULE_TYPES_.begin(), VALID_MODULE_TYPES_.end(), module_type)), CHANNEL_NUM_(std::find(VALID_MODULE_TYPES_.begin(), VALID_MODULE_TYPES_.end(), module_type) != VALID_MODULE_TYPES_.end() ? 16 : 0), channel_names_()
+    : DAQModule(makeModule(module_name, module_type))
 {
 }
 
@@ -49,25 +69,13 @@ void DAQModule::setChannelName(const Int_t channel, const TString &channel_name)
 
 void DAQModule::generateDefaultFilters()
 {
-    // Generate default filters based on the module type
-    if (MODULE_TYPE_ == "mdpp16scp")
+    // Default filters of the module type, in the column order of its descriptor
+    for (const TString &filter : DEFAULT_FILTERS_)
     {
-        filters_.push_back("amplitude");
-        filters_.push_back("channel_time");
-        filters_.push_back("module_timestamp");
-        filters_.push_back("trigger_time");
-    }
-    else if (MODULE_TYPE_ == "mdpp16qdc")
-    {
-        filters_.push_back("channel_time");
-        filters_.push_back("integration_long");
-        filters_.push_back("integration_short");
-        filters_.push_back("module_timestamp");
-        filters_.push_back("trigger_time");
-    }
-    else
-    {
-        std::cerr << "CloverSort [WARN]: No default filters defined for module type " << MODULE_TYPE_ << ". Please define them manually using DAQModule::addFilter()" << std::endl;
+        if (std::find(filters_.begin(), filters_.end(), filter) == filters_.end())
+        {
+            filters_.push_back(filter);
+        }
     }
 }
 
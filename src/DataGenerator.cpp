@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <TFile.h>
+#include <TTree.h>
+#include <TSystem.h>
+#include "DataGenerator.hpp"
+#include "DAQModule.hpp"
+
+namespace
+{
+    // Gamma lines of the synthetic spectra in amplitude channels, 511, 1173, 1333, 1461 and 2615 keV at 8 channels per keV
+    const Double_t LINES[] = {4088., 9385.6, 10660., 11686.4, 20916.};
+    const Double_t LINE_FRACTION = 0.3;       // Fraction of hits in one of the lines
+    const Double_t BACKGROUND_SLOPE = 4000.;  // Mean amplitude of the exponential background
+    const Double_t MAX_AMPLITUDE = 65535.;    // Largest amplitude of a 16 bit ADC
+    const Double_t CHANNEL_TIME_MEAN = 2000.; // Mean channel_time of a hit
+    const Double_t CHANNEL_TIME_SIGMA = 20.;  // Spread of the channel_time of the hits of an entry
+}
+
+DataGenerator::DataGenerator(const std::vector<DAQModule *> &daq_modules, ULong_t seed)
+    : channel_index_(daq_modules), values_(channel_index_.getSize(), std::numeric_limits<Double_t>::quiet_NaN()), random_(seed),
+      multiplicity_(2), occupancy_(1), pileup_fraction_(0.01), mean_spacing_(1000), timestamp_wrap_(1073741824.)
+{
+}
+
+DataGenerator::~DataGenerator()
+{
+}
+
+Long64_t DataGenerator::generate(const TString &file_name, const TString &tree_name, Long64_t n_entries)
+{
+    const TString dir_name = gSystem->GetDirName(file_name);
+    if (!dir_name.IsNull() && dir_name != ".")
+    {
+        gSystem->mkdir(dir_name, kTRUE);
+    }
+    std::unique_ptr<TFile> pfile(TFile::Open(file_name, "RECREATE"));
+    if (!pfile || pfile->IsZombie())
+    {
+        throw std::runtime_error("Error creating file: " + file_name);
+    }
+
+    // One branch per column, the branch addresses point into the flat value array
+    TTree *ptree = new TTree(tree_name, "CloverSort synthetic MVME data");
+    for (const ChannelIndex::Column &column : channel_index_.getColumns())
+    {
+        const TString leaf_list = isScalarFilter(column.filter) ? Form("%s/D", column.filter.Data()) : Form("%s[%u]/D", column.filter.Data(), column.width);
+        ptree->Branch(ChannelIndex::getBranchName(column.pmodule, column.filter), values_.data() + column.offset, leaf_list);
+    }
+
+    Double_t time = 0;
+    for (Long64_t entry = 0; entry < n_entries; ++entry)
+    {
+        time += random_.Exp(mean_spacing_);
+        const Double_t timestamp = std::floor(std::fmod(time, timestamp_wrap_));
+
+        std::fill(values_.begin(), values_.end(), std::numeric_limits<Double_t>::quiet_NaN());
+        for (const DAQModule *pmodule : channel_index_.getDAQModules())
+        {
+            if (random_.Rndm() < occupancy_)
+            {
+                fillModule(pmodule, timestamp);
+            }
+        }
+        ptree->Fill();
+    }
+    ptree->Write();
+    const Long64_t zip_bytes = ptree->GetZipBytes();
+    pfile->Close();
+
+    std::cout << "CloverSort [INFO]: Generated " << n_entries << " entries of " << channel_index_.getDAQModules().size() << " module(s) in " << file_name << " (" << zip_bytes / 1e6 << " MB compressed)" << std::endl;
+
+    return n_entries;
+}
+
+void DataGenerator::fillModule(const DAQModule *pmodule, Double_t timestamp)
+{
+    // Pick the hit channels with a partial Fisher-Yates shuffle
+    const Int_t n_channels = pmodule->getChannelNum();
+    const Int_t n_hits = std::clamp(random_.Poisson(multiplicity_), 1, n_channels);
+    std::vector<Int_t> channels(n_channels);
+    std::iota(channels.begin(), channels.end(), 0);
+    for (Int_t i = 0; i < n_hits; ++i)
+    {
+        std::swap(channels[i], channels[i + random_.Integer(n_channels - i)]);
+    }
+
+    std::vector<Double_t> amplitudes(n_hits), times(n_hits), pileups(n_hits);
+    const Double_t trigger_time = random_.Gaus(CHANNEL_TIME_MEAN, CHANNEL_TIME_SIGMA);
+    for (Int_t i = 0; i < n_hits; ++i)
+    {
+        pileups[i] = random_.Rndm() < pileup_fraction_ ? 1. : 0.;
+        amplitudes[i] = generateAmplitude();
+        if (pileups[i] > 0)
+        {
+            amplitudes[i] = std::min(amplitudes[i] + generateAmplitude(), MAX_AMPLITUDE);
+        }
+        times[i] = trigger_time + random_.Gaus(0., 0.25 * CHANNEL_TIME_SIGMA);
+    }
+
+    for (const TString &filter : *pmodule->getFilters())
+    {
+        const ChannelIndex::Column &column = channel_index_.getColumns()[channel_index_.findColumn(pmodule, filter)];
+        Double_t *pvalues = values_.data() + column.offset;
+        if (isScalarFilter(filter))
+        {
+            pvalues[0] = timestamp;
+            continue;
+        }
+        if (filter == "trigger_time")
+        {
+            pvalues[0] = trigger_time;
+            continue;
+        }
+        for (Int_t i = 0; i < n_hits; ++i)
+        {
+            Double_t &value = pvalues[channels[i]];
+            if (filter == "amplitude" || filter == "integration_long")
+                value = amplitudes[i];
+            else if (filter == "integration_short")
+                value = std::floor(amplitudes[i] * random_.Uniform(0.6, 0.9));
+            else if (filter == "channel_time")
+                value = times[i];
+            else if (filter == "pileup")
+                value = pileups[i];
+            else
+                value = std::floor(random_.Uniform(0., MAX_AMPLITUDE));
+        }
+    }
+}
+
+Double_t DataGenerator::generateAmplitude()
+{
+    // A gamma line with a resolution growing with the amplitude, or the exponential Compton and room background
+    Double_t amplitude;
+    if (random_.Rndm() < LINE_FRACTION)
+    {
+        const Double_t line = LINES[random_.Integer(sizeof(LINES) / sizeof(LINES[0]))];
+        amplitude = random_.Gaus(line, 2. + 0.001 * line);
+    }
+    else
+    {
+        amplitude = random_.Exp(BACKGROUND_SLOPE);
+    }
+    return std::clamp(std::floor(amplitude), 0., MAX_AMPLITUDE);
+}
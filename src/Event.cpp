@@ -1,62 +1,207 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <TTree.h>
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
 #include "Event.hpp"
 #include "DAQModule.hpp"
+#include "SortCache.hpp"
+
+Event::Event(const ChannelIndex *pchannel_index, TTreeReader *ptree_reader, const std::vector<UChar_t> *pactive_columns)
+    : ptree_reader_(ptree_reader),
+      powned_channel_index_(),
+      pchannel_index_(pchannel_index),
+      values_(pchannel_index->getSize(), std::numeric_limits<Double_t>::quiet_NaN())
+{
+    bindReaders(pactive_columns);
+}
 
 Event::Event(std::vector<DAQModule *> daq_modules, TTreeReader *ptree_reader)
     : ptree_reader_(ptree_reader),
-      daq_modules_(daq_modules)
+      powned_channel_index_(std::make_unique<ChannelIndex>(daq_modules)),
+      pchannel_index_(powned_channel_index_.get()),
+      values_(pchannel_index_->getSize(), std::numeric_limits<Double_t>::quiet_NaN())
+{
+    bindReaders();
+}
+
+Event::Event(const ChannelIndex *pchannel_index, const SortCache *pcache, const std::vector<UChar_t> *pactive_columns)
+    : ptree_reader_(nullptr),
+      powned_channel_index_(),
+      pchannel_index_(pchannel_index),
+      values_(pchannel_index->getSize(), std::numeric_limits<Double_t>::quiet_NaN()),
+      pcache_(pcache)
+{
+    bindCache(pactive_columns);
+}
+
+Event::Event(const ChannelIndex *pchannel_index)
+    : ptree_reader_(nullptr),
+      powned_channel_index_(),
+      pchannel_index_(pchannel_index),
+      values_(pchannel_index->getSize(), std::numeric_limits<Double_t>::quiet_NaN())
+{
+}
+
+Event::~Event()
+{
+}
+
+const Double_t Event::getData(DAQModule *pdaq_module, const TString &filter, Int_t channel)
 {
-    for (DAQModule *pmodule : daq_modules_)
+    // Convenience lookup for prototyping, hot paths should resolve the handle once with ChannelIndex::getHandle()
+    return values_[pchannel_index_->getHandle(pdaq_module, filter, channel)];
+}
+
+Double_t *Event::getProduct(ProductHandle handle, size_t size)
+{
+    // Products travel with the event, so tasks in different threads can work on different events of a batch.
+    // Storage is allocated NaN on first use and reused for every later entry.
+    if (products_.size() <= handle)
     {
-        for (const TString &filter : *pmodule->getFilters())
+        products_.resize(handle + 1);
+    }
+    std::vector<Double_t> &product = products_[handle];
+    if (product.size() < size)
+    {
+        product.resize(size, std::numeric_limits<Double_t>::quiet_NaN());
+    }
+    return product.data();
+}
+
+void Event::setValues(const Double_t *pvalues)
+{
+    // Copy a full flat value array laid out like getValues(), e.g. an event built and queued by another thread
+    std::copy_n(pvalues, values_.size(), values_.begin());
+}
+
+void Event::readEntry()
+{
+    // Copy the current entry into the flat value array, must be called after every TTreeReader::Next()
+    for (auto &array : arrays_)
+    {
+        Double_t *pvalues = values_.data() + array.offset;
+        const UInt_t size = std::min<UInt_t>(array.preader->GetSize(), array.width);
+        for (UInt_t i = 0; i < size; ++i)
         {
-            try
-            {
-                addArray(pmodule, filter, ptree_reader);
-            }
-            catch (...)
-            {
-                // Handle the case where the variant type is not TTreeReaderArray<Double_t>
-                // This can happen if the filter is not an array type
-                addValue(pmodule, filter, ptree_reader);
-            }
+            pvalues[i] = (*array.preader)[i];
         }
+        std::fill(pvalues + size, pvalues + array.width, std::numeric_limits<Double_t>::quiet_NaN());
+    }
+    for (auto &scalar : scalars_)
+    {
+        // Per module values are broadcast to every channel of the column
+        std::fill_n(values_.data() + scalar.offset, scalar.width, **scalar.preader);
     }
 }
 
-Event::~Event()
+void Event::readEntry(Long64_t entry)
 {
+    // Copy an entry of the sort cache into the flat value array, the chunks of a block are read once per block
+    const Long64_t block = entry / pcache_->getBlockEntries();
+    if (block != cache_block_)
+    {
+        for (size_t i = 0; i < cache_columns_.size(); ++i)
+        {
+            if (cache_columns_[i] < 0)
+                continue;
+            cache_chunks_[i] = pcache_->readChunk(block, cache_columns_[i], cache_buffers_[i], cache_scratch_);
+        }
+        cache_block_ = block;
+    }
+
+    const Long64_t local_entry = entry - block * pcache_->getBlockEntries();
+    const std::vector<ChannelIndex::Column> &columns = pchannel_index_->getColumns();
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        if (cache_columns_[i] < 0)
+            continue;
+        std::copy_n(cache_chunks_[i] + local_entry * columns[i].width, columns[i].width, values_.data() + columns[i].offset);
+    }
 }
 
-const Double_t Event::getData(DAQModule *pdaq_module, const TString &filter, Int_t channel)
+void Event::bindCache(const std::vector<UChar_t> *pactive_columns)
+{
+    // Every active column of the channel index has to be in the cache with the same width
+    const std::vector<ChannelIndex::Column> &columns = pchannel_index_->getColumns();
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        const ChannelIndex::Column &column = columns[i];
+        if (pactive_columns && !(*pactive_columns)[i])
+        {
+            cache_columns_.push_back(-1);
+            continue;
+        }
+        Int_t cache_column = pcache_->findColumn(column.pmodule->getName(), column.filter);
+        if (cache_column < 0 || pcache_->getColumns()[cache_column].width != column.width)
+        {
+            throw std::runtime_error(Form("Sort cache %s has no matching column for filter %s of module %s", pcache_->getFileName().Data(), column.filter.Data(), column.pmodule->getName().Data()));
+        }
+        cache_columns_.push_back(cache_column);
+    }
+    cache_chunks_.assign(columns.size(), nullptr);
+    cache_buffers_.resize(columns.size());
+}
+
+void Event::bindReaders(const std::vector<UChar_t> *pactive_columns)
 {
-    auto it = data_.find(pdaq_module);
-    if (it == data_.end())
+    TTree *ptree = ptree_reader_->GetTree();
+    if (!ptree)
     {
-        throw std::runtime_error("DAQModule not found in data map");
+        throw std::runtime_error("TTreeReader has no tree to bind the event to");
     }
-    auto jt = it->second.find(filter);
-    if (jt == it->second.end())
+
+    // Unread branches are disabled, so neither TTreeCache nor anything else fetches and decompresses their baskets
+    if (pactive_columns)
     {
-        throw std::runtime_error("Filter not found in data map for the specified DAQModule");
+        ptree->SetBranchStatus("*", kFALSE);
+    }
+
+    const std::vector<ChannelIndex::Column> &columns = pchannel_index_->getColumns();
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        const ChannelIndex::Column &column = columns[i];
+        if (pactive_columns && !(*pactive_columns)[i])
+            continue;
+
+        // Prefer the module qualified branch name, fall back to the bare filter name
+        TString branch_name = ChannelIndex::getBranchName(column.pmodule, column.filter);
+        TBranch *pbranch = ptree->FindBranch(branch_name);
+        if (!pbranch)
+        {
+            branch_name = column.filter;
+            pbranch = ptree->FindBranch(branch_name);
+        }
+        if (!pbranch)
+        {
+            throw std::runtime_error(Form("No branch found for filter %s of module %s", column.filter.Data(), column.pmodule->getName().Data()));
+        }
+        if (pactive_columns)
+        {
+            ptree->SetBranchStatus(branch_name, kTRUE);
+        }
+
+        // The leaf decides the reader type: arrays have a counter leaf or a static length above one
+        TLeaf *pleaf = static_cast<TLeaf *>(pbranch->GetListOfLeaves()->At(0));
+        if (pleaf && (pleaf->GetLeafCount() || pleaf->GetLenStatic() > 1))
+        {
+            addArray(column, branch_name);
+        }
+        else
+        {
+            addValue(column, branch_name);
+        }
     }
-    return std::visit([&](auto &reader)
-                      {
-        using T = std::decay_t<decltype(reader)>;
-        if constexpr (std::is_same_v<T, TTreeReaderArray<Double_t>>) {
-            return reader.At(channel);
-        } else if constexpr (std::is_same_v<T, TTreeReaderValue<Double_t>>) {
-            return *reader;
-        } else {
-            throw std::runtime_error("Unsupported ReaderVar type");
-        } }, jt->second);
 }
 
-void Event::addArray(DAQModule *pmodule, const TString &filter, TTreeReader *ptree_reader)
+void Event::addArray(const ChannelIndex::Column &column, const TString &branch_name)
 {
-    data_[pmodule].insert_or_assign(filter, TTreeReaderArray<Double_t>(*ptree_reader, filter));
+    arrays_.push_back({std::make_unique<TTreeReaderArray<Double_t>>(*ptree_reader_, branch_name), column.offset, column.width});
 }
 
-void Event::addValue(DAQModule *pmodule, const TString &filter, TTreeReader *ptree_reader)
+void Event::addValue(const ChannelIndex::Column &column, const TString &branch_name)
 {
-    data_[pmodule].insert_or_assign(filter, TTreeReaderValue<Double_t>(*ptree_reader, filter));
-}
\ No newline at end of file
+    scalars_.push_back({std::make_unique<TTreeReaderValue<Double_t>>(*ptree_reader_, branch_name), column.offset, column.width});
+}
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include "EventBuilder.hpp"
+#include "DAQModule.hpp"
+#include "Run.hpp"
+
+EventBuilder::EventBuilder(const Run *prun, const ChannelIndex &channel_index, Double_t window, const TString &timestamp_filter, const TString &time_filter)
+    : channel_index_(channel_index), window_(window), timestamp_scale_(1), channel_time_scale_(1), timestamp_wrap_(0),
+      streams_(), pending_(), merged_(), active_columns_(), primed_(false), event_(&channel_index),
+      event_time_(std::numeric_limits<Double_t>::quiet_NaN()), n_built_(0), n_fragments_(0)
+{
+    if (window_ < 0)
+    {
+        throw std::runtime_error(Form("Event build window must not be negative, got %g", window_));
+    }
+
+    // Every module gets its own chain and readers, so the streams can be at different entries of the tree
+    streams_.reserve(channel_index_.getDAQModules().size());
+    for (DAQModule *pmodule : channel_index_.getDAQModules())
+    {
+        Stream stream;
+        stream.pmodule = pmodule;
+        stream.pchain = prun->openChain();
+        stream.ptree_reader = std::make_unique<TTreeReader>(stream.pchain.get());
+        stream.pread_counter = std::make_unique<ReadCounter>(*stream.ptree_reader);
+        stream.pchannel_index = std::make_unique<ChannelIndex>(std::vector<DAQModule *>{pmodule});
+        stream.timestamp_column = stream.pchannel_index->findColumn(pmodule, timestamp_filter);
+        if (stream.timestamp_column < 0)
+        {
+            throw std::runtime_error(Form("Module %s has no %s filter, its events cannot be built", pmodule->getName().Data(), timestamp_filter.Data()));
+        }
+        stream.timestamp_handle = stream.pchannel_index->getHandle(pmodule, timestamp_filter);
+        stream.time_column = stream.pchannel_index->findColumn(pmodule, time_filter);
+
+        // Columns are laid out in module order, so the module's columns are one contiguous range of the built event
+        stream.offset = channel_index_.getColumns()[channel_index_.findColumn(pmodule, stream.pchannel_index->getColumns().front().filter)].offset;
+        stream.last_timestamp = -std::numeric_limits<Double_t>::infinity();
+        stream.epoch = 0;
+        stream.time = 0;
+        streams_.push_back(std::move(stream));
+    }
+    merged_.assign(streams_.size(), 0);
+}
+
+EventBuilder::~EventBuilder()
+{
+}
+
+void EventBuilder::setActiveColumns(const std::vector<UChar_t> &active_columns)
+{
+    if (primed_)
+    {
+        throw std::logic_error("Active columns of an event builder are set before its first event");
+    }
+    if (!active_columns.empty() && active_columns.size() != channel_index_.getColumns().size())
+    {
+        throw std::invalid_argument(Form("%zu active columns for a channel index of %zu columns", active_columns.size(), channel_index_.getColumns().size()));
+    }
+    active_columns_ = active_columns;
+}
+
+void EventBuilder::bindStream(Stream &stream)
+{
+    // Every stream reads the whole tree, so only the module's own branches are enabled on its chain, the baskets of the
+    // other modules are neither fetched nor decompressed by this stream. Of those, only the columns some task reads are
+    // enabled, and the timestamp and channel times the fragments are merged by.
+    const std::vector<ChannelIndex::Column> &columns = stream.pchannel_index->getColumns();
+    std::vector<UChar_t> module_columns(columns.size(), 1);
+    for (size_t i = 0; i < columns.size() && !active_columns_.empty(); ++i)
+    {
+        const Bool_t merged_by = Int_t(i) == stream.timestamp_column || Int_t(i) == stream.time_column;
+        module_columns[i] = merged_by || active_columns_[channel_index_.findColumn(stream.pmodule, columns[i].filter)];
+    }
+    stream.pevent = std::make_unique<Event>(stream.pchannel_index.get(), stream.ptree_reader.get(), &module_columns);
+}
+
+const Long64_t EventBuilder::getBytesRead() const
+{
+    Long64_t bytes_read = 0;
+    for (const Stream &stream : streams_)
+    {
+        bytes_read += stream.pread_counter->getBytesRead();
+    }
+    return bytes_read;
+}
+
+Bool_t EventBuilder::advance(Stream &stream)
+{
+    // Move the stream to the next entry in which its module was read out
+    while (stream.ptree_reader->Next())
+    {
+        stream.pevent->readEntry();
+        stream.pread_counter->update();
+        const std::vector<Double_t> &values = stream.pevent->getValues();
+        Double_t timestamp = values[stream.timestamp_handle];
+        if (std::isnan(timestamp))
+        {
+            continue;
+        }
+
+        // A timestamp more than half the range below the previous one has wrapped
+        if (timestamp_wrap_ > 0 && timestamp < stream.last_timestamp - 0.5 * timestamp_wrap_)
+        {
+            stream.epoch += timestamp_wrap_;
+        }
+        stream.last_timestamp = timestamp;
+        timestamp += stream.epoch;
+
+        // The earliest channel time of the fragment, fmin skips the NaNs of channels without a hit
+        Double_t first_time = std::numeric_limits<Double_t>::infinity();
+        if (stream.time_column >= 0)
+        {
+            const ChannelIndex::Column &column = stream.pchannel_index->getColumns()[stream.time_column];
+            for (UInt_t i = 0; i < column.width; ++i)
+            {
+                first_time = std::fmin(first_time, values[column.offset + i]);
+            }
+        }
+        if (std::isinf(first_time))
+        {
+            first_time = 0;
+        }
+
+        stream.time = timestamp_scale_ * timestamp + channel_time_scale_ * first_time;
+        return kTRUE;
+    }
+    return kFALSE;
+}
+
+Bool_t EventBuilder::next()
+{
+    // The streams are bound and primed on the first call, so the time scales and active columns may be set after
+    // construction
+    if (!primed_)
+    {
+        for (UInt_t i = 0; i < streams_.size(); ++i)
+        {
+            bindStream(streams_[i]);
+            if (advance(streams_[i]))
+            {
+                pending_.push({streams_[i].time, i});
+            }
+        }
+        primed_ = kTRUE;
+    }
+    if (pending_.empty())
+    {
+        return kFALSE;
+    }
+
+    std::fill(event_.values_.begin(), event_.values_.end(), std::numeric_limits<Double_t>::quiet_NaN());
+    event_time_ = pending_.top().time;
+    const Double_t window_end = event_time_ + window_;
+    while (!pending_.empty() && pending_.top().time <= window_end)
+    {
+        // A second fragment of a module already in the event starts the next event
+        const UInt_t i = pending_.top().stream;
+        if (merged_[i])
+        {
+            break;
+        }
+        pending_.pop();
+
+        Stream &stream = streams_[i];
+        std::copy_n(stream.pevent->getValues().data(), stream.pchannel_index->getSize(), event_.values_.data() + stream.offset);
+        merged_[i] = 1;
+        ++n_fragments_;
+
+        if (advance(stream))
+        {
+            pending_.push({stream.time, i});
+        }
+    }
+    std::fill(merged_.begin(), merged_.end(), 0);
+
+    ++n_built_;
+    return kTRUE;
+}
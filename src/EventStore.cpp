@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <RZip.h>
+#include <TH1D.h>
+#include <TObjArray.h>
+#include <TROOT.h>
+#include <ROOT/TThreadExecutor.hxx>
+#include "EventStore.hpp"
+#include "SlotStack.hpp"
+
+// Helpers
+
+namespace
+{
+    const char STORE_MAGIC[8] = {'C', 'S', 'E', 'V', 'S', 'T', 'R', '1'};
+
+    // Uncompressed size of a block's hit section: event offsets, energies and detectors
+    ULong64_t getHitsBytes(const EventStore::BlockRecord &record)
+    {
+        return sizeof(UInt_t) * (ULong64_t(record.n_events) + 1) + (sizeof(Float_t) + sizeof(UShort_t)) * ULong64_t(record.n_hits);
+    }
+
+    // Uncompressed size of a block's index section: keys, key offsets and postings
+    ULong64_t getIndexBytes(const EventStore::BlockRecord &record)
+    {
+        return sizeof(UInt_t) * (2 * ULong64_t(record.n_keys) + 1 + record.n_hits);
+    }
+}
+
+EventStore::EventStore(const TString &file_name)
+    : file_name_(file_name), pdata_(nullptr), size_(0), pheader_(nullptr), pblocks_(nullptr), detector_names_()
+{
+    const int fd = ::open(file_name.Data(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Error opening event store: " + file_name);
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0 || size_t(file_stat.st_size) < sizeof(FileHeader))
+    {
+        ::close(fd);
+        throw std::runtime_error("Invalid event store: " + file_name);
+    }
+    size_ = file_stat.st_size;
+    void *pmapping = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (pmapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Error mapping event store: " + file_name);
+    }
+    pdata_ = static_cast<const char *>(pmapping);
+
+    // Gates read the summaries of all blocks but the sections of only a few, in no particular order
+    ::madvise(pmapping, size_, MADV_RANDOM);
+
+    // Every size and position the gates rely on is checked against the mapping once, so a truncated or damaged file
+    // is refused here instead of being read past its end
+    try
+    {
+        validate();
+    }
+    catch (...)
+    {
+        ::munmap(pmapping, size_);
+        pdata_ = nullptr;
+        throw;
+    }
+}
+
+EventStore::~EventStore()
+{
+    if (pdata_)
+    {
+        ::munmap(const_cast<char *>(pdata_), size_);
+    }
+}
+
+void EventStore::validate()
+{
+    const std::runtime_error invalid("Invalid or incompatible event store: " + file_name_);
+    // Section of n_bytes at offset lies within the mapping
+    auto within = [this](ULong64_t offset, ULong64_t n_bytes)
+    { return offset <= size_ && n_bytes <= size_ - offset; };
+
+    pheader_ = reinterpret_cast<const FileHeader *>(pdata_);
+    const ULong64_t n_keys = ULong64_t(pheader_->n_detectors) * pheader_->n_buckets;
+    if (std::memcmp(pheader_->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || pheader_->version != VERSION_ || pheader_->n_buckets == 0 ||
+        pheader_->n_detectors > 65536 || n_keys > 0xFFFFFFFFull || pheader_->index_offset % alignof(BlockRecord) != 0 ||
+        !within(pheader_->index_offset, ULong64_t(pheader_->n_blocks) * sizeof(BlockRecord)))
+    {
+        throw invalid;
+    }
+    pblocks_ = reinterpret_cast<const BlockRecord *>(pdata_ + pheader_->index_offset);
+
+    // Detector table: the length prefixed names
+    ULong64_t position = sizeof(FileHeader);
+    for (UInt_t i = 0; i < pheader_->n_detectors; ++i)
+    {
+        UInt_t length;
+        if (!within(position, sizeof(length)))
+        {
+            throw invalid;
+        }
+        std::memcpy(&length, pdata_ + position, sizeof(length));
+        position += sizeof(length);
+        if (!within(position, length))
+        {
+            throw invalid;
+        }
+        detector_names_.emplace_back(std::string(pdata_ + position, length));
+        position += length;
+    }
+
+    // Blocks: the sections within the file, uncompressed ones of exactly their size and aligned to be used in place
+    const ULong64_t summary_bytes = (n_keys + 63) / 64 * sizeof(ULong64_t);
+    ULong64_t n_events = 0;
+    ULong64_t n_hits = 0;
+    for (UInt_t block = 0; block < pheader_->n_blocks; ++block)
+    {
+        const BlockRecord &record = pblocks_[block];
+        auto section_valid = [&](ULong64_t offset, UInt_t stored_bytes, ULong64_t raw_bytes, Codec codec)
+        {
+            if (codec == Codec::kNone)
+                return offset % sizeof(ULong64_t) == 0 && stored_bytes == raw_bytes && within(offset, stored_bytes);
+            return codec == Codec::kLZ4 && raw_bytes <= 0x7FFFFFFFull && within(offset, stored_bytes);
+        };
+        if (record.summary_offset % sizeof(ULong64_t) != 0 || !within(record.summary_offset, summary_bytes) ||
+            !section_valid(record.hits_offset, record.hits_bytes, getHitsBytes(record), record.hits_codec) ||
+            !section_valid(record.index_offset, record.index_bytes, getIndexBytes(record), record.index_codec))
+        {
+            throw invalid;
+        }
+        n_events += record.n_events;
+        n_hits += record.n_hits;
+    }
+    if (n_events != pheader_->n_events || n_hits != pheader_->n_hits)
+    {
+        throw invalid;
+    }
+}
+
+const Int_t EventStore::findDetector(const TString &detector_name) const
+{
+    for (size_t i = 0; i < detector_names_.size(); ++i)
+    {
+        if (detector_names_[i] == detector_name)
+        {
+            return i;
+        }
+    }
+    return -1; // Return -1 if the detector is not found
+}
+
+UInt_t EventStore::findBucket(Double_t energy, Double_t energy_low, Double_t energy_up, UInt_t n_buckets)
+{
+    // Below the range and NaN go to the first bucket, at or above it to the last
+    if (!(energy > energy_low))
+        return 0;
+    if (energy >= energy_up)
+        return n_buckets - 1;
+    return std::min<UInt_t>((energy - energy_low) / (energy_up - energy_low) * n_buckets, n_buckets - 1);
+}
+
+std::vector<EventStore::Gate> EventStore::parseGates(const TString &gate_string)
+{
+    // Comma separated windows low:up, each optionally restricted to one detector as low:up@detector
+    std::vector<Gate> gates;
+    std::unique_ptr<TObjArray> ptokens(gate_string.Tokenize(","));
+    for (Int_t i = 0; ptokens && i < ptokens->GetEntriesFast(); ++i)
+    {
+        TString token = ptokens->At(i)->GetName();
+        Gate gate;
+        const Ssiz_t at = token.Index("@");
+        if (at != kNPOS)
+        {
+            gate.detector = token(at + 1, token.Length());
+            token.Remove(at);
+        }
+        const Ssiz_t colon = token.Index(":");
+        if (colon == kNPOS)
+        {
+            throw std::invalid_argument("Gate " + token + " is not of the form low:up[@detector]");
+        }
+        gate.low = TString(token(0, colon)).Atof();
+        gate.up = TString(token(colon + 1, token.Length())).Atof();
+        if (!(gate.up > gate.low))
+        {
+            throw std::invalid_argument("Gate " + token + " has no width");
+        }
+        gate.name = Form("gate_%g_%g", gate.low, gate.up);
+        if (!gate.detector.IsNull())
+        {
+            gate.name += "_" + gate.detector;
+        }
+        gates.push_back(gate);
+    }
+    if (gates.empty())
+    {
+        throw std::invalid_argument("No gates in " + gate_string);
+    }
+    return gates;
+}
+
+const char *EventStore::readSection(ULong64_t offset, UInt_t stored_bytes, size_t raw_bytes, Codec codec, std::vector<char> &scratch) const
+{
+    // Uncompressed sections are used in place, they start on 8 byte boundaries within the page aligned mapping
+    if (codec == Codec::kNone)
+    {
+        return pdata_ + offset;
+    }
+    scratch.resize(raw_bytes);
+    Int_t src_size = stored_bytes;
+    Int_t tgt_size = raw_bytes;
+    Int_t n_unzipped = 0;
+    R__unzip(&src_size, reinterpret_cast<unsigned char *>(const_cast<char *>(pdata_ + offset)), &tgt_size, reinterpret_cast<unsigned char *>(scratch.data()), &n_unzipped);
+    if (size_t(n_unzipped) != raw_bytes)
+    {
+        throw std::runtime_error(Form("Corrupt section at %llu in event store %s", offset, file_name_.Data()));
+    }
+    return scratch.data();
+}
+
+Long64_t EventStore::gate(const std::vector<Gate> &gates, const std::vector<TH1D *> &spectra, Bool_t parallel) const
+{
+    // Every hit within a gate adds all other hits of its event to the gate's spectrum, like gating the symmetric
+    // gamma-gamma matrix. Blocks are gated independently, each slot into its own bin contents, which are added to the
+    // spectra in slot order at the end. Returns the number of events selected, counted once per gate.
+    if (gates.size() != spectra.size())
+    {
+        throw std::invalid_argument(Form("%zu gates but %zu spectra", gates.size(), spectra.size()));
+    }
+    std::vector<ResolvedGate> resolved;
+    for (const Gate &gate : gates)
+    {
+        const Int_t detector = gate.detector.IsNull() ? -1 : findDetector(gate.detector);
+        if (!gate.detector.IsNull() && detector < 0)
+        {
+            throw std::out_of_range("No detector " + gate.detector + " in event store " + file_name_);
+        }
+        resolved.push_back({gate.low, gate.up, detector,
+                            findBucket(gate.low, pheader_->energy_low, pheader_->energy_up, pheader_->n_buckets),
+                            findBucket(gate.up, pheader_->energy_low, pheader_->energy_up, pheader_->n_buckets)});
+    }
+
+    const UInt_t n_slots = parallel && ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1;
+    std::vector<QueryBuffers> slot_buffers(n_slots);
+    for (QueryBuffers &buffers : slot_buffers)
+    {
+        buffers.candidates.resize(gates.size());
+        buffers.n_fills.assign(gates.size(), 0.);
+        for (TH1D *pspectrum : spectra)
+        {
+            buffers.contents.emplace_back(pspectrum->GetNbinsX() + 2, 0.);
+        }
+    }
+
+    if (n_slots > 1 && pheader_->n_blocks > 1)
+    {
+        SlotStack slot_stack(n_slots);
+        ROOT::TThreadExecutor executor;
+        executor.Foreach([&](UInt_t block)
+                         {
+            const UInt_t slot = slot_stack.acquireSlot();
+            try
+            {
+                gateBlock(block, resolved, spectra, slot_buffers[slot]);
+            }
+            catch (...)
+            {
+                slot_stack.releaseSlot(slot);
+                throw;
+            }
+            slot_stack.releaseSlot(slot); },
+                         ROOT::TSeqU(pheader_->n_blocks));
+    }
+    else
+    {
+        for (UInt_t block = 0; block < pheader_->n_blocks; ++block)
+        {
+            gateBlock(block, resolved, spectra, slot_buffers[0]);
+        }
+    }
+
+    // The bin statistics are recomputed from the bin contents, as if every fill had been at its bin centre
+    Long64_t n_gated = 0;
+    for (size_t g = 0; g < gates.size(); ++g)
+    {
+        Double_t n_fills = 0;
+        for (const QueryBuffers &buffers : slot_buffers)
+        {
+            for (size_t bin = 0; bin < buffers.contents[g].size(); ++bin)
+            {
+                if (buffers.contents[g][bin] > 0)
+                    spectra[g]->AddBinContent(bin, buffers.contents[g][bin]);
+            }
+            n_fills += buffers.n_fills[g];
+        }
+        if (n_fills > 0)
+        {
+            const Double_t previous_entries = spectra[g]->GetEntries();
+            spectra[g]->ResetStats();
+            spectra[g]->SetEntries(previous_entries + n_fills);
+        }
+    }
+    for (const QueryBuffers &buffers : slot_buffers)
+    {
+        n_gated += buffers.n_gated;
+    }
+    return n_gated;
+}
+
+void EventStore::gateBlock(UInt_t block, const std::vector<ResolvedGate> &gates, const std::vector<TH1D *> &spectra, QueryBuffers &buffers) const
+{
+    const BlockRecord &record = pblocks_[block];
+    const UInt_t n_buckets = pheader_->n_buckets;
+    const UInt_t n_detectors = pheader_->n_detectors;
+    const ULong64_t *summary = reinterpret_cast<const ULong64_t *>(pdata_ + record.summary_offset);
+    auto detector_range = [n_detectors](const ResolvedGate &gate)
+    { return gate.detector < 0 ? std::make_pair(0u, n_detectors) : std::make_pair(UInt_t(gate.detector), UInt_t(gate.detector) + 1); };
+
+    // The summary decides which gates can match at all, without decompressing anything
+    Bool_t any_open = kFALSE;
+    std::vector<UChar_t> open(gates.size(), 0);
+    for (size_t g = 0; g < gates.size(); ++g)
+    {
+        const auto [first_detector, last_detector] = detector_range(gates[g]);
+        for (UInt_t detector = first_detector; detector < last_detector && !open[g]; ++detector)
+        {
+            for (UInt_t key = detector * n_buckets + gates[g].first_bucket; key <= detector * n_buckets + gates[g].last_bucket; ++key)
+            {
+                if (summary[key / 64] >> (key % 64) & 1)
+                {
+                    open[g] = 1;
+                    break;
+                }
+            }
+        }
+        any_open |= open[g];
+    }
+    if (!any_open)
+        return;
+
+    // Candidate events of every open gate from the posting lists of its keys
+    const UInt_t *keys = reinterpret_cast<const UInt_t *>(readSection(record.index_offset, record.index_bytes, getIndexBytes(record), record.index_codec, buffers.index));
+    const UInt_t *key_offsets = keys + record.n_keys;
+    const UInt_t *postings = key_offsets + record.n_keys + 1;
+    Bool_t any_candidate = kFALSE;
+    for (size_t g = 0; g < gates.size(); ++g)
+    {
+        std::vector<UInt_t> &candidates = buffers.candidates[g];
+        candidates.clear();
+        if (!open[g])
+            continue;
+        const auto [first_detector, last_detector] = detector_range(gates[g]);
+        for (UInt_t detector = first_detector; detector < last_detector; ++detector)
+        {
+            const UInt_t last_key = detector * n_buckets + gates[g].last_bucket;
+            for (const UInt_t *pkey = std::lower_bound(keys, keys + record.n_keys, detector * n_buckets + gates[g].first_bucket);
+                 pkey != keys + record.n_keys && *pkey <= last_key; ++pkey)
+            {
+                const size_t k = pkey - keys;
+                if (key_offsets[k] > key_offsets[k + 1] || key_offsets[k + 1] > record.n_hits)
+                {
+                    throw std::runtime_error(Form("Corrupt index of block %u in event store %s", block, file_name_.Data()));
+                }
+                candidates.insert(candidates.end(), postings + key_offsets[k], postings + key_offsets[k + 1]);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        if (!candidates.empty() && candidates.back() >= record.n_events)
+        {
+            throw std::runtime_error(Form("Corrupt index of block %u in event store %s", block, file_name_.Data()));
+        }
+        any_candidate |= !candidates.empty();
+    }
+    if (!any_candidate)
+        return;
+
+    // Only the candidate events are looked at, with their exact energies
+    const size_t offsets_bytes = sizeof(UInt_t) * (size_t(record.n_events) + 1);
+    const char *phits = readSection(record.hits_offset, record.hits_bytes, getHitsBytes(record), record.hits_codec, buffers.hits);
+    const UInt_t *event_offsets = reinterpret_cast<const UInt_t *>(phits);
+    const Float_t *energies = reinterpret_cast<const Float_t *>(phits + offsets_bytes);
+    const UShort_t *detectors = reinterpret_cast<const UShort_t *>(phits + offsets_bytes + sizeof(Float_t) * record.n_hits);
+    for (size_t g = 0; g < gates.size(); ++g)
+    {
+        const ResolvedGate &gate = gates[g];
+        const TAxis *paxis = spectra[g]->GetXaxis();
+        std::vector<Double_t> &contents = buffers.contents[g];
+        for (UInt_t event : buffers.candidates[g])
+        {
+            if (event_offsets[event] > event_offsets[event + 1] || event_offsets[event + 1] > record.n_hits)
+            {
+                throw std::runtime_error(Form("Corrupt hits of block %u in event store %s", block, file_name_.Data()));
+            }
+            Bool_t gated = kFALSE;
+            for (UInt_t i = event_offsets[event]; i < event_offsets[event + 1]; ++i)
+            {
+                if (energies[i] < gate.low || energies[i] >= gate.up || (gate.detector >= 0 && detectors[i] != gate.detector))
+                    continue;
+                gated = kTRUE;
+                for (UInt_t j = event_offsets[event]; j < event_offsets[event + 1]; ++j)
+                {
+                    if (j != i)
+                    {
+                        contents[paxis->FindFixBin(energies[j])] += 1;
+                        buffers.n_fills[g] += 1;
+                    }
+                }
+            }
+            buffers.n_gated += gated;
+        }
+    }
+}
+
+void EventStore::printInfo() const
+{
+    std::cout << "CloverSort [INFO]: Event store " << file_name_ << ": " << pheader_->n_events << " events, " << pheader_->n_hits << " hits of "
+              << pheader_->n_detectors << " detectors in " << pheader_->n_blocks << " block(s), " << pheader_->n_buckets << " buckets over ["
+              << pheader_->energy_low << ", " << pheader_->energy_up << ")" << std::endl;
+}
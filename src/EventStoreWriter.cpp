@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <Compression.h>
+#include <RZip.h>
+#include <TSystem.h>
+#include "EventStoreWriter.hpp"
+
+// Helpers
+
+namespace
+{
+    const char STORE_MAGIC[8] = {'C', 'S', 'E', 'V', 'S', 'T', 'R', '1'};
+    const char PADDING[8] = {};
+
+    template <typename T>
+    char *appendValues(const T *values, size_t n, char *out)
+    {
+        std::memcpy(out, values, n * sizeof(T));
+        return out + n * sizeof(T);
+    }
+
+    // Keep the section uncompressed unless compression makes it smaller
+    EventStore::Codec compressSection(const std::vector<char> &section, std::vector<char> &compressed)
+    {
+        if (section.empty())
+            return EventStore::Codec::kNone;
+        compressed.resize(section.size());
+        Int_t src_size = section.size();
+        Int_t tgt_size = compressed.size();
+        Int_t n_zipped = 0;
+        R__zipMultipleAlgorithm(1, &src_size, const_cast<char *>(section.data()), &tgt_size, compressed.data(), &n_zipped, ROOT::RCompressionSetting::EAlgorithm::kLZ4);
+        if (n_zipped > 0 && size_t(n_zipped) < section.size())
+        {
+            compressed.resize(n_zipped);
+            return EventStore::Codec::kLZ4;
+        }
+        return EventStore::Codec::kNone;
+    }
+}
+
+EventStoreWriter::EventStoreWriter(const TString &file_name, const std::vector<TString> &detector_names, Double_t energy_low, Double_t energy_up,
+                                   UInt_t n_buckets, UInt_t min_hits)
+    : file_name_(file_name), temp_file_name_(file_name + ".part"), detector_names_(detector_names), min_hits_(std::max(min_hits, 1u)),
+      block_events_(65536), header_{}, blocks_(), out_(), write_mutex_(), slots_()
+{
+    if (detector_names_.empty() || detector_names_.size() > 65536)
+    {
+        throw std::invalid_argument(Form("Event store %s needs 1 to 65536 detectors, got %zu", file_name.Data(), detector_names_.size()));
+    }
+    if (n_buckets == 0 || !(energy_up > energy_low))
+    {
+        throw std::invalid_argument(Form("Event store %s needs at least one bucket over a non-empty energy range", file_name.Data()));
+    }
+
+    const TString dir_name = gSystem->GetDirName(file_name);
+    if (!dir_name.IsNull() && dir_name != ".")
+    {
+        gSystem->mkdir(dir_name, kTRUE);
+    }
+    out_.open(temp_file_name_.Data(), std::ios::binary | std::ios::trunc);
+    if (!out_)
+    {
+        throw std::runtime_error("Error creating event store: " + temp_file_name_);
+    }
+
+    // The header is written again by close(), once the counts and the block table are known
+    std::memcpy(header_.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    header_.version = EventStore::VERSION_;
+    header_.n_detectors = detector_names_.size();
+    header_.n_buckets = n_buckets;
+    header_.energy_low = energy_low;
+    header_.energy_up = energy_up;
+    out_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+    for (const TString &detector_name : detector_names_)
+    {
+        const UInt_t length = detector_name.Length();
+        out_.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        out_.write(detector_name.Data(), length);
+    }
+}
+
+EventStoreWriter::~EventStoreWriter()
+{
+    // Without close() the sort did not finish, the partial store is removed so it is never taken for a complete one
+    if (!out_.is_open())
+        return;
+    out_.close();
+    gSystem->Unlink(temp_file_name_);
+    std::cerr << "CloverSort [WARN]: Event store " << file_name_ << " was not closed, partial file removed" << std::endl;
+}
+
+void EventStoreWriter::initializeSlots(UInt_t n_slots)
+{
+    // Called before the event loop, blocks still open from an earlier loop are written first
+    if (!out_.is_open())
+    {
+        throw std::runtime_error("Event store " + file_name_ + " is already closed");
+    }
+    for (Slot &slot : slots_)
+    {
+        writeBlock(slot);
+    }
+
+    const size_t n_words = (size_t(header_.n_detectors) * header_.n_buckets + 63) / 64;
+    slots_.resize(n_slots);
+    for (Slot &slot : slots_)
+    {
+        slot.event_offsets.assign(1, 0);
+        slot.summary.assign(n_words, 0);
+    }
+}
+
+void EventStoreWriter::fill(const Double_t *energies, UInt_t slot)
+{
+    // energies holds one value per detector, NaN where the detector has no hit, e.g. the energies of an add-back product
+    UInt_t n_hits = 0;
+    for (UInt_t detector = 0; detector < header_.n_detectors; ++detector)
+    {
+        n_hits += !std::isnan(energies[detector]);
+    }
+    if (n_hits < min_hits_)
+        return;
+
+    Slot &state = slots_[slot];
+    for (UInt_t detector = 0; detector < header_.n_detectors; ++detector)
+    {
+        if (std::isnan(energies[detector]))
+            continue;
+        state.energies.push_back(energies[detector]);
+        state.detectors.push_back(detector);
+    }
+    state.event_offsets.push_back(state.energies.size());
+    if (state.event_offsets.size() > block_events_ || state.energies.size() >= MAX_BLOCK_HITS_)
+    {
+        writeBlock(state);
+    }
+}
+
+void EventStoreWriter::writeBlock(Slot &slot)
+{
+    // The index is built and the sections compressed on the slot's worker, only appending them takes the lock
+    const UInt_t n_events = slot.event_offsets.size() - 1;
+    const UInt_t n_hits = slot.energies.size();
+    if (n_events == 0)
+        return;
+
+    // Hits sorted by key, events ascend within a key since they were added in order
+    const UInt_t n_buckets = header_.n_buckets;
+    slot.key_hits.clear();
+    for (UInt_t event = 0; event < n_events; ++event)
+    {
+        for (UInt_t hit = slot.event_offsets[event]; hit < slot.event_offsets[event + 1]; ++hit)
+        {
+            const UInt_t key = slot.detectors[hit] * n_buckets + EventStore::findBucket(slot.energies[hit], header_.energy_low, header_.energy_up, n_buckets);
+            slot.key_hits.emplace_back(key, event);
+            slot.summary[key / 64] |= ULong64_t(1) << (key % 64);
+        }
+    }
+    std::sort(slot.key_hits.begin(), slot.key_hits.end());
+
+    std::vector<UInt_t> keys, key_offsets;
+    for (UInt_t hit = 0; hit < n_hits; ++hit)
+    {
+        if (keys.empty() || keys.back() != slot.key_hits[hit].first)
+        {
+            keys.push_back(slot.key_hits[hit].first);
+            key_offsets.push_back(hit);
+        }
+    }
+    key_offsets.push_back(n_hits);
+
+    slot.hits.resize(sizeof(UInt_t) * (size_t(n_events) + 1) + (sizeof(Float_t) + sizeof(UShort_t)) * size_t(n_hits));
+    char *phits = appendValues(slot.event_offsets.data(), slot.event_offsets.size(), slot.hits.data());
+    phits = appendValues(slot.energies.data(), n_hits, phits);
+    appendValues(slot.detectors.data(), n_hits, phits);
+
+    slot.index.resize(sizeof(UInt_t) * (keys.size() + key_offsets.size() + n_hits));
+    char *pindex = appendValues(keys.data(), keys.size(), slot.index.data());
+    pindex = appendValues(key_offsets.data(), key_offsets.size(), pindex);
+    for (const auto &key_hit : slot.key_hits)
+    {
+        pindex = appendValues(&key_hit.second, 1, pindex);
+    }
+
+    EventStore::BlockRecord record{};
+    record.n_events = n_events;
+    record.n_hits = n_hits;
+    record.n_keys = keys.size();
+    record.hits_codec = compressSection(slot.hits, slot.hits_zipped);
+    record.index_codec = compressSection(slot.index, slot.index_zipped);
+    const std::vector<char> &hits = record.hits_codec == EventStore::Codec::kLZ4 ? slot.hits_zipped : slot.hits;
+    const std::vector<char> &index = record.index_codec == EventStore::Codec::kLZ4 ? slot.index_zipped : slot.index;
+    record.hits_bytes = hits.size();
+    record.index_bytes = index.size();
+
+    {
+        // Sections start on 8 byte boundaries, so uncompressed ones can be used in place
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        auto write_aligned = [this](const char *data, size_t n_bytes)
+        {
+            const std::streamoff position = out_.tellp();
+            const std::streamoff padding = (8 - position % 8) % 8;
+            out_.write(PADDING, padding);
+            out_.write(data, n_bytes);
+            return ULong64_t(position + padding);
+        };
+        record.summary_offset = write_aligned(reinterpret_cast<const char *>(slot.summary.data()), slot.summary.size() * sizeof(ULong64_t));
+        record.hits_offset = write_aligned(hits.data(), hits.size());
+        record.index_offset = write_aligned(index.data(), index.size());
+        blocks_.push_back(record);
+        header_.n_events += n_events;
+        header_.n_hits += n_hits;
+        ++header_.n_blocks;
+    }
+
+    slot.event_offsets.assign(1, 0);
+    slot.energies.clear();
+    slot.detectors.clear();
+    std::fill(slot.summary.begin(), slot.summary.end(), 0);
+}
+
+void EventStoreWriter::close()
+{
+    // Called once no slot fills any more, writes the open blocks, the block table and the final header
+    if (!out_.is_open())
+        return;
+    for (Slot &slot : slots_)
+    {
+        writeBlock(slot);
+    }
+    slots_.clear();
+
+    const std::streamoff position = out_.tellp();
+    const std::streamoff padding = (8 - position % 8) % 8;
+    out_.write(PADDING, padding);
+    header_.index_offset = position + padding;
+    out_.write(reinterpret_cast<const char *>(blocks_.data()), blocks_.size() * sizeof(EventStore::BlockRecord));
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+    out_.close();
+    if (!out_ || std::rename(temp_file_name_.Data(), file_name_.Data()) != 0)
+    {
+        throw std::runtime_error("Error writing event store: " + file_name_);
+    }
+
+    std::cout << "CloverSort [INFO]: Event store " << file_name_ << " written, " << header_.n_events << " events with " << header_.n_hits << " hits in " << header_.n_blocks << " block(s)" << std::endl;
+}
@@ -1,8 +1,14 @@
+#include <algorithm>
+#include <cctype>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <TROOT.h>
+#include <TRegexp.h>
+#include <TSystem.h>
+#include <ROOT/TThreadExecutor.hxx>
 #include "Experiment.hpp"
 #include "DAQModule.hpp"
 #include "Detector.hpp"
@@ -39,6 +45,97 @@ std::vector<Int_t> parseNumberString(const TString &number_string)
     return numbers;
 }
 
+// Whether a byte of a name is a decimal digit, isdigit() is undefined for the negative chars of non-ASCII bytes
+Bool_t isDigit(char c)
+{
+    return isdigit(static_cast<unsigned char>(c));
+}
+
+// Orders names like a person would, runs of digits compare by their value, e.g. _part2 before _part10
+Bool_t naturalLess(const TString &a, const TString &b)
+{
+    Ssiz_t i = 0, j = 0;
+    while (i < a.Length() && j < b.Length())
+    {
+        if (!isDigit(a[i]) || !isDigit(b[j]))
+        {
+            if (a[i] != b[j])
+                return a[i] < b[j];
+            ++i;
+            ++j;
+            continue;
+        }
+        while (i < a.Length() && a[i] == '0')
+            ++i;
+        while (j < b.Length() && b[j] == '0')
+            ++j;
+        Ssiz_t end_a = i, end_b = j;
+        while (end_a < a.Length() && isDigit(a[end_a]))
+            ++end_a;
+        while (end_b < b.Length() && isDigit(b[end_b]))
+            ++end_b;
+        if (end_a - i != end_b - j)
+            return end_a - i < end_b - j;
+        for (; i < end_a; ++i, ++j)
+        {
+            if (a[i] != b[j])
+                return a[i] < b[j];
+        }
+    }
+    return a.Length() - i < b.Length() - j;
+}
+
+// Names of the parts of a run. +++ stands for the part number, 001, 002, ... up to the first part that does not exist.
+// Wildcards (* ? [...]) in the file name are matched in its directory, the parts are taken in natural order of their
+// names (_part2 before _part10). Hist files next to the parts (*_hists.root) are no parts, even if they match.
+// A file name that is neither stays a single part, as does one that matches nothing, so the error shows when it is read
+std::vector<TString> expandFileName(const TString &file_name)
+{
+    std::vector<TString> file_names;
+    if (file_name.Contains("+++"))
+    {
+        for (Int_t part = 1;; ++part)
+        {
+            TString part_name = file_name;
+            part_name.ReplaceAll("+++", Form("%03d", part));
+            if (gSystem->AccessPathName(part_name)) // kTRUE if the file does not exist
+            {
+                if (file_names.empty())
+                    file_names.push_back(part_name);
+                break;
+            }
+            file_names.push_back(part_name);
+        }
+        return file_names;
+    }
+
+    const TString base_name = gSystem->BaseName(file_name);
+    if (file_name.Contains("://") || base_name.First("*?[") == kNPOS)
+    {
+        return {file_name};
+    }
+
+    const TString dir_name = gSystem->GetDirName(file_name);
+    const TRegexp wildcard(base_name, kTRUE);
+    if (void *pdir = gSystem->OpenDirectory(dir_name))
+    {
+        while (const char *entry = gSystem->GetDirEntry(pdir))
+        {
+            const TString entry_name = entry;
+            if (entry_name.Index(wildcard) != kNPOS && !entry_name.EndsWith("_hists.root"))
+                file_names.push_back(dir_name + "/" + entry_name);
+        }
+        gSystem->FreeDirectory(pdir);
+    }
+    if (file_names.empty())
+    {
+        std::cerr << "CloverSort [WARN]: No file matches " << file_name << std::endl;
+        return {file_name};
+    }
+    std::sort(file_names.begin(), file_names.end(), naturalLess);
+    return file_names;
+}
+
 // Constructor
 Experiment::Experiment(const TString file_name)
     : file_name_(file_name),
@@ -77,9 +174,9 @@ Experiment::Experiment(const TString file_name)
             continue;
 
         // Check for section headers
-        if (trimmed_line == "ExperimentOptions" || trimmed_line == "DAQModules" || trimmed_line == "Detectors" || trimmed_line == "Runs")
+        if (trimmed_line == "Experiment" || trimmed_line == "ExperimentOptions" || trimmed_line == "DAQModules" || trimmed_line == "Detectors" || trimmed_line == "Runs")
         {
-            current_section = trimmed_line;
+            current_section = trimmed_line == "ExperimentOptions" ? "Experiment" : trimmed_line;
             // std::cout << "CloverSort [INFO]: Entering section " << current_section << std::endl;
             continue;
         }
@@ -101,6 +198,126 @@ Experiment::Experiment(const TString file_name)
             {
                 name_ = value.c_str();
             }
+            else if (option == "CalibrationFile")
+            {
+                calibration_file_name_ = value.c_str();
+            }
+            else if (option == "EventBuildWindow")
+            {
+                event_build_window_ = std::stod(value);
+            }
+            else if (option == "TimestampScale")
+            {
+                timestamp_scale_ = std::stod(value);
+            }
+            else if (option == "ChannelTimeScale")
+            {
+                channel_time_scale_ = std::stod(value);
+            }
+            else if (option == "TimestampWrap")
+            {
+                timestamp_wrap_ = std::stod(value);
+            }
+            else if (option == "ProfileSampling")
+            {
+                profile_sampling_ = std::stoul(value);
+            }
+            else if (option == "ProgressInterval")
+            {
+                progress_interval_ = std::stod(value);
+            }
+            else if (option == "ProfileFile")
+            {
+                profile_pattern_ = value.c_str();
+            }
+            else if (option == "TaskBatchSize")
+            {
+                task_batch_size_ = std::stoul(value);
+            }
+            else if (option == "StaticPipeline")
+            {
+                static_pipeline_ = std::stoi(value) != 0;
+            }
+            else if (option == "FollowInterval")
+            {
+                follow_interval_ = std::stod(value);
+            }
+            else if (option == "FollowTimeout")
+            {
+                follow_timeout_ = std::stod(value);
+            }
+            else if (option == "CheckpointFile")
+            {
+                checkpoint_pattern_ = value.c_str();
+            }
+            else if (option == "CheckpointInterval")
+            {
+                checkpoint_interval_ = std::stod(value);
+            }
+            else if (option == "PrefetchThreads")
+            {
+                prefetch_threads_ = std::stoul(value);
+            }
+            else if (option == "PrefetchDepth")
+            {
+                prefetch_depth_ = std::stoul(value);
+            }
+            else if (option == "SharedHistogramBins")
+            {
+                shared_histogram_bins_ = std::stoul(value);
+            }
+            else if (option == "SharedHistogramBuffer")
+            {
+                shared_histogram_buffer_ = std::stoul(value);
+            }
+            else if (option == "HistogramMemoryLimit")
+            {
+                histogram_memory_limit_ = std::stoul(value);
+            }
+            else if (option == "SkimFile")
+            {
+                skim_pattern_ = value.c_str();
+            }
+            else if (option == "SkimMinClovers")
+            {
+                skim_min_clovers_ = std::stoul(value);
+            }
+            else if (option == "SkimCompression")
+            {
+                skim_compression_ = value.c_str();
+            }
+            else if (option == "SkimCompressionLevel")
+            {
+                skim_compression_level_ = std::stoi(value);
+            }
+            else if (option == "EventStoreFile")
+            {
+                event_store_pattern_ = value.c_str();
+            }
+            else if (option == "EventStoreMinHits")
+            {
+                event_store_min_hits_ = std::stoul(value);
+            }
+            else if (option == "EventStoreBuckets")
+            {
+                event_store_buckets_ = std::stoul(value);
+            }
+            else if (option == "GateFile")
+            {
+                gate_file_name_ = value.c_str();
+            }
+            else if (option == "PromptWindow")
+            {
+                prompt_window_ = std::stod(value);
+            }
+            else if (option == "RandomWindowLow")
+            {
+                random_window_low_ = std::stod(value);
+            }
+            else if (option == "RandomWindowUp")
+            {
+                random_window_up_ = std::stod(value);
+            }
             // Other options (e.g. FilenamePattern) can be parsed similarly.
         }
         // Handle Module definitions
@@ -111,13 +328,14 @@ Experiment::Experiment(const TString file_name)
             if (!(iss >> module_name >> module_type))
                 continue;
 
-            // Check if module_name is in the list of valid module names
-            if (std::find(DAQModule::VALID_MODULE_TYPES_.begin(), DAQModule::VALID_MODULE_TYPES_.end(), module_type) == DAQModule::VALID_MODULE_TYPES_.end())
+            // The module type is picked at runtime from the descriptors of ModuleTypes.hpp
+            DAQModule *pmodule = nullptr;
+            if (!visitModuleType(module_type, [&](auto descriptor)
+                                 { pmodule = new DAQModule(module_name, descriptor); }))
             {
                 throw std::runtime_error("Unsupported module type: " + module_type);
             }
-            // Create a DAQModule object and parse filters
-            DAQModule *pmodule = new DAQModule(module_name, module_type);
+            // Parse the filters
             std::string filter;
             while (iss >> filter)
             {
@@ -167,7 +385,7 @@ Experiment::Experiment(const TString file_name)
             // Check for FilenamePattern line
             if (trimmed_line.find("FilenamePattern") == 0)
             {
-                // Format: FilenamePattern    /absolute/path/to/file---.root
+                // Format: FilenamePattern    /absolute/path/to/file---.root, file---_part+++.root or file---_part*.root
                 std::string keyword, pattern;
                 iss >> keyword;
                 std::getline(iss, pattern);
@@ -201,7 +419,8 @@ Experiment::Experiment(const TString file_name)
                     file_name = run_filename_pattern;
                 }
 
-                Run *prun = new Run(run_number, run_description, run_type, file_name, tree_name);
+                Run *prun = new Run(run_number, run_description, run_type, expandFileName(file_name), tree_name);
+                prun->file_pattern_ = file_name;
                 runs_.push_back(prun);
             }
         }
@@ -268,6 +487,28 @@ void Experiment::removeRun(const Int_t run_number)
     }
 }
 
+void Experiment::prefetchRunMetadata(const TString &run_type, UInt_t n_threads) const
+{
+    // Read entry counts and cluster boundaries of all runs (of a type) concurrently, no file stays open afterwards
+    std::vector<Run *> runs;
+    for (Run *prun : runs_)
+    {
+        if (run_type.IsNull() || prun->getRunType() == run_type)
+        {
+            runs.push_back(prun);
+        }
+    }
+    if (runs.empty())
+        return;
+
+    std::cout << "CloverSort [INFO]: Fetching metadata of " << runs.size() << " run(s)" << std::endl;
+    ROOT::EnableThreadSafety();
+    ROOT::TThreadExecutor executor(n_threads);
+    executor.Foreach([](Run *prun)
+                     { prun->fetchMetadata(); },
+                     runs);
+}
+
 void Experiment::printInfo() const
 {
     std::cout << Form("Experiment %s (%s)", name_.Data(), file_name_.Data()) << std::endl;
@@ -1,10 +1,332 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <TROOT.h>
+#include <ROOT/TThreadExecutor.hxx>
 #include "HistogramManager.hpp"
+#include "Detector.hpp"
 
 HistogramManager::HistogramManager()
+    : hist_infos_(), models_(), slot_hists_(), owned_(), matrices_(), shared_hists_()
 {
-    // Constructor implementation
 }
 
 HistogramManager::~HistogramManager()
 {
-}
\ No newline at end of file
+}
+
+const Int_t HistogramManager::findHistogram(const TString &detector_name, const TString &name) const
+{
+    for (size_t i = 0; i < hist_infos_.size(); ++i)
+    {
+        if (hist_infos_[i].detector_name == detector_name && hist_infos_[i].name == name)
+        {
+            return i;
+        }
+    }
+    return -1; // Return -1 if the histogram is not found
+}
+
+const HistHandle HistogramManager::getHandle(const TString &detector_name, const TString &name) const
+{
+    // Resolve a histogram once at setup time, the handle is then used for every fill
+    Int_t handle = findHistogram(detector_name, name);
+    if (handle < 0)
+    {
+        throw std::out_of_range(Form("Histogram %s not found for detector %s", name.Data(), detector_name.Data()));
+    }
+    return handle;
+}
+
+const HistHandle HistogramManager::getHandle(const Detector *pdetector, const TString &filter, Int_t channel) const
+{
+    return getHandle(pdetector->getName(), Form("%s_%s_%i", pdetector->getName().Data(), filter.Data(), channel));
+}
+
+const Int_t HistogramManager::findMatrix(const TString &name) const
+{
+    for (size_t i = 0; i < matrices_.size(); ++i)
+    {
+        if (matrices_[i]->getName() == name)
+        {
+            return i;
+        }
+    }
+    return -1; // Return -1 if the matrix is not found
+}
+
+const ULong64_t HistogramManager::getMemoryBytes(UInt_t n_slots) const
+{
+    // Peak memory of a sort with n_slots slots: the models and their slot copies, the counts of the shared spectra,
+    // the matrix cells, and the largest matrix export, which writeHistsToFile() holds next to its serialized buffer
+    ULong64_t n_bytes = 0;
+    for (HistHandle handle = 0; handle < models_.size(); ++handle)
+    {
+        const TH1D *pmodel = models_[handle].get();
+        const ULong64_t copy_bytes = ULong64_t(pmodel->GetNcells()) * sizeof(Double_t) * (pmodel->GetSumw2N() > 0 ? 2 : 1);
+        if (hist_infos_[handle].backend == HistBackend::kShared)
+            n_bytes += 2 * copy_bytes + ULong64_t(pmodel->GetNcells()) * sizeof(UInt_t);
+        else
+            n_bytes += (n_slots + 1) * copy_bytes;
+    }
+    ULong64_t export_bytes = 0;
+    for (const auto &pmatrix : matrices_)
+    {
+        n_bytes += pmatrix->getMemoryBytes();
+        export_bytes = std::max(export_bytes, 2 * pmatrix->getExportBytes());
+    }
+    return n_bytes + export_bytes;
+}
+
+TH1D *HistogramManager::getHistogram(HistHandle handle) const
+{
+    // Before the first event loop this is the model, afterwards the merged result in slot 0
+    return slot_hists_.empty() ? models_.at(handle).get() : slot_hists_[0].at(handle);
+}
+
+HistHandle HistogramManager::addHistogram(const TString &detector_name, const TH1D &model, const TString &filter, Int_t channel, HistBackend backend)
+{
+    if (!slot_hists_.empty())
+    {
+        throw std::runtime_error("Histograms cannot be added after the slots have been initialized");
+    }
+    if (findHistogram(detector_name, model.GetName()) >= 0)
+    {
+        throw std::invalid_argument(Form("Histogram %s already exists for detector %s", model.GetName(), detector_name.Data()));
+    }
+    if (backend == HistBackend::kShared && model.GetXaxis()->IsVariableBinSize())
+    {
+        throw std::invalid_argument(Form("Histogram %s has variable bins, shared histograms need fixed bins", model.GetName()));
+    }
+
+    TH1D *phist = static_cast<TH1D *>(model.Clone(model.GetName()));
+    phist->SetDirectory(nullptr);
+    models_.emplace_back(phist);
+    hist_infos_.push_back({detector_name, filter, channel, model.GetName(), backend});
+    return hist_infos_.size() - 1;
+}
+
+HistHandle HistogramManager::addHistograms(const Detector *pdetector, const TString &filter, Int_t n_bins, Double_t x_low, Double_t x_up, HistBackend backend)
+{
+    // One histogram per channel of the detector, the handles are consecutive in channel order
+    const HistHandle first = hist_infos_.size();
+    for (Int_t channel : *pdetector->getChannels())
+    {
+        TString name = Form("%s_%s_%i", pdetector->getName().Data(), filter.Data(), channel);
+        TH1D model(name, Form("%s %s channel %i;%s;Counts", pdetector->getName().Data(), filter.Data(), channel, filter.Data()), n_bins, x_low, x_up);
+        model.SetDirectory(nullptr);
+        addHistogram(pdetector->getName(), model, filter, channel, backend);
+    }
+    return first;
+}
+
+void HistogramManager::removeHistogram(const TString &detector_name, const TString &name)
+{
+    // Removing renumbers the histograms after the removed one, handles have to be resolved again afterwards
+    if (!slot_hists_.empty())
+    {
+        throw std::runtime_error("Histograms cannot be removed after the slots have been initialized");
+    }
+    Int_t handle = findHistogram(detector_name, name);
+    if (handle < 0)
+    {
+        std::cerr << "CloverSort [WARN]: Histogram " << name << " not found for detector " << detector_name << std::endl;
+        return;
+    }
+    hist_infos_.erase(hist_infos_.begin() + handle);
+    models_.erase(models_.begin() + handle);
+}
+
+MatrixHandle HistogramManager::addMatrix(const TString &name, const TString &title, Int_t n_bins, Double_t x_low, Double_t x_up, Double_t random_weight)
+{
+    if (!slot_hists_.empty())
+    {
+        throw std::runtime_error("Matrices cannot be added after the slots have been initialized");
+    }
+    if (findMatrix(name) >= 0)
+    {
+        throw std::invalid_argument(Form("Matrix %s already exists", name.Data()));
+    }
+    matrices_.push_back(std::make_unique<CoincidenceMatrix>(name, title, n_bins, x_low, x_up, 4096, random_weight));
+    return matrices_.size() - 1;
+}
+
+std::map<std::vector<TString>, TH1D *> HistogramManager::generateHistPtrMap() const
+{
+    // Map of {detector name, histogram name} to the current (merged) histogram
+    std::map<std::vector<TString>, TH1D *> hist_ptr_map;
+    for (HistHandle handle = 0; handle < hist_infos_.size(); ++handle)
+    {
+        hist_ptr_map[{hist_infos_[handle].detector_name, hist_infos_[handle].name}] = getHistogram(handle);
+    }
+    return hist_ptr_map;
+}
+
+void HistogramManager::initializeSlots(UInt_t n_slots)
+{
+    // Every slot gets a private, empty copy of every model, so the fill path never shares a histogram between threads.
+    // Shared histograms only get the copy of slot 0, which holds the result, the other slots fill the shared counts.
+    clearSlots();
+    owned_.resize(n_slots);
+    slot_hists_.resize(n_slots);
+    for (UInt_t slot = 0; slot < n_slots; ++slot)
+    {
+        owned_[slot].reserve(models_.size());
+        slot_hists_[slot].reserve(models_.size());
+        for (HistHandle handle = 0; handle < models_.size(); ++handle)
+        {
+            const auto &pmodel = models_[handle];
+            if (slot > 0 && hist_infos_[handle].backend == HistBackend::kShared)
+            {
+                slot_hists_[slot].push_back(nullptr);
+                continue;
+            }
+            TH1D *phist = static_cast<TH1D *>(pmodel->Clone(pmodel->GetName()));
+            phist->SetDirectory(nullptr);
+            phist->Reset();
+            owned_[slot].emplace_back(phist);
+            slot_hists_[slot].push_back(phist);
+        }
+    }
+    shared_hists_.resize(models_.size());
+    for (HistHandle handle = 0; handle < models_.size(); ++handle)
+    {
+        if (hist_infos_[handle].backend != HistBackend::kShared)
+            continue;
+        const TAxis *paxis = models_[handle]->GetXaxis();
+        shared_hists_[handle] = std::make_unique<SharedHistogram>(paxis->GetNbins(), paxis->GetXmin(), paxis->GetXmax(), shared_buffer_size_);
+        shared_hists_[handle]->initializeSlots(n_slots);
+    }
+    for (auto &pmatrix : matrices_)
+    {
+        pmatrix->initializeSlots(n_slots);
+    }
+}
+
+void HistogramManager::mergeSlots(Bool_t keep_slots)
+{
+    // Tree reduction: at every level slot i absorbs slot i + stride. All pairs of a level are independent, and so
+    // are the histograms of a pair, so a level is split into (pair, chunk of histograms) work items. The pairing only
+    // depends on the slot numbers, so the result does not depend on scheduling.
+    const UInt_t n_slots = slot_hists_.size();
+    const UInt_t n_hists = models_.size();
+    const UInt_t chunk_size = 64;
+    const UInt_t n_chunks = (n_hists + chunk_size - 1) / chunk_size;
+    const Bool_t parallel = ROOT::IsImplicitMTEnabled();
+
+    for (auto &pmatrix : matrices_)
+    {
+        pmatrix->flushSlots();
+    }
+
+    // Shared histograms have nothing to reduce, their counts are added to the result in slot 0 once
+    for (HistHandle handle = 0; handle < shared_hists_.size() && n_slots > 0; ++handle)
+    {
+        if (!shared_hists_[handle])
+            continue;
+        shared_hists_[handle]->flushSlots();
+        shared_hists_[handle]->moveTo(slot_hists_[0][handle]);
+    }
+
+    for (UInt_t stride = 1; stride < n_slots; stride *= 2)
+    {
+        const UInt_t n_pairs = (n_slots + stride - 1) / (2 * stride);
+        auto merge_item = [&, stride](UInt_t item)
+        {
+            const UInt_t dst = 2 * stride * (item / n_chunks);
+            const UInt_t src = dst + stride;
+            const UInt_t first = (item % n_chunks) * chunk_size;
+            const UInt_t last = std::min(first + chunk_size, n_hists);
+            for (UInt_t handle = first; handle < last; ++handle)
+            {
+                if (slot_hists_[src][handle])
+                    slot_hists_[dst][handle]->Add(slot_hists_[src][handle]);
+            }
+        };
+
+        const UInt_t n_items = n_pairs * n_chunks;
+        if (parallel && n_items > 1)
+        {
+            ROOT::TThreadExecutor executor;
+            executor.Foreach(merge_item, ROOT::TSeqU(n_items));
+        }
+        else
+        {
+            for (UInt_t item = 0; item < n_items; ++item)
+            {
+                merge_item(item);
+            }
+        }
+    }
+
+    // The merged result lives in slot 0. While sorting goes on (follow mode) the other copies are emptied to be
+    // filled again, otherwise they are no longer needed.
+    if (keep_slots)
+    {
+        for (UInt_t slot = 1; slot < n_slots; ++slot)
+        {
+            for (TH1D *phist : slot_hists_[slot])
+            {
+                if (phist)
+                    phist->Reset();
+            }
+        }
+        return;
+    }
+    owned_.resize(std::min<UInt_t>(n_slots, 1));
+    slot_hists_.resize(std::min<UInt_t>(n_slots, 1));
+    shared_hists_.clear();
+}
+
+void HistogramManager::writeHistsToFile(TFile *file)
+{
+    if (!file || file->IsZombie())
+    {
+        throw std::runtime_error("Cannot write histograms to an invalid file");
+    }
+
+    // One directory per detector
+    for (HistHandle handle = 0; handle < hist_infos_.size(); ++handle)
+    {
+        const HistInfo &info = hist_infos_[handle];
+        TDirectory *pdir = file->GetDirectory(info.detector_name);
+        if (!pdir)
+        {
+            pdir = file->mkdir(info.detector_name);
+        }
+        pdir->WriteTObject(getHistogram(handle), info.name, "Overwrite");
+    }
+
+    // Matrices are exported in their symmetric full form, together with their total projection
+    for (const auto &pmatrix : matrices_)
+    {
+        TDirectory *pdir = file->GetDirectory("Matrices");
+        if (!pdir)
+        {
+            pdir = file->mkdir("Matrices");
+        }
+        pdir->WriteTObject(pmatrix->toTH2().get(), pmatrix->getName(), "Overwrite");
+        pdir->WriteTObject(pmatrix->project(pmatrix->getName() + "_projection").get(), pmatrix->getName() + "_projection", "Overwrite");
+    }
+}
+
+void HistogramManager::printInfo()
+{
+    std::cout << Form("HistogramManager [%zu histograms, %zu matrices, %zu slots]", hist_infos_.size(), matrices_.size(), slot_hists_.size()) << std::endl;
+    for (const HistInfo &info : hist_infos_)
+    {
+        std::cout << Form("    %s/%s%s", info.detector_name.Data(), info.name.Data(), info.backend == HistBackend::kShared ? " [shared]" : "") << std::endl;
+    }
+    for (const auto &pmatrix : matrices_)
+    {
+        std::cout << "    ";
+        pmatrix->printInfo();
+    }
+}
+
+void HistogramManager::clearSlots()
+{
+    slot_hists_.clear();
+    owned_.clear();
+    shared_hists_.clear();
+}
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <stdexcept>
+#include "HitFilter.hpp"
+#include "DAQModule.hpp"
+#include "Event.hpp"
+
+namespace
+{
+    // Pileup flags of a module without a pileup filter, no channel is ever piled up
+    const Double_t NO_PILEUP[HitFilter::MAX_CHANNEL_NUM_] = {};
+}
+
+HitFilter::HitFilter(const ChannelIndex &channel_index, const TString &energy_filter, const TString &pileup_filter, Double_t threshold)
+    : modules_(), n_channels_(0), threshold_(threshold)
+{
+    for (const DAQModule *pmodule : channel_index.getDAQModules())
+    {
+        const Int_t energy_column = channel_index.findColumn(pmodule, energy_filter);
+        if (energy_column < 0)
+            continue;
+
+        const ChannelIndex::Column &column = channel_index.getColumns()[energy_column];
+        if (column.width > MAX_CHANNEL_NUM_)
+        {
+            throw std::out_of_range(Form("Module %s has %u channels, hit masks hold %u", pmodule->getName().Data(), column.width, MAX_CHANNEL_NUM_));
+        }
+        const Int_t pileup_column = channel_index.findColumn(pmodule, pileup_filter);
+        const Int_t pileup_offset = pileup_column < 0 ? -1 : Int_t(channel_index.getColumns()[pileup_column].offset);
+        modules_.push_back({pmodule, column.offset, pileup_offset, column.width});
+        n_channels_ += column.width;
+    }
+}
+
+HitFilter::~HitFilter()
+{
+}
+
+UInt_t HitFilter::process(const Event *pevent, Double_t *hit_product) const
+{
+    return process(pevent->getValues().data(), hit_product);
+}
+
+UInt_t HitFilter::process(const Double_t *values, Double_t *hit_product) const
+{
+    // values is in the layout of Event::getValues(), hit_product holds getProductSize() values. Returns the number of hits.
+    Double_t *hits = hit_product + modules_.size() + 1;
+    UInt_t n_hits = 0;
+    for (size_t i = 0; i < modules_.size(); ++i)
+    {
+        const Module &module = modules_[i];
+        const Double_t *pileups = module.pileup_offset < 0 ? NO_PILEUP : values + module.pileup_offset;
+        UInt_t mask = buildModuleMask(values + module.energy_offset, pileups, module.width, threshold_);
+        hit_product[i] = mask;
+
+        // One iteration per hit, the lowest set bit is the next hit channel
+        while (mask)
+        {
+            hits[n_hits++] = module.energy_offset + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    hit_product[modules_.size()] = n_hits;
+    return n_hits;
+}
+
+UInt_t HitFilter::buildMask(const Double_t *energies, const Double_t *pileups, UInt_t width, Double_t threshold)
+{
+    // NaN fails every comparison: an unhit channel fails the energy test and a NaN pileup flag counts as no pileup.
+    // The bits are combined with & and |, so the loop has no branch and vectorizes into packed compares.
+    UInt_t mask = 0;
+    for (UInt_t i = 0; i < width; ++i)
+    {
+        const UInt_t hit = (energies[i] > threshold) & !(pileups[i] > 0.);
+        mask |= hit << i;
+    }
+    return mask;
+}
+
+void HitFilter::printInfo() const
+{
+    std::cout << Form("HitFilter [threshold %g]", threshold_) << std::endl;
+    for (const Module &module : modules_)
+    {
+        std::cout << Form("    %s [%u channels, %s]", module.pmodule->getName().Data(), module.width, module.pileup_offset < 0 ? "no pileup flags" : "pileup flags") << std::endl;
+    }
+}
@@ -0,0 +1,91 @@
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include "RandomSubtraction.hpp"
+
+RandomSubtraction::RandomSubtraction(Double_t prompt_window, Double_t random_low, Double_t random_up)
+    : prompt_window_(prompt_window), random_low_(random_low), random_up_(random_up), random_weight_(0.), slot_buffers_()
+{
+    // The random window must not overlap the prompt one, or a pair would be counted as both
+    if (!(prompt_window > 0.) || !(random_low >= prompt_window) || !(random_up > random_low))
+    {
+        throw std::invalid_argument(Form("Invalid time windows for random subtraction: prompt |dt| <= %g, random %g <= |dt| < %g", prompt_window, random_low, random_up));
+    }
+    random_weight_ = -prompt_window / (random_up - random_low);
+}
+
+RandomSubtraction::~RandomSubtraction()
+{
+}
+
+void RandomSubtraction::initializeSlots(UInt_t n_slots)
+{
+    slot_buffers_.assign(n_slots, SlotBuffers());
+}
+
+UInt_t RandomSubtraction::process(const Double_t *energies, const Double_t *times, UInt_t n_hits, UInt_t slot)
+{
+    // energies and times hold one value per hit index, e.g. the energies and times of an add-back product
+    SlotBuffers &buffers = slot_buffers_[slot];
+    buffers.hits.clear();
+    buffers.times.clear();
+    buffers.pairs.clear();
+    for (UInt_t i = 0; i < n_hits; ++i)
+    {
+        if (std::isnan(energies[i]))
+            continue;
+        buffers.hits.push_back(i);
+        buffers.times.push_back(times[i]);
+    }
+
+    const UInt_t n_lanes = buffers.hits.size();
+    const UInt_t n_pairs = n_lanes * (n_lanes - (n_lanes > 0)) / 2;
+    buffers.firsts.resize(n_pairs);
+    buffers.seconds.resize(n_pairs);
+    buffers.weights.resize(n_pairs);
+    if (n_pairs == 0)
+        return 0;
+
+    // Time differences of all pairs (i < j), every row a contiguous run over the lanes after i
+    const Double_t *lane_times = buffers.times.data();
+    Double_t *weights = buffers.weights.data();
+    UInt_t pair = 0;
+    for (UInt_t i = 0; i + 1 < n_lanes; ++i)
+    {
+        const Double_t time = lane_times[i];
+        const UInt_t n_row = n_lanes - i - 1;
+        for (UInt_t k = 0; k < n_row; ++k)
+        {
+            weights[pair + k] = lane_times[i + 1 + k] - time;
+            buffers.firsts[pair + k] = i;
+            buffers.seconds[pair + k] = i + 1 + k;
+        }
+        pair += n_row;
+    }
+
+    // Difference to weight over all pairs at once, NaN differences fail both windows. The windows are copied into
+    // locals so the compiler need not reload them after every store through weights.
+    const Double_t prompt_window = prompt_window_;
+    const Double_t random_low = random_low_;
+    const Double_t random_up = random_up_;
+    const Double_t random_weight = random_weight_;
+    for (UInt_t k = 0; k < n_pairs; ++k)
+    {
+        const Double_t dt = std::fabs(weights[k]);
+        const Bool_t prompt = dt <= prompt_window;
+        const Bool_t random = (dt >= random_low) & (dt < random_up);
+        weights[k] = prompt ? 1. : random ? random_weight : 0.;
+    }
+
+    for (UInt_t k = 0; k < n_pairs; ++k)
+    {
+        if (weights[k] != 0.)
+            buffers.pairs.push_back({buffers.hits[buffers.firsts[k]], buffers.hits[buffers.seconds[k]], weights[k]});
+    }
+    return buffers.pairs.size();
+}
+
+void RandomSubtraction::printInfo() const
+{
+    std::cout << Form("RandomSubtraction [prompt |dt| <= %g, random %g <= |dt| < %g, random weight %g]", prompt_window_, random_low_, random_up_, random_weight_) << std::endl;
+}
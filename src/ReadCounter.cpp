@@ -0,0 +1,18 @@
+#include "ReadCounter.hpp"
+
+ReadCounter::ReadCounter(TTreeReader &tree_reader)
+    : tree_reader_(tree_reader), tree_number_(-1), start_bytes_(0), bytes_(0), closed_bytes_(0)
+{
+    // A tree reused from an earlier entry range is still in the file of that range
+    TTree *ptree = tree_reader_.GetTree();
+    TFile *pfile = ptree ? ptree->GetCurrentFile() : nullptr;
+    if (pfile)
+    {
+        tree_number_ = ptree->GetTreeNumber();
+        start_bytes_ = bytes_ = pfile->GetBytesRead();
+    }
+}
+
+ReadCounter::~ReadCounter()
+{
+}
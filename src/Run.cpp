@@ -1,22 +1,25 @@
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
 #include "Run.hpp"
 #include "HistogramManager.hpp"
 
-Run::Run(Int_t run_number, TString run_description, TString run_type, TString file_name, TString tree_name)
-    : run_number_(run_number), run_description_(run_description), run_type_(run_type), file_name_(file_name), tree_name_(tree_name)
+Run::Run(Int_t run_number, TString run_description, TString run_type, std::vector<TString> file_names, TString tree_name)
+    : run_number_(run_number), run_description_(run_description), run_type_(run_type), file_names_(std::move(file_names)), tree_name_(tree_name)
 {
-    // Initialize file and tree pointers
-    // Open the ROOT file (read only) and retrieve the TTree
-    pfile_ = TFile::Open(file_name, "READ");
-    if (!pfile_ || pfile_->IsZombie())
+    if (file_names_.empty())
     {
-        throw std::runtime_error("Error opening file: " + file_name);
+        throw std::invalid_argument(Form("Run %d has no files", run_number));
     }
+    file_name_ = file_names_.front();
+    file_pattern_ = file_name_; // Set by Experiment if the parts were looked up from a pattern
 
-    ptree_ = static_cast<TTree *>(pfile_->Get(tree_name_));
-    if (!ptree_)
-    {
-        throw std::runtime_error("Error retrieving TTree" + tree_name_ + " from file " + file_name);
-    }
+    // The file and tree are opened on first use, see Run::open()
+    pfile_ = nullptr;
+    ptree_ = nullptr;
 
     // Initialize histogram file pointer
     phist_file_ = nullptr; // Initially set to nullptr, can be set later if needed
@@ -27,69 +30,186 @@ Run::Run(Int_t run_number, TString run_description, TString run_type, TString fi
 
 Run::~Run()
 {
-    // Clean up dynamically allocated memory
-    if (pfile_)
-    {
-        pfile_->Close();
-        delete pfile_;
-    }
+    // Clean up dynamically allocated memory, the tree is owned and deleted by its file
+    close();
     if (phist_file_)
     {
         phist_file_->Close();
         delete phist_file_;
     }
-    if (ptree_)
-    {
-        delete ptree_;
-    }
     delete phist_manager_;
 }
 
-void Run::setFile(TFile *file)
+const TFile *Run::getFile() const
+{
+    open();
+    return pfile_;
+}
+
+const TTree *Run::getTree() const
+{
+    // Valid until the run is closed or its file is set. Only the first part of a chained run, see Run::openChain() to
+    // read all parts
+    open();
+    return ptree_;
+}
+
+const Run::Metadata &Run::getMetadata() const
 {
-    if (pfile_)
     {
-        pfile_->Close();
-        delete pfile_;
+        std::lock_guard<std::mutex> lock(metadata_mutex_);
+        if (metadata_.n_entries >= 0)
+            return metadata_;
     }
-    pfile_ = file;
+    fetchMetadata();
+    return metadata_;
+}
 
-    if (!pfile_ || pfile_->IsZombie())
+void Run::setFile(TFile *file)
+{
+    close();
+    if (!file || file->IsZombie())
     {
         throw std::runtime_error("Error setting file: " + file_name_);
     }
+    {
+        std::lock_guard<std::mutex> lock(metadata_mutex_);
+        metadata_ = Metadata();
+    }
+
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    pfile_ = file;
     file_name_ = pfile_->GetName(); // Update filename_ to match the new file
+    file_names_ = {file_name_};
+    ptree_ = static_cast<TTree *>(pfile_->Get(tree_name_));
 }
 
 void Run::setFile(const TString &file_name)
 {
-    if (pfile_)
-    {
-        pfile_->Close();
-        delete pfile_;
-    }
-    pfile_ = TFile::Open(file_name, "READ");
-    if (!pfile_ || pfile_->IsZombie())
+    close();
+    file_name_ = file_name;
+    file_names_ = {file_name_};
     {
-        throw std::runtime_error("Error opening file: " + file_name);
+        std::lock_guard<std::mutex> lock(metadata_mutex_);
+        metadata_ = Metadata();
     }
-    file_name_ = file_name;
+    open();
 }
 
 void Run::setTree(TTree *tree)
 {
-    if (ptree_)
+    if (!tree)
     {
-        delete ptree_;
+        throw std::runtime_error("Error setting TTree: " + tree_name_);
     }
+    std::lock_guard<std::mutex> lock(file_mutex_);
     ptree_ = tree;
+    tree_name_ = ptree_->GetName(); // Update treeName_ to match the new tree
+}
 
-    if (!ptree_)
+void Run::open() const
+{
     {
-        throw std::runtime_error("Error setting TTree: " + tree_name_);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        if (pfile_)
+            return;
     }
 
-    tree_name_ = ptree_->GetName(); // Update treeName_ to match the new tree
+    // Open the ROOT file (read only) and retrieve the TTree outside the lock, a slow file system only stalls the
+    // threads opening this run
+    std::unique_ptr<TFile> pfile(TFile::Open(file_name_, "READ"));
+    if (!pfile || pfile->IsZombie())
+    {
+        throw std::runtime_error("Error opening file: " + file_name_);
+    }
+    TTree *ptree = static_cast<TTree *>(pfile->Get(tree_name_));
+    if (!ptree)
+    {
+        throw std::runtime_error("Error retrieving TTree" + tree_name_ + " from file " + file_name_);
+    }
+
+    // A thread that opened the run at the same time wins, this handle is closed again
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    if (!pfile_)
+    {
+        pfile_ = pfile.release();
+        ptree_ = ptree;
+    }
+}
+
+void Run::close() const
+{
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    releaseFile();
+}
+
+void Run::fetchMetadata() const
+{
+    // Uses private handles, so runs can be fetched concurrently and nothing stays open afterwards. The parts are laid
+    // end to end, entries and cluster starts are counted from the start of the first part as in a TChain
+    Metadata metadata;
+    metadata.n_entries = 0;
+    for (const TString &file_name : file_names_)
+    {
+        std::unique_ptr<TFile> pfile(TFile::Open(file_name, "READ"));
+        if (!pfile || pfile->IsZombie())
+        {
+            throw std::runtime_error("Error opening file: " + file_name);
+        }
+        TTree *ptree = static_cast<TTree *>(pfile->Get(tree_name_));
+        if (!ptree)
+        {
+            throw std::runtime_error("Error retrieving TTree" + tree_name_ + " from file " + file_name);
+        }
+
+        const Long64_t offset = metadata.n_entries;
+        const Long64_t n_entries = ptree->GetEntries();
+        metadata.part_entries.push_back(n_entries);
+        metadata.n_entries += n_entries;
+        metadata.tot_bytes += ptree->GetTotBytes();
+        metadata.zip_bytes += ptree->GetZipBytes();
+        TObjArray *pleaves = ptree->GetListOfLeaves();
+        for (Int_t i = 0; pleaves && i < pleaves->GetEntriesFast(); ++i)
+        {
+            TBranch *pbranch = static_cast<TLeaf *>(pleaves->At(i))->GetBranch();
+            metadata.branch_zip_bytes[pbranch->GetName()] += pbranch->GetZipBytes();
+        }
+        TTree::TClusterIterator cluster_iterator = ptree->GetClusterIterator(0);
+        for (Long64_t start = cluster_iterator.Next(); start < n_entries; start = cluster_iterator.Next())
+        {
+            metadata.cluster_starts.push_back(offset + start);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(metadata_mutex_);
+    metadata_ = std::move(metadata);
+}
+
+std::unique_ptr<TChain> Run::openChain() const
+{
+    // A private chain over all parts for a single reader, its entry numbers are the ones of the metadata. The entries
+    // of every part are known from the metadata, so no file is opened before the chain reaches it
+    const Metadata &metadata = getMetadata();
+    auto pchain = std::make_unique<TChain>(tree_name_);
+    for (size_t part = 0; part < file_names_.size(); ++part)
+    {
+        if (!pchain->AddFile(file_names_[part], metadata.part_entries[part]))
+        {
+            throw std::runtime_error("Error adding file to chain: " + file_names_[part]);
+        }
+    }
+    return pchain;
+}
+
+void Run::releaseFile() const
+{
+    // Caller holds file_mutex_
+    if (!pfile_)
+        return;
+    pfile_->Close();
+    delete pfile_;
+    pfile_ = nullptr;
+    ptree_ = nullptr;
 }
 
 void Run::setHistFile(TFile *histFile)
@@ -129,5 +249,7 @@ void Run::printInfo() const
     TString short_file_name = file_name_;
     if (short_file_name.Contains("/"))
         short_file_name = short_file_name.Tokenize("/")->Last()->GetName();
+    if (isChained())
+        short_file_name += Form(" +%zu parts", file_names_.size() - 1);
     std::cout << Form("%i (%s) (%s) [%s]", run_number_, run_description_.Data(), run_type_.Data(), short_file_name.Data()) << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <TFile.h>
+#include <TH1D.h>
+#include <TROOT.h>
+#include <TSystem.h>
+#include <ROOT/TThreadExecutor.hxx>
+#include "RunScheduler.hpp"
+#include "Experiment.hpp"
+#include "ChannelIndex.hpp"
+#include "Run.hpp"
+#include "SortCache.hpp"
+#include "EventBuilder.hpp"
+#include "TaskProfiler.hpp"
+#include "Checkpointer.hpp"
+
+RunScheduler::RunScheduler(const Experiment *pexperiment, const ChannelIndex &channel_index, SortSetup setup)
+    : pexperiment_(pexperiment), channel_index_(channel_index), setup_(std::move(setup)), run_type_(), hist_file_pattern_(), split_threshold_(0), cache_pattern_(),
+      profile_pattern_(), profile_sampling_(1024), progress_interval_(10), task_batch_size_(0),
+      follow_interval_(10), follow_timeout_(300), checkpoint_pattern_(), checkpoint_interval_(300), resume_(false),
+      prefetch_threads_(0), prefetch_depth_(16), histogram_memory_limit_(0), event_store_pattern_(), histogram_memory_mutex_(),
+      histograms_released_(), histogram_memory_(0), profilers_(), monitoring_(false), progress_thread_(), progress_mutex_(),
+      progress_condition_()
+{
+}
+
+RunScheduler::~RunScheduler()
+{
+    stopProgressMonitor();
+}
+
+std::vector<Run *> RunScheduler::getScheduledRuns() const
+{
+    std::vector<Run *> runs;
+    for (Run *prun : *pexperiment_->getRuns())
+    {
+        if (run_type_.IsNull() || prun->getRunType() == run_type_)
+        {
+            runs.push_back(prun);
+        }
+    }
+    return runs;
+}
+
+TString RunScheduler::getHistFileName(const Run *prun) const
+{
+    if (hist_file_pattern_.IsNull())
+    {
+        // Next to the run file, e.g. run_001.root -> run_001_hists.root. A run in parts is named after its file pattern
+        // without the part number and wildcards, e.g. exp_run001_part+++.root -> exp_run001_part_hists.root, a name
+        // derived from its first part would only hold the histograms of that part.
+        if (prun->getFilePattern() == prun->getFileName())
+        {
+            TString hist_file_name = prun->getFileName();
+            if (hist_file_name.EndsWith(".root"))
+                hist_file_name.Remove(hist_file_name.Length() - 5);
+            return hist_file_name + "_hists.root";
+        }
+        TString base_name = gSystem->BaseName(prun->getFilePattern());
+        if (base_name.EndsWith(".root"))
+            base_name.Remove(base_name.Length() - 5);
+        base_name.ReplaceAll("+++", "");
+        for (Ssiz_t open = base_name.Index("["); open != kNPOS; open = base_name.Index("["))
+        {
+            const Ssiz_t close = base_name.Index("]", open);
+            base_name.Remove(open, close == kNPOS ? base_name.Length() - open : close - open + 1);
+        }
+        base_name.ReplaceAll("*", "");
+        base_name.ReplaceAll("?", "");
+        while (base_name.EndsWith("_") || base_name.EndsWith("-") || base_name.EndsWith("."))
+            base_name.Remove(base_name.Length() - 1);
+        if (base_name.IsNull())
+            base_name = Form("run%03d", prun->getRunNumber());
+        return gSystem->GetDirName(prun->getFileName()) + "/" + base_name + "_hists.root";
+    }
+
+    std::ostringstream oss;
+    oss << std::setw(3) << std::setfill('0') << prun->getRunNumber();
+    TString hist_file_name = hist_file_pattern_;
+    hist_file_name.ReplaceAll("---", oss.str().c_str());
+    return hist_file_name;
+}
+
+TString RunScheduler::getCacheFileName(const Run *prun) const
+{
+    std::ostringstream oss;
+    oss << std::setw(3) << std::setfill('0') << prun->getRunNumber();
+    TString cache_file_name = cache_pattern_;
+    cache_file_name.ReplaceAll("---", oss.str().c_str());
+    return cache_file_name;
+}
+
+TString RunScheduler::getProfileFileName(const Run *prun) const
+{
+    std::ostringstream oss;
+    oss << std::setw(3) << std::setfill('0') << prun->getRunNumber();
+    TString profile_file_name = profile_pattern_;
+    profile_file_name.ReplaceAll("---", oss.str().c_str());
+    return profile_file_name;
+}
+
+TString RunScheduler::getCheckpointFileName(const Run *prun) const
+{
+    std::ostringstream oss;
+    oss << std::setw(3) << std::setfill('0') << prun->getRunNumber();
+    TString checkpoint_file_name = checkpoint_pattern_;
+    checkpoint_file_name.ReplaceAll("---", oss.str().c_str());
+    return checkpoint_file_name;
+}
+
+TString RunScheduler::getEventStoreFileName(const Run *prun) const
+{
+    std::ostringstream oss;
+    oss << std::setw(3) << std::setfill('0') << prun->getRunNumber();
+    TString event_store_file_name = event_store_pattern_;
+    event_store_file_name.ReplaceAll("---", oss.str().c_str());
+    return event_store_file_name;
+}
+
+Long64_t RunScheduler::processRuns(UInt_t n_threads)
+{
+    std::vector<Run *> runs = getScheduledRuns();
+    if (resume_ && !checkpoint_pattern_.IsNull())
+    {
+        // A run is done once its checkpoint is complete and its hist file is still there
+        const size_t n_scheduled = runs.size();
+        runs.erase(std::remove_if(runs.begin(), runs.end(),
+                                  [this](const Run *prun)
+                                  { return Checkpointer::isComplete(getCheckpointFileName(prun)) && !gSystem->AccessPathName(getHistFileName(prun)); }),
+                   runs.end());
+        std::cout << "CloverSort [INFO]: Resuming, " << n_scheduled - runs.size() << " of " << n_scheduled << " run(s) already sorted" << std::endl;
+    }
+    if (runs.empty())
+    {
+        std::cerr << "CloverSort [WARN]: No runs" << (run_type_.IsNull() ? TString("") : " of type " + run_type_) << " to sort" << std::endl;
+        return 0;
+    }
+
+    if (n_threads != 1 && !ROOT::IsImplicitMTEnabled())
+    {
+        ROOT::EnableImplicitMT(n_threads);
+    }
+    const UInt_t n_workers = n_threads != 1 && ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1;
+
+    // Largest runs first, so the concurrent small runs finish close together. The sizes come from the run metadata,
+    // which is fetched for all runs concurrently without keeping their files open.
+    pexperiment_->prefetchRunMetadata(run_type_, n_threads);
+    std::vector<std::pair<Long64_t, Run *>> sized_runs;
+    Long64_t total_entries = 0;
+    for (Run *prun : runs)
+    {
+        const Long64_t n_entries = prun->getEntries();
+        sized_runs.emplace_back(n_entries, prun);
+        total_entries += n_entries;
+    }
+    std::stable_sort(sized_runs.begin(), sized_runs.end(),
+                     [](const auto &a, const auto &b)
+                     { return a.first > b.first; });
+
+    const Long64_t split_threshold = split_threshold_ > 0 ? split_threshold_ : total_entries / n_workers;
+    std::vector<Run *> large_runs, small_runs;
+    for (const auto &[n_entries, prun] : sized_runs)
+    {
+        (n_workers > 1 && n_entries > split_threshold ? large_runs : small_runs).push_back(prun);
+    }
+
+    std::cout << "CloverSort [INFO]: Scheduling " << runs.size() << " run(s) on " << n_workers << " worker(s), " << large_runs.size() << " split by cluster and " << small_runs.size() << " sorted concurrently" << std::endl;
+
+    Long64_t n_entries = 0;
+    for (Run *prun : large_runs)
+    {
+        n_entries += processRun(prun, n_threads, kFALSE);
+    }
+
+    if (n_workers > 1 && small_runs.size() > 1)
+    {
+        // Every worker pulls the next largest run until none are left. One monitor prints the progress of all of them,
+        // their own profilers print none, so the lines of the runs do not interleave.
+        std::atomic<size_t> next_run{0};
+        std::atomic<Long64_t> small_entries{0};
+        startProgressMonitor();
+        try
+        {
+            ROOT::TThreadExecutor executor;
+            executor.Foreach([&](UInt_t)
+                             {
+                for (size_t i = next_run++; i < small_runs.size(); i = next_run++)
+                {
+                    small_entries += processRun(small_runs[i], 1, kTRUE);
+                } },
+                             ROOT::TSeqU(std::min<size_t>(n_workers, small_runs.size())));
+        }
+        catch (...)
+        {
+            stopProgressMonitor();
+            throw;
+        }
+        stopProgressMonitor();
+        n_entries += small_entries;
+    }
+    else
+    {
+        for (Run *prun : small_runs)
+        {
+            n_entries += processRun(prun, n_threads, kFALSE);
+        }
+    }
+
+    std::cout << "CloverSort [INFO]: " << runs.size() << " run(s) sorted, " << n_entries << " entries processed" << std::endl;
+
+    return n_entries;
+}
+
+Long64_t RunScheduler::processRun(Run *prun, UInt_t n_threads, Bool_t concurrent)
+{
+    // Declared before the context, so the histogram memory is only released once the context has freed it
+    std::shared_ptr<void> phistogram_memory;
+    RunContext context{prun, {}, {}, {}};
+    context.task_manager.setHistogramManager(&context.hist_manager);
+    context.task_manager.setTaskBatchSize(task_batch_size_);
+    context.task_manager.setPrefetchThreads(prefetch_threads_);
+    context.task_manager.setPrefetchDepth(prefetch_depth_);
+
+    // Only the clusters after the checkpoint are sorted when resuming, built events and sort caches start over
+    const Bool_t checkpointed = !checkpoint_pattern_.IsNull() && pexperiment_->getEventBuildWindow() <= 0 && cache_pattern_.IsNull();
+    context.resumed = resume_ && checkpointed && !gSystem->AccessPathName(getCheckpointFileName(prun)) &&
+                      !Checkpointer::isComplete(getCheckpointFileName(prun));
+    setup_(context);
+
+    // Slot copies and matrix cells are only allocated when the sort starts, a run waits here until its histograms and
+    // their export fit next to the others
+    const UInt_t n_slots = n_threads != 1 && ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1;
+    phistogram_memory = reserveHistogramMemory(prun, context.hist_manager.getMemoryBytes(n_slots));
+
+    // A run sorted concurrently with others is printed by the scheduler's progress monitor, declared after the
+    // profiler so it is unregistered first
+    TaskProfiler profiler(profile_sampling_, concurrent ? 0. : progress_interval_);
+    context.task_manager.setProfiler(&profiler);
+    std::shared_ptr<void> pprogress = concurrent ? watchProgress(&profiler) : nullptr;
+
+    // Checkpoints are taken by cluster of the run's tree, built events and sort caches are only checkpointed by run
+    std::unique_ptr<Checkpointer> pcheckpointer;
+    if (!checkpoint_pattern_.IsNull())
+    {
+        pcheckpointer = std::make_unique<Checkpointer>(getCheckpointFileName(prun), checkpoint_interval_);
+        if (!resume_)
+        {
+            gSystem->Unlink(pcheckpointer->getFileName());
+        }
+        if (checkpointed)
+        {
+            context.task_manager.setCheckpointer(pcheckpointer.get());
+        }
+    }
+
+    Long64_t n_entries = 0;
+    if (pexperiment_->getEventBuildWindow() > 0)
+    {
+        // Modules read out in separate events are merged by time, the sort cache holds unbuilt entries
+        if (!cache_pattern_.IsNull())
+        {
+            std::cerr << "CloverSort [WARN]: The sort cache " << getCacheFileName(prun) << " is ignored, the events of run " << prun->getRunNumber() << " are built from the run's tree with EventBuildWindow > 0" << std::endl;
+        }
+        EventBuilder builder(prun, channel_index_, pexperiment_->getEventBuildWindow());
+        builder.setTimestampScale(pexperiment_->getTimestampScale());
+        builder.setChannelTimeScale(pexperiment_->getChannelTimeScale());
+        builder.setTimestampWrap(pexperiment_->getTimestampWrap());
+        n_entries = context.task_manager.processBuiltEvents(prun, builder, n_threads);
+    }
+    else if (cache_pattern_.IsNull())
+    {
+        n_entries = context.task_manager.processRun(prun, channel_index_, n_threads);
+    }
+    else
+    {
+        // A cache of an older format, or of run files changed since its conversion, is converted again
+        const TString cache_file_name = getCacheFileName(prun);
+        std::unique_ptr<SortCache> pcache;
+        if (!std::ifstream(cache_file_name.Data()).fail())
+        {
+            try
+            {
+                pcache = std::make_unique<SortCache>(cache_file_name);
+            }
+            catch (const std::runtime_error &)
+            {
+            }
+            if (!pcache || !pcache->matches(prun))
+            {
+                std::cerr << "CloverSort [WARN]: The sort cache " << cache_file_name << " is outdated or does not match the files of run " << prun->getRunNumber() << ", converting it again" << std::endl;
+                pcache.reset();
+            }
+        }
+        if (!pcache)
+        {
+            SortCache::convert(prun, channel_index_, cache_file_name);
+            pcache = std::make_unique<SortCache>(cache_file_name);
+        }
+        n_entries = context.task_manager.processCache(prun, *pcache, channel_index_, n_threads);
+    }
+
+    // The run owns its hist file, it is closed once the histograms are written
+    const TString hist_file_name = getHistFileName(prun);
+    TFile *phist_file = TFile::Open(hist_file_name, "RECREATE");
+    if (!phist_file || phist_file->IsZombie())
+    {
+        throw std::runtime_error("Error opening histogram file: " + hist_file_name);
+    }
+    prun->setHistFile(phist_file);
+    context.hist_manager.writeHistsToFile(phist_file);
+    phist_file->Close();
+
+    std::cout << "CloverSort [INFO]: Histograms of run " << prun->getRunNumber() << " written to " << hist_file_name << std::endl;
+
+    if (pcheckpointer)
+    {
+        pcheckpointer->complete(prun->getEntries());
+    }
+
+    if (!profile_pattern_.IsNull())
+    {
+        const TString profile_file_name = getProfileFileName(prun);
+        profiler.writeSummary(profile_file_name);
+        std::cout << "CloverSort [INFO]: Profile of run " << prun->getRunNumber() << " written to " << profile_file_name << std::endl;
+    }
+
+    return n_entries;
+}
+
+std::shared_ptr<void> RunScheduler::reserveHistogramMemory(const Run *prun, ULong64_t n_bytes)
+{
+    ULong64_t limit = ULong64_t(histogram_memory_limit_) << 20;
+    MemInfo_t mem_info;
+    if (limit == 0 && gSystem->GetMemInfo(&mem_info) == 0 && mem_info.fMemTotal > 0)
+    {
+        limit = ULong64_t(mem_info.fMemTotal) << 19; // Half of the physical memory, given in MB
+    }
+
+    // A run always starts if no other run holds histograms, so a run larger than the limit is sorted alone
+    std::unique_lock<std::mutex> lock(histogram_memory_mutex_);
+    auto fits = [&]()
+    { return limit == 0 || histogram_memory_ == 0 || histogram_memory_ + n_bytes <= limit; };
+    if (!fits())
+    {
+        std::cout << "CloverSort [INFO]: Run " << prun->getRunNumber() << Form(" waits for %.0f MB of histograms, %.0f MB of %.0f MB are held by the runs being sorted", n_bytes / 1048576., histogram_memory_ / 1048576., limit / 1048576.) << std::endl;
+        histograms_released_.wait(lock, fits);
+    }
+    histogram_memory_ += n_bytes;
+
+    // The deleter runs when the returned handle is destroyed, also for the null pointer it owns
+    return std::shared_ptr<void>(nullptr, [this, n_bytes](void *)
+                                 {
+        {
+            std::lock_guard<std::mutex> lock(histogram_memory_mutex_);
+            histogram_memory_ -= n_bytes;
+        }
+        histograms_released_.notify_all(); });
+}
+
+std::shared_ptr<void> RunScheduler::watchProgress(const TaskProfiler *pprofiler)
+{
+    {
+        std::lock_guard<std::mutex> lock(progress_mutex_);
+        profilers_.push_back(pprofiler);
+    }
+
+    // The deleter runs when the returned handle is destroyed, also for the null pointer it owns
+    return std::shared_ptr<void>(nullptr, [this, pprofiler](void *)
+                                 {
+        std::lock_guard<std::mutex> lock(progress_mutex_);
+        profilers_.erase(std::find(profilers_.begin(), profilers_.end(), pprofiler)); });
+}
+
+void RunScheduler::startProgressMonitor()
+{
+    if (progress_interval_ <= 0)
+        return;
+    stopProgressMonitor();
+    monitoring_ = true;
+    progress_thread_ = std::thread(&RunScheduler::monitorProgress, this);
+}
+
+void RunScheduler::stopProgressMonitor()
+{
+    {
+        std::lock_guard<std::mutex> lock(progress_mutex_);
+        monitoring_ = false;
+    }
+    progress_condition_.notify_all();
+    if (progress_thread_.joinable())
+    {
+        progress_thread_.join();
+    }
+}
+
+void RunScheduler::monitorProgress()
+{
+    // The lines of all running runs are printed together under the lock, runs that have not started are left out
+    std::unique_lock<std::mutex> lock(progress_mutex_);
+    while (!progress_condition_.wait_for(lock, std::chrono::duration<Double_t>(progress_interval_), [this]()
+                                         { return !monitoring_; }))
+    {
+        for (const TaskProfiler *pprofiler : profilers_)
+        {
+            if (pprofiler->isRunning())
+                pprofiler->printProgress();
+        }
+    }
+}
+
+Long64_t RunScheduler::followRun(Int_t run_number, UInt_t n_threads)
+{
+    Run *prun = const_cast<Run *>(pexperiment_->getRun(run_number));
+    if (!prun)
+    {
+        throw std::out_of_range(Form("Run %i is not defined in the experiment", run_number));
+    }
+    if (pexperiment_->getEventBuildWindow() > 0)
+    {
+        throw std::runtime_error("Follow mode does not build events across modules, unset EventBuildWindow to follow a run");
+    }
+    if (!cache_pattern_.IsNull())
+    {
+        std::cout << "CloverSort [WARN]: The sort cache is not used while following run " << run_number << std::endl;
+    }
+
+    RunContext context{prun, {}, {}, {}};
+    context.task_manager.setHistogramManager(&context.hist_manager);
+    context.task_manager.setTaskBatchSize(task_batch_size_);
+    setup_(context);
+
+    TaskProfiler profiler(profile_sampling_, progress_interval_);
+    context.task_manager.setProfiler(&profiler);
+
+    // Histograms are written to a temporary file which then replaces the hist file, so viewers never see a partial file
+    const TString hist_file_name = getHistFileName(prun);
+    auto publish = [&](Long64_t n_entries)
+    {
+        const TString part_file_name = hist_file_name + ".part";
+        std::unique_ptr<TFile> phist_file(TFile::Open(part_file_name, "RECREATE"));
+        if (!phist_file || phist_file->IsZombie())
+        {
+            throw std::runtime_error("Error opening histogram file: " + part_file_name);
+        }
+        context.hist_manager.writeHistsToFile(phist_file.get());
+        phist_file->Close();
+        if (gSystem->Rename(part_file_name, hist_file_name) != 0)
+        {
+            throw std::runtime_error("Error replacing histogram file: " + hist_file_name);
+        }
+        std::cout << "CloverSort [INFO]: Histograms of run " << run_number << " (" << n_entries << " entries) published to " << hist_file_name << std::endl;
+    };
+
+    const Long64_t n_entries = context.task_manager.followRun(prun, channel_index_, publish, follow_interval_, follow_timeout_, n_threads);
+    publish(n_entries);
+
+    if (!profile_pattern_.IsNull())
+    {
+        const TString profile_file_name = getProfileFileName(prun);
+        profiler.writeSummary(profile_file_name);
+        std::cout << "CloverSort [INFO]: Profile of run " << run_number << " written to " << profile_file_name << std::endl;
+    }
+
+    return n_entries;
+}
+
+Long64_t RunScheduler::gateRuns(const std::vector<EventStore::Gate> &gates, const TString &gate_file_name, UInt_t n_threads)
+{
+    // Every gate is summed over the event stores of all scheduled runs into one spectrum, binned over the energy range
+    // of the first store. Stores are gated one after another, each split by block over the whole thread pool.
+    if (event_store_pattern_.IsNull())
+    {
+        throw std::runtime_error("Gating reads the event stores of an earlier sort, set EventStoreFile in the configuration");
+    }
+    const std::vector<Run *> runs = getScheduledRuns();
+    if (runs.empty())
+    {
+        std::cerr << "CloverSort [WARN]: No runs" << (run_type_.IsNull() ? TString("") : " of type " + run_type_) << " to gate" << std::endl;
+        return 0;
+    }
+
+    if (n_threads != 1 && !ROOT::IsImplicitMTEnabled())
+    {
+        ROOT::EnableImplicitMT(n_threads);
+    }
+    const Bool_t parallel = n_threads != 1 && ROOT::IsImplicitMTEnabled();
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<TH1D>> spectra;
+    std::vector<TH1D *> pspectra;
+    Long64_t n_gated = 0;
+    Long64_t n_events = 0;
+    UInt_t n_stores = 0;
+    for (const Run *prun : runs)
+    {
+        const TString store_file_name = getEventStoreFileName(prun);
+        if (gSystem->AccessPathName(store_file_name))
+        {
+            std::cerr << "CloverSort [WARN]: Run " << prun->getRunNumber() << " has no event store " << store_file_name << ", it is not gated" << std::endl;
+            continue;
+        }
+        EventStore store(store_file_name);
+        if (spectra.empty())
+        {
+            for (const EventStore::Gate &gate : gates)
+            {
+                const TString title = Form("Gate [%g, %g)%s;Energy;Counts", gate.low, gate.up, gate.detector.IsNull() ? "" : (" on " + gate.detector).Data());
+                spectra.push_back(std::make_unique<TH1D>(gate.name, title, GATE_BINS_, store.getEnergyLow(), store.getEnergyUp()));
+                spectra.back()->SetDirectory(nullptr);
+                pspectra.push_back(spectra.back().get());
+            }
+        }
+        n_gated += store.gate(gates, pspectra, parallel);
+        n_events += store.getEvents();
+        ++n_stores;
+    }
+    if (n_stores == 0)
+    {
+        throw std::runtime_error("No event stores to gate, sort the runs with EventStoreFile set first");
+    }
+
+    std::unique_ptr<TFile> pgate_file(TFile::Open(gate_file_name, "RECREATE"));
+    if (!pgate_file || pgate_file->IsZombie())
+    {
+        throw std::runtime_error("Error opening gate file: " + gate_file_name);
+    }
+    for (const TH1D *pspectrum : pspectra)
+    {
+        pgate_file->WriteTObject(pspectrum);
+    }
+    pgate_file->Close();
+
+    const Double_t seconds = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "CloverSort [INFO]: " << gates.size() << " gate(s) set on " << n_stores << " event store(s) in " << seconds << " s, "
+              << n_gated << " of " << n_events << " events selected, spectra written to " << gate_file_name << std::endl;
+
+    return n_gated;
+}
@@ -0,0 +1,112 @@
+#include <stdexcept>
+#include "SharedHistogram.hpp"
+
+namespace
+{
+    UInt_t roundUpToPowerOfTwo(UInt_t n)
+    {
+        UInt_t power = 1;
+        while (power < n)
+        {
+            power *= 2;
+        }
+        return n ? power : 0;
+    }
+}
+
+SharedHistogram::SharedHistogram(Int_t n_bins, Double_t x_low, Double_t x_up, UInt_t buffer_size)
+    : n_bins_(n_bins), x_low_(x_low), x_up_(x_up), buffer_size_(roundUpToPowerOfTwo(buffer_size)),
+      counts_(n_bins > 0 ? n_bins + 2 : 0), slot_buffers_()
+{
+    if (n_bins <= 0 || !(x_up > x_low))
+    {
+        throw std::invalid_argument(Form("Invalid binning for shared histogram with %i bins in [%g, %g)", n_bins, x_low, x_up));
+    }
+}
+
+SharedHistogram::~SharedHistogram()
+{
+}
+
+const Int_t SharedHistogram::findBin(Double_t x) const
+{
+    // Same bin as TAxis::FindFixBin(), NaN counts as overflow
+    if (x < x_low_)
+        return 0;
+    if (!(x < x_up_))
+        return n_bins_ + 1;
+    return 1 + Int_t(n_bins_ * (x - x_low_) / (x_up_ - x_low_));
+}
+
+void SharedHistogram::initializeSlots(UInt_t n_slots)
+{
+    slot_buffers_.assign(n_slots, SlotBuffer{std::vector<Int_t>(buffer_size_, -1), std::vector<UInt_t>(buffer_size_, 0)});
+}
+
+void SharedHistogram::fill(UInt_t slot, Double_t x)
+{
+    const Int_t bin = findBin(x);
+    if (buffer_size_ == 0)
+    {
+        counts_[bin].fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Neighbouring bins take different entries, so a peak spread over a few bins stays in the buffer
+    SlotBuffer &buffer = slot_buffers_[slot];
+    const UInt_t entry = bin & (buffer_size_ - 1);
+    if (buffer.bins[entry] != bin)
+    {
+        if (buffer.counts[entry] > 0)
+        {
+            counts_[buffer.bins[entry]].fetch_add(buffer.counts[entry], std::memory_order_relaxed);
+        }
+        buffer.bins[entry] = bin;
+        buffer.counts[entry] = 0;
+    }
+    ++buffer.counts[entry];
+}
+
+void SharedHistogram::flush(UInt_t slot)
+{
+    SlotBuffer &buffer = slot_buffers_[slot];
+    for (UInt_t entry = 0; entry < buffer_size_; ++entry)
+    {
+        if (buffer.counts[entry] > 0)
+        {
+            counts_[buffer.bins[entry]].fetch_add(buffer.counts[entry], std::memory_order_relaxed);
+        }
+        buffer.bins[entry] = -1;
+        buffer.counts[entry] = 0;
+    }
+}
+
+void SharedHistogram::flushSlots()
+{
+    for (UInt_t slot = 0; slot < slot_buffers_.size(); ++slot)
+    {
+        flush(slot);
+    }
+}
+
+void SharedHistogram::moveTo(TH1D *phist)
+{
+    // Called while no slot fills, after flushSlots(). The counts are added to phist and start again from 0. The bin
+    // statistics of phist are recomputed from its bin contents, as if every fill had been at its bin centre.
+    Double_t n_entries = 0;
+    for (Int_t bin = 0; bin < n_bins_ + 2; ++bin)
+    {
+        const UInt_t count = counts_[bin].exchange(0, std::memory_order_relaxed);
+        if (count > 0)
+        {
+            phist->AddBinContent(bin, count);
+            n_entries += count;
+        }
+    }
+    if (n_entries > 0)
+    {
+        const Double_t previous_entries = phist->GetEntries();
+        phist->ResetStats();
+        phist->SetEntries(previous_entries + n_entries);
+    }
+}
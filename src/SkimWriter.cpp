@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <Compression.h>
+#include <TSystem.h>
+#include <TTree.h>
+#include <ROOT/TBufferMerger.hxx>
+#include "SkimWriter.hpp"
+#include "DAQModule.hpp"
+#include "Event.hpp"
+
+SkimWriter::SkimWriter(const ChannelIndex &channel_index, const TString &file_name, const TString &tree_name, const TString &algorithm, Int_t level)
+    : channel_index_(channel_index), file_name_(file_name), tree_name_(tree_name), compression_settings_(getCompressionSettings(algorithm, level)),
+      temp_file_name_(file_name + ".part"), flush_entries_(10000), calibrated_columns_(), pmerger_(), slots_()
+{
+    const TString dir_name = gSystem->GetDirName(file_name);
+    if (!dir_name.IsNull() && dir_name != ".")
+    {
+        gSystem->mkdir(dir_name, kTRUE);
+    }
+    pmerger_ = std::make_unique<ROOT::TBufferMerger>(temp_file_name_, "RECREATE", compression_settings_);
+}
+
+SkimWriter::~SkimWriter()
+{
+    // Without close() the sort did not finish, the merger still writes what it has, then the partial skim is removed
+    if (!pmerger_)
+        return;
+    for (Slot &slot : slots_)
+    {
+        slot.ptree = nullptr;
+        slot.pfile.reset();
+    }
+    pmerger_.reset();
+    gSystem->Unlink(temp_file_name_);
+    std::cerr << "CloverSort [WARN]: Skim " << file_name_ << " was not closed, partial file removed" << std::endl;
+}
+
+const Long64_t SkimWriter::getEntries() const
+{
+    Long64_t n_entries = 0;
+    for (const Slot &slot : slots_)
+    {
+        n_entries += slot.n_entries;
+    }
+    return n_entries;
+}
+
+void SkimWriter::addCalibratedColumn(const DAQModule *pmodule, const TString &filter)
+{
+    if (!slots_.empty())
+    {
+        throw std::runtime_error("Skim columns cannot be added after the slots have been initialized");
+    }
+    const Int_t column = channel_index_.findColumn(pmodule, filter);
+    if (column < 0)
+    {
+        throw std::out_of_range(Form("No column %s for module %s in the channel index", filter.Data(), pmodule->getName().Data()));
+    }
+    if (std::find(calibrated_columns_.begin(), calibrated_columns_.end(), column) == calibrated_columns_.end())
+    {
+        calibrated_columns_.push_back(column);
+    }
+}
+
+void SkimWriter::initializeSlots(UInt_t n_slots)
+{
+    // Called before the event loop, every slot file is taken from the merger on this thread
+    if (!pmerger_)
+    {
+        throw std::runtime_error("Skim file " + file_name_ + " is already closed");
+    }
+    if (!slots_.empty())
+    {
+        throw std::runtime_error("Skim slots of " + file_name_ + " are already initialized");
+    }
+
+    const std::vector<ChannelIndex::Column> &columns = channel_index_.getColumns();
+    UInt_t calibrated_size = 0;
+    for (Int_t column : calibrated_columns_)
+    {
+        calibrated_size += columns[column].width;
+    }
+
+    slots_.resize(n_slots);
+    for (Slot &slot : slots_)
+    {
+        slot.pfile = pmerger_->GetFile();
+        slot.values.assign(channel_index_.getSize(), 0.);
+        slot.calibrated.assign(calibrated_size, 0.);
+        slot.ptree = new TTree(tree_name_, "CloverSort skim");
+        slot.ptree->SetDirectory(slot.pfile.get());
+
+        // Scalar columns are written as arrays like Event::getValues() holds them, one value per channel
+        for (const ChannelIndex::Column &column : columns)
+        {
+            slot.ptree->Branch(ChannelIndex::getBranchName(column.pmodule, column.filter), slot.values.data() + column.offset,
+                               Form("%s[%u]/D", column.filter.Data(), column.width));
+        }
+        UInt_t offset = 0;
+        for (Int_t column : calibrated_columns_)
+        {
+            const TString filter = columns[column].filter + "_calibrated";
+            slot.ptree->Branch(ChannelIndex::getBranchName(columns[column].pmodule, filter), slot.calibrated.data() + offset,
+                               Form("%s[%u]/D", filter.Data(), columns[column].width));
+            offset += columns[column].width;
+        }
+    }
+}
+
+void SkimWriter::fill(const Event *pevent, const Double_t *calibrated, UInt_t slot)
+{
+    // calibrated is in the layout of Event::getValues(), e.g. the calibrated energies product
+    Slot &state = slots_[slot];
+    std::copy(pevent->getValues().begin(), pevent->getValues().end(), state.values.begin());
+    Double_t *pcalibrated = state.calibrated.data();
+    for (Int_t column : calibrated_columns_)
+    {
+        const ChannelIndex::Column &index_column = channel_index_.getColumns()[column];
+        pcalibrated = std::copy_n(calibrated + index_column.offset, index_column.width, pcalibrated);
+    }
+    state.ptree->Fill();
+
+    if (++state.n_entries % flush_entries_ == 0)
+    {
+        state.pfile->Write();
+    }
+}
+
+void SkimWriter::close()
+{
+    // The merger writes the skim file once the last slot file is released
+    if (!pmerger_)
+        return;
+    const Long64_t n_entries = getEntries();
+    for (Slot &slot : slots_)
+    {
+        slot.pfile->Write();
+        slot.ptree = nullptr;
+        slot.pfile.reset();
+    }
+    pmerger_.reset();
+    if (gSystem->Rename(temp_file_name_, file_name_) != 0)
+    {
+        throw std::runtime_error("Error writing skim file: " + file_name_);
+    }
+    std::cout << "CloverSort [INFO]: Skim " << file_name_ << " written, " << n_entries << " entries" << std::endl;
+}
+
+Int_t SkimWriter::getCompressionSettings(const TString &algorithm, Int_t level)
+{
+    // ROOT encodes the settings as 100 * algorithm + level
+    using EAlgorithm = ROOT::RCompressionSetting::EAlgorithm;
+    TString name(algorithm);
+    name.ToLower();
+    Int_t code;
+    if (name == "zlib")
+        code = EAlgorithm::kZLIB;
+    else if (name == "lzma")
+        code = EAlgorithm::kLZMA;
+    else if (name == "lz4")
+        code = EAlgorithm::kLZ4;
+    else if (name == "zstd")
+        code = EAlgorithm::kZSTD;
+    else
+        throw std::invalid_argument("Unknown compression algorithm: " + algorithm);
+    if (level < 0 || level > 9)
+    {
+        throw std::invalid_argument(Form("Compression level %i of %s is outside [0, 9]", level, algorithm.Data()));
+    }
+    return 100 * code + level;
+}
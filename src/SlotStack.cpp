@@ -0,0 +1,34 @@
+#include <stdexcept>
+#include "SlotStack.hpp"
+
+SlotStack::SlotStack(UInt_t n_slots)
+    : n_slots_(n_slots)
+{
+    // Hand out the lowest slots first
+    for (UInt_t slot = n_slots_; slot > 0; --slot)
+    {
+        free_slots_.push_back(slot - 1);
+    }
+}
+
+SlotStack::~SlotStack()
+{
+}
+
+UInt_t SlotStack::acquireSlot()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_slots_.empty())
+    {
+        throw std::runtime_error("No free worker slot available, more concurrent tasks than slots");
+    }
+    UInt_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    return slot;
+}
+
+void SlotStack::releaseSlot(UInt_t slot)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_slots_.push_back(slot);
+}
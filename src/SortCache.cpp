@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <RZip.h>
+#include <TChain.h>
+#include <TSystem.h>
+#include <TTreeReader.h>
+#include "SortCache.hpp"
+#include "ChannelIndex.hpp"
+#include "DAQModule.hpp"
+#include "Event.hpp"
+#include "Run.hpp"
+
+// Helpers
+
+namespace
+{
+    const char CACHE_MAGIC[8] = {'C', 'S', 'C', 'A', 'C', 'H', 'E', '1'};
+    const char PADDING[8] = {};
+    const Int_t MAX_ZIP_BYTES = 0xffffff; // Largest buffer ROOT compresses in one call
+
+    size_t getTypeSize(SortCache::ValueType type)
+    {
+        switch (type)
+        {
+        case SortCache::ValueType::kUInt16:
+            return sizeof(UShort_t);
+        case SortCache::ValueType::kInt32:
+            return sizeof(Int_t);
+        case SortCache::ValueType::kInt64:
+            return sizeof(Long64_t);
+        default:
+            return sizeof(Double_t);
+        }
+    }
+
+    SortCache::ValueType findNarrowestType(const Double_t *values, size_t n)
+    {
+        // Integers (and NaN) only, within the range of the type minus its NaN sentinel
+        Double_t min = 0., max = 0.;
+        Bool_t integral = kTRUE;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const Double_t value = values[i];
+            if (std::isnan(value))
+                continue;
+            integral &= std::isfinite(value) && value == std::floor(value);
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+        if (!integral)
+            return SortCache::ValueType::kFloat64;
+        if (min >= 0. && max < 65535.)
+            return SortCache::ValueType::kUInt16;
+        if (min > Double_t(std::numeric_limits<Int_t>::min()) && max <= Double_t(std::numeric_limits<Int_t>::max()))
+            return SortCache::ValueType::kInt32;
+        if (std::fabs(min) < 9007199254740992. && std::fabs(max) < 9007199254740992.) // 2^53, exact in a double
+            return SortCache::ValueType::kInt64;
+        return SortCache::ValueType::kFloat64;
+    }
+
+    template <typename T>
+    void encodeValues(const Double_t *values, size_t n, T nan_value, char *out)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            const T value = std::isnan(values[i]) ? nan_value : T(values[i]);
+            std::memcpy(out + i * sizeof(T), &value, sizeof(T));
+        }
+    }
+
+    template <typename T>
+    void decodeValues(const char *in, size_t n, T nan_value, Double_t *values)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            T value;
+            std::memcpy(&value, in + i * sizeof(T), sizeof(T));
+            values[i] = value == nan_value ? std::numeric_limits<Double_t>::quiet_NaN() : Double_t(value);
+        }
+    }
+
+    std::vector<SortCache::Source> statSources(const Run *prun)
+    {
+        std::vector<SortCache::Source> sources;
+        for (const TString &file_name : prun->getFileNames())
+        {
+            FileStat_t file_stat;
+            if (gSystem->GetPathInfo(file_name, file_stat) != 0)
+            {
+                throw std::runtime_error("Error reading run file info: " + file_name);
+            }
+            sources.push_back({file_name, file_stat.fSize, file_stat.fMtime});
+        }
+        return sources;
+    }
+}
+
+SortCache::SortCache(const TString &file_name)
+    : file_name_(file_name), pdata_(nullptr), size_(0), pheader_(nullptr), pindex_(nullptr), columns_()
+{
+    const int fd = ::open(file_name.Data(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Error opening sort cache: " + file_name);
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0 || size_t(file_stat.st_size) < sizeof(FileHeader))
+    {
+        ::close(fd);
+        throw std::runtime_error("Invalid sort cache: " + file_name);
+    }
+    size_ = file_stat.st_size;
+    void *pmapping = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (pmapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Error mapping sort cache: " + file_name);
+    }
+    pdata_ = static_cast<const char *>(pmapping);
+    ::madvise(pmapping, size_, MADV_SEQUENTIAL);
+
+    // Every length, count and position read from the file is checked against the mapping once, so a truncated or
+    // damaged cache is refused here, and converted again by RunScheduler, instead of being read past its end
+    try
+    {
+        validate();
+    }
+    catch (...)
+    {
+        ::munmap(pmapping, size_);
+        pdata_ = nullptr;
+        throw;
+    }
+}
+
+void SortCache::validate()
+{
+    const std::runtime_error invalid("Invalid or incompatible sort cache: " + file_name_);
+    // Section of n_bytes at offset lies within the mapping
+    auto within = [this](ULong64_t offset, ULong64_t n_bytes)
+    { return offset <= size_ && n_bytes <= size_ - offset; };
+
+    pheader_ = reinterpret_cast<const FileHeader *>(pdata_);
+    const ULong64_t n_chunks = ULong64_t(pheader_->n_blocks) * pheader_->n_columns;
+    if (std::memcmp(pheader_->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || pheader_->version != VERSION_ || pheader_->block_entries == 0 ||
+        pheader_->n_blocks != pheader_->n_entries / pheader_->block_entries + (pheader_->n_entries % pheader_->block_entries != 0) ||
+        pheader_->index_offset % alignof(ChunkRecord) != 0 || n_chunks > size_ / sizeof(ChunkRecord) ||
+        !within(pheader_->index_offset, n_chunks * sizeof(ChunkRecord)))
+    {
+        throw invalid;
+    }
+    pindex_ = reinterpret_cast<const ChunkRecord *>(pdata_ + pheader_->index_offset);
+
+    // Column table: width, then the length prefixed module and filter names. Source table: the length prefixed file
+    // name, size and modification time of every part
+    ULong64_t position = sizeof(FileHeader);
+    auto read_uint = [&]()
+    {
+        UInt_t value;
+        if (!within(position, sizeof(value)))
+        {
+            throw invalid;
+        }
+        std::memcpy(&value, pdata_ + position, sizeof(value));
+        position += sizeof(value);
+        return value;
+    };
+    auto read_string = [&]()
+    {
+        const UInt_t length = read_uint();
+        if (!within(position, length))
+        {
+            throw invalid;
+        }
+        TString value(std::string(pdata_ + position, length));
+        position += length;
+        return value;
+    };
+    for (UInt_t i = 0; i < pheader_->n_columns; ++i)
+    {
+        Column column;
+        column.width = read_uint();
+        column.module_name = read_string();
+        column.filter = read_string();
+        columns_.push_back(column);
+    }
+    for (UInt_t i = 0; i < pheader_->n_sources; ++i)
+    {
+        Source source;
+        source.file_name = read_string();
+        if (!within(position, sizeof(source.size) + sizeof(source.mtime)))
+        {
+            throw invalid;
+        }
+        std::memcpy(&source.size, pdata_ + position, sizeof(source.size));
+        std::memcpy(&source.mtime, pdata_ + position + sizeof(source.size), sizeof(source.mtime));
+        position += sizeof(source.size) + sizeof(source.mtime);
+        sources_.push_back(source);
+    }
+
+    // Chunks: within the file, of a known type and codec, uncompressed ones of exactly their size and aligned to be
+    // used in place
+    for (UInt_t block = 0; block < pheader_->n_blocks; ++block)
+    {
+        for (UInt_t column = 0; column < pheader_->n_columns; ++column)
+        {
+            const ChunkRecord &chunk = getChunk(block, column);
+            const ULong64_t n_values = getChunkValueNum(block, column);
+            if (chunk.type > ValueType::kFloat64 || n_values > 0xFFFFFFFFull || !within(chunk.offset, chunk.stored_bytes))
+            {
+                throw invalid;
+            }
+            const ULong64_t raw_bytes = n_values * getTypeSize(chunk.type);
+            const Bool_t valid = chunk.codec == Codec::kNone ? chunk.offset % sizeof(Double_t) == 0 && chunk.stored_bytes == raw_bytes
+                                                             : chunk.codec == Codec::kLZ4 && raw_bytes <= 0x7FFFFFFFull;
+            if (!valid)
+            {
+                throw invalid;
+            }
+        }
+    }
+}
+
+SortCache::~SortCache()
+{
+    if (pdata_)
+    {
+        ::munmap(const_cast<char *>(pdata_), size_);
+    }
+}
+
+const Int_t SortCache::findColumn(const TString &module_name, const TString &filter) const
+{
+    for (size_t i = 0; i < columns_.size(); ++i)
+    {
+        if (columns_[i].module_name == module_name && columns_[i].filter == filter)
+        {
+            return i;
+        }
+    }
+    return -1; // Return -1 if the column is not found
+}
+
+const ULong64_t SortCache::getChunkValueNum(UInt_t block, UInt_t column) const
+{
+    // Every block but the last holds block_entries entries
+    const ULong64_t first_entry = ULong64_t(block) * pheader_->block_entries;
+    return std::min<ULong64_t>(pheader_->block_entries, pheader_->n_entries - first_entry) * columns_[column].width;
+}
+
+const Double_t *SortCache::readChunk(UInt_t block, UInt_t column, std::vector<Double_t> &buffer, std::vector<char> &scratch) const
+{
+    // Values of one column of one block, entry major. Uncompressed double chunks point into the mapping, everything
+    // else is decompressed into scratch and widened into buffer.
+    const ChunkRecord &chunk = getChunk(block, column);
+    const size_t n_values = getChunkValueNum(block, column);
+    const size_t raw_bytes = n_values * getTypeSize(chunk.type);
+
+    const char *praw = pdata_ + chunk.offset;
+    if (chunk.codec == Codec::kLZ4)
+    {
+        scratch.resize(raw_bytes);
+        Int_t src_size = chunk.stored_bytes;
+        Int_t tgt_size = raw_bytes;
+        Int_t n_unzipped = 0;
+        R__unzip(&src_size, reinterpret_cast<unsigned char *>(const_cast<char *>(praw)), &tgt_size, reinterpret_cast<unsigned char *>(scratch.data()), &n_unzipped);
+        if (size_t(n_unzipped) != raw_bytes)
+        {
+            throw std::runtime_error(Form("Corrupt chunk %u of block %u in sort cache %s", column, block, file_name_.Data()));
+        }
+        praw = scratch.data();
+    }
+
+    if (chunk.type == ValueType::kFloat64 && chunk.codec == Codec::kNone)
+    {
+        return reinterpret_cast<const Double_t *>(praw); // Chunks are 8 byte aligned within the page aligned mapping
+    }
+
+    buffer.resize(n_values);
+    switch (chunk.type)
+    {
+    case ValueType::kUInt16:
+        decodeValues<UShort_t>(praw, n_values, std::numeric_limits<UShort_t>::max(), buffer.data());
+        break;
+    case ValueType::kInt32:
+        decodeValues<Int_t>(praw, n_values, std::numeric_limits<Int_t>::min(), buffer.data());
+        break;
+    case ValueType::kInt64:
+        decodeValues<Long64_t>(praw, n_values, std::numeric_limits<Long64_t>::min(), buffer.data());
+        break;
+    default:
+        std::memcpy(buffer.data(), praw, raw_bytes);
+        break;
+    }
+    return buffer.data();
+}
+
+void SortCache::convert(const Run *prun, const ChannelIndex &channel_index, const TString &file_name, UInt_t block_entries, Codec codec)
+{
+    // Blocks are bounded so the widest chunk still fits in a single ROOT compression call
+    UInt_t max_width = 1;
+    for (const ChannelIndex::Column &column : channel_index.getColumns())
+    {
+        max_width = std::max(max_width, column.width);
+    }
+    block_entries = std::clamp<UInt_t>(block_entries, 1, MAX_ZIP_BYTES / (max_width * sizeof(Double_t)));
+
+    // The parts are stated before they are read, a part written to during the conversion no longer matches
+    const std::vector<Source> sources = statSources(prun);
+    std::unique_ptr<TChain> pchain = prun->openChain();
+    TTreeReader tree_reader(pchain.get());
+    Event event(&channel_index, &tree_reader);
+
+    // Write to a temporary name, so an interrupted conversion never leaves a cache that looks complete
+    const TString temp_file_name = file_name + ".part";
+    std::ofstream out(temp_file_name.Data(), std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        throw std::runtime_error("Error creating sort cache: " + temp_file_name);
+    }
+
+    const std::vector<ChannelIndex::Column> &columns = channel_index.getColumns();
+    FileHeader header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = VERSION_;
+    header.n_columns = columns.size();
+    header.block_entries = block_entries;
+    header.n_sources = sources.size();
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const ChannelIndex::Column &column : columns)
+    {
+        const TString &module_name = column.pmodule->getName();
+        const UInt_t module_length = module_name.Length();
+        const UInt_t filter_length = column.filter.Length();
+        out.write(reinterpret_cast<const char *>(&column.width), sizeof(column.width));
+        out.write(reinterpret_cast<const char *>(&module_length), sizeof(module_length));
+        out.write(module_name.Data(), module_length);
+        out.write(reinterpret_cast<const char *>(&filter_length), sizeof(filter_length));
+        out.write(column.filter.Data(), filter_length);
+    }
+    for (const Source &source : sources)
+    {
+        const UInt_t name_length = source.file_name.Length();
+        out.write(reinterpret_cast<const char *>(&name_length), sizeof(name_length));
+        out.write(source.file_name.Data(), name_length);
+        out.write(reinterpret_cast<const char *>(&source.size), sizeof(source.size));
+        out.write(reinterpret_cast<const char *>(&source.mtime), sizeof(source.mtime));
+    }
+
+    std::vector<std::vector<Double_t>> block_values(columns.size());
+    for (size_t c = 0; c < columns.size(); ++c)
+    {
+        block_values[c].resize(size_t(block_entries) * columns[c].width);
+    }
+    std::vector<ChunkRecord> index;
+    std::vector<char> encoded, compressed;
+
+    auto write_block = [&](UInt_t n_block_entries)
+    {
+        for (size_t c = 0; c < columns.size(); ++c)
+        {
+            const size_t n_values = size_t(n_block_entries) * columns[c].width;
+            const Double_t *values = block_values[c].data();
+            ChunkRecord chunk{0, 0, findNarrowestType(values, n_values), Codec::kNone, 0};
+
+            encoded.resize(n_values * getTypeSize(chunk.type));
+            switch (chunk.type)
+            {
+            case ValueType::kUInt16:
+                encodeValues<UShort_t>(values, n_values, std::numeric_limits<UShort_t>::max(), encoded.data());
+                break;
+            case ValueType::kInt32:
+                encodeValues<Int_t>(values, n_values, std::numeric_limits<Int_t>::min(), encoded.data());
+                break;
+            case ValueType::kInt64:
+                encodeValues<Long64_t>(values, n_values, std::numeric_limits<Long64_t>::min(), encoded.data());
+                break;
+            default:
+                std::memcpy(encoded.data(), values, encoded.size());
+                break;
+            }
+
+            const char *pstored = encoded.data();
+            chunk.stored_bytes = encoded.size();
+            if (codec == Codec::kLZ4 && !encoded.empty())
+            {
+                // Keep the chunk uncompressed unless compression makes it smaller
+                compressed.resize(encoded.size());
+                Int_t src_size = encoded.size();
+                Int_t tgt_size = compressed.size();
+                Int_t n_zipped = 0;
+                R__zipMultipleAlgorithm(1, &src_size, encoded.data(), &tgt_size, compressed.data(), &n_zipped, ROOT::RCompressionSetting::EAlgorithm::kLZ4);
+                if (n_zipped > 0 && size_t(n_zipped) < encoded.size())
+                {
+                    pstored = compressed.data();
+                    chunk.stored_bytes = n_zipped;
+                    chunk.codec = Codec::kLZ4;
+                }
+            }
+
+            // Chunks start on 8 byte boundaries, so uncompressed doubles can be used in place
+            const std::streamoff position = out.tellp();
+            const std::streamoff padding = (8 - position % 8) % 8;
+            out.write(PADDING, padding);
+            chunk.offset = position + padding;
+            out.write(pstored, chunk.stored_bytes);
+            index.push_back(chunk);
+        }
+        ++header.n_blocks;
+    };
+
+    UInt_t n_block_entries = 0;
+    while (tree_reader.Next())
+    {
+        event.readEntry();
+        const Double_t *values = event.getValues().data();
+        for (size_t c = 0; c < columns.size(); ++c)
+        {
+            std::copy_n(values + columns[c].offset, columns[c].width, block_values[c].data() + size_t(n_block_entries) * columns[c].width);
+        }
+        ++header.n_entries;
+        if (++n_block_entries == block_entries)
+        {
+            write_block(n_block_entries);
+            n_block_entries = 0;
+        }
+    }
+    if (n_block_entries > 0)
+    {
+        write_block(n_block_entries);
+    }
+
+    const std::streamoff position = out.tellp();
+    const std::streamoff padding = (8 - position % 8) % 8;
+    out.write(PADDING, padding);
+    header.index_offset = position + padding;
+    out.write(reinterpret_cast<const char *>(index.data()), index.size() * sizeof(ChunkRecord));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.close();
+    if (!out || std::rename(temp_file_name.Data(), file_name.Data()) != 0)
+    {
+        throw std::runtime_error("Error writing sort cache: " + file_name);
+    }
+
+    std::cout << "CloverSort [INFO]: Run " << prun->getRunNumber() << " converted to sort cache " << file_name << ", " << header.n_entries << " entries in " << header.n_blocks << " block(s)" << std::endl;
+}
+
+Bool_t SortCache::matches(const Run *prun) const
+{
+    const std::vector<TString> &file_names = prun->getFileNames();
+    if (file_names.size() != sources_.size())
+    {
+        return kFALSE;
+    }
+    for (size_t part = 0; part < file_names.size(); ++part)
+    {
+        FileStat_t file_stat;
+        const Source &source = sources_[part];
+        if (file_names[part] != source.file_name || gSystem->GetPathInfo(file_names[part], file_stat) != 0 ||
+            file_stat.fSize != source.size || Long64_t(file_stat.fMtime) != source.mtime)
+        {
+            return kFALSE;
+        }
+    }
+    return kTRUE;
+}
+
+void SortCache::printInfo() const
+{
+    ULong64_t stored_bytes = 0;
+    for (UInt_t block = 0; block < getBlockNum(); ++block)
+    {
+        for (UInt_t column = 0; column < columns_.size(); ++column)
+        {
+            stored_bytes += getChunk(block, column).stored_bytes;
+        }
+    }
+    std::cout << Form("%s [%lld entries, %u blocks, %zu columns, %.1f MB]", file_name_.Data(), getEntries(), getBlockNum(), columns_.size(), stored_bytes / 1048576.) << std::endl;
+}
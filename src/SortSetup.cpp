@@ -0,0 +1,362 @@
+#include "SortSetup.hpp"
+#include "Experiment.hpp"
+#include "DAQModule.hpp"
+#include "Detector.hpp"
+#include "Run.hpp"
+#include "Event.hpp"
+#include "AddBack.hpp"
+#include "RandomSubtraction.hpp"
+#include "Calibration.hpp"
+#include "HitFilter.hpp"
+#include "SkimWriter.hpp"
+#include "EventStoreWriter.hpp"
+#include "TaskManager.hpp"
+#include "Task.hpp"
+#include "StaticPipeline.hpp"
+#include "RunScheduler.hpp"
+
+// Fill one amplitude spectrum per detector channel, both handle lists are resolved once before sorting
+void fillAmplitudes(Event *pevent, UInt_t slot, const HistogramManager *phist_manager, const std::vector<std::pair<ChannelHandle, HistHandle>> *phandles)
+{
+    for (const auto &[channel_handle, hist_handle] : *phandles)
+    {
+        phist_manager->fill(slot, hist_handle, pevent->getData(channel_handle));
+    }
+}
+
+// Build the hit masks and the sparse hit list of the event into its hits product
+void filterHits(Event *pevent, UInt_t slot, const HitFilter *phit_filter, ProductHandle hits_handle)
+{
+    phit_filter->process(pevent, pevent->getProduct(hits_handle, phit_filter->getProductSize()));
+}
+
+// Fill the amplitude spectra of the event's hits only, the lookup gives the HistHandle of every ChannelHandle or -1
+void fillHitAmplitudes(Event *pevent, UInt_t slot, const HitFilter *phit_filter, ProductHandle hits_handle, const HistogramManager *phist_manager, const std::vector<Int_t> *phist_lookup)
+{
+    const Double_t *hit_product = pevent->getProduct(hits_handle);
+    const Double_t *hits = phit_filter->getHits(hit_product);
+    for (UInt_t i = 0; i < phit_filter->getHitNum(hit_product); ++i)
+    {
+        const ChannelHandle channel_handle = hits[i];
+        const Int_t hist_handle = (*phist_lookup)[channel_handle];
+        if (hist_handle >= 0)
+            phist_manager->fill(slot, hist_handle, pevent->getData(channel_handle));
+    }
+}
+
+// Calibrate the event into its calibrated energies product, laid out like Event::getValues()
+void calibrateEvent(Event *pevent, UInt_t slot, const Calibration *pcalibration, ProductHandle energies_handle)
+{
+    pcalibration->process(pevent, pevent->getProduct(energies_handle, pevent->getValues().size()));
+}
+
+// Add-back every clover from the calibrated energies into the addback product, then fill the add-back spectra, whose handles are consecutive in clover order
+void addBackClovers(Event *pevent, UInt_t slot, ProductHandle energies_handle, ProductHandle addback_handle, const AddBack *paddback, const HistogramManager *phist_manager, HistHandle first_handle, MatrixHandle matrix_handle)
+{
+    Double_t *addback_product = pevent->getProduct(addback_handle, paddback->getProductSize());
+    paddback->process(pevent->getProduct(energies_handle), pevent->getValues().data(), addback_product);
+
+    const Double_t *energies = paddback->getEnergies(addback_product);
+    const Double_t *multiplicities = paddback->getMultiplicities(addback_product);
+    for (size_t i = 0; i < paddback->getClovers().size(); ++i)
+    {
+        if (multiplicities[i] > 0)
+            phist_manager->fill(slot, first_handle + i, energies[i]);
+    }
+
+    // Every pair of clovers with a hit is one gamma-gamma coincidence
+    const size_t n_clovers = paddback->getClovers().size();
+    for (size_t i = 0; i < n_clovers; ++i)
+    {
+        if (multiplicities[i] == 0)
+            continue;
+        for (size_t j = i + 1; j < n_clovers; ++j)
+        {
+            if (multiplicities[j] > 0)
+                phist_manager->fillMatrix(slot, matrix_handle, energies[i], energies[j]);
+        }
+    }
+}
+
+// Fill the prompt minus random spectra from the clover pairs of the event, weighted by their time difference, and
+// count the prompt and random pairs in the subtracted matrix
+void subtractRandoms(Event *pevent, UInt_t slot, ProductHandle addback_handle, const AddBack *paddback, RandomSubtraction *psubtraction, const HistogramManager *phist_manager, HistHandle first_handle, MatrixHandle matrix_handle)
+{
+    if (!psubtraction)
+        return;
+    const Double_t *addback_product = pevent->getProduct(addback_handle);
+    const Double_t *energies = paddback->getEnergies(addback_product);
+    const UInt_t n_pairs = psubtraction->process(energies, paddback->getTimes(addback_product), paddback->getClovers().size(), slot);
+    const RandomSubtraction::Pair *pairs = psubtraction->getPairs(slot);
+    for (UInt_t i = 0; i < n_pairs; ++i)
+    {
+        const RandomSubtraction::Pair &pair = pairs[i];
+        phist_manager->fill(slot, first_handle + pair.first, energies[pair.first], pair.weight);
+        phist_manager->fill(slot, first_handle + pair.second, energies[pair.second], pair.weight);
+        if (pair.weight > 0.)
+            phist_manager->fillMatrix(slot, matrix_handle, energies[pair.first], energies[pair.second]);
+        else
+            phist_manager->fillRandomMatrix(slot, matrix_handle, energies[pair.first], energies[pair.second]);
+    }
+}
+
+// Write the event and its calibrated energies to the skim if at least min_clovers clovers have an add-back energy
+void skimEvent(Event *pevent, UInt_t slot, ProductHandle energies_handle, ProductHandle addback_handle, const AddBack *paddback, SkimWriter *pskim_writer, UInt_t min_clovers)
+{
+    if (!pskim_writer)
+        return;
+    const Double_t *multiplicities = paddback->getMultiplicities(pevent->getProduct(addback_handle));
+    UInt_t n_clovers = 0;
+    for (size_t i = 0; i < paddback->getClovers().size(); ++i)
+    {
+        n_clovers += multiplicities[i] > 0;
+    }
+    if (n_clovers >= min_clovers)
+    {
+        pskim_writer->fill(pevent, pevent->getProduct(energies_handle), slot);
+    }
+}
+
+// Add the add-back energies of the event's clovers to the event store, which keeps events with enough clovers hit
+void storeEvent(Event *pevent, UInt_t slot, ProductHandle addback_handle, const AddBack *paddback, EventStoreWriter *pstore_writer)
+{
+    if (!pstore_writer)
+        return;
+    pstore_writer->fill(paddback->getEnergies(pevent->getProduct(addback_handle)), slot);
+}
+
+// Build the tasks and histograms of one run, every run gets its own so runs can be sorted concurrently
+void setupSort(RunContext &context, const Experiment *pexperiment, const ChannelIndex *pchannel_index, Bool_t static_pipeline)
+{
+    HistogramManager &hist_manager = context.hist_manager;
+
+    // Spectra of at least SharedHistogramBins bins are shared by the slots instead of copied into every slot
+    const UInt_t shared_bins = pexperiment->getSharedHistogramBins();
+    auto backend = [shared_bins](Int_t n_bins)
+    { return shared_bins > 0 && UInt_t(n_bins) >= shared_bins ? HistBackend::kShared : HistBackend::kSlotCopies; };
+    hist_manager.setSharedBufferSize(pexperiment->getSharedHistogramBuffer());
+
+    // Amplitude spectra of every detector on a module with an amplitude filter
+    auto *pamplitude_handles = context.make<std::vector<std::pair<ChannelHandle, HistHandle>>>();
+    for (DAQModule *pmodule : *pexperiment->getDAQModules())
+    {
+        if (pchannel_index->findColumn(pmodule, "amplitude") < 0)
+            continue;
+        for (const Detector *pdetector : *pmodule->getDetectors())
+        {
+            HistHandle hist_handle = hist_manager.addHistograms(pdetector, "amplitude", 65536, 0, 65536, backend(65536));
+            for (Int_t channel : *pdetector->getChannels())
+            {
+                pamplitude_handles->emplace_back(pchannel_index->getHandle(pmodule, "amplitude", channel), hist_handle++);
+            }
+        }
+    }
+
+    // Hits are the channels with an amplitude above 0 and no pileup flag, only they are filled into the spectra
+    auto *phit_filter = context.make<HitFilter>(*pchannel_index, "amplitude", "pileup");
+    auto *phist_lookup = context.make<std::vector<Int_t>>(pchannel_index->getSize(), -1);
+    for (const auto &[channel_handle, hist_handle] : *pamplitude_handles)
+    {
+        (*phist_lookup)[channel_handle] = hist_handle;
+    }
+
+    // Energy calibration of the run, amplitudes without a calibration entry are used as they are
+    auto *pcalibration = context.make<Calibration>(*pchannel_index);
+    if (!pexperiment->getCalibrationFileName().IsNull())
+    {
+        pcalibration->load(pexperiment->getCalibrationFileName(), context.prun->getRunNumber());
+    }
+    for (const DAQModule *pmodule : *pexperiment->getDAQModules())
+    {
+        if (pchannel_index->findColumn(pmodule, "amplitude") >= 0)
+        {
+            pcalibration->addColumn(pmodule, "amplitude");
+        }
+    }
+
+    // Add-back spectrum of every clover, crystals within 100 channel_time units of the leading crystal are summed
+    auto *paddback = context.make<AddBack>(*pchannel_index, 100.);
+    const HistHandle first_addback_handle = hist_manager.getHistNum();
+    for (const AddBack::Clover &clover : paddback->getClovers())
+    {
+        hist_manager.addHistogram(clover.pdetector->getName(), TH1D(clover.pdetector->getName() + "_addback", clover.pdetector->getName() + " add-back;Energy;Counts", 65536, 0, 4 * 65536), "", -1, backend(65536));
+    }
+    const MatrixHandle gg_handle = hist_manager.addMatrix("gg_addback", "Clover add-back #gamma#gamma;Energy;Energy", 8192, 0, 4 * 65536);
+
+    // Prompt minus random coincidence spectrum of every clover and matrix, each clover pair classified by the difference
+    // of the clovers' leading crystal times. Weighted spectra are always slot copies, shared spectra only count.
+    RandomSubtraction *psubtraction = nullptr;
+    HistHandle first_subtracted_handle = 0;
+    MatrixHandle subtracted_gg_handle = 0;
+    if (pexperiment->getPromptWindow() > 0.)
+    {
+        psubtraction = context.make<RandomSubtraction>(pexperiment->getPromptWindow(), pexperiment->getRandomWindowLow(), pexperiment->getRandomWindowUp());
+        first_subtracted_handle = hist_manager.getHistNum();
+        for (const AddBack::Clover &clover : paddback->getClovers())
+        {
+            TH1D model(clover.pdetector->getName() + "_addback_subtracted", clover.pdetector->getName() + " add-back coincidences, prompt minus random;Energy;Counts", 65536, 0, 4 * 65536);
+            model.Sumw2();
+            hist_manager.addHistogram(clover.pdetector->getName(), model);
+        }
+        subtracted_gg_handle = hist_manager.addMatrix("gg_addback_subtracted", "Clover add-back #gamma#gamma, prompt minus random;Energy;Energy", 8192, 0, 4 * 65536,
+                                                      psubtraction->getRandomWeight());
+    }
+
+    // Hits, calibration and add-back pass their results through the event, the amplitude spectra are independent
+    const ProductHandle hits_handle = context.task_manager.getProductHandle("hits");
+    const ProductHandle energies_handle = context.task_manager.getProductHandle("calibrated_energies");
+    const ProductHandle addback_handle = context.task_manager.getProductHandle("addback");
+
+    // List mode skim of the events with enough clovers hit, in the run's tree layout so it can be sorted as a run. A
+    // resumed run only sorts the events after its checkpoint, its skim would look complete without them.
+    SkimWriter *pskim_writer = nullptr;
+    const UInt_t skim_min_clovers = pexperiment->getSkimMinClovers();
+    if (!pexperiment->getSkimPattern().IsNull())
+    {
+        TString skim_file_name = pexperiment->getSkimPattern();
+        skim_file_name.ReplaceAll("---", Form("%03d", context.prun->getRunNumber()));
+        if (context.resumed)
+        {
+            std::cerr << "CloverSort [WARN]: Run " << context.prun->getRunNumber() << " is resumed from its checkpoint, skim " << skim_file_name
+                      << " is not written, sort the run without --resume to write it" << std::endl;
+        }
+        else
+        {
+            pskim_writer = context.make<SkimWriter>(*pchannel_index, skim_file_name, context.prun->getTreeName(),
+                                                    pexperiment->getSkimCompression(), pexperiment->getSkimCompressionLevel());
+            for (const DAQModule *pmodule : *pexperiment->getDAQModules())
+            {
+                if (pchannel_index->findColumn(pmodule, "amplitude") >= 0)
+                {
+                    pskim_writer->addCalibratedColumn(pmodule, "amplitude");
+                }
+            }
+        }
+    }
+
+    // Add-back hits of every event with enough clovers hit, indexed by clover and energy so gates can be set later
+    // without sorting the run again. The buckets cover the range of the add-back spectra. Gates on the store of a
+    // resumed run would miss the events before its checkpoint, so none is written.
+    EventStoreWriter *pstore_writer = nullptr;
+    if (!pexperiment->getEventStorePattern().IsNull())
+    {
+        TString store_file_name = pexperiment->getEventStorePattern();
+        store_file_name.ReplaceAll("---", Form("%03d", context.prun->getRunNumber()));
+        if (context.resumed)
+        {
+            std::cerr << "CloverSort [WARN]: Run " << context.prun->getRunNumber() << " is resumed from its checkpoint, event store " << store_file_name
+                      << " is not written, sort the run without --resume to write it" << std::endl;
+        }
+        else
+        {
+            std::vector<TString> clover_names;
+            for (const AddBack::Clover &clover : paddback->getClovers())
+            {
+                clover_names.push_back(clover.pdetector->getName());
+            }
+            pstore_writer = context.make<EventStoreWriter>(store_file_name, clover_names, 0., 4 * 65536., pexperiment->getEventStoreBuckets(),
+                                                           pexperiment->getEventStoreMinHits());
+        }
+    }
+
+    // Same stages fused at compile time, one virtual call per event or batch for the whole sort
+    if (static_pipeline)
+    {
+        auto pipeline = makePipeline(makeStage(Function<filterHits>{}, phit_filter, hits_handle),
+                                     makeStage(Function<fillHitAmplitudes>{}, phit_filter, hits_handle, &hist_manager, phist_lookup),
+                                     makeStage(Function<calibrateEvent>{}, pcalibration, energies_handle),
+                                     makeStage(Function<addBackClovers>{}, energies_handle, addback_handle, paddback, &hist_manager, first_addback_handle, gg_handle),
+                                     makeStage(Function<subtractRandoms>{}, addback_handle, paddback, psubtraction, &hist_manager, first_subtracted_handle, subtracted_gg_handle),
+                                     makeStage(Function<skimEvent>{}, energies_handle, addback_handle, paddback, pskim_writer, skim_min_clovers),
+                                     makeStage(Function<storeEvent>{}, addback_handle, paddback, pstore_writer));
+        auto *ppipeline_task = context.make<PipelineTask<decltype(pipeline)>>("standard", std::move(pipeline));
+        ppipeline_task->setOutputs({"hits", "calibrated_energies", "addback"});
+        if (!pskim_writer)
+        {
+            ppipeline_task->setBranches({"amplitude", "pileup", "channel_time"});
+        }
+        ppipeline_task->setSlotInitializeFunction([psubtraction, pskim_writer, pstore_writer](UInt_t n_slots)
+                                                  { if (psubtraction)
+                                                        psubtraction->initializeSlots(n_slots);
+                                                    if (pskim_writer)
+                                                        pskim_writer->initializeSlots(n_slots);
+                                                    if (pstore_writer)
+                                                        pstore_writer->initializeSlots(n_slots); });
+        ppipeline_task->setFinalizeFunction([pskim_writer, pstore_writer]()
+                                            { if (pskim_writer)
+                                                  pskim_writer->close();
+                                              if (pstore_writer)
+                                                  pstore_writer->close(); });
+        context.task_manager.addTask(ppipeline_task);
+        return;
+    }
+
+    using HitFilterTask = Task<void(), void(Event *, UInt_t, const HitFilter *, ProductHandle), void()>;
+    auto *phit_filter_task = context.make<HitFilterTask>("hits", []() {}, filterHits, []() {});
+    phit_filter_task->setExecuteArguments(std::make_tuple(nullptr, 0, phit_filter, hits_handle));
+    phit_filter_task->setOutputs({"hits"});
+    phit_filter_task->setBranches({"amplitude", "pileup"});
+    context.task_manager.addTask(phit_filter_task);
+
+    using AmplitudeTask = Task<void(), void(Event *, UInt_t, const HitFilter *, ProductHandle, const HistogramManager *, const std::vector<Int_t> *), void()>;
+    auto *pamplitude_task = context.make<AmplitudeTask>("amplitude", []() {}, fillHitAmplitudes, []() {});
+    pamplitude_task->setExecuteArguments(std::make_tuple(nullptr, 0, phit_filter, hits_handle, &hist_manager, phist_lookup));
+    pamplitude_task->setInputs({"hits"});
+    pamplitude_task->setBranches({"amplitude"});
+    context.task_manager.addTask(pamplitude_task);
+
+    using CalibrationTask = Task<void(), void(Event *, UInt_t, const Calibration *, ProductHandle), void()>;
+    auto *pcalibration_task = context.make<CalibrationTask>("calibration", []() {}, calibrateEvent, []() {});
+    pcalibration_task->setExecuteArguments(std::make_tuple(nullptr, 0, pcalibration, energies_handle));
+    pcalibration_task->setOutputs({"calibrated_energies"});
+    pcalibration_task->setBranches({"amplitude"});
+    context.task_manager.addTask(pcalibration_task);
+
+    using AddBackTask = Task<void(), void(Event *, UInt_t, ProductHandle, ProductHandle, const AddBack *, const HistogramManager *, HistHandle, MatrixHandle), void()>;
+    auto *paddback_task = context.make<AddBackTask>("addback", []() {}, addBackClovers, []() {});
+    paddback_task->setExecuteArguments(std::make_tuple(nullptr, 0, energies_handle, addback_handle, paddback, &hist_manager, first_addback_handle, gg_handle));
+    paddback_task->setInputs({"calibrated_energies"});
+    paddback_task->setOutputs({"addback"});
+    paddback_task->setBranches({"channel_time"});
+    context.task_manager.addTask(paddback_task);
+
+    // The clover times come with the add-back result, the subtraction reads no branches of its own
+    if (psubtraction)
+    {
+        using SubtractionTask = Task<void(), void(Event *, UInt_t, ProductHandle, const AddBack *, RandomSubtraction *, const HistogramManager *, HistHandle, MatrixHandle), void()>;
+        auto *psubtraction_task = context.make<SubtractionTask>("subtraction", []() {}, subtractRandoms, []() {});
+        psubtraction_task->setExecuteArguments(std::make_tuple(nullptr, 0, addback_handle, paddback, psubtraction, &hist_manager, first_subtracted_handle, subtracted_gg_handle));
+        psubtraction_task->setInputs({"addback"});
+        psubtraction_task->setBranches({});
+        psubtraction_task->setSlotInitializeFunction([psubtraction](UInt_t n_slots)
+                                                     { psubtraction->initializeSlots(n_slots); });
+        context.task_manager.addTask(psubtraction_task);
+    }
+
+    // The skim holds every column of the selected events, so it reads all branches
+    if (pskim_writer)
+    {
+        using SkimTask = Task<void(), void(Event *, UInt_t, ProductHandle, ProductHandle, const AddBack *, SkimWriter *, UInt_t), void()>;
+        auto *pskim_task = context.make<SkimTask>("skim", []() {}, skimEvent, [pskim_writer]()
+                                                  { pskim_writer->close(); });
+        pskim_task->setExecuteArguments(std::make_tuple(nullptr, 0, energies_handle, addback_handle, paddback, pskim_writer, skim_min_clovers));
+        pskim_task->setInputs({"calibrated_energies", "addback"});
+        pskim_task->setSlotInitializeFunction([pskim_writer](UInt_t n_slots)
+                                              { pskim_writer->initializeSlots(n_slots); });
+        context.task_manager.addTask(pskim_task);
+    }
+
+    // The event store only needs the add-back result, no branches of its own
+    if (pstore_writer)
+    {
+        using StoreTask = Task<void(), void(Event *, UInt_t, ProductHandle, const AddBack *, EventStoreWriter *), void()>;
+        auto *pstore_task = context.make<StoreTask>("store", []() {}, storeEvent, [pstore_writer]()
+                                                    { pstore_writer->close(); });
+        pstore_task->setExecuteArguments(std::make_tuple(nullptr, 0, addback_handle, paddback, pstore_writer));
+        pstore_task->setInputs({"addback"});
+        pstore_task->setBranches({});
+        pstore_task->setSlotInitializeFunction([pstore_writer](UInt_t n_slots)
+                                               { pstore_writer->initializeSlots(n_slots); });
+        context.task_manager.addTask(pstore_task);
+    }
+}
@@ -1,7 +1,38 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <map>
+#include <set>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <TString.h>
+#include <TChain.h>
+#include <TFile.h>
+#include <TROOT.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <ROOT/TTreeProcessorMT.hxx>
+#include <ROOT/TThreadExecutor.hxx>
+#include <ROOT/TTaskGroup.hxx>
 #include "TaskManager.hpp"
 #include "ITask.hpp"
+#include "Event.hpp"
+#include "ChannelIndex.hpp"
+#include "Run.hpp"
+#include "SlotStack.hpp"
+#include "HistogramManager.hpp"
+#include "SortCache.hpp"
+#include "EventBuilder.hpp"
+#include "BoundedQueue.hpp"
+#include "TaskProfiler.hpp"
+#include "Checkpointer.hpp"
+#include "ReadCounter.hpp"
 
 TaskManager::TaskManager() = default;
 
@@ -11,7 +42,8 @@ TaskManager::~TaskManager()
 
 void TaskManager::initializeTasks()
 {
-    for (auto &task : tasks_)
+    buildGraph();
+    for (auto &task : ordered_tasks_)
     {
         task->callInitialize();
     }
@@ -19,7 +51,7 @@ void TaskManager::initializeTasks()
 
 void TaskManager::executeTasks()
 {
-    for (auto &task : tasks_)
+    for (auto &task : ordered_tasks_)
     {
         task->callExecute();
     }
@@ -27,17 +59,109 @@ void TaskManager::executeTasks()
 
 void TaskManager::finalizeTasks()
 {
-    for (auto &task : tasks_)
+    for (auto &task : ordered_tasks_)
     {
         task->callFinalize();
     }
 }
 
+void TaskManager::initializeSlots(UInt_t n_slots)
+{
+    if (phist_manager_)
+    {
+        phist_manager_->initializeSlots(n_slots);
+    }
+    for (auto &task : tasks_)
+    {
+        task->callInitializeSlots(n_slots);
+    }
+}
+
+void TaskManager::executeTasks(Event *pevent, UInt_t slot)
+{
+    if (pprofiler_ && pprofiler_->countEntry(slot))
+    {
+        // Sampled entry, every task is timed
+        for (size_t i = 0; i < ordered_tasks_.size(); ++i)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            ordered_tasks_[i]->callExecute(pevent, slot);
+            pprofiler_->recordTask(slot, i, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+        return;
+    }
+    for (auto &task : ordered_tasks_)
+    {
+        task->callExecute(pevent, slot);
+    }
+}
+
+void TaskManager::executeBatch(Event *const *events, UInt_t n_events, UInt_t slot)
+{
+    // Level by level, every task runs over the whole batch. Tasks of a level share no products, so they run
+    // concurrently with the same slot, each task's per slot state is only touched by the thread running the task.
+    // The calling thread is a worker of the ROOT pool already, it runs the first task of a level itself and hands
+    // the others to a task group on the same pool, so no executor is set up per level and batch.
+    Bool_t sampled = kFALSE;
+    if (pprofiler_)
+    {
+        for (UInt_t i = 0; i < n_events; ++i)
+        {
+            sampled |= pprofiler_->countEntry(slot);
+        }
+    }
+    auto run_task = [this, events, n_events, slot, sampled](ITask *ptask)
+    {
+        if (!sampled)
+        {
+            ptask->callExecuteBatch(events, n_events, slot);
+            return;
+        }
+        // A batch holding a sampled entry times every task over the whole batch and records the time per entry.
+        // Every task has its own timing counters, so concurrent tasks of a level record without racing.
+        const auto start = std::chrono::steady_clock::now();
+        ptask->callExecuteBatch(events, n_events, slot);
+        const ULong64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        const size_t index = std::find(ordered_tasks_.begin(), ordered_tasks_.end(), ptask) - ordered_tasks_.begin();
+        pprofiler_->recordTask(slot, index, ns / std::max(n_events, 1u));
+    };
+    for (std::vector<ITask *> &level : task_levels_)
+    {
+        if (level.size() == 1)
+        {
+            run_task(level.front());
+            continue;
+        }
+        ROOT::Experimental::TTaskGroup group;
+        for (size_t i = 1; i < level.size(); ++i)
+        {
+            ITask *ptask = level[i];
+            group.Run([&run_task, ptask]()
+                      { run_task(ptask); });
+        }
+        run_task(level.front());
+        group.Wait();
+    }
+}
+
+void TaskManager::mergeSlots()
+{
+    if (phist_manager_)
+    {
+        phist_manager_->mergeSlots();
+    }
+    for (auto &task : tasks_)
+    {
+        task->callMergeSlots();
+    }
+}
+
 void TaskManager::addTask(ITask *task)
 {
     if (task)
     {
         tasks_.push_back(task);
+        buildGraph();
     }
 }
 
@@ -46,8 +170,1002 @@ void TaskManager::removeTask(const TString &name)
     auto it = std::remove_if(tasks_.begin(), tasks_.end(),
                              [&name](ITask *task)
                              { return task->getName() == name; });
-    if (it != tasks_.end())
+    if (it == tasks_.end())
+    {
+        return;
+    }
+    std::vector<ITask *> removed(it, tasks_.end());
+    tasks_.erase(it, tasks_.end());
+    buildGraph();
+
+    // Tasks reading a product that only the removed tasks wrote now read whatever the event holds
+    std::set<TString> written;
+    for (const ITask *ptask : tasks_)
+    {
+        written.insert(ptask->getOutputs().begin(), ptask->getOutputs().end());
+    }
+    for (const ITask *premoved : removed)
+    {
+        for (const TString &product : premoved->getOutputs())
+        {
+            for (const ITask *ptask : tasks_)
+            {
+                const std::vector<TString> &inputs = ptask->getInputs();
+                if (!written.count(product) && std::find(inputs.begin(), inputs.end(), product) != inputs.end())
+                {
+                    std::cerr << "CloverSort [WARN]: Task " << ptask->getName() << " reads product " << product << ", which no task writes after removing " << premoved->getName() << std::endl;
+                }
+            }
+        }
+    }
+}
+
+void TaskManager::buildGraph()
+{
+    // Edges run from every writer of a product to every reader, and between the writers of a product in the order
+    // they were added. Inputs nobody writes are external, e.g. the raw values of the event.
+    const size_t n_tasks = tasks_.size();
+    std::map<TString, std::vector<size_t>> writers;
+    for (size_t i = 0; i < n_tasks; ++i)
+    {
+        for (const TString &product : tasks_[i]->getOutputs())
+        {
+            // An output is only safe to batch if it lives in the event, i.e. the task writes it through the
+            // Event::getProduct() handle it resolved before it was added, not into state of its own
+            if (std::find(products_.begin(), products_.end(), product) == products_.end())
+            {
+                throw std::runtime_error(Form("Task %s writes product %s without a product handle, resolve it with getProductHandle() before adding the task", tasks_[i]->getName().Data(), product.Data()));
+            }
+            writers[product].push_back(i);
+        }
+    }
+
+    std::vector<std::vector<size_t>> dependents(n_tasks);
+    std::vector<UInt_t> n_dependencies(n_tasks, 0);
+    auto add_edge = [&](size_t from, size_t to)
+    {
+        if (from != to)
+        {
+            dependents[from].push_back(to);
+            ++n_dependencies[to];
+        }
+    };
+    for (const auto &[product, product_writers] : writers)
+    {
+        for (size_t k = 1; k < product_writers.size(); ++k)
+        {
+            add_edge(product_writers[k - 1], product_writers[k]);
+        }
+    }
+    for (size_t i = 0; i < n_tasks; ++i)
+    {
+        for (const TString &product : tasks_[i]->getInputs())
+        {
+            auto it = writers.find(product);
+            if (it == writers.end())
+                continue;
+            for (size_t writer : it->second)
+            {
+                add_edge(writer, i);
+            }
+        }
+    }
+
+    // Kahn's algorithm, always taking the earliest added ready task keeps the order the tasks were added in
+    // wherever no dependency forces another. The level of a task is the length of the longest path to it.
+    std::set<size_t> ready;
+    for (size_t i = 0; i < n_tasks; ++i)
+    {
+        if (n_dependencies[i] == 0)
+            ready.insert(i);
+    }
+    std::vector<size_t> levels(n_tasks, 0);
+    ordered_tasks_.clear();
+    task_levels_.clear();
+    while (!ready.empty())
+    {
+        const size_t i = *ready.begin();
+        ready.erase(ready.begin());
+        ordered_tasks_.push_back(tasks_[i]);
+        if (task_levels_.size() <= levels[i])
+        {
+            task_levels_.resize(levels[i] + 1);
+        }
+        task_levels_[levels[i]].push_back(tasks_[i]);
+        for (size_t dependent : dependents[i])
+        {
+            levels[dependent] = std::max(levels[dependent], levels[i] + 1);
+            if (--n_dependencies[dependent] == 0)
+                ready.insert(dependent);
+        }
+    }
+    if (ordered_tasks_.size() != n_tasks)
+    {
+        for (size_t i = 0; i < n_tasks; ++i)
+        {
+            if (n_dependencies[i] > 0)
+            {
+                throw std::runtime_error(Form("Task %s is part of a dependency cycle", tasks_[i]->getName().Data()));
+            }
+        }
+    }
+    has_parallel_levels_ = std::any_of(task_levels_.begin(), task_levels_.end(), [](const std::vector<ITask *> &level)
+                                       { return level.size() > 1; });
+}
+
+ProductHandle TaskManager::getProductHandle(const TString &name)
+{
+    // Handles are assigned on first use and stay valid, so tasks can resolve them before the graph is built
+    auto it = std::find(products_.begin(), products_.end(), name);
+    if (it != products_.end())
+    {
+        return it - products_.begin();
+    }
+    products_.push_back(name);
+    return products_.size() - 1;
+}
+
+void TaskManager::printGraph() const
+{
+    for (size_t level = 0; level < task_levels_.size(); ++level)
+    {
+        std::cout << "CloverSort [INFO]: Task level " << level << ":";
+        for (const ITask *ptask : task_levels_[level])
+        {
+            std::cout << " " << ptask->getName();
+        }
+        std::cout << std::endl;
+    }
+}
+
+Long64_t TaskManager::processRun(const Run *prun, const ChannelIndex &channel_index, UInt_t n_threads)
+{
+    // n_threads == 1 sorts serially on the calling thread, anything else uses the ROOT thread pool (0 = all cores)
+    if (n_threads != 1 && !ROOT::IsImplicitMTEnabled())
+    {
+        ROOT::EnableImplicitMT(n_threads);
+    }
+    if (pcheckpointer_)
+    {
+        return processCheckpointed(prun, channel_index, n_threads);
+    }
+    if (prefetch_threads_ > 0 && n_threads != 1 && ROOT::IsImplicitMTEnabled())
+    {
+        return processPrefetched(prun, channel_index, n_threads);
+    }
+    const Bool_t parallel = n_threads != 1 && ROOT::IsImplicitMTEnabled();
+    const UInt_t n_slots = parallel ? ROOT::GetThreadPoolSize() : 1;
+
+    std::cout << "CloverSort [INFO]: Sorting run " << prun->getRunNumber() << " with " << n_slots << " slot(s)" << std::endl;
+
+    initializeTasks();
+    selectColumns(channel_index, prun);
+    initializeSlots(n_slots);
+    startProfile(prun, n_slots, prun->getEntries());
+
+    std::atomic<Long64_t> n_entries{0};
+    if (parallel)
+    {
+        // Every cluster range gets its own TTreeReader, the slot identifies the per slot state the tasks may use. The
+        // clusters of all parts of a chained run are handed out together, not one part after the other
+        SlotStack slot_stack(n_slots);
+        const std::vector<std::string> file_names(prun->getFileNames().begin(), prun->getFileNames().end());
+        ROOT::TTreeProcessorMT processor(std::vector<std::string_view>(file_names.begin(), file_names.end()), prun->getTreeName().Data());
+        processor.Process([&](TTreeReader &tree_reader)
+                          {
+            const UInt_t slot = slot_stack.acquireSlot();
+            try
+            {
+                n_entries += processEntries(tree_reader, channel_index, slot);
+            }
+            catch (...)
+            {
+                slot_stack.releaseSlot(slot);
+                throw;
+            }
+            slot_stack.releaseSlot(slot); });
+    }
+    else
+    {
+        std::unique_ptr<TChain> pchain = prun->openChain();
+        TTreeReader tree_reader(pchain.get());
+        n_entries = processEntries(tree_reader, channel_index, 0);
+    }
+
+    // Slots are merged in order so the result does not depend on how clusters were scheduled
+    finishSlots();
+
+    std::cout << "CloverSort [INFO]: Run " << prun->getRunNumber() << " sorted, " << n_entries << " entries processed" << std::endl;
+
+    return n_entries;
+}
+
+Long64_t TaskManager::processCache(const Run *prun, const SortCache &cache, const ChannelIndex &channel_index, UInt_t n_threads)
+{
+    // Same event loop as processRun(), over the blocks of a sort cache instead of the clusters of the tree
+    if (n_threads != 1 && !ROOT::IsImplicitMTEnabled())
     {
-        tasks_.erase(it, tasks_.end());
+        ROOT::EnableImplicitMT(n_threads);
     }
-}
\ No newline at end of file
+    const Bool_t parallel = n_threads != 1 && ROOT::IsImplicitMTEnabled();
+    const UInt_t n_slots = parallel ? ROOT::GetThreadPoolSize() : 1;
+
+    std::cout << "CloverSort [INFO]: Sorting run " << prun->getRunNumber() << " from sort cache " << cache.getFileName() << " with " << n_slots << " slot(s)" << std::endl;
+    warnIgnoredPrefetch("sort caches");
+
+    initializeTasks();
+    selectColumns(channel_index);
+    initializeSlots(n_slots);
+    startProfile(prun, n_slots, cache.getEntries());
+
+    std::atomic<Long64_t> n_entries{0};
+    if (parallel)
+    {
+        SlotStack slot_stack(n_slots);
+        ROOT::TThreadExecutor executor;
+        executor.Foreach([&](UInt_t block)
+                         {
+            const UInt_t slot = slot_stack.acquireSlot();
+            try
+            {
+                n_entries += processBlock(cache, block, channel_index, slot);
+            }
+            catch (...)
+            {
+                slot_stack.releaseSlot(slot);
+                throw;
+            }
+            slot_stack.releaseSlot(slot); },
+                         ROOT::TSeqU(cache.getBlockNum()));
+    }
+    else
+    {
+        for (UInt_t block = 0; block < cache.getBlockNum(); ++block)
+        {
+            n_entries += processBlock(cache, block, channel_index, 0);
+        }
+    }
+
+    finishSlots();
+
+    std::cout << "CloverSort [INFO]: Run " << prun->getRunNumber() << " sorted, " << n_entries << " entries processed" << std::endl;
+
+    return n_entries;
+}
+
+Long64_t TaskManager::processBuiltEvents(const Run *prun, EventBuilder &builder, UInt_t n_threads)
+{
+    // Events are built in time order on the calling thread and handed in batches to workers, which are tasks of the
+    // ROOT pool, one thread fewer than the pool has, as the builder takes one. The batches are recycled through a
+    // free queue, so at most a fixed number of built events is held in memory at any time.
+    if (n_threads != 1 && !ROOT::IsImplicitMTEnabled())
+    {
+        ROOT::EnableImplicitMT(n_threads);
+    }
+    const Bool_t parallel = n_threads != 1 && ROOT::IsImplicitMTEnabled();
+    const UInt_t n_workers = parallel ? std::max<UInt_t>(1, ROOT::GetThreadPoolSize() - 1) : 0;
+    const UInt_t n_slots = std::max<UInt_t>(1, n_workers);
+
+    std::cout << "CloverSort [INFO]: Building and sorting events of run " << prun->getRunNumber() << " with a window of " << builder.getWindow() << " and " << n_slots << " slot(s)" << std::endl;
+    warnIgnoredPrefetch("built events");
+
+    // The builder's streams are bound on its first event, so they only read the columns the tasks declare
+    initializeTasks();
+    selectColumns(builder.getChannelIndex(), prun);
+    builder.setActiveColumns(active_columns_);
+    initializeSlots(n_slots);
+    startProfile(prun, n_slots, 0); // The number of built events is not known in advance
+
+    Long64_t n_events = 0;
+    if (n_workers == 0)
+    {
+        while (true)
+        {
+            const Bool_t sampled = pprofiler_ && pprofiler_->isSampleDue(0);
+            const auto start = sampled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+            if (!builder.next())
+                break;
+            if (sampled)
+                pprofiler_->recordRead(0, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            executeTasks(builder.getEvent(), 0);
+            ++n_events;
+        }
+    }
+    else
+    {
+        struct Batch
+        {
+            std::vector<Double_t> values; // Flat values of n_events built events
+            UInt_t n_events;              // Number of events in the batch
+        };
+
+        const UInt_t event_size = builder.getChannelIndex().getSize();
+        const UInt_t n_batches = 3 * n_workers;
+        std::vector<Batch> batches(n_batches, Batch{std::vector<Double_t>(size_t(BUILT_BATCH_EVENTS_) * event_size), 0});
+        BoundedQueue<Batch *> free_batches(n_batches);
+        BoundedQueue<Batch *> full_batches(n_batches);
+        for (Batch &batch : batches)
+        {
+            free_batches.push(&batch);
+        }
+
+        std::mutex error_mutex;
+        std::exception_ptr perror;
+        auto fail = [&](std::exception_ptr pcurrent)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!perror)
+            {
+                perror = pcurrent;
+            }
+            free_batches.close();
+            full_batches.close();
+        };
+
+        ROOT::Experimental::TTaskGroup workers;
+        for (UInt_t slot = 0; slot < n_workers; ++slot)
+        {
+            workers.Run([&, slot]()
+                        {
+                Event event(&builder.getChannelIndex());
+                Batch *pbatch = nullptr;
+                try
+                {
+                    while (full_batches.pop(pbatch))
+                    {
+                        for (UInt_t i = 0; i < pbatch->n_events; ++i)
+                        {
+                            const Bool_t sampled = pprofiler_ && pprofiler_->isSampleDue(slot);
+                            const auto start = sampled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+                            event.setValues(pbatch->values.data() + size_t(i) * event_size);
+                            if (sampled)
+                                pprofiler_->recordRead(slot, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+                            executeTasks(&event, slot);
+                        }
+                        free_batches.push(pbatch);
+                    }
+                }
+                catch (...)
+                {
+                    fail(std::current_exception());
+                } });
+        }
+
+        try
+        {
+            Batch *pbatch = nullptr;
+            Bool_t more = kTRUE;
+            while (more && free_batches.pop(pbatch))
+            {
+                pbatch->n_events = 0;
+                while (pbatch->n_events < BUILT_BATCH_EVENTS_ && (more = builder.next()))
+                {
+                    std::copy_n(builder.getEvent()->getValues().data(), event_size, pbatch->values.data() + size_t(pbatch->n_events) * event_size);
+                    ++pbatch->n_events;
+                }
+                n_events += pbatch->n_events;
+                if (!full_batches.push(pbatch))
+                {
+                    break;
+                }
+            }
+            full_batches.close();
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+        }
+
+        workers.Wait();
+        if (perror)
+        {
+            std::rethrow_exception(perror);
+        }
+    }
+
+    if (pprofiler_)
+    {
+        pprofiler_->addBytesRead(builder.getBytesRead());
+    }
+    finishSlots();
+
+    std::cout << "CloverSort [INFO]: Run " << prun->getRunNumber() << " sorted, " << n_events << " events built from " << builder.getFragmentNum() << " module fragments" << std::endl;
+
+    return n_events;
+}
+
+Long64_t TaskManager::processPrefetched(const Run *prun, const ChannelIndex &channel_index, UInt_t n_threads)
+{
+    // Reading is split from sorting: I/O threads own whole clusters, fetch and decompress them through their own file
+    // handle and copy the entries into blocks of flat values, workers take the ready blocks and run the tasks. Blocks
+    // are recycled through a free queue, so the I/O threads run at most getPrefetchDepth() blocks ahead of the workers.
+    // The workers are tasks of the ROOT pool, as many as the pool has threads beyond the I/O threads, so I/O threads
+    // and workers together do not run more threads than the pool has. The threads of the pool the workers leave
+    // free run the concurrent tasks of a batch level.
+    const UInt_t n_total = ROOT::GetThreadPoolSize();
+    const UInt_t n_io = prefetch_threads_;
+    const UInt_t n_workers = std::max<UInt_t>(1, n_total > n_io ? n_total - n_io : 1);
+    const UInt_t event_size = channel_index.getSize();
+
+    std::cout << "CloverSort [INFO]: Sorting run " << prun->getRunNumber() << " with " << n_io << " I/O thread(s) prefetching up to " << prefetch_depth_ << " block(s) for " << n_workers << " slot(s)" << std::endl;
+
+    const Run::Metadata &metadata = prun->getMetadata();
+    initializeTasks();
+    selectColumns(channel_index, prun);
+    initializeSlots(n_workers);
+    startProfile(prun, n_workers, metadata.n_entries);
+
+    struct Block
+    {
+        std::vector<Double_t> values; // Flat values of n_events entries
+        UInt_t n_events;              // Number of entries in the block
+    };
+
+    const UInt_t n_blocks = prefetch_depth_ + n_io + n_workers;
+    std::vector<Block> blocks(n_blocks, Block{std::vector<Double_t>(size_t(PREFETCH_BLOCK_ENTRIES_) * event_size), 0});
+    BoundedQueue<Block *> free_blocks(n_blocks);
+    BoundedQueue<Block *> full_blocks(prefetch_depth_);
+    for (Block &block : blocks)
+    {
+        free_blocks.push(&block);
+    }
+
+    std::mutex error_mutex;
+    std::exception_ptr perror;
+    auto fail = [&](std::exception_ptr pcurrent)
+    {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!perror)
+        {
+            perror = pcurrent;
+        }
+        free_blocks.close();
+        full_blocks.close();
+    };
+
+    std::atomic<Long64_t> n_entries{0};
+    auto work = [&](UInt_t slot)
+    {
+        Event event(&channel_index);
+        std::vector<std::unique_ptr<Event>> batch;
+        std::vector<Event *> pevents;
+        for (UInt_t i = 0; isBatched() && i < task_batch_size_; ++i)
+        {
+            batch.push_back(std::make_unique<Event>(&channel_index));
+            pevents.push_back(batch.back().get());
+        }
+        Block *pblock = nullptr;
+        try
+        {
+            while (full_blocks.pop(pblock))
+            {
+                if (isBatched())
+                {
+                    for (UInt_t first = 0; first < pblock->n_events; first += task_batch_size_)
+                    {
+                        const UInt_t n_events = std::min(task_batch_size_, pblock->n_events - first);
+                        for (UInt_t i = 0; i < n_events; ++i)
+                        {
+                            pevents[i]->setValues(pblock->values.data() + size_t(first + i) * event_size);
+                        }
+                        executeBatch(pevents.data(), n_events, slot);
+                    }
+                }
+                else
+                {
+                    for (UInt_t i = 0; i < pblock->n_events; ++i)
+                    {
+                        // Reading is done by the I/O threads, what remains for the worker is the copy out of the block
+                        const Bool_t sampled = pprofiler_ && pprofiler_->isSampleDue(slot);
+                        const auto start = sampled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+                        event.setValues(pblock->values.data() + size_t(i) * event_size);
+                        if (sampled)
+                            pprofiler_->recordRead(slot, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+                        executeTasks(&event, slot);
+                    }
+                }
+                n_entries += pblock->n_events;
+                free_blocks.push(pblock);
+            }
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+        }
+    };
+
+    // Every I/O thread pulls the next cluster until none are left, the entries of a cluster share their baskets
+    std::atomic<size_t> next_cluster{0};
+    std::atomic<UInt_t> n_io_running{n_io};
+    std::vector<std::thread> io_threads;
+    for (UInt_t io = 0; io < n_io; ++io)
+    {
+        io_threads.emplace_back([&]()
+                                {
+            try
+            {
+                // Cluster starts count over all parts of the run, as do the entries of the chain
+                std::unique_ptr<TChain> pchain = prun->openChain();
+                TTreeReader tree_reader(pchain.get());
+                Event event(&channel_index, &tree_reader, active_columns_.empty() ? nullptr : &active_columns_);
+                ReadCounter read_counter(tree_reader);
+                auto count_bytes = [&]()
+                {
+                    if (pprofiler_)
+                        pprofiler_->addBytesRead(read_counter.getBytesRead());
+                };
+                Block *pblock = nullptr;
+                for (size_t cluster = next_cluster++; cluster < metadata.cluster_starts.size(); cluster = next_cluster++)
+                {
+                    const Long64_t first = metadata.cluster_starts[cluster];
+                    const Long64_t last = cluster + 1 < metadata.cluster_starts.size() ? metadata.cluster_starts[cluster + 1] : metadata.n_entries;
+                    tree_reader.Restart();
+                    tree_reader.SetEntriesRange(first, last);
+                    while (tree_reader.Next())
+                    {
+                        if (!pblock)
+                        {
+                            if (!free_blocks.pop(pblock))
+                                return count_bytes();
+                            pblock->n_events = 0;
+                        }
+                        event.readEntry();
+                        read_counter.update();
+                        std::copy_n(event.getValues().data(), event_size, pblock->values.data() + size_t(pblock->n_events) * event_size);
+                        if (++pblock->n_events == PREFETCH_BLOCK_ENTRIES_)
+                        {
+                            if (!full_blocks.push(pblock))
+                                return count_bytes();
+                            pblock = nullptr;
+                        }
+                    }
+                }
+                count_bytes();
+                if (pblock && !full_blocks.push(pblock))
+                    return;
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+            // The last I/O thread to finish tells the workers that no more blocks are coming
+            if (--n_io_running == 0)
+            {
+                full_blocks.close();
+            } });
+    }
+
+    // Every worker task is its own slot, the pool runs them until the last I/O thread closes the queue
+    ROOT::TThreadExecutor executor;
+    executor.Foreach(work, ROOT::TSeqU(n_workers));
+    for (std::thread &io_thread : io_threads)
+    {
+        io_thread.join();
+    }
+    if (perror)
+    {
+        std::rethrow_exception(perror);
+    }
+
+    finishSlots();
+
+    std::cout << "CloverSort [INFO]: Run " << prun->getRunNumber() << " sorted, " << n_entries << " entries processed" << std::endl;
+
+    return n_entries;
+}
+
+Long64_t TaskManager::followRun(const Run *prun, const ChannelIndex &channel_index, const PublishFunc &publish, Double_t publish_interval, Double_t idle_timeout, UInt_t n_threads)
+{
+    // Sorts a run while it is being written. Every slot keeps its own handle of the file, whose tree is refreshed from
+    // disk on every pass, and only the entries committed since the previous pass are sorted, split by cluster over the
+    // slots. Tasks and histogram slots stay initialized between passes, so the work of a pass and of publishing the
+    // histograms do not depend on how long the run has been going. Only the histograms are merged for publishing,
+    // ITask::callMergeSlots() runs once when following ends.
+    if (prun->isChained())
+    {
+        // Parts are found when the experiment is read, a part the writer starts later would never be seen
+        throw std::runtime_error(Form("Run %d is split into %u parts, only runs written to a single file can be followed", prun->getRunNumber(), prun->getPartNum()));
+    }
+    if (n_threads != 1 && !ROOT::IsImplicitMTEnabled())
+    {
+        ROOT::EnableImplicitMT(n_threads);
+    }
+    const Bool_t parallel = n_threads != 1 && ROOT::IsImplicitMTEnabled();
+    const UInt_t n_slots = parallel ? ROOT::GetThreadPoolSize() : 1;
+
+    std::cout << "CloverSort [INFO]: Following run " << prun->getRunNumber() << " with " << n_slots << " slot(s), publishing every " << publish_interval << " s" << std::endl;
+    warnIgnoredPrefetch("followed runs");
+
+    std::vector<std::unique_ptr<TFile>> files;
+    std::vector<TTree *> trees = openSlotTrees(prun, n_slots, files);
+
+    initializeTasks();
+    selectColumns(channel_index, prun);
+    initializeSlots(n_slots);
+    startProfile(prun, n_slots, 0);
+
+    Long64_t n_entries = 0;
+    Long64_t n_published = 0;
+    auto last_publish = std::chrono::steady_clock::now();
+    auto last_growth = last_publish;
+    while (true)
+    {
+        // The writer saves the tree header from time to time, entries are visible once their baskets and the header are on disk
+        Long64_t n_committed = -1;
+        for (TTree *ptree : trees)
+        {
+            ptree->Refresh();
+            n_committed = n_committed < 0 ? ptree->GetEntries() : std::min(n_committed, ptree->GetEntries());
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (n_committed > n_entries)
+        {
+            EntryRanges ranges;
+            TTree::TClusterIterator cluster_iterator = trees[0]->GetClusterIterator(n_entries);
+            for (Long64_t start = cluster_iterator.Next(); start < n_committed; start = cluster_iterator.Next())
+            {
+                ranges.emplace_back(std::max<Long64_t>(start, n_entries), std::min(cluster_iterator.GetNextEntry(), n_committed));
+            }
+            n_entries += processRanges(trees, ranges, channel_index, parallel);
+            last_growth = now;
+        }
+
+        // No worker fills between passes, so the slots can be merged into slot 0 and emptied to be filled again
+        if (n_entries > n_published && std::chrono::duration<Double_t>(now - last_publish).count() >= publish_interval)
+        {
+            if (phist_manager_)
+            {
+                phist_manager_->mergeSlots(kTRUE);
+            }
+            publish(n_entries);
+            n_published = n_entries;
+            last_publish = std::chrono::steady_clock::now();
+        }
+
+        // The run is over once nothing was committed for idle_timeout seconds
+        if (idle_timeout > 0 && std::chrono::duration<Double_t>(now - last_growth).count() >= idle_timeout)
+            break;
+        if (n_committed <= n_entries)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(FOLLOW_POLL_MS_));
+        }
+    }
+
+    finishSlots();
+
+    std::cout << "CloverSort [INFO]: Run " << prun->getRunNumber() << " no longer growing, " << n_entries << " entries processed" << std::endl;
+
+    return n_entries;
+}
+
+Long64_t TaskManager::processCheckpointed(const Run *prun, const ChannelIndex &channel_index, UInt_t n_threads)
+{
+    // Clusters are sorted in epochs. Between two epochs no worker fills, so the slots can be merged into slot 0 and
+    // the histograms are consistent with the clusters sorted so far, which is what a checkpoint needs. Only merging
+    // and copying hold the workers up, the checkpoint is written by the checkpointer's own thread. An epoch is sized
+    // to end about when the next checkpoint is due, so the workers only wait at an epoch end that is checkpointed.
+    const Bool_t parallel = n_threads != 1 && ROOT::IsImplicitMTEnabled();
+    const UInt_t n_slots = parallel ? ROOT::GetThreadPoolSize() : 1;
+
+    std::cout << "CloverSort [INFO]: Sorting run " << prun->getRunNumber() << " with " << n_slots << " slot(s), checkpointing to " << pcheckpointer_->getFileName() << std::endl;
+    std::cout << "CloverSort [INFO]: Checkpointed runs are sorted in epochs of clusters instead of by TTreeProcessorMT" << std::endl;
+    warnIgnoredPrefetch("checkpointed runs");
+
+    const Run::Metadata &metadata = prun->getMetadata();
+    EntryRanges ranges;
+    for (size_t i = 0; i < metadata.cluster_starts.size(); ++i)
+    {
+        ranges.emplace_back(metadata.cluster_starts[i], i + 1 < metadata.cluster_starts.size() ? metadata.cluster_starts[i + 1] : metadata.n_entries);
+    }
+
+    initializeTasks();
+    selectColumns(channel_index, prun);
+    initializeSlots(n_slots);
+
+    // Clusters of a resumed run that are in the checkpoint are skipped, their histogram contents are restored
+    EntryRanges done;
+    Long64_t n_restored = 0;
+    if (pcheckpointer_->restore(phist_manager_))
+    {
+        done = pcheckpointer_->getRestoredRanges();
+        n_restored = pcheckpointer_->getRestoredEntries();
+        ranges = Checkpointer::subtract(ranges, done);
+        std::cout << "CloverSort [INFO]: Resuming run " << prun->getRunNumber() << ", " << n_restored << " entries restored from " << pcheckpointer_->getFileName() << std::endl;
+    }
+
+    std::vector<std::unique_ptr<TChain>> chains;
+    std::vector<TTree *> trees = openSlotChains(prun, n_slots, chains);
+    startProfile(prun, n_slots, metadata.n_entries - n_restored);
+
+    // Epochs are sized from the measured clusters per second to last until the next checkpoint is due, but at least a
+    // tenth of the interval, so a checkpoint that is not written yet when it is due is never far behind
+    const Double_t min_epoch_seconds = pcheckpointer_->getInterval() / 10.;
+    size_t epoch_size = 4 * n_slots;
+    Long64_t n_entries = 0;
+    for (size_t next = 0; next < ranges.size();)
+    {
+        const EntryRanges epoch(ranges.begin() + next, ranges.begin() + std::min(next + epoch_size, ranges.size()));
+        const auto start = std::chrono::steady_clock::now();
+        n_entries += processRanges(trees, epoch, channel_index, parallel);
+        done.insert(done.end(), epoch.begin(), epoch.end());
+        next += epoch.size();
+
+        const Double_t seconds = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - start).count();
+        if (phist_manager_ && next < ranges.size() && pcheckpointer_->isDue())
+        {
+            phist_manager_->mergeSlots(kTRUE);
+            pcheckpointer_->submit(*phist_manager_, done);
+        }
+        if (seconds > 0)
+        {
+            const Double_t epoch_seconds = std::max(pcheckpointer_->getSecondsToDue(), min_epoch_seconds);
+            epoch_size = std::clamp<size_t>(epoch.size() * epoch_seconds / seconds, n_slots, 4 * epoch_size);
+        }
+    }
+
+    finishSlots();
+
+    std::cout << "CloverSort [INFO]: Run " << prun->getRunNumber() << " sorted, " << n_entries << " entries processed" << std::endl;
+
+    return n_entries + n_restored;
+}
+
+std::vector<TTree *> TaskManager::openSlotTrees(const Run *prun, UInt_t n_slots, std::vector<std::unique_ptr<TFile>> &files) const
+{
+    // One handle of the run file per slot, a slot's tree is only ever read by the worker holding the slot
+    files.clear();
+    std::vector<TTree *> trees;
+    for (UInt_t slot = 0; slot < n_slots; ++slot)
+    {
+        files.emplace_back(TFile::Open(prun->getFileName(), "READ"));
+        if (!files.back() || files.back()->IsZombie())
+        {
+            throw std::runtime_error("Error opening file: " + prun->getFileName());
+        }
+        trees.push_back(static_cast<TTree *>(files.back()->Get(prun->getTreeName())));
+        if (!trees.back())
+        {
+            throw std::runtime_error("Tree " + prun->getTreeName() + " not found in file: " + prun->getFileName());
+        }
+    }
+    return trees;
+}
+
+std::vector<TTree *> TaskManager::openSlotChains(const Run *prun, UInt_t n_slots, std::vector<std::unique_ptr<TChain>> &chains) const
+{
+    // One chain over all parts of the run per slot, entry ranges may lie in any part
+    chains.clear();
+    std::vector<TTree *> trees;
+    for (UInt_t slot = 0; slot < n_slots; ++slot)
+    {
+        chains.push_back(prun->openChain());
+        trees.push_back(chains.back().get());
+    }
+    return trees;
+}
+
+Long64_t TaskManager::processRanges(const std::vector<TTree *> &trees, const EntryRanges &ranges, const ChannelIndex &channel_index, Bool_t parallel)
+{
+    std::atomic<Long64_t> n_entries{0};
+    auto process_range = [&](UInt_t range, UInt_t slot)
+    {
+        TTreeReader tree_reader(trees[slot]);
+        tree_reader.SetEntriesRange(ranges[range].first, ranges[range].second);
+        n_entries += processEntries(tree_reader, channel_index, slot);
+    };
+    if (parallel && ranges.size() > 1)
+    {
+        SlotStack slot_stack(trees.size());
+        ROOT::TThreadExecutor executor;
+        executor.Foreach([&](UInt_t range)
+                         {
+            const UInt_t slot = slot_stack.acquireSlot();
+            try
+            {
+                process_range(range, slot);
+            }
+            catch (...)
+            {
+                slot_stack.releaseSlot(slot);
+                throw;
+            }
+            slot_stack.releaseSlot(slot); },
+                         ROOT::TSeqU(ranges.size()));
+    }
+    else
+    {
+        for (UInt_t range = 0; range < ranges.size(); ++range)
+        {
+            process_range(range, 0);
+        }
+    }
+    return n_entries;
+}
+
+void TaskManager::selectColumns(const ChannelIndex &channel_index, const Run *prun)
+{
+    // A column is read if some task declares its module.filter branch, its filter, or "*"
+    const std::vector<ChannelIndex::Column> &columns = channel_index.getColumns();
+    active_columns_.assign(columns.size(), 0);
+    for (const ITask *ptask : tasks_)
+    {
+        for (const TString &branch : ptask->getBranches())
+        {
+            for (size_t i = 0; i < columns.size(); ++i)
+            {
+                if (branch == "*" || branch == columns[i].filter || branch == ChannelIndex::getBranchName(columns[i].pmodule, columns[i].filter))
+                {
+                    active_columns_[i] = 1;
+                }
+            }
+        }
+    }
+
+    const size_t n_active = std::count(active_columns_.begin(), active_columns_.end(), 1);
+    if (n_active == columns.size())
+    {
+        active_columns_.clear();
+        return;
+    }
+
+    // Branch sizes come from the run metadata, named like Event::bindReaders() finds them
+    TString report = Form("CloverSort [INFO]: Tasks read %zu of %zu columns", n_active, columns.size());
+    if (prun)
+    {
+        const std::map<TString, Long64_t> &branch_zip_bytes = prun->getMetadata().branch_zip_bytes;
+        Long64_t active_bytes = 0, total_bytes = 0;
+        for (size_t i = 0; i < columns.size(); ++i)
+        {
+            auto it = branch_zip_bytes.find(ChannelIndex::getBranchName(columns[i].pmodule, columns[i].filter));
+            if (it == branch_zip_bytes.end())
+            {
+                it = branch_zip_bytes.find(columns[i].filter);
+            }
+            const Long64_t bytes = it != branch_zip_bytes.end() ? it->second : 0;
+            total_bytes += bytes;
+            active_bytes += active_columns_[i] ? bytes : 0;
+        }
+        if (total_bytes > 0)
+        {
+            report += Form(", %.1f of %.1f MB compressed, %.1f MB (%.1f%%) not read", active_bytes / 1e6, total_bytes / 1e6,
+                           (total_bytes - active_bytes) / 1e6, 100. * (total_bytes - active_bytes) / total_bytes);
+        }
+    }
+    std::cout << report << std::endl;
+}
+
+void TaskManager::warnIgnoredPrefetch(const TString &sort_path) const
+{
+    // Only processRun() on the run's tree prefetches, every other event loop reads its entries in the workers
+    if (prefetch_threads_ > 0)
+    {
+        std::cerr << "CloverSort [WARN]: PrefetchThreads " << prefetch_threads_ << " is ignored for " << sort_path << ", only runs sorted from their tree are prefetched" << std::endl;
+    }
+}
+
+void TaskManager::startProfile(const Run *prun, UInt_t n_slots, Long64_t n_expected_entries)
+{
+    if (pprofiler_)
+    {
+        pprofiler_->start(Form("Run %i", prun->getRunNumber()), ordered_tasks_, n_slots, n_expected_entries);
+    }
+}
+
+void TaskManager::finishSlots()
+{
+    // The event loop ends here, the merge is timed on its own since it does not scale with the number of entries
+    if (pprofiler_)
+    {
+        pprofiler_->stop();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    mergeSlots();
+    if (pprofiler_)
+    {
+        pprofiler_->setMergeSeconds(std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - start).count());
+        pprofiler_->printSummary();
+    }
+    finalizeTasks();
+}
+
+Long64_t TaskManager::processBlock(const SortCache &cache, UInt_t block, const ChannelIndex &channel_index, UInt_t slot)
+{
+    Event event(&channel_index, &cache, active_columns_.empty() ? nullptr : &active_columns_);
+
+    const Long64_t first_entry = Long64_t(block) * cache.getBlockEntries();
+    const Long64_t last_entry = std::min(first_entry + cache.getBlockEntries(), cache.getEntries());
+    if (isBatched())
+    {
+        // Entries are read by one event, so the block's chunks are decoded once, and copied into the batch
+        std::vector<std::unique_ptr<Event>> batch;
+        std::vector<Event *> pevents;
+        for (UInt_t i = 0; i < task_batch_size_; ++i)
+        {
+            batch.push_back(std::make_unique<Event>(&channel_index));
+            pevents.push_back(batch.back().get());
+        }
+        for (Long64_t entry = first_entry; entry < last_entry; entry += task_batch_size_)
+        {
+            const UInt_t n_events = std::min<Long64_t>(task_batch_size_, last_entry - entry);
+            for (UInt_t i = 0; i < n_events; ++i)
+            {
+                event.readEntry(entry + i);
+                pevents[i]->setValues(event.getValues().data());
+            }
+            executeBatch(pevents.data(), n_events, slot);
+        }
+        return last_entry - first_entry;
+    }
+
+    for (Long64_t entry = first_entry; entry < last_entry; ++entry)
+    {
+        const Bool_t sampled = pprofiler_ && pprofiler_->isSampleDue(slot);
+        const auto start = sampled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        event.readEntry(entry);
+        if (sampled)
+            pprofiler_->recordRead(slot, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        executeTasks(&event, slot);
+    }
+    return last_entry - first_entry;
+}
+
+Long64_t TaskManager::processEntries(TTreeReader &tree_reader, const ChannelIndex &channel_index, UInt_t slot)
+{
+    // The Event has to bind its readers before the first call to Next()
+    Event event(&channel_index, &tree_reader, active_columns_.empty() ? nullptr : &active_columns_);
+    ReadCounter read_counter(tree_reader);
+
+    Long64_t n_entries = 0;
+    if (isBatched())
+    {
+        // Entries are copied into the events of a batch, which then goes through the task graph level by level
+        std::vector<std::unique_ptr<Event>> batch;
+        std::vector<Event *> pevents;
+        for (UInt_t i = 0; i < task_batch_size_; ++i)
+        {
+            batch.push_back(std::make_unique<Event>(&channel_index));
+            pevents.push_back(batch.back().get());
+        }
+        UInt_t n_events = 0;
+        while (tree_reader.Next())
+        {
+            event.readEntry();
+            if (pprofiler_)
+                read_counter.update();
+            pevents[n_events]->setValues(event.getValues().data());
+            if (++n_events == task_batch_size_)
+            {
+                executeBatch(pevents.data(), n_events, slot);
+                n_events = 0;
+            }
+            ++n_entries;
+        }
+        if (n_events > 0)
+        {
+            executeBatch(pevents.data(), n_events, slot);
+        }
+        if (pprofiler_)
+            pprofiler_->addBytesRead(read_counter.getBytesRead());
+        return n_entries;
+    }
+
+    while (true)
+    {
+        // Reading is timed for sampled entries only, Next() and readEntry() include the basket decompression
+        const Bool_t sampled = pprofiler_ && pprofiler_->isSampleDue(slot);
+        const auto start = sampled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        if (!tree_reader.Next())
+            break;
+        event.readEntry();
+        if (sampled)
+            pprofiler_->recordRead(slot, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        if (pprofiler_)
+            read_counter.update();
+        executeTasks(&event, slot);
+        ++n_entries;
+    }
+    if (pprofiler_)
+        pprofiler_->addBytesRead(read_counter.getBytesRead());
+    return n_entries;
+}
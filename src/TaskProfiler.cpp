@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include "TaskProfiler.hpp"
+#include "ITask.hpp"
+
+Double_t TaskProfiler::TaskSummary::getQuantileNs(Double_t quantile) const
+{
+    // Upper edge of the latency bin holding the quantile
+    const Double_t target = quantile * n_sampled;
+    ULong64_t n_below = 0;
+    for (UInt_t bin = 0; bin < LATENCY_BINS_; ++bin)
+    {
+        n_below += latency[bin];
+        if (n_below > 0 && n_below >= target)
+        {
+            return Double_t(1ull << bin);
+        }
+    }
+    return 0.;
+}
+
+TaskProfiler::TaskProfiler(UInt_t sample_interval, Double_t progress_interval)
+    : sample_interval_(sample_interval), progress_interval_(progress_interval), label_(), task_names_(), slots_(), n_slots_(0),
+      n_expected_entries_(0), start_time_(), stop_time_(), running_(false), bytes_read_(0), merge_seconds_(0)
+{
+}
+
+TaskProfiler::~TaskProfiler()
+{
+    stop();
+}
+
+const Long64_t TaskProfiler::getEntries() const
+{
+    Long64_t n_entries = 0;
+    for (UInt_t slot = 0; slot < n_slots_; ++slot)
+    {
+        n_entries += slots_[slot].n_entries.load(std::memory_order_relaxed);
+    }
+    return n_entries;
+}
+
+const Double_t TaskProfiler::getElapsedSeconds() const
+{
+    std::lock_guard<std::mutex> lock(monitor_mutex_);
+    const auto end_time = running_ ? std::chrono::steady_clock::now() : stop_time_;
+    return std::chrono::duration<Double_t>(end_time - start_time_).count();
+}
+
+const Bool_t TaskProfiler::isRunning() const
+{
+    std::lock_guard<std::mutex> lock(monitor_mutex_);
+    return running_;
+}
+
+std::vector<TaskProfiler::TaskSummary> TaskProfiler::getSummaries() const
+{
+    // Reading first, then every task in execution order, each summed over the slots
+    std::vector<TaskSummary> summaries;
+    const ULong64_t n_entries = getEntries();
+    for (size_t i = 0; i <= task_names_.size(); ++i)
+    {
+        TaskSummary summary{i == 0 ? TString("read") : task_names_[i - 1], n_entries, 0, 0., {}};
+        for (UInt_t slot = 0; slot < n_slots_; ++slot)
+        {
+            const TimingCounters &counters = i == 0 ? slots_[slot].read : slots_[slot].tasks[i - 1];
+            summary.n_sampled += counters.n_sampled;
+            summary.sampled_ns += counters.sampled_ns;
+            for (UInt_t bin = 0; bin < LATENCY_BINS_; ++bin)
+            {
+                summary.latency[bin] += counters.latency[bin];
+            }
+        }
+        summaries.push_back(summary);
+    }
+    return summaries;
+}
+
+void TaskProfiler::start(const TString &label, const std::vector<ITask *> &tasks, UInt_t n_slots, Long64_t n_expected_entries)
+{
+    stop();
+
+    label_ = label;
+    task_names_.clear();
+    for (const ITask *ptask : tasks)
+    {
+        task_names_.push_back(ptask->getName());
+    }
+    n_slots_ = n_slots;
+    slots_ = std::make_unique<SlotCounters[]>(n_slots);
+    for (UInt_t slot = 0; slot < n_slots; ++slot)
+    {
+        slots_[slot].countdown = sample_interval_ ? sample_interval_ : 1;
+        slots_[slot].tasks.resize(tasks.size());
+    }
+    n_expected_entries_ = n_expected_entries;
+    merge_seconds_ = 0;
+    // The event loops add the bytes their own readers read, see ReadCounter
+    bytes_read_ = 0;
+    {
+        // Set under the lock, so a monitor that sees the profiler running also sees its counters
+        std::lock_guard<std::mutex> lock(monitor_mutex_);
+        start_time_ = std::chrono::steady_clock::now();
+        running_ = true;
+    }
+    if (progress_interval_ > 0)
+    {
+        monitor_thread_ = std::thread(&TaskProfiler::monitor, this);
+    }
+}
+
+void TaskProfiler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(monitor_mutex_);
+        if (!running_)
+            return;
+        running_ = false;
+        stop_time_ = std::chrono::steady_clock::now();
+    }
+    monitor_condition_.notify_all();
+    if (monitor_thread_.joinable())
+    {
+        monitor_thread_.join();
+    }
+}
+
+void TaskProfiler::record(TimingCounters &counters, ULong64_t ns)
+{
+    // Power of two bins: bin b holds [2^(b-1), 2^b) ns, bin 0 holds 0 ns
+    const UInt_t bin = ns ? std::min<UInt_t>(64 - __builtin_clzll(ns), LATENCY_BINS_ - 1) : 0;
+    ++counters.latency[bin];
+    ++counters.n_sampled;
+    counters.sampled_ns += ns;
+}
+
+void TaskProfiler::monitor()
+{
+    std::unique_lock<std::mutex> lock(monitor_mutex_);
+    while (!monitor_condition_.wait_for(lock, std::chrono::duration<Double_t>(progress_interval_), [this]()
+                                        { return !running_; }))
+    {
+        lock.unlock();
+        printProgress();
+        lock.lock();
+    }
+}
+
+void TaskProfiler::printProgress() const
+{
+    const Long64_t n_entries = getEntries();
+    const Double_t elapsed = getElapsedSeconds();
+    const Double_t rate = elapsed > 0 ? n_entries / elapsed : 0.;
+
+    TString progress = Form("CloverSort [INFO]: %s: %lld", label_.Data(), n_entries);
+    if (n_expected_entries_ > 0)
+    {
+        progress += Form("/%lld entries (%.1f%%)", n_expected_entries_, 100. * n_entries / n_expected_entries_);
+    }
+    else
+    {
+        progress += " entries";
+    }
+    progress += Form(", %.3g entries/s", rate);
+    if (n_expected_entries_ > 0 && rate > 0)
+    {
+        const Long64_t eta = std::max<Long64_t>(0, (n_expected_entries_ - n_entries) / rate);
+        progress += Form(", ETA %02lld:%02lld:%02lld", eta / 3600, eta / 60 % 60, eta % 60);
+    }
+    std::cout << progress << std::endl;
+}
+
+void TaskProfiler::printSummary() const
+{
+    const Long64_t n_entries = getEntries();
+    const Double_t elapsed = getElapsedSeconds();
+    std::cout << Form("CloverSort [INFO]: %s: %lld entries in %.2f s (%.3g entries/s), %.1f MB read (%.1f MB/s), slots merged in %.2f s",
+                      label_.Data(), n_entries, elapsed, elapsed > 0 ? n_entries / elapsed : 0., bytes_read_ / 1e6,
+                      elapsed > 0 ? bytes_read_ / 1e6 / elapsed : 0., merge_seconds_)
+              << std::endl;
+    if (!sample_interval_)
+        return;
+
+    // Estimated times are summed over the slots, i.e. CPU time rather than wall clock time
+    for (const TaskSummary &summary : getSummaries())
+    {
+        std::cout << Form("CloverSort [INFO]:   %-20s mean %10.0f ns, p50 < %8.0f ns, p99 < %8.0f ns, ~%.2f s over %llu sampled calls",
+                          summary.name.Data(), summary.getMeanNs(), summary.getQuantileNs(0.5), summary.getQuantileNs(0.99),
+                          summary.getEstimatedSeconds(), summary.n_sampled)
+                  << std::endl;
+    }
+}
+
+void TaskProfiler::writeSummary(const TString &file_name) const
+{
+    std::ofstream output(file_name.Data());
+    if (!output)
+    {
+        throw std::runtime_error("Error opening profile file: " + file_name);
+    }
+
+    const Long64_t n_entries = getEntries();
+    const Double_t elapsed = getElapsedSeconds();
+    const std::vector<TaskSummary> summaries = getSummaries();
+
+    if (file_name.EndsWith(".csv"))
+    {
+        // The total row holds the wall clock time of the whole event loop
+        output << "name,calls,sampled,mean_ns,p50_ns,p99_ns,estimated_s" << std::endl;
+        output << "total," << n_entries << ",0,0,0,0," << elapsed << std::endl;
+        for (const TaskSummary &summary : summaries)
+        {
+            output << summary.name << "," << summary.n_calls << "," << summary.n_sampled << "," << summary.getMeanNs() << ","
+                   << summary.getQuantileNs(0.5) << "," << summary.getQuantileNs(0.99) << "," << summary.getEstimatedSeconds() << std::endl;
+        }
+        return;
+    }
+
+    output << "{" << std::endl;
+    output << "  \"label\": \"" << label_ << "\"," << std::endl;
+    output << "  \"entries\": " << n_entries << "," << std::endl;
+    output << "  \"seconds\": " << elapsed << "," << std::endl;
+    output << "  \"entries_per_s\": " << (elapsed > 0 ? n_entries / elapsed : 0.) << "," << std::endl;
+    output << "  \"bytes_read\": " << bytes_read_ << "," << std::endl;
+    output << "  \"mb_per_s\": " << (elapsed > 0 ? bytes_read_ / 1e6 / elapsed : 0.) << "," << std::endl;
+    output << "  \"merge_seconds\": " << merge_seconds_ << "," << std::endl;
+    output << "  \"slots\": " << n_slots_ << "," << std::endl;
+    output << "  \"sample_interval\": " << sample_interval_ << "," << std::endl;
+    output << "  \"tasks\": [" << std::endl;
+    for (size_t i = 0; i < summaries.size(); ++i)
+    {
+        const TaskSummary &summary = summaries[i];
+        output << "    {\"name\": \"" << summary.name << "\", \"calls\": " << summary.n_calls << ", \"sampled\": " << summary.n_sampled
+               << ", \"mean_ns\": " << summary.getMeanNs() << ", \"p50_ns\": " << summary.getQuantileNs(0.5)
+               << ", \"p99_ns\": " << summary.getQuantileNs(0.99) << ", \"estimated_s\": " << summary.getEstimatedSeconds() << ", \"latency\": [";
+        for (UInt_t bin = 0; bin < LATENCY_BINS_; ++bin)
+        {
+            output << (bin ? ", " : "") << summary.latency[bin];
+        }
+        output << "]}" << (i + 1 < summaries.size() ? "," : "") << std::endl;
+    }
+    output << "  ]" << std::endl;
+    output << "}" << std::endl;
+}
@@ -0,0 +1,42 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#include <iostream>
+
+// Assertions of the test programs in tests/. A failed check is reported with its location and counted, the program
+// returns the number of failed checks, so make test stops at the first program with a failure.
+namespace Check
+{
+    inline int n_failed = 0; // Number of failed checks so far
+}
+
+#define CHECK(condition)                                                                                         \
+    do                                                                                                           \
+    {                                                                                                            \
+        if (!(condition))                                                                                        \
+        {                                                                                                        \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl;              \
+            ++Check::n_failed;                                                                                   \
+        }                                                                                                        \
+    } while (0)
+
+#define CHECK_THROWS(statement, exception)                                                                       \
+    do                                                                                                           \
+    {                                                                                                            \
+        Bool_t thrown = kFALSE;                                                                                  \
+        try                                                                                                      \
+        {                                                                                                        \
+            statement;                                                                                           \
+        }                                                                                                        \
+        catch (const exception &)                                                                                \
+        {                                                                                                        \
+            thrown = kTRUE;                                                                                      \
+        }                                                                                                        \
+        if (!thrown)                                                                                             \
+        {                                                                                                        \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": no " #exception " thrown by " #statement << std::endl; \
+            ++Check::n_failed;                                                                                   \
+        }                                                                                                        \
+    } while (0)
+
+#endif // CHECK_HPP
@@ -0,0 +1,99 @@
+#include <memory>
+#include <TH1D.h>
+#include <TSystem.h>
+#include "Checkpointer.hpp"
+#include "HistogramManager.hpp"
+#include "Check.hpp"
+
+// Checkpointer: entry ranges are coalesced and subtracted exactly, and a sort resumed from a checkpoint restores the
+// ranges and histogram state of the epochs written before it
+
+namespace
+{
+    using RangeList = Checkpointer::RangeList;
+
+    // Histograms and matrix of the checkpointed sort, the same setup every time like a sort started again
+    void setupHistograms(HistogramManager &hist_manager)
+    {
+        hist_manager.addHistogram("clover", TH1D("energy", "Energy", 100, 0., 100.));
+        hist_manager.addMatrix("gg", "Coincidences", 16, 0., 16.);
+        hist_manager.initializeSlots(2);
+    }
+}
+
+void testCoalesce()
+{
+    // Unordered, overlapping, adjacent and empty ranges
+    CHECK((Checkpointer::coalesce({{50, 60}, {0, 10}, {5, 20}, {20, 30}, {40, 40}, {70, 80}, {55, 75}}) == RangeList{{0, 30}, {50, 80}}));
+    CHECK(Checkpointer::coalesce({}).empty());
+    CHECK(Checkpointer::coalesce({{10, 10}}).empty());
+}
+
+void testSubtract()
+{
+    // Done ranges inside, across the edges of and beyond the ranges to sort
+    CHECK((Checkpointer::subtract({{0, 100}}, {{10, 20}, {40, 50}}) == RangeList{{0, 10}, {20, 40}, {50, 100}}));
+    CHECK((Checkpointer::subtract({{0, 100}, {200, 300}}, {{50, 250}}) == RangeList{{0, 50}, {250, 300}}));
+    CHECK((Checkpointer::subtract({{0, 100}}, {{0, 100}}) == RangeList{}));
+    CHECK((Checkpointer::subtract({{0, 100}}, {{100, 200}}) == RangeList{{0, 100}}));
+
+    // Done ranges come unordered and overlapping from the epochs of the checkpoint
+    CHECK((Checkpointer::subtract({{0, 100}}, {{60, 80}, {0, 30}, {20, 40}}) == RangeList{{40, 60}, {80, 100}}));
+}
+
+void testRestore()
+{
+    const TString file_name = "TestCheckpointer_checkpoint.root";
+    gSystem->Unlink(file_name);
+
+    // Two epochs of a sort, the histograms merged into slot 0 before the checkpoint like between epochs
+    HistogramManager sorted;
+    setupHistograms(sorted);
+    for (Int_t i = 0; i < 1000; ++i)
+    {
+        sorted.fill(i % 2, 0, i % 100 + 0.5);
+        sorted.fillMatrix(i % 2, 0, i % 16 + 0.5, (i / 16) % 16 + 0.5);
+    }
+    sorted.mergeSlots(kTRUE);
+    {
+        Checkpointer checkpointer(file_name, 0.);
+        checkpointer.submit(sorted, {{500, 1000}, {0, 500}});
+        // The destructor waits until the checkpoint is written
+    }
+    CHECK(!gSystem->AccessPathName(file_name));
+    CHECK(!Checkpointer::isComplete(file_name));
+
+    // The resumed sort starts from the checkpoint's state and only sorts what the checkpoint lacks
+    HistogramManager resumed;
+    setupHistograms(resumed);
+    Checkpointer checkpointer(file_name, 0.);
+    CHECK(checkpointer.restore(&resumed));
+    CHECK((checkpointer.getRestoredRanges() == RangeList{{0, 1000}}));
+    CHECK(checkpointer.getRestoredEntries() == 1000);
+    CHECK((Checkpointer::subtract({{0, 1500}}, checkpointer.getRestoredRanges()) == RangeList{{1000, 1500}}));
+    for (Int_t bin = 0; bin <= 101; ++bin)
+    {
+        CHECK(resumed.getSlot(0)[0]->GetBinContent(bin) == sorted.getHistogram(0)->GetBinContent(bin));
+    }
+    CHECK(resumed.getMatrix(0)->getCounts() == sorted.getMatrix(0)->getCounts());
+
+    // A complete checkpoint is not restored, its run's hist file went missing and the run is sorted again
+    checkpointer.complete(1500);
+    CHECK(Checkpointer::isComplete(file_name));
+    HistogramManager again;
+    setupHistograms(again);
+    Checkpointer complete_checkpointer(file_name, 0.);
+    CHECK(!complete_checkpointer.restore(&again));
+    CHECK(complete_checkpointer.getRestoredRanges().empty());
+
+    gSystem->Unlink(file_name);
+}
+
+int main()
+{
+    testCoalesce();
+    testSubtract();
+    testRestore();
+    std::cout << "TestCheckpointer: " << Check::n_failed << " failed check(s)" << std::endl;
+    return Check::n_failed;
+}
@@ -0,0 +1,133 @@
+#include <cmath>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <TH1D.h>
+#include <TH2.h>
+#include "CoincidenceMatrix.hpp"
+#include "Check.hpp"
+
+// CoincidenceMatrix: the stored upper triangle reads back as the full symmetric matrix of filling both (x, y) and
+// (y, x), with diagonal pairs counted twice, in getCount(), the TH2 export, the projection and gates
+
+namespace
+{
+    const Int_t N_BINS = 20;
+
+    using FullMatrix = std::vector<std::vector<Double_t>>;
+
+    // Fills pairs into the matrix from several slots and the full matrix, both orders of every pair in range
+    void fillPairs(CoincidenceMatrix &matrix, FullMatrix &full, UInt_t n_pairs, UInt_t seed, Bool_t random)
+    {
+        std::mt19937 generator(seed);
+        std::uniform_real_distribution<Double_t> energy(-2., N_BINS + 2.);
+        for (UInt_t i = 0; i < n_pairs; ++i)
+        {
+            const Double_t x = energy(generator);
+            const Double_t y = i % 10 == 0 ? x : energy(generator); // Some pairs on the diagonal
+            if (random)
+                matrix.fillRandom(i % 3, x, y);
+            else
+                matrix.fill(i % 3, x, y);
+            const Int_t bin_x = matrix.findBin(x), bin_y = matrix.findBin(y);
+            if (bin_x < 0 || bin_y < 0)
+                continue;
+            full[bin_x][bin_y] += 1;
+            full[bin_y][bin_x] += 1;
+        }
+        matrix.flushSlots();
+    }
+}
+
+void testSymmetricView()
+{
+    CoincidenceMatrix matrix("gg", "Coincidences", N_BINS, 0., N_BINS, 64);
+    matrix.initializeSlots(3);
+    FullMatrix full(N_BINS, std::vector<Double_t>(N_BINS, 0.));
+    fillPairs(matrix, full, 50000, 1, kFALSE);
+
+    CHECK(matrix.getCellNum() == ULong64_t(N_BINS) * (N_BINS + 1) / 2);
+    Bool_t diagonal_filled = kFALSE;
+    for (Int_t i = 0; i < N_BINS; ++i)
+    {
+        for (Int_t j = 0; j < N_BINS; ++j)
+        {
+            CHECK(matrix.getCount(i, j) == ULong64_t(full[i][j]));
+            CHECK(matrix.getCount(i, j) == matrix.getCount(j, i));
+        }
+        // Every diagonal pair is counted twice, so diagonal counts are even
+        CHECK(matrix.getCount(i, i) % 2 == 0);
+        diagonal_filled |= matrix.getCount(i, i) > 0;
+    }
+    CHECK(diagonal_filled);
+    CHECK_THROWS(matrix.getCount(N_BINS, 0), std::out_of_range);
+
+    // The export, projection and gates show the same symmetric matrix
+    std::unique_ptr<TH2> pexport = matrix.toTH2();
+    std::unique_ptr<TH1D> pprojection = matrix.project("gg_projection");
+    std::unique_ptr<TH1D> pgate = matrix.gate("gg_gate", 5., 7.99); // Bins 5 to 7, their centres are in the gate
+    for (Int_t i = 0; i < N_BINS; ++i)
+    {
+        Double_t row_sum = 0., gate_sum = 0.;
+        for (Int_t j = 0; j < N_BINS; ++j)
+        {
+            CHECK(pexport->GetBinContent(i + 1, j + 1) == full[i][j]);
+            row_sum += full[i][j];
+            gate_sum += j >= 5 && j <= 7 ? full[i][j] : 0.;
+        }
+        CHECK(pprojection->GetBinContent(i + 1) == row_sum);
+        CHECK(pgate->GetBinContent(i + 1) == gate_sum);
+    }
+
+    // Raw counts, as checkpointed, add up like a second sort of the same pairs
+    CoincidenceMatrix restored("gg", "Coincidences", N_BINS, 0., N_BINS, 64);
+    restored.initializeSlots(1);
+    restored.addCounts(matrix.getCounts());
+    restored.addCounts(matrix.getCounts());
+    for (Int_t i = 0; i < N_BINS; ++i)
+    {
+        for (Int_t j = 0; j < N_BINS; ++j)
+        {
+            CHECK(restored.getCount(i, j) == 2 * matrix.getCount(i, j));
+        }
+    }
+    CHECK_THROWS(restored.addCounts(std::vector<UInt_t>(3, 0)), std::runtime_error);
+}
+
+void testSubtracted()
+{
+    // Prompt minus weighted random pairs, with the errors of both counts
+    const Double_t random_weight = -0.25;
+    CoincidenceMatrix matrix("gg_subtracted", "Prompt minus random", N_BINS, 0., N_BINS, 64, random_weight);
+    matrix.initializeSlots(3);
+    FullMatrix prompt(N_BINS, std::vector<Double_t>(N_BINS, 0.)), random(N_BINS, std::vector<Double_t>(N_BINS, 0.));
+    fillPairs(matrix, prompt, 20000, 2, kFALSE);
+    fillPairs(matrix, random, 20000, 3, kTRUE);
+
+    CHECK(matrix.isSubtracted());
+    CHECK(matrix.getMemoryBytes() == 2 * matrix.getCellNum() * sizeof(UInt_t));
+    CHECK_THROWS(matrix.getCount(0, 0), std::runtime_error);
+    std::unique_ptr<TH2> pexport = matrix.toTH2();
+    for (Int_t i = 0; i < N_BINS; ++i)
+    {
+        for (Int_t j = 0; j < N_BINS; ++j)
+        {
+            const Double_t content = prompt[i][j] + random_weight * random[i][j];
+            CHECK(matrix.getContent(i, j) == content);
+            CHECK(pexport->GetBinContent(i + 1, j + 1) == content);
+            // A diagonal cell is its stored count doubled, so are its counts' standard deviations
+            const Double_t scale = i == j ? 0.5 : 1.;
+            const Double_t error = std::sqrt(scale * prompt[i][j] + random_weight * random_weight * scale * random[i][j]) / scale;
+            CHECK(std::abs(pexport->GetBinError(i + 1, j + 1) - error) < 1e-9 * (1. + error));
+        }
+    }
+}
+
+int main()
+{
+    testSymmetricView();
+    testSubtracted();
+    std::cout << "TestCoincidenceMatrix: " << Check::n_failed << " failed check(s)" << std::endl;
+    return Check::n_failed;
+}
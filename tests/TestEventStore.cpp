@@ -0,0 +1,193 @@
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <TH1D.h>
+#include <TSystem.h>
+#include "EventStore.hpp"
+#include "EventStoreWriter.hpp"
+#include "Check.hpp"
+
+// EventStore: a store written by an EventStoreWriter gates to the same spectra as applying the gates to every stored
+// event, and damaged files are refused when they are opened
+
+namespace
+{
+    const UInt_t N_DETECTORS = 6;
+    const Double_t ENERGY_LOW = 0.;
+    const Double_t ENERGY_UP = 1000.;
+
+    // Events as stored: energies rounded to Float_t, NaN where a detector has no hit
+    std::vector<std::vector<Double_t>> makeEvents(UInt_t n_events)
+    {
+        std::mt19937 generator(12345);
+        std::uniform_real_distribution<Double_t> energy(-50., 1200.);
+        std::uniform_int_distribution<UInt_t> multiplicity(0, 4);
+        std::uniform_int_distribution<UInt_t> detector(0, N_DETECTORS - 1);
+        std::vector<std::vector<Double_t>> events;
+        for (UInt_t i = 0; i < n_events; ++i)
+        {
+            std::vector<Double_t> energies(N_DETECTORS, std::numeric_limits<Double_t>::quiet_NaN());
+            for (UInt_t n_hits = multiplicity(generator); n_hits > 0; --n_hits)
+            {
+                energies[detector(generator)] = Float_t(energy(generator));
+            }
+            events.push_back(energies);
+        }
+        return events;
+    }
+
+    // Spectrum of a gate by looking at every event, like gating the full gamma-gamma matrix
+    Long64_t gateAll(const std::vector<std::vector<Double_t>> &events, const EventStore::Gate &gate, Int_t gate_detector, TH1D &spectrum)
+    {
+        Long64_t n_gated = 0;
+        for (const std::vector<Double_t> &energies : events)
+        {
+            UInt_t n_hits = 0;
+            for (Double_t energy : energies)
+            {
+                n_hits += !std::isnan(energy);
+            }
+            if (n_hits < 2)
+                continue;
+            Bool_t gated = kFALSE;
+            for (UInt_t i = 0; i < N_DETECTORS; ++i)
+            {
+                if (std::isnan(energies[i]) || energies[i] < gate.low || energies[i] >= gate.up || (gate_detector >= 0 && Int_t(i) != gate_detector))
+                    continue;
+                gated = kTRUE;
+                for (UInt_t j = 0; j < N_DETECTORS; ++j)
+                {
+                    if (j != i && !std::isnan(energies[j]))
+                        spectrum.Fill(energies[j]);
+                }
+            }
+            n_gated += gated;
+        }
+        return n_gated;
+    }
+
+    std::string readFile(const TString &file_name)
+    {
+        std::ifstream in(file_name.Data(), std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    void writeFile(const TString &file_name, const std::string &contents)
+    {
+        std::ofstream out(file_name.Data(), std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), contents.size());
+    }
+}
+
+void testRoundTrip(const TString &file_name)
+{
+    // Small blocks from two slots, so the gates cross many blocks of interleaved slots
+    const std::vector<std::vector<Double_t>> events = makeEvents(20000);
+    std::vector<TString> detector_names;
+    for (UInt_t i = 0; i < N_DETECTORS; ++i)
+    {
+        detector_names.push_back(Form("C%u", i));
+    }
+    {
+        EventStoreWriter writer(file_name, detector_names, ENERGY_LOW, ENERGY_UP, 64, 2);
+        writer.setBlockEvents(500);
+        writer.initializeSlots(2);
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            writer.fill(events[i].data(), i % 2);
+        }
+        writer.close();
+    }
+
+    EventStore store(file_name);
+    CHECK(store.getDetectorNames() == detector_names);
+    CHECK(store.getBucketNum() == 64);
+    CHECK(store.getBlockNum() > 10);
+
+    // Windows within a bucket, across buckets, restricted to a detector, and above the bucket range
+    const std::vector<EventStore::Gate> gates = EventStore::parseGates("100:200,333.3:334.1,500:700@C2,1100:1300,-50:0");
+    CHECK(gates.size() == 5);
+    std::vector<std::unique_ptr<TH1D>> spectra, expected;
+    std::vector<TH1D *> pspectra;
+    Long64_t n_expected = 0;
+    for (size_t g = 0; g < gates.size(); ++g)
+    {
+        spectra.push_back(std::make_unique<TH1D>(gates[g].name, "", 250, 0., 1000.));
+        expected.push_back(std::make_unique<TH1D>(gates[g].name + "_expected", "", 250, 0., 1000.));
+        spectra.back()->SetDirectory(nullptr);
+        expected.back()->SetDirectory(nullptr);
+        pspectra.push_back(spectra.back().get());
+        n_expected += gateAll(events, gates[g], gates[g].detector.IsNull() ? -1 : store.findDetector(gates[g].detector), *expected.back());
+    }
+    CHECK(n_expected > 0);
+    CHECK(store.gate(gates, pspectra, kFALSE) == n_expected);
+    for (size_t g = 0; g < gates.size(); ++g)
+    {
+        for (Int_t bin = 0; bin <= 251; ++bin)
+        {
+            CHECK(spectra[g]->GetBinContent(bin) == expected[g]->GetBinContent(bin));
+        }
+        CHECK(spectra[g]->GetEntries() == expected[g]->GetEntries());
+    }
+
+    CHECK_THROWS(EventStore::parseGates("100-200"), std::invalid_argument);
+    CHECK_THROWS(store.gate(EventStore::parseGates("100:200@C9"), {pspectra[0]}, kFALSE), std::out_of_range);
+}
+
+void testDamagedFiles(const TString &file_name)
+{
+    const std::string contents = readFile(file_name);
+    const TString damaged_file_name = "TestEventStore_damaged.evs";
+
+    // Cut off in the middle of the blocks, the block table is gone
+    writeFile(damaged_file_name, contents.substr(0, contents.size() / 2));
+    CHECK_THROWS(EventStore store(damaged_file_name), std::runtime_error);
+
+    // Cut off within the block table
+    writeFile(damaged_file_name, contents.substr(0, contents.size() - sizeof(EventStore::BlockRecord) / 2));
+    CHECK_THROWS(EventStore store(damaged_file_name), std::runtime_error);
+
+    // Block table position that wraps when the table size is added
+    std::string header_damaged = contents;
+    EventStore::FileHeader header;
+    std::memcpy(&header, header_damaged.data(), sizeof(header));
+    header.index_offset = std::numeric_limits<ULong64_t>::max() - 7;
+    std::memcpy(&header_damaged[0], &header, sizeof(header));
+    writeFile(damaged_file_name, header_damaged);
+    CHECK_THROWS(EventStore store(damaged_file_name), std::runtime_error);
+
+    // A block section beyond the end of the file
+    std::string block_damaged = contents;
+    std::memcpy(&header, block_damaged.data(), sizeof(header));
+    EventStore::BlockRecord record;
+    std::memcpy(&record, block_damaged.data() + header.index_offset, sizeof(record));
+    record.hits_offset = contents.size() - 8;
+    std::memcpy(&block_damaged[header.index_offset], &record, sizeof(record));
+    writeFile(damaged_file_name, block_damaged);
+    CHECK_THROWS(EventStore store(damaged_file_name), std::runtime_error);
+
+    // A detector name longer than the file
+    std::string name_damaged = contents;
+    const UInt_t length = 0xFFFFFFF0u;
+    std::memcpy(&name_damaged[sizeof(EventStore::FileHeader)], &length, sizeof(length));
+    writeFile(damaged_file_name, name_damaged);
+    CHECK_THROWS(EventStore store(damaged_file_name), std::runtime_error);
+
+    gSystem->Unlink(damaged_file_name);
+}
+
+int main()
+{
+    const TString file_name = "TestEventStore.evs";
+    testRoundTrip(file_name);
+    testDamagedFiles(file_name);
+    gSystem->Unlink(file_name);
+    std::cout << "TestEventStore: " << Check::n_failed << " failed check(s)" << std::endl;
+    return Check::n_failed;
+}
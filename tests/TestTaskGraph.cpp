@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "TaskManager.hpp"
+#include "Task.hpp"
+#include "Check.hpp"
+
+// TaskManager::buildGraph(): tasks are ordered by the products they read and write, independent tasks share a
+// level, cycles and outputs without a product handle are rejected
+
+namespace
+{
+    using RecordTask = Task<void(), void(Event *, UInt_t), void()>;
+
+    // Task recording its name in executed when it runs
+    std::unique_ptr<RecordTask> makeTask(const TString &name, std::vector<TString> inputs, std::vector<TString> outputs, std::vector<TString> &executed)
+    {
+        auto ptask = std::make_unique<RecordTask>(name, []() {}, [name, &executed](Event *, UInt_t)
+                                                  { executed.push_back(name); }, []() {});
+        ptask->setInputs(std::move(inputs));
+        ptask->setOutputs(std::move(outputs));
+        return ptask;
+    }
+
+    size_t position(const std::vector<ITask *> &tasks, const TString &name)
+    {
+        return std::find_if(tasks.begin(), tasks.end(), [&name](const ITask *ptask)
+                            { return ptask->getName() == name; }) -
+               tasks.begin();
+    }
+}
+
+void testOrdering()
+{
+    // Added in reverse: histogramming reads add-back, add-back reads calibrated energies, calibration reads hits.
+    // The amplitude spectra only read the raw values and are independent of the chain.
+    TaskManager manager;
+    manager.getProductHandle("hits");
+    manager.getProductHandle("energies");
+    manager.getProductHandle("addback");
+    std::vector<TString> executed;
+    auto phistograms = makeTask("histograms", {"addback"}, {}, executed);
+    auto paddback = makeTask("addback", {"energies"}, {"addback"}, executed);
+    auto pamplitudes = makeTask("amplitudes", {"raw"}, {}, executed);
+    auto pcalibration = makeTask("calibration", {"hits"}, {"energies"}, executed);
+    auto pfilter = makeTask("filter", {"raw"}, {"hits"}, executed);
+    for (ITask *ptask : std::vector<ITask *>{phistograms.get(), paddback.get(), pamplitudes.get(), pcalibration.get(), pfilter.get()})
+    {
+        manager.addTask(ptask);
+    }
+
+    const std::vector<ITask *> &ordered = manager.getOrderedTasks();
+    CHECK(ordered.size() == 5);
+    CHECK(position(ordered, "filter") < position(ordered, "calibration"));
+    CHECK(position(ordered, "calibration") < position(ordered, "addback"));
+    CHECK(position(ordered, "addback") < position(ordered, "histograms"));
+
+    // Levels are the longest path to a task, inputs nobody writes (raw) are external
+    const std::vector<std::vector<ITask *>> &levels = manager.getTaskLevels();
+    CHECK(levels.size() == 4);
+    CHECK(levels[0].size() == 2 && position(levels[0], "amplitudes") < 2 && position(levels[0], "filter") < 2);
+    CHECK(levels[1].size() == 1 && levels[1][0] == pcalibration.get());
+    CHECK(levels[3].size() == 1 && levels[3][0] == phistograms.get());
+
+    // A single entry runs the tasks in dependency order
+    manager.executeTasks(nullptr, 0);
+    std::vector<TString> expected;
+    for (const ITask *ptask : ordered)
+    {
+        expected.push_back(ptask->getName());
+    }
+    CHECK(executed == expected);
+
+    // Without declarations the order the tasks were added in is kept
+    TaskManager plain_manager;
+    std::vector<TString> plain_executed;
+    auto pfirst = makeTask("first", {}, {}, plain_executed);
+    auto psecond = makeTask("second", {}, {}, plain_executed);
+    auto pthird = makeTask("third", {}, {}, plain_executed);
+    plain_manager.addTask(pfirst.get());
+    plain_manager.addTask(psecond.get());
+    plain_manager.addTask(pthird.get());
+    plain_manager.executeTasks(nullptr, 0);
+    CHECK((plain_executed == std::vector<TString>{"first", "second", "third"}));
+}
+
+void testWritersInOrder()
+{
+    // Two writers of a product run in the order they were added, the reader after both
+    TaskManager manager;
+    manager.getProductHandle("energies");
+    std::vector<TString> executed;
+    auto preader = makeTask("reader", {"energies"}, {}, executed);
+    auto pwriter = makeTask("writer", {}, {"energies"}, executed);
+    auto pcorrection = makeTask("correction", {}, {"energies"}, executed);
+    manager.addTask(preader.get());
+    manager.addTask(pwriter.get());
+    manager.addTask(pcorrection.get());
+    manager.executeTasks(nullptr, 0);
+    CHECK((executed == std::vector<TString>{"writer", "correction", "reader"}));
+}
+
+void testCycle()
+{
+    TaskManager manager;
+    manager.getProductHandle("a");
+    manager.getProductHandle("b");
+    std::vector<TString> executed;
+    auto pfirst = makeTask("first", {"b"}, {"a"}, executed);
+    auto psecond = makeTask("second", {"a"}, {"b"}, executed);
+    manager.addTask(pfirst.get());
+    CHECK_THROWS(manager.addTask(psecond.get()), std::runtime_error);
+
+    // Removing one task of the cycle makes the graph valid again
+    manager.removeTask("second");
+    CHECK(manager.getOrderedTasks().size() == 1);
+}
+
+void testMissingProductHandle()
+{
+    // An output whose handle was not resolved before the task was added could not be batched safely
+    TaskManager manager;
+    std::vector<TString> executed;
+    auto pwriter = makeTask("writer", {}, {"unresolved"}, executed);
+    CHECK_THROWS(manager.addTask(pwriter.get()), std::runtime_error);
+}
+
+int main()
+{
+    testOrdering();
+    testWritersInOrder();
+    testCycle();
+    testMissingProductHandle();
+    std::cout << "TestTaskGraph: " << Check::n_failed << " failed check(s)" << std::endl;
+    return Check::n_failed;
+}